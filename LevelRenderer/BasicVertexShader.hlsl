@@ -17,6 +17,17 @@ struct _OBJ_ATTRIBUTES_
     uint illum; // illumination model
 } OBJ_ATTRIBUTES;
 #define MAX_SUBMESH_PER_DRAW 1054 // we can change this if desired
+// COMPACT_TRANSFORMS is defined by the renderer when compiling (see compact_transform.h)
+#if COMPACT_TRANSFORMS
+#define COMPACT_FULL_MATRIX 0x80000000u // set in rotationHi, rotationLo is then a fullMatricies index
+struct COMPACT_TRANSFORM
+{
+    float3 translation;
+    uint rotationLo; // smallest three quaternion, 20 bits per component
+    float3 scale; // x is negative for mirrored instances
+    uint rotationHi;
+};
+#endif
 struct SHADER_MODEL_DATA
 {
 		//gloabally shared model data
@@ -24,7 +35,12 @@ struct SHADER_MODEL_DATA
     float3 sunAmbient, cameraPos;
     matrix viewMatrix, projectionMatrix; // viewing info
 		// per sub-mesh transform and material data
-    matrix matricies[MAX_SUBMESH_PER_DRAW]; // world space transforms
+#if COMPACT_TRANSFORMS // same size as matricies so materials do not move
+    COMPACT_TRANSFORM transforms[MAX_SUBMESH_PER_DRAW]; // world space transforms
+    matrix fullMatricies[MAX_SUBMESH_PER_DRAW / 2]; // transforms with shear, each followed by its normal matrix
+#else
+    matrix matricies[MAX_SUBMESH_PER_DRAW]; // world space transforms, normal matrices from the end down
+#endif
     OBJ_ATTRIBUTES materials[MAX_SUBMESH_PER_DRAW]; // color/texture of surface
 };
 StructuredBuffer<SHADER_MODEL_DATA> SceneData;
@@ -34,6 +50,9 @@ cbuffer MESH_INDEX
 {
     uint mesh_ID;
     uint world_ID;
+    uint2 padding;
+    float4 quantizeMin; // model bounds, decodes PACKED_VERTICES positions
+    float4 quantizeScale;
 };
 
 struct OUTPUT_TO_RASTERIZER
@@ -44,20 +63,83 @@ struct OUTPUT_TO_RASTERIZER
     float2 uvC : UV; // uv cooridinate for textures
 };
 
+// PACKED_VERTICES is defined by the renderer when compiling (see h2bPacked.h)
+#if PACKED_VERTICES
+struct VERTEX
+{
+    float4 pos : POSITION; // unorm16 within the model bounds
+    float2 uvw : COLOR; // half2
+    float2 nrm : NORMAL; // octahedral snorm16
+};
+float3 DecodeOctahedral(float2 e)
+{
+    float3 n = float3(e, 1 - abs(e.x) - abs(e.y));
+    float t = saturate(-n.z);
+    n.xy += float2(n.x >= 0 ? -t : t, n.y >= 0 ? -t : t);
+    return normalize(n);
+}
+#else
 struct VERTEX
 {
     float3 pos : POSITION;
     float3 uvw : COLOR;
     float3 nrm : NORMAL;
 };
+#endif
+#if COMPACT_TRANSFORMS
+// Same as DecodeCompactTransform in compact_transform.h, normalMatrix is the
+// inverse transpose of the world matrix (rotation over scale for TRS)
+matrix LoadWorld(uint slot, out float3x3 normalMatrix)
+{
+    COMPACT_TRANSFORM t = SceneData[0].transforms[slot];
+    if (t.rotationHi & COMPACT_FULL_MATRIX)
+    {
+        normalMatrix = (float3x3)SceneData[0].fullMatricies[t.rotationLo + 1];
+        return SceneData[0].fullMatricies[t.rotationLo];
+    }
+    const float k = 0.70710678f;
+    uint3 bits = uint3(t.rotationLo & 0xFFFFF, (t.rotationLo >> 20) | ((t.rotationHi & 0xFF) << 12),
+        (t.rotationHi >> 8) & 0xFFFFF);
+    float3 small = float3(bits) * (2 * k / 1048575.0f) - k;
+    uint dropped = (t.rotationHi >> 28) & 3;
+    float largest = sqrt(max(0, 1 - dot(small, small)));
+    float4 q = dropped == 0 ? float4(largest, small) :
+        dropped == 1 ? float4(small.x, largest, small.yz) :
+        dropped == 2 ? float4(small.xy, largest, small.z) : float4(small, largest);
+    float x = q.x, y = q.y, z = q.z, w = q.w;
+    float3 axisX = float3(1 - 2 * (y * y + z * z), 2 * (x * y + w * z), 2 * (x * z - w * y));
+    float3 axisY = float3(2 * (x * y - w * z), 1 - 2 * (x * x + z * z), 2 * (y * z + w * x));
+    float3 axisZ = float3(2 * (x * z + w * y), 2 * (y * z - w * x), 1 - 2 * (x * x + y * y));
+    normalMatrix = float3x3(axisX / t.scale.x, axisY / t.scale.y, axisZ / t.scale.z);
+    return matrix(float4(axisX * t.scale.x, 0), float4(axisY * t.scale.y, 0), float4(axisZ * t.scale.z, 0),
+        float4(t.translation, 1));
+}
+#else
+matrix LoadWorld(uint slot, out float3x3 normalMatrix)
+{
+    matrix world = SceneData[0].matricies[slot];
+    // the renderer puts the slot of a non uniformly scaled instance's normal matrix in _14
+    normalMatrix = world._14 > 0 ? (float3x3)SceneData[0].matricies[(uint)world._14] : (float3x3)world;
+    return world;
+}
+#endif
 OUTPUT_TO_RASTERIZER main(VERTEX inputVertex, int ID : SV_InstanceID)
 {
+#if PACKED_VERTICES
+    float3 pos = quantizeMin.xyz + inputVertex.pos.xyz * quantizeScale.xyz;
+    float3 nrm = DecodeOctahedral(inputVertex.nrm);
+#else
+    float3 pos = inputVertex.pos;
+    float3 nrm = inputVertex.nrm;
+#endif
+    float3x3 normalMatrix;
+    matrix world = LoadWorld(world_ID + ID, normalMatrix);
     OUTPUT_TO_RASTERIZER output;
-    output.posW = mul(float4(inputVertex.pos, 1), SceneData[0].matricies[world_ID + ID]).xyz;
+    output.posW = mul(float4(pos, 1), world).xyz;
     output.posH = mul(float4(output.posW, 1), SceneData[0].viewMatrix);
     output.posH = mul(output.posH, SceneData[0].projectionMatrix);
-    output.nrmW = mul(inputVertex.nrm, SceneData[0].matricies[world_ID + ID]);
-    output.uvC = inputVertex.uvw;
+    output.nrmW = mul(nrm, normalMatrix);
+    output.uvC = inputVertex.uvw.xy;
     
     return output;
 }
\ No newline at end of file
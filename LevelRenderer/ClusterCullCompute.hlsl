@@ -0,0 +1,69 @@
+#pragma pack_matrix(row_major)
+// Per meshlet frustum and normal cone culling, the GPU twin of cluster_culling.h.
+// One workgroup per CLUSTER_JOB (one mesh of one instance). Surviving meshlets
+// append their triangles to the job's slice of OutIndices and grow the job's
+// indexed indirect draw, which the renderer has reset to an empty draw.
+struct MESHLET
+{
+    uint vertexOffset, vertexCount; // into MeshletVertices
+    uint triangleOffset, triangleCount; // into MeshletTriangles (3 bytes each)
+    float4 sphere; // local center, radius
+    float4 cone; // local axis, cutoff (1 disables)
+};
+struct CLUSTER_JOB
+{
+    matrix world;
+    uint meshletOffset, meshletCount;
+    uint outputOffset; // first index of this job in OutIndices
+    uint coneTest; // 0 for non uniform or mirrored instances
+    float4 scale; // x: largest axis scale
+};
+[[vk::binding(0)]] StructuredBuffer<MESHLET> Meshlets;
+[[vk::binding(1)]] StructuredBuffer<uint> MeshletVertices;
+[[vk::binding(2)]] ByteAddressBuffer MeshletTriangles;
+[[vk::binding(3)]] StructuredBuffer<CLUSTER_JOB> Jobs;
+[[vk::binding(4)]] RWStructuredBuffer<uint> OutIndices;
+[[vk::binding(5)]] RWStructuredBuffer<uint> DrawArgs; // VkDrawIndexedIndirectCommand per job
+
+[[vk::push_constant]]
+cbuffer CLUSTER_VIEW
+{
+    float4 planes[6]; // world space, xyz inward normal
+    float4 eye;
+};
+
+uint LoadTriangleCorner(uint corner)
+{
+    uint word = MeshletTriangles.Load(corner & ~3u);
+    return (word >> ((corner & 3u) * 8)) & 0xFF;
+}
+
+[numthreads(64, 1, 1)]
+void main(uint3 group : SV_GroupID, uint thread : SV_GroupIndex)
+{
+    CLUSTER_JOB job = Jobs[group.x];
+    for (uint i = thread; i < job.meshletCount; i += 64)
+    {
+        MESHLET m = Meshlets[job.meshletOffset + i];
+        float3 center = mul(float4(m.sphere.xyz, 1), job.world).xyz;
+        float radius = m.sphere.w * job.scale.x;
+        bool visible = true;
+        for (int p = 0; p < 6; ++p)
+            if (dot(planes[p].xyz, center) + planes[p].w < -radius)
+                visible = false;
+        if (visible && job.coneTest != 0 && m.cone.w < 1)
+        {
+            float3 axis = mul(m.cone.xyz, (float3x3) job.world) / job.scale.x;
+            float3 d = center - eye.xyz;
+            if (dot(d, axis) >= m.cone.w * length(d) + radius)
+                visible = false;
+        }
+        if (!visible)
+            continue;
+        uint base;
+        InterlockedAdd(DrawArgs[group.x * 5], m.triangleCount * 3, base);
+        for (uint c = 0; c < m.triangleCount * 3; ++c)
+            OutIndices[job.outputOffset + base + c] =
+                MeshletVertices[m.vertexOffset + LoadTriangleCorner(m.triangleOffset * 3 + c)];
+    }
+}
@@ -0,0 +1,50 @@
+// Offline tool that upgrades .h2b files to the v2 format
+// usage: H2BBake <input.h2b> [output.h2b]   (output defaults to overwriting the input)
+#include "h2bBaker.h"
+#include <iostream>
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		std::cout << "usage: H2BBake <input.h2b> [output.h2b]" << std::endl;
+		return 1;
+	}
+	const char* inPath = argv[1];
+	const char* outPath = argc > 2 ? argv[2] : argv[1];
+
+	H2B::Parser p;
+	if (p.Parse(inPath) == false) {
+		std::cout << "ERROR: could not read \"" << inPath << "\"" << std::endl;
+		return 1;
+	}
+	std::cout << inPath << ": " << p.vertexCount << " vertices, " << p.indexCount
+		<< " indices, " << p.meshCount << " meshes (version "
+		<< (p.IsVersion2() ? "2" : "1.9d") << ")" << std::endl;
+
+	H2B::BakeBounds(p);
+	H2B::BakeLods(p);
+	H2B::VCACHE_STATS before = H2B::AnalyzeVertexCache(p);
+	H2B::BakeVertexCache(p);
+	H2B::VCACHE_STATS after = H2B::AnalyzeVertexCache(p);
+	std::cout << "  vertex cache ACMR " << before.ACMR() << " -> " << after.ACMR()
+		<< ", ATVR " << before.ATVR() << " -> " << after.ATVR() << std::endl;
+	H2B::BakeMeshlets(p); // after the cache pass, meshlets follow the final triangle order
+	std::cout << "  " << p.meshlets.size() << " meshlets for " << p.meshletTriangles.size() / 3
+		<< " triangles" << std::endl;
+	for (unsigned i = 0; i < p.meshCount; ++i) {
+		const H2B::BOUNDS& b = p.bounds[i];
+		const H2B::LOD& lod = p.lods[i];
+		std::cout << "  mesh " << i << " " << (p.meshes[i].name ? p.meshes[i].name : "")
+			<< " radius " << b.radius << ", LOD triangles:";
+		for (unsigned l = 0; l < lod.levelCount; ++l)
+			std::cout << " " << lod.levels[l].indexCount / 3 << " (error " << lod.error[l] << ")";
+		std::cout << std::endl;
+	}
+
+	if (p.Write(outPath) == false) {
+		std::cout << "ERROR: could not write \"" << outPath << "\"" << std::endl;
+		return 1;
+	}
+	std::cout << "wrote " << outPath << std::endl;
+	return 0;
+}
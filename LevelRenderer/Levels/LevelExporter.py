@@ -1,4 +1,4 @@
-# DEV4 Simple Level Exporter v1.0
+# DEV4 Simple Level Exporter v1.1
 # a simple export script based on this answer from Blender stack exchange:
 # https://blender.stackexchange.com/a/146344
 
@@ -12,23 +12,28 @@ print("----------Begin Level Export----------")
 
 path = os.path.join(os.path.dirname(bpy.data.filepath), "GameLevel.txt")
 file = open(path,"w")
-file.write("# Game Level Exporter v1.0\n")
+file.write("# Game Level Exporter v1.1\n")
 
 scene = bpy.context.scene
 
+# file order index of every object written so far, children point at their
+# parent with it so the loader can rebuild the hierarchy
+written = {}
+
 def print_heir(ob, levels=10):
     def recurse(ob, parent, depth):
         if depth > levels: 
             return
+        written[ob.name] = len(written)
         # spacing to show hierarchy
         spaces = "  " * depth;
         # print to system console for debugging
         print(spaces, ob.type)
         print(spaces, ob.name)
         print(spaces, ob.matrix_world)
-        # send to file
-        file.write(spaces + ob.type + "\n")
-        file.write(spaces + ob.name + "\n")
+        # send to file (hierarchy comes from PARENT below, not indentation)
+        file.write(ob.type + "\n")
+        file.write(ob.name + "\n")
         
         # swap from blender space to vulkan/d3d 
         # { rx, ry, rz, 0 } to { rx, rz, ry, 0 }  
@@ -45,11 +50,13 @@ def print_heir(ob, levels=10):
         # flip the local Z axis for winding and transpose for export
         scaleZ = mathutils.Matrix.Scale(-1.0, 4, (0.0, 0.0, 1.0))
         converted = scaleZ.transposed() @ converted  
-        file.write(spaces + str(converted) + "\n")
+        file.write(str(converted) + "\n")
+        # matrices stay in world space, the loader derives the local ones
+        parent_index = written.get(parent.name, -1) if parent else -1
+        file.write("PARENT " + str(parent_index) + "\n")
          
         # TODO: For a game ready exporter we would
         # probably want the delta(pivot) matrix, lights,
-        # detailed mesh hierarchy information
         # and bounding box/collission data at minimum
 
         for child in ob.children:
@@ -1,8 +1,17 @@
+// TEXTURE_ARRAYS is defined by the renderer when compiling (see texture_arrays.h)
+#if TEXTURE_ARRAYS
+#define MAX_TEXTURE_ARRAYS 32 // as in renderer.h
+[[vk::binding(0, 1)]]
+Texture2DArray materialArrays[MAX_TEXTURE_ARRAYS];
+[[vk::binding(1, 1)]]
+SamplerState qualityFilter;
+#else
 // You need a Texture2D and a Sampler HLSL object
 [[vk::binding(0, 1)]]
 Texture2D diffuseMap;
 [[vk::binding(0, 1)]]
 SamplerState qualityFilter;
+#endif
 
 // NOTE: It is HIGHLY suggested you always supply a resource's *register/binding* location
 // this avoids compiler ambiguity and allows ordering of resource types to be clear
@@ -33,6 +42,10 @@ struct SHADER_MODEL_DATA
 		// per sub-mesh transform and material data
     matrix matricies[MAX_SUBMESH_PER_DRAW]; // world space transforms
     OBJ_ATTRIBUTES materials[MAX_SUBMESH_PER_DRAW]; // color/texture of surface
+#if TEXTURE_ARRAYS
+    uint4 materialMaps[MAX_SUBMESH_PER_DRAW]; // albedo, roughness, metal, normal
+    float4 mapRects[MAX_SUBMESH_PER_DRAW][4]; // uv offset (xy) and scale (zw) of each map in its layer
+#endif
 };
 StructuredBuffer<SHADER_MODEL_DATA> SceneData;
 // TODO: Part 4g
@@ -52,9 +65,41 @@ struct OUTPUT_TO_RASTERIZER
     float2 uvC : UV; // uv cooridinate for textures
 };
 
+#if TEXTURE_ARRAYS
+// map is array << 16 | layer (PackTextureLayer), none is returned for ~0u.
+// Maps packed into an atlas page (rect smaller than the layer) wrap by hand
+// and stay half a texel inside their rect at the level read, so neither the
+// neighbours nor the filter's footprint bleed in.
+float4 SampleMap(uint map, float4 rect, float2 uv, float4 none)
+{
+    if (map == 0xFFFFFFFF)
+        return none;
+    float3 layerUV = float3(uv, map & 0xFFFF);
+    if (all(rect.zw == 1))
+        return materialArrays[map >> 16].Sample(qualityFilter, layerUV);
+    float width, height, layers, levels;
+    materialArrays[map >> 16].GetDimensions(0, width, height, layers, levels);
+    float2 dx = ddx(uv) * rect.zw, dy = ddy(uv) * rect.zw;
+    float2 size = float2(width, height);
+    float lod = clamp(log2(max(length(dx * size), length(dy * size))), 0, levels - 1);
+    float2 inset = exp2(ceil(lod)) * 0.5 / size;
+    layerUV.xy = clamp(rect.xy + frac(uv) * rect.zw, rect.xy + inset, rect.xy + rect.zw - inset);
+    return materialArrays[map >> 16].SampleGrad(qualityFilter, layerUV, dx, dy);
+}
+#endif
+
 float4 main(OUTPUT_TO_RASTERIZER inputVertex) : SV_TARGET
 {
+#if TEXTURE_ARRAYS
+    // MTL scalar maps scale their term: map_Ns the specular exponent, map_Ks
+    // the specular color. The normal map needs tangents the vertices lack.
+    uint4 maps = SceneData[0].materialMaps[mesh_ID];
+    float4 texel = SampleMap(maps.x, SceneData[0].mapRects[mesh_ID][0], inputVertex.uvC, float4(1, 1, 1, 1));
+    float exponentScale = SampleMap(maps.y, SceneData[0].mapRects[mesh_ID][1], inputVertex.uvC, float4(1, 1, 1, 1)).r;
+    float3 specularScale = SampleMap(maps.z, SceneData[0].mapRects[mesh_ID][2], inputVertex.uvC, float4(1, 1, 1, 1)).rgb;
+#else
     float4 texel = diffuseMap.Sample(qualityFilter, inputVertex.uvC);
+#endif
     float4 matColor = float4(SceneData[0].materials[mesh_ID].Kd, 1);
     // Diffuse and Ambient lights
     float3 normalizedNRM = normalize(inputVertex.nrmW);
@@ -64,9 +109,15 @@ float4 main(OUTPUT_TO_RASTERIZER inputVertex) : SV_TARGET
     // Specular Light
     float3 viewDir = normalize(SceneData[0].cameraPos - inputVertex.posW);
     float3 halfVec = normalize(normalize(-SceneData[0].sunDirection) + viewDir);
+#if TEXTURE_ARRAYS
+    float intensity = max(pow(saturate(dot(normalizedNRM, halfVec)), max(SceneData[0].materials[mesh_ID].Ns * exponentScale, 1)), 0);
+    float4 reflectedLight = intensity * float4(SceneData[0].materials[mesh_ID].Ks * specularScale, 1);
+    return (float4(saturate(directColor + indirectColor), 1) * texel * matColor) + reflectedLight;
+#else
     float intensity = max(pow(saturate(dot(normalizedNRM, halfVec)), SceneData[0].materials[mesh_ID].Ns), 0);
     float4 reflectedLight = intensity * float4(SceneData[0].materials[mesh_ID].Ks, 1);
     
     //return (float4(saturate(directColor + indirectColor), 1) * texel * matColor) + reflectedLight;
     return float4(0.75, 0.75, 0.25, 1);
+#endif
 }
\ No newline at end of file
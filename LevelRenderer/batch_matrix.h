@@ -0,0 +1,367 @@
+#ifndef _BATCH_MATRIX_H_
+#define _BATCH_MATRIX_H_
+// Kernels over contiguous GW::MATH::GMATRIXF arrays (row vectors, row4 is the
+// translation), for work that would otherwise go through the GMatrix proxy one
+// matrix at a time. Each kernel is written once against a lane type:
+//  BATCH_SCALAR one matrix at a time, used for what is left over
+//  BATCH_SSE    four matrices per register
+//  BATCH_AVX2   eight matrices per register (needs AVX2, FMA when available)
+// Lanes hold the same element of consecutive matrices, the loads transpose,
+// except for Multiply which goes a row at a time.
+// BATCH_LANES is the widest one this translation unit was compiled for and the
+// default of every Batch function, pass another one explicitly to compare them.
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define BATCH_MATRIX_SIMD 2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#if defined(__SSE4_1__) || defined(__AVX__)
+		#include <smmintrin.h>
+	#endif
+	#define BATCH_MATRIX_SIMD 1
+#else
+	#define BATCH_MATRIX_SIMD 0
+#endif
+
+struct BATCH_SCALAR {
+	typedef float V;
+	typedef bool M;
+	enum { WIDTH = 1 };
+	static V Set(float f) { return f; }
+	static V Add(V a, V b) { return a + b; }
+	static V Sub(V a, V b) { return a - b; }
+	static V Mul(V a, V b) { return a * b; }
+	static V MulAdd(V a, V b, V c) { return a * b + c; }
+	static V Div(V a, V b) { return a / b; }
+	static V Max(V a, V b) { return std::max(a, b); }
+	static V Abs(V a) { return std::fabs(a); }
+	static V Sqrt(V a) { return std::sqrt(a); }
+	static M Equal(V a, V b) { return a == b; }
+	static M LessEqual(V a, V b) { return a <= b; }
+	static M And(M a, M b) { return a && b; }
+	static V Select(M m, V a, V b) { return m ? a : b; }
+	static unsigned Bits(M m) { return m ? 1 : 0; }
+	// four floats at base + lane * stride, returned as x y z w of every lane
+	static void Load(const float* base, size_t, V out[4]) {
+		out[0] = base[0]; out[1] = base[1]; out[2] = base[2]; out[3] = base[3];
+	}
+	static void Store(float* base, size_t, const V in[4]) {
+		base[0] = in[0]; base[1] = in[1]; base[2] = in[2]; base[3] = in[3];
+	}
+	// WIDTH products a[j] * b[j * bStep], a row at a time rather than transposed
+	static void Multiply(const GW::MATH::GMATRIXF* a, const GW::MATH::GMATRIXF* b, size_t, GW::MATH::GMATRIXF* out) {
+		GW::MATH::GMATRIXF result;
+		for (int r = 0; r < 4; ++r)
+			for (int c = 0; c < 4; ++c)
+				result.data[r * 4 + c] = a->data[r * 4] * b->data[c] + a->data[r * 4 + 1] * b->data[4 + c] +
+					a->data[r * 4 + 2] * b->data[8 + c] + a->data[r * 4 + 3] * b->data[12 + c];
+		*out = result;
+	}
+};
+
+#if BATCH_MATRIX_SIMD >= 1
+struct BATCH_SSE {
+	typedef __m128 V;
+	typedef __m128 M;
+	enum { WIDTH = 4 };
+	static V Set(float f) { return _mm_set1_ps(f); }
+	static V Add(V a, V b) { return _mm_add_ps(a, b); }
+	static V Sub(V a, V b) { return _mm_sub_ps(a, b); }
+	static V Mul(V a, V b) { return _mm_mul_ps(a, b); }
+	static V MulAdd(V a, V b, V c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+	static V Div(V a, V b) { return _mm_div_ps(a, b); }
+	static V Max(V a, V b) { return _mm_max_ps(a, b); }
+	static V Abs(V a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+	static V Sqrt(V a) { return _mm_sqrt_ps(a); }
+	static M Equal(V a, V b) { return _mm_cmpeq_ps(a, b); }
+	static M LessEqual(V a, V b) { return _mm_cmple_ps(a, b); }
+	static M And(M a, M b) { return _mm_and_ps(a, b); }
+	static V Select(M m, V a, V b) {
+#if defined(__SSE4_1__) || defined(__AVX__)
+		return _mm_blendv_ps(b, a, m);
+#else
+		return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+#endif
+	}
+	static unsigned Bits(M m) { return unsigned(_mm_movemask_ps(m)); }
+	static void Load(const float* base, size_t stride, V out[4]) {
+		out[0] = _mm_loadu_ps(base);
+		out[1] = _mm_loadu_ps(base + stride);
+		out[2] = _mm_loadu_ps(base + stride * 2);
+		out[3] = _mm_loadu_ps(base + stride * 3);
+		_MM_TRANSPOSE4_PS(out[0], out[1], out[2], out[3]);
+	}
+	static void Store(float* base, size_t stride, const V in[4]) {
+		V t0 = in[0], t1 = in[1], t2 = in[2], t3 = in[3];
+		_MM_TRANSPOSE4_PS(t0, t1, t2, t3);
+		_mm_storeu_ps(base, t0);
+		_mm_storeu_ps(base + stride, t1);
+		_mm_storeu_ps(base + stride * 2, t2);
+		_mm_storeu_ps(base + stride * 3, t3);
+	}
+	static void Multiply(const GW::MATH::GMATRIXF* a, const GW::MATH::GMATRIXF* b, size_t bStep, GW::MATH::GMATRIXF* out) {
+		for (int j = 0; j < WIDTH; ++j, b += bStep) {
+			V rows[4] = { _mm_loadu_ps(b->data), _mm_loadu_ps(b->data + 4), _mm_loadu_ps(b->data + 8), _mm_loadu_ps(b->data + 12) };
+			V result[4];
+			for (int r = 0; r < 4; ++r) {
+				const float* row = a[j].data + r * 4;
+				result[r] = MulAdd(Set(row[0]), rows[0], MulAdd(Set(row[1]), rows[1],
+					MulAdd(Set(row[2]), rows[2], Mul(Set(row[3]), rows[3]))));
+			}
+			for (int r = 0; r < 4; ++r)
+				_mm_storeu_ps(out[j].data + r * 4, result[r]);
+		}
+	}
+};
+#endif
+
+#if BATCH_MATRIX_SIMD >= 2
+struct BATCH_AVX2 {
+	typedef __m256 V;
+	typedef __m256 M;
+	enum { WIDTH = 8 };
+	static V Set(float f) { return _mm256_set1_ps(f); }
+	static V Add(V a, V b) { return _mm256_add_ps(a, b); }
+	static V Sub(V a, V b) { return _mm256_sub_ps(a, b); }
+	static V Mul(V a, V b) { return _mm256_mul_ps(a, b); }
+	static V MulAdd(V a, V b, V c) {
+#if defined(__FMA__) || defined(_MSC_VER)
+		return _mm256_fmadd_ps(a, b, c);
+#else
+		return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+	}
+	static V Div(V a, V b) { return _mm256_div_ps(a, b); }
+	static V Max(V a, V b) { return _mm256_max_ps(a, b); }
+	static V Abs(V a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+	static V Sqrt(V a) { return _mm256_sqrt_ps(a); }
+	static M Equal(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+	static M LessEqual(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+	static M And(M a, M b) { return _mm256_and_ps(a, b); }
+	static V Select(M m, V a, V b) { return _mm256_blendv_ps(b, a, m); }
+	static unsigned Bits(M m) { return unsigned(_mm256_movemask_ps(m)); }
+	// lanes 0-3 in the low halves and 4-7 in the high halves, then a 4x4
+	// transpose inside each half
+	static void Load(const float* base, size_t stride, V out[4]) {
+		for (int j = 0; j < 4; ++j)
+			out[j] = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(base + stride * j)),
+				_mm_loadu_ps(base + stride * (j + 4)), 1);
+		Transpose(out);
+	}
+	static void Store(float* base, size_t stride, const V in[4]) {
+		V t[4] = { in[0], in[1], in[2], in[3] };
+		Transpose(t);
+		for (int j = 0; j < 4; ++j) {
+			_mm_storeu_ps(base + stride * j, _mm256_castps256_ps128(t[j]));
+			_mm_storeu_ps(base + stride * (j + 4), _mm256_extractf128_ps(t[j], 1));
+		}
+	}
+	static void Transpose(V r[4]) {
+		V t0 = _mm256_unpacklo_ps(r[0], r[1]), t1 = _mm256_unpackhi_ps(r[0], r[1]);
+		V t2 = _mm256_unpacklo_ps(r[2], r[3]), t3 = _mm256_unpackhi_ps(r[2], r[3]);
+		r[0] = _mm256_shuffle_ps(t0, t2, 0x44);
+		r[1] = _mm256_shuffle_ps(t0, t2, 0xEE);
+		r[2] = _mm256_shuffle_ps(t1, t3, 0x44);
+		r[3] = _mm256_shuffle_ps(t1, t3, 0xEE);
+	}
+	// two rows of a per register, the rows of b repeated in both halves
+	static void Multiply(const GW::MATH::GMATRIXF* a, const GW::MATH::GMATRIXF* b, size_t bStep, GW::MATH::GMATRIXF* out) {
+		for (int j = 0; j < WIDTH; ++j, b += bStep) {
+			V rows[4] = { _mm256_broadcast_ps((const __m128*)b->data), _mm256_broadcast_ps((const __m128*)(b->data + 4)),
+				_mm256_broadcast_ps((const __m128*)(b->data + 8)), _mm256_broadcast_ps((const __m128*)(b->data + 12)) };
+			V pairs[2] = { _mm256_loadu_ps(a[j].data), _mm256_loadu_ps(a[j].data + 8) };
+			for (int p = 0; p < 2; ++p) {
+				V x = _mm256_shuffle_ps(pairs[p], pairs[p], 0x00), y = _mm256_shuffle_ps(pairs[p], pairs[p], 0x55);
+				V z = _mm256_shuffle_ps(pairs[p], pairs[p], 0xAA), w = _mm256_shuffle_ps(pairs[p], pairs[p], 0xFF);
+				_mm256_storeu_ps(out[j].data + p * 8, MulAdd(x, rows[0], MulAdd(y, rows[1], MulAdd(z, rows[2], Mul(w, rows[3])))));
+			}
+		}
+	}
+};
+typedef BATCH_AVX2 BATCH_LANES;
+#elif BATCH_MATRIX_SIMD >= 1
+typedef BATCH_SSE BATCH_LANES;
+#else
+typedef BATCH_SCALAR BATCH_LANES;
+#endif
+
+// One kernel invocation covers S::WIDTH matrices starting at the given pointers
+template <class S>
+struct BATCH_KERNELS {
+	typedef typename S::V V;
+	typedef typename S::M M;
+	enum { STRIDE = 16 }; // floats per GMATRIXF
+
+	static void LoadMatrix(const GW::MATH::GMATRIXF* m, V rows[4][4]) {
+		for (int r = 0; r < 4; ++r)
+			S::Load(m->data + r * 4, STRIDE, rows[r]);
+	}
+	static void StoreMatrix(GW::MATH::GMATRIXF* m, const V rows[4][4]) {
+		for (int r = 0; r < 4; ++r)
+			S::Store(m->data + r * 4, STRIDE, rows[r]);
+	}
+	// rows (b x c, c x a, a x b) of the upper 3x3, and its determinant
+	static V Cofactors(const V m[4][4], V out[3][3]) {
+		const V* a = m[0], * b = m[1], * c = m[2];
+		const V* rows[3][2] = { { b, c }, { c, a }, { a, b } };
+		for (int r = 0; r < 3; ++r) {
+			const V* u = rows[r][0], * v = rows[r][1];
+			out[r][0] = S::Sub(S::Mul(u[1], v[2]), S::Mul(u[2], v[1]));
+			out[r][1] = S::Sub(S::Mul(u[2], v[0]), S::Mul(u[0], v[2]));
+			out[r][2] = S::Sub(S::Mul(u[0], v[1]), S::Mul(u[1], v[0]));
+		}
+		return S::MulAdd(a[0], out[0][0], S::MulAdd(a[1], out[0][1], S::Mul(a[2], out[0][2])));
+	}
+	// 1 / det, or 1 where singular so the result stays finite
+	static V Reciprocal(V det) {
+		return S::Div(S::Set(1), S::Select(S::Equal(det, S::Set(0)), S::Set(1), det));
+	}
+	static V Dot3(const V* u, const V* v) {
+		return S::MulAdd(u[0], v[0], S::MulAdd(u[1], v[1], S::Mul(u[2], v[2])));
+	}
+
+	static void InverseAffine(const GW::MATH::GMATRIXF* in, GW::MATH::GMATRIXF* out) {
+		V m[4][4], cof[3][3], inv[4][4];
+		LoadMatrix(in, m);
+		V scale = Reciprocal(Cofactors(m, cof));
+		// the inverse of the 3x3 is the transposed cofactors over the determinant
+		for (int r = 0; r < 3; ++r) {
+			for (int c = 0; c < 3; ++c)
+				inv[r][c] = S::Mul(cof[c][r], scale);
+			inv[r][3] = S::Set(0);
+		}
+		// translation moves back through the inverse
+		for (int c = 0; c < 3; ++c)
+			inv[3][c] = S::Sub(S::Set(0), S::MulAdd(m[3][0], inv[0][c], S::MulAdd(m[3][1], inv[1][c], S::Mul(m[3][2], inv[2][c]))));
+		inv[3][3] = S::Set(1);
+		StoreMatrix(out, inv);
+	}
+	static void NormalMatrices(const GW::MATH::GMATRIXF* in, GW::MATH::GMATRIXF* out, uint8_t* uniform, float tolerance) {
+		V m[4][4], cof[3][3], n[4][4];
+		LoadMatrix(in, m);
+		V scale = Reciprocal(Cofactors(m, cof));
+		for (int r = 0; r < 3; ++r) {
+			for (int c = 0; c < 3; ++c)
+				n[r][c] = S::Mul(cof[r][c], scale);
+			n[r][3] = S::Set(0);
+		}
+		n[3][0] = n[3][1] = n[3][2] = S::Set(0);
+		n[3][3] = S::Set(1);
+		StoreMatrix(out, n);
+		if (uniform == nullptr)
+			return;
+		// equal row lengths and orthogonal rows, relative to the squared length
+		V aa = Dot3(m[0], m[0]), bb = Dot3(m[1], m[1]), cc = Dot3(m[2], m[2]);
+		V limit = S::Mul(S::Set(tolerance), aa);
+		M ok = S::And(S::LessEqual(S::Abs(S::Sub(bb, aa)), limit), S::LessEqual(S::Abs(S::Sub(cc, aa)), limit));
+		ok = S::And(ok, S::LessEqual(S::Abs(Dot3(m[0], m[1])), limit));
+		ok = S::And(ok, S::LessEqual(S::Abs(Dot3(m[1], m[2])), limit));
+		ok = S::And(ok, S::LessEqual(S::Abs(Dot3(m[2], m[0])), limit));
+		unsigned bits = S::Bits(ok);
+		for (int j = 0; j < S::WIDTH; ++j)
+			uniform[j] = (bits >> j) & 1;
+	}
+	// local point placed by each matrix
+	static void Place(const GW::MATH::GVECTORF& p, const V m[4][4], V out[3]) {
+		for (int c = 0; c < 3; ++c)
+			out[c] = S::MulAdd(S::Set(p.x), m[0][c], S::MulAdd(S::Set(p.y), m[1][c], S::MulAdd(S::Set(p.z), m[2][c], m[3][c])));
+	}
+	static void TransformAABB(const GW::MATH::GAABBCEF& local, const GW::MATH::GMATRIXF* m, GW::MATH::GAABBCEF* out) {
+		V rows[4][4], center[4], extent[4];
+		LoadMatrix(m, rows);
+		Place(local.center, rows, center);
+		// extents along each world axis are the absolute rows weighted by the local extents
+		for (int c = 0; c < 3; ++c)
+			extent[c] = S::MulAdd(S::Set(local.extent.x), S::Abs(rows[0][c]), S::MulAdd(S::Set(local.extent.y),
+				S::Abs(rows[1][c]), S::Mul(S::Set(local.extent.z), S::Abs(rows[2][c]))));
+		center[3] = extent[3] = S::Set(0);
+		S::Store(out->center.data, 8, center);
+		S::Store(out->extent.data, 8, extent);
+	}
+	static void TransformSphere(const GW::MATH::GSPHEREF& local, const GW::MATH::GMATRIXF* m, GW::MATH::GSPHEREF* out) {
+		V rows[4][4], sphere[4];
+		LoadMatrix(m, rows);
+		Place(local.data, rows, sphere);
+		// largest stretch of the 3x3 is at most the largest absolute row sum of
+		// M * M^T (exact when the rows are orthogonal, so for any TRS)
+		V g[3][3];
+		for (int r = 0; r < 3; ++r)
+			for (int c = r; c < 3; ++c)
+				g[r][c] = g[c][r] = Dot3(rows[r], rows[c]);
+		V stretch = S::Set(0);
+		for (int r = 0; r < 3; ++r)
+			stretch = S::Max(stretch, S::Add(S::Abs(g[r][0]), S::Add(S::Abs(g[r][1]), S::Abs(g[r][2]))));
+		sphere[3] = S::Mul(S::Set(local.radius), S::Sqrt(stretch));
+		S::Store(out->data.data, 4, sphere);
+	}
+};
+
+// out[i] = a[i] * b[i]
+template <class S = BATCH_LANES>
+inline void BatchMultiply(const GW::MATH::GMATRIXF* a, const GW::MATH::GMATRIXF* b, GW::MATH::GMATRIXF* out, size_t count)
+{
+	size_t i = 0;
+	for (; i + S::WIDTH <= count; i += S::WIDTH)
+		S::Multiply(a + i, b + i, 1, out + i);
+	for (; i < count; ++i)
+		BATCH_SCALAR::Multiply(a + i, b + i, 1, out + i);
+}
+// out[i] = a[i] * b, e.g. local matrices placed under one parent
+template <class S = BATCH_LANES>
+inline void BatchMultiply(const GW::MATH::GMATRIXF* a, const GW::MATH::GMATRIXF& b, GW::MATH::GMATRIXF* out, size_t count)
+{
+	size_t i = 0;
+	for (; i + S::WIDTH <= count; i += S::WIDTH)
+		S::Multiply(a + i, &b, 0, out + i);
+	for (; i < count; ++i)
+		BATCH_SCALAR::Multiply(a + i, &b, 0, out + i);
+}
+// Inverse of matrices whose w column is 0 0 0 1 (any 3x3, not only rotations)
+template <class S = BATCH_LANES>
+inline void BatchInverseAffine(const GW::MATH::GMATRIXF* in, GW::MATH::GMATRIXF* out, size_t count)
+{
+	size_t i = 0;
+	for (; i + S::WIDTH <= count; i += S::WIDTH)
+		BATCH_KERNELS<S>::InverseAffine(in + i, out + i);
+	for (; i < count; ++i)
+		BATCH_KERNELS<BATCH_SCALAR>::InverseAffine(in + i, out + i);
+}
+// Inverse transpose of the upper 3x3 (w column and row4 left 0 0 0 1), what
+// normals are multiplied by. uniform (may be null) is set where the rows are an
+// equally scaled orthonormal basis, so the matrix itself already does for normals.
+// Singular matrices get their cofactors, which point normals the same way up to sign.
+template <class S = BATCH_LANES>
+inline void BatchNormalMatrices(const GW::MATH::GMATRIXF* in, GW::MATH::GMATRIXF* out, uint8_t* uniform, size_t count,
+								float tolerance = 1e-4f)
+{
+	size_t i = 0;
+	for (; i + S::WIDTH <= count; i += S::WIDTH)
+		BATCH_KERNELS<S>::NormalMatrices(in + i, out + i, uniform ? uniform + i : nullptr, tolerance);
+	for (; i < count; ++i)
+		BATCH_KERNELS<BATCH_SCALAR>::NormalMatrices(in + i, out + i, uniform ? uniform + i : nullptr, tolerance);
+}
+// World box around local placed by each matrix
+template <class S = BATCH_LANES>
+inline void BatchTransformAABB(const GW::MATH::GAABBCEF& local, const GW::MATH::GMATRIXF* m, GW::MATH::GAABBCEF* out, size_t count)
+{
+	size_t i = 0;
+	for (; i + S::WIDTH <= count; i += S::WIDTH)
+		BATCH_KERNELS<S>::TransformAABB(local, m + i, out + i);
+	for (; i < count; ++i)
+		BATCH_KERNELS<BATCH_SCALAR>::TransformAABB(local, m + i, out + i);
+}
+// World sphere holding local placed by each matrix
+template <class S = BATCH_LANES>
+inline void BatchTransformSphere(const GW::MATH::GSPHEREF& local, const GW::MATH::GMATRIXF* m, GW::MATH::GSPHEREF* out, size_t count)
+{
+	size_t i = 0;
+	for (; i + S::WIDTH <= count; i += S::WIDTH)
+		BATCH_KERNELS<S>::TransformSphere(local, m + i, out + i);
+	for (; i < count; ++i)
+		BATCH_KERNELS<BATCH_SCALAR>::TransformSphere(local, m + i, out + i);
+}
+#endif
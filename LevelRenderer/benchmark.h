@@ -0,0 +1,149 @@
+#ifndef _BENCHMARK_H_
+#define _BENCHMARK_H_
+// main.cpp --bench path: flies a Camera_Path (a .cam or a --record recording)
+// through the loaded level at a fixed timestep and times the CPU stages of
+// every frame (LOD selection, culling, draw list, recording and upload)
+// without a window or device, so runs are repeatable and work on machines
+// with no GPU. Recording encodes the planned draws into a plain command
+// stream and upload packs the scene data into host memory, the same work
+// Renderer::Render does minus the driver's. One CSV row per frame. Needs no
+// Vulkan, main.cpp and benchmarks/LevelBench.cpp both run it. Include after
+// load_data_oriented.h.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include "frame_planner.h"
+#include "scene_data.h"
+#include "camera_path.h"
+
+struct BENCHMARK_SETTINGS {
+	unsigned frames = 0; // 0 covers the whole path
+	float step = 1.0f / 60; // seconds of path per frame
+	unsigned width = 800, height = 600; // viewport the LODs and projection assume
+	std::string csvPath; // empty writes no CSV
+	unsigned clusterMode = 1; // the renderer's CLUSTER_CULLING
+	unsigned clusterMinTriangles = 2048; // Renderer::clusterCullMinTriangles
+};
+
+// Returns false when the path or the CSV couldn't be opened
+inline bool RunBenchmark(Level_Data& level, const char* camPath, const BENCHMARK_SETTINGS& settings, GW::SYSTEM::GLog log)
+{
+	if (settings.step <= 0) {
+		log.LogCategorized("ERROR", "Benchmark: the timestep must be positive");
+		return false;
+	}
+	Camera_Path path;
+	std::string error;
+	if (path.Load(camPath, error) == false) {
+		log.LogCategorized("ERROR", ("Benchmark: " + error).c_str());
+		return false;
+	}
+	FILE* csv = nullptr;
+	if (settings.csvPath.size()) {
+		csv = std::fopen(settings.csvPath.c_str(), "w");
+		if (csv == nullptr) {
+			log.LogCategorized("ERROR", ("Benchmark: could not write " + settings.csvPath).c_str());
+			return false;
+		}
+		std::fprintf(csv, "frame,time,lod_ms,cull_ms,build_ms,record_ms,upload_ms,draws,instances,triangles,"
+			"full_detail_triangles,instances_culled,clusters,clusters_culled,pipeline_binds,texture_binds,index_binds\n");
+	}
+	unsigned frames = settings.frames ? settings.frames : unsigned(path.Duration() / settings.step + 0.5f) + 1;
+
+	// the renderer's defaults, textured wherever a material names an albedo map
+	const float fieldOfView = 1.13446f;
+	GW::MATH::GMatrix proxy;
+	proxy.Create();
+	GW::MATH::GMATRIXF perspective;
+	proxy.ProjectionVulkanLHF(fieldOfView, float(settings.width) / settings.height, 0.1f, 100.0f, perspective);
+	Frame_Planner planner;
+	planner.clusterMode = settings.clusterMode;
+	planner.Reset(level);
+	planner.SelectClusterModels(level, settings.clusterMode ? settings.clusterMinTriangles : ~0u);
+	std::vector<bool> texturedMaterials(level.levelMaterials.size(), false);
+	for (size_t m = 0; m < texturedMaterials.size() && m < level.levelTextures.size(); ++m)
+		texturedMaterials[m] = level.levelTextures[m].albedoIndex != ~0u;
+	std::unique_ptr<SHADER_MODEL_DATA> sceneData(new SHADER_MODEL_DATA());
+	std::vector<char> uploaded(sizeof(SHADER_MODEL_DATA)); // stands in for the mapped storage buffer
+	std::vector<unsigned> commands; // stands in for the command buffer
+	std::vector<unsigned> clusterUpload;
+
+	double totals[5] = {};
+	for (unsigned frame = 0; frame < frames; ++frame) {
+		float time = path.keys.front().time + frame * settings.step;
+		GW::MATH::GMATRIXF cameraWorld = path.Sample(time), view, viewProjection;
+		proxy.InverseF(cameraWorld, view);
+		proxy.MultiplyMatrixF(view, perspective, viewProjection);
+		CLUSTER_VIEW clusterView = MakeClusterView(viewProjection, cameraWorld.row4);
+		uint64_t marks[6];
+		marks[0] = Profiler::Now();
+		planner.SelectLods(level, cameraWorld, settings.height, fieldOfView);
+		marks[1] = Profiler::Now();
+		level.UpdateHierarchy();
+		planner.Cull(level, clusterView);
+		marks[2] = Profiler::Now();
+		planner.Build(level, texturedMaterials, clusterView);
+		marks[3] = Profiler::Now();
+		{
+			PROFILE_SCOPE("Record draws");
+			commands.clear();
+			unsigned pushedModel = ~0u;
+			for (const PLANNED_DRAW& draw : planner.draws) {
+				if (draw.model != pushedModel) { // quantization bounds
+					const H2B::BOUNDS& bounds = level.levelModels[draw.model].bounds;
+					const float* box = &bounds.min.x;
+					commands.insert(commands.end(), reinterpret_cast<const unsigned*>(box), reinterpret_cast<const unsigned*>(box + 6));
+					pushedModel = draw.model;
+				}
+				if (draw.bindPipeline)
+					commands.push_back(draw.textured);
+				if (draw.bindTextures)
+					commands.push_back(1);
+				if (draw.bindIndices)
+					commands.push_back(draw.indices);
+				unsigned record[] = { draw.material, draw.firstWorld, draw.indexCount, draw.instanceCount,
+					draw.firstIndex, unsigned(draw.vertexOffset) };
+				commands.insert(commands.end(), record, record + 6);
+			}
+		}
+		marks[4] = Profiler::Now();
+		{
+			PROFILE_SCOPE("Upload scene data");
+			sceneData->viewMatrix = view;
+			sceneData->projectionMatrix = perspective;
+			sceneData->cameraPos = cameraWorld.row4;
+			unsigned worldCount = std::min<unsigned>(planner.worlds.size(), MAX_SUBMESH_PER_DRAW);
+			SCENE_RANGE ranges[2];
+			unsigned rangeCount = SceneRanges(worldCount, PackWorlds(level, planner.worlds, *sceneData), ranges);
+			for (unsigned r = 0; r < rangeCount; ++r)
+				std::memcpy(uploaded.data() + ranges[r].offset, reinterpret_cast<const char*>(sceneData.get()) + ranges[r].offset, ranges[r].size);
+			clusterUpload.assign(planner.clusterIndices.begin(), planner.clusterIndices.end()); // the cluster index buffer
+		}
+		marks[5] = Profiler::Now();
+		Profiler::Get().EndFrame();
+
+		double milliseconds[5];
+		for (int s = 0; s < 5; ++s) {
+			milliseconds[s] = (marks[s + 1] - marks[s]) / 1e6;
+			totals[s] += milliseconds[s];
+		}
+		const PLAN_STATS& stats = planner.stats;
+		if (csv)
+			std::fprintf(csv, "%u,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u\n", frame, time,
+				milliseconds[0], milliseconds[1], milliseconds[2], milliseconds[3], milliseconds[4],
+				stats.drawCount, stats.instanceCount, stats.triangleCount, stats.fullDetailTriangleCount, stats.instancesCulled,
+				stats.clusters.clusters, stats.clusters.frustumCulled + stats.clusters.backfaceCulled,
+				stats.pipelineBinds, stats.textureBinds, stats.indexBinds);
+	}
+	if (csv)
+		std::fclose(csv);
+	char line[256];
+	std::snprintf(line, sizeof(line), "Benchmark: %u frames of %s, avg ms lod %.3f cull %.3f build %.3f record %.3f upload %.3f",
+		frames, camPath, totals[0] / frames, totals[1] / frames, totals[2] / frames, totals[3] / frames, totals[4] / frames);
+	log.LogCategorized("INFO", line);
+	if (csv)
+		log.LogCategorized("INFO", ("Benchmark: per frame results written to " + settings.csvPath).c_str());
+	return true;
+}
+#endif
@@ -0,0 +1,178 @@
+// Times the batch_matrix.h kernels against the GMatrix proxy, once per lane
+// type this build has (scalar, SSE, and AVX2 in the BatchMatrixBenchAVX2
+// build), on 4099 random affine matrices (or the count given on the command
+// line) so every width also runs its leftover path. Each lane type is first
+// checked against the proxy and brute force; the run fails when one is off.
+#define GATEWARE_ENABLE_CORE
+#define GATEWARE_ENABLE_SYSTEM
+#define GATEWARE_ENABLE_MATH
+#include "../../Gateware/Gateware.h"
+#include "../batch_matrix.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace GW::MATH;
+
+static std::mt19937 rng(11);
+static std::uniform_real_distribution<float> unit(-2, 2);
+static volatile float sink; // keeps the timed results alive
+
+// diagonally dominant, so the inverse checks don't hinge on conditioning
+static GMATRIXF RandomAffine()
+{
+	GMATRIXF m;
+	for (int i = 0; i < 16; ++i)
+		m.data[i] = unit(rng) * (i < 12 ? 0.5f : 10) + (i % 5 == 0 ? 2.5f * (i % 2 ? -1 : 1) : 0);
+	m.row1.w = m.row2.w = m.row3.w = 0;
+	m.row4.w = 1;
+	return m;
+}
+
+// largest difference relative to the expected value
+static float Error(const float* a, const float* b, int count)
+{
+	float worst = 0;
+	for (int i = 0; i < count; ++i)
+		worst = std::max(worst, std::fabs(a[i] - b[i]) / (1 + std::fabs(b[i])));
+	return worst;
+}
+
+// best of 15 timings, in nanoseconds per call of f
+template <class F>
+static double TimeNs(F f, int calls)
+{
+	f();
+	double best = 1e30;
+	for (int t = 0; t < 15; ++t) {
+		auto start = std::chrono::steady_clock::now();
+		for (int c = 0; c < calls; ++c)
+			f();
+		best = std::min(best, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / calls);
+	}
+	return best;
+}
+
+// Returns false when a kernel disagreed with the proxy or brute force
+template <class S>
+static bool Run(const char* name, const std::vector<GMATRIXF>& a, const std::vector<GMATRIXF>& b)
+{
+	size_t count = a.size();
+	std::vector<GMATRIXF> out(count);
+	std::vector<GAABBCEF> boxes(count);
+	std::vector<GSPHEREF> spheres(count);
+	std::vector<uint8_t> uniform(count);
+	GAABBCEF box;
+	box.center = { 0.3f, -0.2f, 0.5f, 0 };
+	box.extent = { 1, 2, 0.5f, 0 };
+	GSPHEREF sphere;
+	sphere.data = { 0.3f, -0.2f, 0.5f, 1.5f };
+
+	float multiply = 0, inverse = 0, bounds = 0, normal = 0;
+	unsigned sphereMisses = 0;
+	GMATRIXF expected;
+	BatchMultiply<S>(a.data(), b.data(), out.data(), count);
+	for (size_t i = 0; i < count; ++i) {
+		GMatrix::MultiplyMatrixF(a[i], b[i], expected);
+		multiply = std::max(multiply, Error(out[i].data, expected.data, 16));
+	}
+	BatchMultiply<S>(a.data(), b[0], out.data(), count);
+	for (size_t i = 0; i < count; ++i) {
+		GMatrix::MultiplyMatrixF(a[i], b[0], expected);
+		multiply = std::max(multiply, Error(out[i].data, expected.data, 16));
+	}
+	BatchInverseAffine<S>(a.data(), out.data(), count);
+	for (size_t i = 0; i < count; ++i) {
+		if (G_FAIL(GMatrix::InverseF(a[i], expected)))
+			continue;
+		inverse = std::max(inverse, Error(out[i].data, expected.data, 16));
+	}
+	BatchNormalMatrices<S>(a.data(), out.data(), uniform.data(), count);
+	for (size_t i = 0; i < count; ++i) {
+		GMATRIXF linear = a[i], inverted;
+		linear.row4 = { 0, 0, 0, 1 };
+		if (G_FAIL(GMatrix::InverseF(linear, inverted)))
+			continue; // singular, nothing to compare against
+		GMatrix::TransposeF(inverted, expected);
+		normal = std::max(normal, Error(out[i].data, expected.data, 12));
+	}
+	BatchTransformAABB<S>(box, a.data(), boxes.data(), count);
+	BatchTransformSphere<S>(sphere, a.data(), spheres.data(), count);
+	for (size_t i = 0; i < count; ++i) {
+		// the world box is exactly the bounds of the moved corners
+		float lo[3] = { 1e30f, 1e30f, 1e30f }, hi[3] = { -1e30f, -1e30f, -1e30f };
+		for (int c = 0; c < 8; ++c) {
+			GVECTORF corner = { box.center.x + (c & 1 ? 1 : -1) * box.extent.x, box.center.y + (c & 2 ? 1 : -1) * box.extent.y,
+				box.center.z + (c & 4 ? 1 : -1) * box.extent.z, 1 }, world;
+			GMatrix::VectorXMatrixF(a[i], corner, world);
+			for (int k = 0; k < 3; ++k) {
+				lo[k] = std::min(lo[k], world.data[k]);
+				hi[k] = std::max(hi[k], world.data[k]);
+			}
+		}
+		for (int k = 0; k < 3; ++k)
+			bounds = std::max(bounds, std::max(std::fabs((lo[k] + hi[k]) / 2 - boxes[i].center.data[k]),
+				std::fabs((hi[k] - lo[k]) / 2 - boxes[i].extent.data[k])));
+		// the world sphere holds every moved point of the local one
+		for (int s = 0; s < 64; ++s) {
+			float d[3] = { unit(rng), unit(rng), unit(rng) };
+			float length = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+			GVECTORF point = { sphere.x + d[0] / length * sphere.radius, sphere.y + d[1] / length * sphere.radius,
+				sphere.z + d[2] / length * sphere.radius, 1 }, world;
+			GMatrix::VectorXMatrixF(a[i], point, world);
+			float dx = world.x - spheres[i].x, dy = world.y - spheres[i].y, dz = world.z - spheres[i].z;
+			sphereMisses += std::sqrt(dx * dx + dy * dy + dz * dz) > spheres[i].radius * 1.0001f;
+		}
+	}
+	bool match = multiply < 1e-5f && inverse < 1e-5f && bounds < 1e-4f && normal < 1e-5f && sphereMisses == 0;
+	std::printf("%-6s error: multiply %.1e inverse %.1e aabb %.1e normal %.1e, sphere misses %u%s\n", name,
+		multiply, inverse, bounds, normal, sphereMisses, match ? "" : "  MISMATCH");
+
+	const int calls = 20;
+	double ns[6];
+	ns[0] = TimeNs([&] { BatchMultiply<S>(a.data(), b.data(), out.data(), count); }, calls);
+	ns[1] = TimeNs([&] { BatchMultiply<S>(a.data(), b[0], out.data(), count); }, calls);
+	ns[2] = TimeNs([&] { BatchInverseAffine<S>(a.data(), out.data(), count); }, calls);
+	ns[3] = TimeNs([&] { BatchNormalMatrices<S>(a.data(), out.data(), uniform.data(), count); }, calls);
+	ns[4] = TimeNs([&] { BatchTransformAABB<S>(box, a.data(), boxes.data(), count); }, calls);
+	ns[5] = TimeNs([&] { BatchTransformSphere<S>(sphere, a.data(), spheres.data(), count); }, calls);
+	std::printf("%-6s ns/matrix: multiply %.2f shared %.2f inverse affine %.2f normal %.2f aabb %.2f sphere %.2f\n", name,
+		ns[0] / count, ns[1] / count, ns[2] / count, ns[3] / count, ns[4] / count, ns[5] / count);
+	sink = out[count / 2].data[5] + boxes[count / 2].center.x + spheres[count / 2].radius;
+	return match;
+}
+
+int main(int argc, char** argv)
+{
+	size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4099;
+	if (count == 0) {
+		std::printf("usage: BatchMatrixBench [matrix count]\n");
+		return 1;
+	}
+	std::vector<GMATRIXF> a(count), b(count), out(count);
+	for (size_t i = 0; i < count; ++i) {
+		a[i] = RandomAffine();
+		b[i] = RandomAffine();
+	}
+	double multiply = TimeNs([&] {
+		for (size_t i = 0; i < count; ++i)
+			GMatrix::MultiplyMatrixF(a[i], b[i], out[i]);
+	}, 5);
+	double inverse = TimeNs([&] {
+		for (size_t i = 0; i < count; ++i)
+			GMatrix::InverseF(a[i], out[i]);
+	}, 5);
+	sink = out[count / 2].data[5];
+	std::printf("%zu matrices\nproxy  ns/matrix: multiply %.2f inverse %.2f\n", count, multiply / count, inverse / count);
+
+	bool match = Run<BATCH_SCALAR>("scalar", a, b);
+#if BATCH_MATRIX_SIMD >= 1
+	match = Run<BATCH_SSE>("sse", a, b) && match;
+#endif
+#if BATCH_MATRIX_SIMD >= 2
+	match = Run<BATCH_AVX2>("avx2", a, b) && match;
+#endif
+	return match ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+// Times Instance_BVH queries against testing every box, on 10k, 100k and 1M
+// random boxes at a constant density (or the counts given on the command line).
+// Both sides use the same GCollision tests, so their results must match; the
+// run fails when they don't. Half the queries run after 5% of the boxes moved
+// and were refit.
+#define GATEWARE_ENABLE_CORE
+#define GATEWARE_ENABLE_SYSTEM
+#define GATEWARE_ENABLE_MATH
+#include "../../Gateware/Gateware.h"
+#include "../instance_bvh.h"
+#include "../cluster_culling.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+using namespace GW::MATH;
+typedef GCollision::GCollisionCheck COLLISION;
+
+static double Now()
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool SameItems(std::vector<unsigned>& a, std::vector<unsigned>& b)
+{
+	std::sort(a.begin(), a.end());
+	std::sort(b.begin(), b.end());
+	return a == b;
+}
+
+// Returns false when any BVH query disagreed with brute force
+static bool Run(unsigned count)
+{
+	std::mt19937 rng(count);
+	float size = 20.0f * std::cbrt(float(count));
+	std::uniform_real_distribution<float> position(-size * 0.5f, size * 0.5f), extent(0.5f, 4.0f);
+	std::vector<GAABBCEF> boxes(count);
+	for (GAABBCEF& b : boxes) {
+		b.center = { position(rng), position(rng) * 0.1f, position(rng), 0 };
+		b.extent = { extent(rng), extent(rng), extent(rng), 0 };
+	}
+	Instance_BVH bvh;
+	double start = Now();
+	bvh.Build(boxes);
+	double build = Now() - start, refit = 0;
+
+	const char* names[4] = { "frustum", "sphere", "aabb", "ray" };
+	const int queries = 100;
+	double brute[4] = {}, tree[4] = {};
+	size_t hits[4] = {};
+	bool match = true;
+	std::vector<unsigned> a, b;
+	for (int pass = 0; pass < 2; ++pass) {
+		for (int q = 0; q < queries; ++q) {
+			GVECTORF eye = { position(rng), 5, position(rng), 1 }, at = { position(rng), 0, position(rng), 1 }, up = { 0, 1, 0, 0 };
+			GMATRIXF view, projection, viewProjection;
+			GMatrix::LookAtLHF(eye, at, up, view);
+			GMatrix::ProjectionVulkanLHF(1.13f, 1.33f, 0.1f, size * 0.25f, projection);
+			GMatrix::MultiplyMatrixF(view, projection, viewProjection);
+			CLUSTER_VIEW clusterView = MakeClusterView(viewProjection, eye);
+			GPLANEF planes[6];
+			for (int i = 0; i < 6; ++i)
+				planes[i] = { clusterView.planes[i].x, clusterView.planes[i].y, clusterView.planes[i].z, -clusterView.planes[i].w };
+			a.clear(); b.clear();
+			start = Now();
+			for (unsigned i = 0; i < count; ++i) {
+				bool inside = true;
+				for (int p = 0; p < 6 && inside; ++p) {
+					COLLISION result;
+					GCollision::TestPlaneToAABBF(planes[p], bvh.itemBounds[i], result);
+					inside = result != COLLISION::BELOW;
+				}
+				if (inside)
+					a.push_back(i);
+			}
+			brute[0] += Now() - start;
+			start = Now();
+			bvh.QueryFrustum(planes, b);
+			tree[0] += Now() - start;
+			hits[0] += b.size();
+			match = SameItems(a, b) && match;
+
+			GSPHEREF sphere;
+			sphere.data = { position(rng), 0, position(rng), 30 };
+			a.clear(); b.clear();
+			start = Now();
+			for (unsigned i = 0; i < count; ++i) {
+				COLLISION result;
+				GCollision::TestSphereToAABBF(sphere, bvh.itemBounds[i], result);
+				if (result == COLLISION::COLLISION)
+					a.push_back(i);
+			}
+			brute[1] += Now() - start;
+			start = Now();
+			bvh.QuerySphere(sphere, b);
+			tree[1] += Now() - start;
+			hits[1] += b.size();
+			match = SameItems(a, b) && match;
+
+			GAABBCEF box;
+			box.center = { position(rng), 0, position(rng), 0 };
+			box.extent = { 25, 25, 25, 0 };
+			a.clear(); b.clear();
+			start = Now();
+			for (unsigned i = 0; i < count; ++i) {
+				COLLISION result;
+				GCollision::TestAABBToAABBF(box, bvh.itemBounds[i], result);
+				if (result == COLLISION::COLLISION)
+					a.push_back(i);
+			}
+			brute[2] += Now() - start;
+			start = Now();
+			bvh.QueryAABB(box, b);
+			tree[2] += Now() - start;
+			hits[2] += b.size();
+			match = SameItems(a, b) && match;
+
+			GRAYF ray;
+			float angle = position(rng);
+			ray.position = { position(rng), 2, position(rng), 1 };
+			ray.direction = { std::cos(angle), -0.01f, std::sin(angle), 0 };
+			a.clear(); b.clear();
+			start = Now();
+			for (unsigned i = 0; i < count; ++i) {
+				GAABBMMF minMax;
+				GCollision::ConvertAABBCEToAABBMMF(bvh.itemBounds[i], minMax);
+				COLLISION result;
+				GCollision::TestRayToAABBF(ray, minMax, result);
+				if (result == COLLISION::COLLISION)
+					a.push_back(i);
+			}
+			brute[3] += Now() - start;
+			start = Now();
+			bvh.QueryRay(ray, b);
+			tree[3] += Now() - start;
+			hits[3] += b.size();
+			match = SameItems(a, b) && match;
+		}
+		if (pass == 0) {
+			start = Now();
+			for (unsigned m = 0; m < count / 20; ++m) {
+				unsigned i = rng() % count;
+				GAABBCEF moved = bvh.itemBounds[i];
+				moved.center.x += extent(rng) * 5;
+				moved.center.z -= extent(rng) * 5;
+				bvh.Update(i, moved);
+			}
+			refit = Now() - start;
+		}
+	}
+	std::printf("%u boxes: build %.1f ms, %zu nodes, refit of %u moves %.2f ms%s\n", count, build, bvh.nodes.size(),
+		count / 20, refit, match ? "" : ", RESULTS DIFFER");
+	for (int k = 0; k < 4; ++k)
+		std::printf("  %-8s brute force %9.3f ms  bvh %8.4f ms  %6.0fx  %zu hits\n", names[k],
+			brute[k] / (2 * queries), tree[k] / (2 * queries), brute[k] / tree[k], hits[k] / (2 * queries));
+	return match;
+}
+
+int main(int argc, char** argv)
+{
+	bool match = true;
+	if (argc > 1)
+		for (int i = 1; i < argc; ++i)
+			match = Run(unsigned(std::strtoul(argv[i], nullptr, 10))) && match;
+	else
+		for (unsigned count : { 10000u, 100000u, 1000000u })
+			match = Run(count) && match;
+	return match ? 0 : 1;
+}
@@ -0,0 +1,53 @@
+// The --bench path of main.cpp without the renderer: loads a level and flies
+// a camera path through it with RunBenchmark (benchmark.h), timing LOD
+// selection, culling, the draw list, recording and the scene data upload.
+// Builds without Vulkan, so it runs anywhere the level and models do.
+//  LevelBench [--level path] [--models folder] [--cam path] [--frames N]
+//             [--step seconds] [--csv path] [--cluster-mode 0|1|2]
+// Paths default to main.cpp's, relative to a build folder next to Levels.
+#define GATEWARE_ENABLE_CORE
+#define GATEWARE_ENABLE_SYSTEM
+#define GATEWARE_ENABLE_MATH
+#include "../../Gateware/Gateware.h"
+#include "../load_data_oriented.h"
+#include "../benchmark.h"
+
+int main(int argc, char** argv)
+{
+	GW::SYSTEM::GLog log;
+	log.Create("LevelBench.log");
+	log.EnableConsoleLogging(true);
+	const char* levelPath = "../Levels/SmallTest1.txt";
+	const char* modelFolder = "../ModelsOBJ";
+	const char* camPath = "../Levels/SmallTest1.cam";
+	BENCHMARK_SETTINGS bench;
+	for (int i = 1; i < argc; i += 2) {
+		std::string option = argv[i];
+		if (i + 1 == argc) {
+			log.LogCategorized("ERROR", ("Missing the value of " + option).c_str());
+			return 1;
+		}
+		if (option == "--level")
+			levelPath = argv[i + 1];
+		else if (option == "--models")
+			modelFolder = argv[i + 1];
+		else if (option == "--cam")
+			camPath = argv[i + 1];
+		else if (option == "--frames")
+			bench.frames = std::strtoul(argv[i + 1], nullptr, 10);
+		else if (option == "--step")
+			bench.step = std::strtof(argv[i + 1], nullptr);
+		else if (option == "--csv")
+			bench.csvPath = argv[i + 1];
+		else if (option == "--cluster-mode")
+			bench.clusterMode = std::strtoul(argv[i + 1], nullptr, 10);
+		else
+			log.LogCategorized("WARNING", ("Unknown option " + option).c_str());
+	}
+	Level_Data level;
+	if (level.LoadLevel(levelPath, modelFolder, log) == false)
+		return 1;
+	bool ran = RunBenchmark(level, camPath, bench, log);
+	log.Flush();
+	return ran ? 0 : 1;
+}
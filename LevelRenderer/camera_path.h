@@ -0,0 +1,269 @@
+#ifndef _CAMERA_PATH_H_
+#define _CAMERA_PATH_H_
+// A timed camera path for reproducible runs (main.cpp --bench, --replay). Keys
+// hold a position and a rotation; positions follow a Catmull-Rom spline
+// through the keys and rotations are slerped between them, so any time
+// samples the same camera on every run. Only Gateware math types are used, no
+// window needed.
+//
+// .cam files are text, one key per line, # starts a comment:
+//   time  eye.x eye.y eye.z  target.x target.y target.z
+// Times are seconds and must increase, the camera looks from eye at target
+// with +y up. Camera_Recorder writes binary recordings instead: a
+// CAMERA_FILE_HEADER followed by one CAMERA_KEY per frame until the end of
+// the file. Load tells them apart by the header.
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct CAMERA_KEY {
+	float time;
+	float position[3];
+	float rotation[4]; // unit quaternion xyzw, turns +z to the view direction
+};
+struct CAMERA_FILE_HEADER {
+	char magic[4]; // CAMERA_FILE_MAGIC
+	uint32_t version; // CAMERA_FILE_VERSION
+	uint32_t keySize; // sizeof(CAMERA_KEY) when written
+};
+#define CAMERA_FILE_MAGIC "CAMR"
+#define CAMERA_FILE_VERSION 1
+
+class Camera_Path {
+public:
+	std::vector<CAMERA_KEY> keys; // by increasing time
+
+	// A Camera_Recorder file or a text .cam
+	bool Load(const char* path, std::string& error) {
+		char magic[4] = {};
+		FILE* file = std::fopen(path, "rb");
+		if (file) {
+			std::fread(magic, 1, sizeof(magic), file);
+			std::fclose(file);
+		}
+		if (std::memcmp(magic, CAMERA_FILE_MAGIC, sizeof(magic)) == 0)
+			return LoadRecording(path, error);
+		return LoadText(path, error);
+	}
+	bool LoadRecording(const char* path, std::string& error) {
+		keys.clear();
+		FILE* file = std::fopen(path, "rb");
+		if (file == nullptr) {
+			error = std::string("could not open ") + path;
+			return false;
+		}
+		CAMERA_FILE_HEADER header;
+		if (std::fread(&header, sizeof(header), 1, file) != 1 || std::memcmp(header.magic, CAMERA_FILE_MAGIC, 4) ||
+			header.version != CAMERA_FILE_VERSION || header.keySize != sizeof(CAMERA_KEY)) {
+			std::fclose(file);
+			error = std::string(path) + " is not a version " + std::to_string(CAMERA_FILE_VERSION) + " camera recording";
+			return false;
+		}
+		CAMERA_KEY key;
+		while (std::fread(&key, sizeof(key), 1, file) == 1)
+			if (keys.empty() || key.time > keys.back().time) // frames closer than the clock can tell apart
+				keys.push_back(key);
+		std::fclose(file); // a partial last key is a recording cut short, the rest still plays
+		if (keys.empty()) {
+			error = std::string(path) + " has no keys";
+			return false;
+		}
+		return true;
+	}
+	bool LoadText(const char* path, std::string& error) {
+		keys.clear();
+		std::ifstream file(path);
+		if (file.is_open() == false) {
+			error = std::string("could not open ") + path;
+			return false;
+		}
+		std::string line;
+		for (unsigned number = 1; std::getline(file, line); ++number) {
+			line = line.substr(0, line.find('#'));
+			if (line.find_first_not_of(" \t\r") == std::string::npos)
+				continue;
+			std::istringstream fields(line);
+			float time, eye[3], target[3];
+			if (!(fields >> time >> eye[0] >> eye[1] >> eye[2] >> target[0] >> target[1] >> target[2])) {
+				error = std::string(path) + "(" + std::to_string(number) + "): expected time, eye and target";
+				return false;
+			}
+			if (keys.size() && time <= keys.back().time) {
+				error = std::string(path) + "(" + std::to_string(number) + "): times must increase";
+				return false;
+			}
+			keys.push_back(LookAt(time, eye, target));
+		}
+		if (keys.empty()) {
+			error = std::string(path) + " has no keys";
+			return false;
+		}
+		return true;
+	}
+	float Duration() const { return keys.size() ? keys.back().time - keys.front().time : 0.0f; }
+
+	// The key at time, clamped to the ends of the path
+	CAMERA_KEY SampleKey(float time) const {
+		if (keys.size() < 2 || time <= keys.front().time)
+			return keys.size() ? keys.front() : CAMERA_KEY{ 0, { 0, 0, 0 }, { 0, 0, 0, 1 } };
+		if (time >= keys.back().time)
+			return keys.back();
+		size_t next = std::upper_bound(keys.begin(), keys.end(), time,
+			[](float t, const CAMERA_KEY& key) { return t < key.time; }) - keys.begin();
+		size_t i = next - 1;
+		const CAMERA_KEY& a = keys[i];
+		const CAMERA_KEY& b = keys[next];
+		float span = b.time - a.time, u = (time - a.time) / span;
+		CAMERA_KEY key = {};
+		key.time = time;
+		// Hermite with tangents from the neighbours (Catmull-Rom for uneven times)
+		for (int c = 0; c < 3; ++c) {
+			float m0 = Tangent(i, c) * span, m1 = Tangent(next, c) * span;
+			float u2 = u * u, u3 = u2 * u;
+			key.position[c] = (2 * u3 - 3 * u2 + 1) * a.position[c] + (u3 - 2 * u2 + u) * m0 +
+				(-2 * u3 + 3 * u2) * b.position[c] + (u3 - u2) * m1;
+		}
+		Slerp(a.rotation, b.rotation, u, key.rotation);
+		return key;
+	}
+	// Camera world matrix (row vectors, rows are right, up, forward and eye),
+	// its inverse is the view matrix
+	GW::MATH::GMATRIXF Sample(float time) const { return KeyWorld(SampleKey(time)); }
+
+	static CAMERA_KEY LookAt(float time, const float eye[3], const float target[3]) {
+		float forward[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+		Normalize(forward, 0, 0, 1);
+		float right[3] = { forward[2], 0, -forward[0] }; // up x forward with up +y
+		Normalize(right, 1, 0, 0); // looking straight up or down
+		float up[3] = { forward[1] * right[2] - forward[2] * right[1], forward[2] * right[0] - forward[0] * right[2],
+			forward[0] * right[1] - forward[1] * right[0] };
+		return KeyFromBasis(time, eye, right, up, forward);
+	}
+	// world's rotation is made orthonormal first, input drifts a little every frame
+	static CAMERA_KEY KeyFromWorld(float time, const GW::MATH::GMATRIXF& world) {
+		float forward[3] = { world.row3.x, world.row3.y, world.row3.z };
+		Normalize(forward, 0, 0, 1);
+		float along = world.row1.x * forward[0] + world.row1.y * forward[1] + world.row1.z * forward[2];
+		float right[3] = { world.row1.x - along * forward[0], world.row1.y - along * forward[1], world.row1.z - along * forward[2] };
+		Normalize(right, 1, 0, 0);
+		float up[3] = { forward[1] * right[2] - forward[2] * right[1], forward[2] * right[0] - forward[0] * right[2],
+			forward[0] * right[1] - forward[1] * right[0] };
+		float eye[3] = { world.row4.x, world.row4.y, world.row4.z };
+		return KeyFromBasis(time, eye, right, up, forward);
+	}
+	static GW::MATH::GMATRIXF KeyWorld(const CAMERA_KEY& key) {
+		float x = key.rotation[0], y = key.rotation[1], z = key.rotation[2], w = key.rotation[3];
+		GW::MATH::GMATRIXF world;
+		world.row1 = { 1 - 2 * (y * y + z * z), 2 * (x * y + w * z), 2 * (x * z - w * y), 0 };
+		world.row2 = { 2 * (x * y - w * z), 1 - 2 * (x * x + z * z), 2 * (y * z + w * x), 0 };
+		world.row3 = { 2 * (x * z + w * y), 2 * (y * z - w * x), 1 - 2 * (x * x + y * y), 0 };
+		world.row4 = { key.position[0], key.position[1], key.position[2], 1 };
+		return world;
+	}
+
+private:
+	// the quaternion of the rotation whose rows are right, up and forward
+	static CAMERA_KEY KeyFromBasis(float time, const float eye[3], const float right[3], const float up[3], const float forward[3]) {
+		CAMERA_KEY key = {};
+		key.time = time;
+		std::memcpy(key.position, eye, sizeof(key.position));
+		float m[3][3] = { { right[0], right[1], right[2] }, { up[0], up[1], up[2] }, { forward[0], forward[1], forward[2] } };
+		float trace = m[0][0] + m[1][1] + m[2][2];
+		float* q = key.rotation;
+		if (trace > 0) {
+			float s = std::sqrt(trace + 1) * 2;
+			q[3] = s / 4; q[0] = (m[1][2] - m[2][1]) / s; q[1] = (m[2][0] - m[0][2]) / s; q[2] = (m[0][1] - m[1][0]) / s;
+		}
+		else if (m[0][0] > m[1][1] && m[0][0] > m[2][2]) {
+			float s = std::sqrt(1 + m[0][0] - m[1][1] - m[2][2]) * 2;
+			q[3] = (m[1][2] - m[2][1]) / s; q[0] = s / 4; q[1] = (m[1][0] + m[0][1]) / s; q[2] = (m[2][0] + m[0][2]) / s;
+		}
+		else if (m[1][1] > m[2][2]) {
+			float s = std::sqrt(1 + m[1][1] - m[0][0] - m[2][2]) * 2;
+			q[3] = (m[2][0] - m[0][2]) / s; q[0] = (m[1][0] + m[0][1]) / s; q[1] = s / 4; q[2] = (m[2][1] + m[1][2]) / s;
+		}
+		else {
+			float s = std::sqrt(1 + m[2][2] - m[0][0] - m[1][1]) * 2;
+			q[3] = (m[0][1] - m[1][0]) / s; q[0] = (m[2][0] + m[0][2]) / s; q[1] = (m[2][1] + m[1][2]) / s; q[2] = s / 4;
+		}
+		return key;
+	}
+	// d position / d time at key i on axis c, one sided at the ends
+	float Tangent(size_t i, int c) const {
+		size_t before = i ? i - 1 : i, after = std::min(i + 1, keys.size() - 1);
+		return (keys[after].position[c] - keys[before].position[c]) / (keys[after].time - keys[before].time);
+	}
+	static void Normalize(float v[3], float x, float y, float z) {
+		float length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+		if (length < 1e-6f) {
+			v[0] = x; v[1] = y; v[2] = z;
+			return;
+		}
+		v[0] /= length; v[1] /= length; v[2] /= length;
+	}
+	static void Slerp(const float a[4], const float b[4], float u, float out[4]) {
+		float d = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+		float sign = d < 0 ? -1.0f : 1.0f; // the short way around
+		d *= sign;
+		float wa = 1 - u, wb = u;
+		if (d < 0.9995f) {
+			float angle = std::acos(d), s = std::sin(angle);
+			wa = std::sin(wa * angle) / s;
+			wb = std::sin(wb * angle) / s;
+		}
+		float length = 0;
+		for (int c = 0; c < 4; ++c) {
+			out[c] = wa * a[c] + wb * sign * b[c];
+			length += out[c] * out[c];
+		}
+		length = std::sqrt(length);
+		for (int c = 0; c < 4; ++c)
+			out[c] /= length;
+	}
+};
+
+// Streams one CAMERA_KEY per Record call to a binary camera file, nothing is
+// held back but stdio's buffer so a session that ends badly keeps its frames
+class Camera_Recorder {
+public:
+	~Camera_Recorder() { Close(); }
+
+	bool Open(const char* path, std::string& error) {
+		Close();
+		file = std::fopen(path, "wb");
+		CAMERA_FILE_HEADER header = { {}, CAMERA_FILE_VERSION, sizeof(CAMERA_KEY) };
+		std::memcpy(header.magic, CAMERA_FILE_MAGIC, sizeof(header.magic));
+		if (file == nullptr || std::fwrite(&header, sizeof(header), 1, file) != 1) {
+			Close();
+			error = std::string("could not write ") + path;
+			return false;
+		}
+		count = 0;
+		return true;
+	}
+	bool IsOpen() const { return file != nullptr; }
+	unsigned GetCount() const { return count; }
+	// time in seconds since the recording started, cameraWorld as Camera_Path::Sample returns it
+	void Record(float time, const GW::MATH::GMATRIXF& cameraWorld) {
+		if (file == nullptr)
+			return;
+		CAMERA_KEY key = Camera_Path::KeyFromWorld(time, cameraWorld);
+		count += unsigned(std::fwrite(&key, sizeof(key), 1, file));
+	}
+	void Close() {
+		if (file)
+			std::fclose(file);
+		file = nullptr;
+	}
+
+private:
+	FILE* file = nullptr;
+	unsigned count = 0;
+};
+#endif
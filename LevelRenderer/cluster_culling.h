@@ -0,0 +1,121 @@
+#ifndef _CLUSTER_CULLING_H_
+#define _CLUSTER_CULLING_H_
+// Per meshlet frustum and normal cone culling on the CPU. ClusterCullCompute.hlsl
+// runs the same tests on the GPU, keep the two in sync. Only Gateware math types
+// and the H2B meshlet tables are used so this runs without a window or device.
+#include "h2bParser.h"
+#include <cmath>
+#include <vector>
+
+// World space planes (xyz inward normal, w offset) and eye position of one view
+struct CLUSTER_VIEW {
+	GW::MATH::GVECTORF planes[6];
+	GW::MATH::GVECTORF eye;
+};
+// One model instance prepared for culling its meshlets
+struct CLUSTER_INSTANCE {
+	GW::MATH::GMATRIXF world;
+	float scale; // largest axis scale, grows the meshlet spheres
+	bool coneTest; // normal cones only hold for uniform scale without mirroring
+};
+struct CLUSTER_CULL_STATS {
+	unsigned clusters, frustumCulled, backfaceCulled;
+	unsigned triangles, visibleTriangles;
+};
+
+// Planes of a row vector view * projection matrix (Vulkan clip space, z in 0..w)
+inline CLUSTER_VIEW MakeClusterView(const GW::MATH::GMATRIXF& viewProjection, const GW::MATH::GVECTORF& eye)
+{
+	const GW::MATH::GMATRIXF& m = viewProjection;
+	GW::MATH::GVECTORF column[4];
+	for (int c = 0; c < 4; ++c)
+		column[c] = { m.data[c], m.data[4 + c], m.data[8 + c], m.data[12 + c] };
+	CLUSTER_VIEW view;
+	for (int i = 0; i < 4; ++i) {
+		float sign = i % 2 ? -1.0f : 1.0f; // left, right, bottom, top
+		const GW::MATH::GVECTORF& axis = column[i / 2];
+		view.planes[i] = { column[3].x + sign * axis.x, column[3].y + sign * axis.y,
+						   column[3].z + sign * axis.z, column[3].w + sign * axis.w };
+	}
+	view.planes[4] = column[2]; // near
+	view.planes[5] = { column[3].x - column[2].x, column[3].y - column[2].y,
+					   column[3].z - column[2].z, column[3].w - column[2].w }; // far
+	for (GW::MATH::GVECTORF& p : view.planes) {
+		float length = std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+		if (length > 0) {
+			p.x /= length; p.y /= length; p.z /= length; p.w /= length;
+		}
+	}
+	view.eye = eye;
+	return view;
+}
+
+inline CLUSTER_INSTANCE MakeClusterInstance(const GW::MATH::GMATRIXF& world)
+{
+	const GW::MATH::GMATRIXF& m = world;
+	float x = std::sqrt(m.row1.x * m.row1.x + m.row1.y * m.row1.y + m.row1.z * m.row1.z);
+	float y = std::sqrt(m.row2.x * m.row2.x + m.row2.y * m.row2.y + m.row2.z * m.row2.z);
+	float z = std::sqrt(m.row3.x * m.row3.x + m.row3.y * m.row3.y + m.row3.z * m.row3.z);
+	float determinant =
+		m.row1.x * (m.row2.y * m.row3.z - m.row2.z * m.row3.y) -
+		m.row1.y * (m.row2.x * m.row3.z - m.row2.z * m.row3.x) +
+		m.row1.z * (m.row2.x * m.row3.y - m.row2.y * m.row3.x);
+	CLUSTER_INSTANCE out;
+	out.world = world;
+	out.scale = std::fmax(x, std::fmax(y, z));
+	out.coneTest = determinant > 0 && out.scale - std::fmin(x, std::fmin(y, z)) <= out.scale * 0.01f;
+	return out;
+}
+
+// True when any part of the meshlet may be visible and front facing
+inline bool ClusterVisible(const H2B::MESHLET& meshlet, const CLUSTER_INSTANCE& instance,
+							const CLUSTER_VIEW& view, CLUSTER_CULL_STATS& stats)
+{
+	const GW::MATH::GMATRIXF& m = instance.world;
+	const H2B::VECTOR& c = meshlet.center;
+	float x = c.x * m.row1.x + c.y * m.row2.x + c.z * m.row3.x + m.row4.x;
+	float y = c.x * m.row1.y + c.y * m.row2.y + c.z * m.row3.y + m.row4.y;
+	float z = c.x * m.row1.z + c.y * m.row2.z + c.z * m.row3.z + m.row4.z;
+	float radius = meshlet.radius * instance.scale;
+	++stats.clusters;
+	for (const GW::MATH::GVECTORF& p : view.planes)
+		if (p.x * x + p.y * y + p.z * z + p.w < -radius) {
+			++stats.frustumCulled;
+			return false;
+		}
+	if (instance.coneTest && meshlet.coneCutoff < 1) {
+		const H2B::VECTOR& a = meshlet.coneAxis;
+		float ax = (a.x * m.row1.x + a.y * m.row2.x + a.z * m.row3.x) / instance.scale;
+		float ay = (a.x * m.row1.y + a.y * m.row2.y + a.z * m.row3.y) / instance.scale;
+		float az = (a.x * m.row1.z + a.y * m.row2.z + a.z * m.row3.z) / instance.scale;
+		float dx = x - view.eye.x, dy = y - view.eye.y, dz = z - view.eye.z;
+		if (dx * ax + dy * ay + dz * az >= meshlet.coneCutoff * std::sqrt(dx * dx + dy * dy + dz * dz) + radius) {
+			++stats.backfaceCulled;
+			return false;
+		}
+	}
+	return true;
+}
+
+// Appends the triangles of every surviving meshlet among the count starting at
+// meshlets to out as model local vertex indices, returns how many were added
+inline unsigned CullClusters(const H2B::MESHLET* meshlets, unsigned count,
+							const unsigned* meshletVertices, const unsigned char* meshletTriangles,
+							const CLUSTER_INSTANCE& instance, const CLUSTER_VIEW& view,
+							std::vector<unsigned>& out, CLUSTER_CULL_STATS& stats)
+{
+	size_t before = out.size();
+	for (unsigned i = 0; i < count; ++i) {
+		const H2B::MESHLET& meshlet = meshlets[i];
+		stats.triangles += meshlet.triangleCount;
+		if (!ClusterVisible(meshlet, instance, view, stats))
+			continue;
+		stats.visibleTriangles += meshlet.triangleCount;
+		const unsigned* vertices = meshletVertices + meshlet.vertexOffset;
+		const unsigned char* triangles = meshletTriangles + meshlet.triangleOffset * 3;
+		for (unsigned t = 0; t < meshlet.triangleCount * 3; ++t)
+			out.push_back(vertices[triangles[t]]);
+	}
+	return unsigned(out.size() - before);
+}
+#endif
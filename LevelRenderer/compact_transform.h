@@ -0,0 +1,164 @@
+#ifndef _COMPACT_TRANSFORM_H_
+#define _COMPACT_TRANSFORM_H_
+// 32 byte alternative to a 64 byte GW::MATH::GMATRIXF instance transform.
+//  translation: float3
+//  rotation:    smallest three quaternion, 20 bits per component and 2 bits
+//               for which component was dropped (rotation error under 1e-5 rad)
+//  scale:       float3 per axis, x is negated for mirrored instances
+// Matrices with shear (or a projective column) can not be rebuilt from these,
+// they are flagged with COMPACT_FULL_MATRIX and keep a full matrix elsewhere.
+// BasicVertexShader.hlsl holds the GPU twin of DecodeCompactTransform.
+#include <cmath>
+#include <cstdint>
+
+#define COMPACT_FULL_MATRIX 0x80000000u // set in rotationHi
+
+struct COMPACT_TRANSFORM {
+	float translation[3];
+	uint32_t rotationLo; // a | b << 20
+	float scale[3];
+	uint32_t rotationHi; // b >> 12 | c << 8 | dropped << 28 | COMPACT_FULL_MATRIX
+};
+static_assert(sizeof(COMPACT_TRANSFORM) == 32, "COMPACT_TRANSFORM must stay 32 bytes");
+
+inline GW::MATH::GMATRIXF DecodeCompactTransform(const COMPACT_TRANSFORM& t)
+{
+	const float k = 0.70710678f; // smallest three components stay within +-1/sqrt(2)
+	uint32_t bits[3] = { t.rotationLo & 0xFFFFF, (t.rotationLo >> 20) | ((t.rotationHi & 0xFF) << 12),
+		(t.rotationHi >> 8) & 0xFFFFF };
+	float q[4], sum = 0;
+	unsigned dropped = (t.rotationHi >> 28) & 3;
+	for (unsigned i = 0, j = 0; i < 4; ++i) {
+		if (i == dropped)
+			continue;
+		q[i] = bits[j++] * (2 * k / 1048575.0f) - k;
+		sum += q[i] * q[i];
+	}
+	q[dropped] = std::sqrt(std::fmax(0.0f, 1 - sum));
+	float x = q[0], y = q[1], z = q[2], w = q[3];
+	// rows are the rotated axes (row vectors), scaled per axis
+	GW::MATH::GMATRIXF m;
+	m.row1 = { (1 - 2 * (y * y + z * z)) * t.scale[0], 2 * (x * y + w * z) * t.scale[0], 2 * (x * z - w * y) * t.scale[0], 0 };
+	m.row2 = { 2 * (x * y - w * z) * t.scale[1], (1 - 2 * (x * x + z * z)) * t.scale[1], 2 * (y * z + w * x) * t.scale[1], 0 };
+	m.row3 = { 2 * (x * z + w * y) * t.scale[2], 2 * (y * z - w * x) * t.scale[2], (1 - 2 * (x * x + y * y)) * t.scale[2], 0 };
+	m.row4 = { t.translation[0], t.translation[1], t.translation[2], 1 };
+	return m;
+}
+
+// Returns false (and flags the output COMPACT_FULL_MATRIX) when m has shear, a
+// projective column or a collapsed axis, or when the compact form would move
+// any basis vector by more than tolerance times its length. Flagged outputs
+// still hold the closest TRS, for when no full matrix slot is left.
+inline bool EncodeCompactTransform(const GW::MATH::GMATRIXF& m, COMPACT_TRANSFORM& out, float tolerance = 1e-4f)
+{
+	out = {};
+	out.translation[0] = m.row4.x;
+	out.translation[1] = m.row4.y;
+	out.translation[2] = m.row4.z;
+	bool fits = m.row1.w == 0 && m.row2.w == 0 && m.row3.w == 0 && m.row4.w == 1;
+	float r[3][3] = { { m.row1.x, m.row1.y, m.row1.z }, { m.row2.x, m.row2.y, m.row2.z }, { m.row3.x, m.row3.y, m.row3.z } };
+	for (int i = 0; i < 3; ++i) {
+		out.scale[i] = std::sqrt(r[i][0] * r[i][0] + r[i][1] * r[i][1] + r[i][2] * r[i][2]);
+		if (out.scale[i] == 0) {
+			fits = false; // the shader divides by scale for normals
+			continue;
+		}
+		for (int j = 0; j < 3; ++j)
+			r[i][j] /= out.scale[i];
+	}
+	// a collapsed axis has no direction, complete the basis from the other two
+	for (int i = 0; i < 3; ++i) {
+		if (out.scale[i] != 0)
+			continue;
+		const float* a = r[(i + 1) % 3];
+		const float* b = r[(i + 2) % 3];
+		float n[3] = { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] };
+		float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (length < 1e-6f) { // the others collapsed or parallel too, any axis across what is left
+			const float* u = a[0] * a[0] + a[1] * a[1] + a[2] * a[2] > 0.5f ? a : b;
+			bool any = u[0] * u[0] + u[1] * u[1] + u[2] * u[2] > 0.5f;
+			int axis = 0;
+			for (int j = 1; j < 3 && any; ++j)
+				if (std::fabs(u[j]) < std::fabs(u[axis]))
+					axis = j;
+			float d = any ? u[axis] : 0;
+			for (int j = 0; j < 3; ++j)
+				n[j] = (j == axis ? 1 : 0) - d * (any ? u[j] : 0);
+			length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		}
+		for (int j = 0; j < 3; ++j)
+			r[i][j] = n[j] / length;
+	}
+	// mirrored: flip the first axis so what is left is a proper rotation
+	float det = r[0][0] * (r[1][1] * r[2][2] - r[1][2] * r[2][1]) - r[0][1] * (r[1][0] * r[2][2] - r[1][2] * r[2][0]) +
+		r[0][2] * (r[1][0] * r[2][1] - r[1][1] * r[2][0]);
+	if (det < 0) {
+		out.scale[0] = -out.scale[0];
+		for (int j = 0; j < 3; ++j)
+			r[0][j] = -r[0][j];
+	}
+	// quaternion of the column vector matrix, which is the transpose of r
+	auto c = [&](int i, int j) { return r[j][i]; };
+	float q[4]; // x y z w
+	float trace = c(0, 0) + c(1, 1) + c(2, 2);
+	if (trace > 0) {
+		float s = std::sqrt(trace + 1) * 2;
+		q[3] = s / 4;
+		q[0] = (c(2, 1) - c(1, 2)) / s;
+		q[1] = (c(0, 2) - c(2, 0)) / s;
+		q[2] = (c(1, 0) - c(0, 1)) / s;
+	}
+	else if (c(0, 0) > c(1, 1) && c(0, 0) > c(2, 2)) {
+		float s = std::sqrt(1 + c(0, 0) - c(1, 1) - c(2, 2)) * 2;
+		q[3] = (c(2, 1) - c(1, 2)) / s;
+		q[0] = s / 4;
+		q[1] = (c(0, 1) + c(1, 0)) / s;
+		q[2] = (c(0, 2) + c(2, 0)) / s;
+	}
+	else if (c(1, 1) > c(2, 2)) {
+		float s = std::sqrt(1 + c(1, 1) - c(0, 0) - c(2, 2)) * 2;
+		q[3] = (c(0, 2) - c(2, 0)) / s;
+		q[0] = (c(0, 1) + c(1, 0)) / s;
+		q[1] = s / 4;
+		q[2] = (c(1, 2) + c(2, 1)) / s;
+	}
+	else {
+		float s = std::sqrt(1 + c(2, 2) - c(0, 0) - c(1, 1)) * 2;
+		q[3] = (c(1, 0) - c(0, 1)) / s;
+		q[0] = (c(0, 2) + c(2, 0)) / s;
+		q[1] = (c(1, 2) + c(2, 1)) / s;
+		q[2] = s / 4;
+	}
+	// drop the largest component, the sign of q does not matter so keep it positive
+	unsigned dropped = 0;
+	for (unsigned i = 1; i < 4; ++i)
+		if (std::fabs(q[i]) > std::fabs(q[dropped]))
+			dropped = i;
+	float sign = q[dropped] < 0 ? -1.0f : 1.0f, length = 0;
+	for (unsigned i = 0; i < 4; ++i)
+		length += q[i] * q[i];
+	length = std::sqrt(length);
+	const float k = 0.70710678f;
+	uint32_t bits[3];
+	for (unsigned i = 0, j = 0; i < 4; ++i) {
+		if (i == dropped)
+			continue;
+		float v = std::fmin(std::fmax(sign * q[i] / length, -k), k);
+		bits[j++] = uint32_t(std::lround((v + k) / (2 * k) * 1048575.0f));
+	}
+	out.rotationLo = bits[0] | (bits[1] << 20);
+	out.rotationHi = (bits[1] >> 12) | (bits[2] << 8) | (dropped << 28);
+	// shear leaves the rows non orthogonal, which no rotation reproduces
+	GW::MATH::GMATRIXF decoded = DecodeCompactTransform(out);
+	const GW::MATH::GVECTORF* rows[3] = { &m.row1, &m.row2, &m.row3 };
+	const GW::MATH::GVECTORF* back[3] = { &decoded.row1, &decoded.row2, &decoded.row3 };
+	for (int i = 0; i < 3; ++i) {
+		float dx = rows[i]->x - back[i]->x, dy = rows[i]->y - back[i]->y, dz = rows[i]->z - back[i]->z;
+		if (std::sqrt(dx * dx + dy * dy + dz * dz) > tolerance * std::fabs(out.scale[i]))
+			fits = false;
+	}
+	if (fits == false)
+		out.rotationHi |= COMPACT_FULL_MATRIX;
+	return fits;
+}
+#endif
@@ -0,0 +1,88 @@
+#ifndef _FILE_WATCHER_H_
+#define _FILE_WATCHER_H_
+// Reports files that were written since the last Poll. On Linux the parent
+// directories are watched with inotify so editors that save through a rename
+// are still seen, elsewhere each file's modification time is polled.
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#ifdef __linux__
+	#include <sys/inotify.h>
+	#include <unistd.h>
+	#include <climits>
+#endif
+
+class File_Watcher {
+public:
+	bool Add(const std::string& path) {
+		WATCHED_FILE add;
+		add.path = path;
+		size_t slash = path.find_last_of("/\\");
+		add.folder = slash == std::string::npos ? "." : path.substr(0, slash);
+		add.name = slash == std::string::npos ? path : path.substr(slash + 1);
+		add.modified = ModifiedTime(path);
+#ifdef __linux__
+		if (notify < 0 && (notify = inotify_init1(IN_NONBLOCK)) < 0)
+			return false;
+		add.watch = inotify_add_watch(notify, add.folder.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (add.watch < 0)
+			return false;
+#endif
+		files.push_back(add);
+		return true;
+	}
+	// Appends the registered paths that changed, each at most once per call
+	void Poll(std::vector<std::string>& changed) {
+		std::vector<bool> hit(files.size(), false);
+#ifdef __linux__
+		alignas(inotify_event) char buffer[4096];
+		ssize_t bytes;
+		while (notify >= 0 && (bytes = read(notify, buffer, sizeof(buffer))) > 0)
+			for (char* p = buffer; p < buffer + bytes; p += sizeof(inotify_event) + ((inotify_event*)p)->len) {
+				const inotify_event* e = (const inotify_event*)p;
+				if (e->len == 0)
+					continue;
+				for (unsigned i = 0; i < files.size(); ++i)
+					if (files[i].watch == e->wd && files[i].name == e->name)
+						hit[i] = true;
+			}
+#else
+		for (unsigned i = 0; i < files.size(); ++i) {
+			long long modified = ModifiedTime(files[i].path);
+			if (modified != files[i].modified) {
+				files[i].modified = modified;
+				hit[i] = true;
+			}
+		}
+#endif
+		for (unsigned i = 0; i < files.size(); ++i)
+			if (hit[i])
+				changed.push_back(files[i].path);
+	}
+	void Clear() {
+#ifdef __linux__
+		if (notify >= 0)
+			close(notify);
+		notify = -1;
+#endif
+		files.clear();
+	}
+	~File_Watcher() { Clear(); }
+
+private:
+	struct WATCHED_FILE {
+		std::string path, folder, name;
+		long long modified = 0;
+		int watch = -1;
+	};
+	std::vector<WATCHED_FILE> files;
+#ifdef __linux__
+	int notify = -1;
+#endif
+
+	static long long ModifiedTime(const std::string& path) {
+		struct stat info;
+		return stat(path.c_str(), &info) == 0 ? (long long)info.st_mtime : 0;
+	}
+};
+#endif
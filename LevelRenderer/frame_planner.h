@@ -0,0 +1,239 @@
+#ifndef _FRAME_PLANNER_H_
+#define _FRAME_PLANNER_H_
+// The CPU half of a frame: LOD selection, frustum culling and the draw list,
+// every draw in recording order with the state changes it needs and the world
+// slots it reads. The renderer records the list into its command buffer, the
+// headless benchmark (benchmark.h) runs the same stages without a window or
+// device. Include after load_data_oriented.h.
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "cluster_culling.h"
+#include "profiler.h"
+
+enum DRAW_INDICES : uint8_t { DRAW_INDICES_32, DRAW_INDICES_16, DRAW_INDICES_CLUSTER };
+
+struct PLANNED_DRAW {
+	unsigned model, mesh; // levelModels and levelMeshes index
+	unsigned material; // levelMaterials index, offset by the models before it
+	unsigned firstWorld, instanceCount; // world slots, one instance for cluster draws
+	unsigned firstIndex, indexCount; // in the index buffer of indices
+	int vertexOffset;
+	DRAW_INDICES indices;
+	bool textured;
+	bool gpuCulled; // cluster draw the compute pass fills, indexCount is the most it can get
+	// state changes ahead of the draw; the recorder starts a frame with the
+	// untextured pipeline bound and no index buffer
+	bool bindPipeline, bindTextures, bindIndices;
+};
+struct MODEL_PLACEMENT { // where a model's geometry starts in the bound buffers
+	int vertexOffset;
+	unsigned firstIndex; // in indices of the model's width
+};
+struct PLAN_STATS { // what the last Cull and Build planned
+	unsigned drawCount, instanceCount;
+	unsigned triangleCount, fullDetailTriangleCount; // gpuCulled draws add no triangles
+	unsigned instancesCulled;
+	unsigned pipelineBinds, textureBinds, indexBinds;
+	CLUSTER_CULL_STATS clusters; // clusterMode 1 only
+};
+
+class Frame_Planner {
+public:
+	float lodPixelError = 1.0f; // largest on screen simplification error allowed, in pixels
+	unsigned clusterMode = 1; // 0 draws whole meshes, 1 culls meshlets in Build, 2 leaves them to a compute pass
+	std::vector<bool> clusterCulledModels; // same size as levelModels, set by the caller
+	// per instance, same size as levelTransforms
+	std::vector<unsigned> instanceLods; // chosen level
+	std::vector<bool> instanceVisible; // inside the view frustum, callers may clear more
+	std::vector<float> instancePixels; // screen pixels across the instance's bounds
+	// per levelModels entry when the caller places geometry itself (level
+	// streaming), empty follows the buffers LoadLevel lays out
+	std::vector<MODEL_PLACEMENT> modelPlacements;
+	// the last Build
+	std::vector<PLANNED_DRAW> draws;
+	std::vector<unsigned> worlds; // levelTransforms index of each world slot
+	std::vector<unsigned> clusterIndices; // surviving triangles of clusterMode 1, model local
+	PLAN_STATS stats = {};
+
+	// Sizes the per instance state to level
+	void Reset(const Level_Data& level)
+	{
+		instanceLods.assign(level.levelTransforms.size(), 0);
+		instanceVisible.assign(level.levelTransforms.size(), true);
+		instancePixels.assign(level.levelTransforms.size(), 0.0f);
+		clusterCulledModels.resize(level.levelModels.size(), false);
+	}
+
+	// Marks the models of at least minTriangles that have meshlets for per
+	// instance cluster culling, ~0u marks none
+	void SelectClusterModels(const Level_Data& level, unsigned minTriangles)
+	{
+		clusterCulledModels.assign(level.levelModels.size(), false);
+		if (level.levelMeshletRanges.size() != level.levelMeshes.size())
+			return;
+		for (size_t j = 0; j < level.levelModels.size(); ++j) {
+			const Level_Data::LEVEL_MODEL& model = level.levelModels[j];
+			unsigned triangles = 0;
+			for (unsigned i = model.meshStart; i < model.meshStart + model.meshCount; ++i)
+				triangles += level.levelMeshes[i].drawInfo.indexCount / 3;
+			clusterCulledModels[j] = minTriangles != ~0u && triangles >= minTriangles;
+		}
+	}
+
+	// Picks the coarsest LOD of every instance whose simplification error stays
+	// under lodPixelError once projected to a viewport height pixels tall
+	void SelectLods(const Level_Data& level, const GW::MATH::GMATRIXF& cameraWorld, unsigned height, float fieldOfView)
+	{
+		PROFILE_SCOPE("Select LODs");
+		// pixels covered by one world unit seen from a distance of one
+		float pixelsPerUnit = height / (2 * std::tan(fieldOfView * 0.5f));
+		for (size_t j = 0; j < level.levelInstances.size(); ++j) {
+			const Level_Data::MODEL_INSTANCES& instances = level.levelInstances[j];
+			const Level_Data::LEVEL_MODEL& model = level.levelModels[instances.modelIndex];
+			const H2B::VECTOR& c = model.bounds.center;
+			for (unsigned k = instances.transformStart; k < instances.transformStart + instances.transformCount; ++k) {
+				const GW::MATH::GMATRIXF& m = level.levelTransforms[k];
+				float x = c.x * m.row1.x + c.y * m.row2.x + c.z * m.row3.x + m.row4.x - cameraWorld.row4.x;
+				float y = c.x * m.row1.y + c.y * m.row2.y + c.z * m.row3.y + m.row4.y - cameraWorld.row4.y;
+				float z = c.x * m.row1.z + c.y * m.row2.z + c.z * m.row3.z + m.row4.z - cameraWorld.row4.z;
+				float scale = std::sqrt(std::max({
+					m.row1.x * m.row1.x + m.row1.y * m.row1.y + m.row1.z * m.row1.z,
+					m.row2.x * m.row2.x + m.row2.y * m.row2.y + m.row2.z * m.row2.z,
+					m.row3.x * m.row3.x + m.row3.y * m.row3.y + m.row3.z * m.row3.z }));
+				float distance = std::sqrt(x * x + y * y + z * z) - model.bounds.radius * scale;
+				unsigned lod = 0;
+				if (distance > 0) { // inside the bounds always gets full detail
+					float projected = pixelsPerUnit * scale / distance; // pixels per local unit
+					while (lod + 1 < model.lodCount && model.lodError[lod + 1] * projected <= lodPixelError)
+						++lod;
+				}
+				instanceLods[k] = lod;
+				instancePixels[k] = distance > 0 ? pixelsPerUnit * scale * 2 * model.bounds.radius / distance : 1e9f; // inside wants level 0
+			}
+		}
+	}
+
+	// Marks the instances whose bounds touch view (Level_Data::levelSpatialIndex)
+	void Cull(const Level_Data& level, const CLUSTER_VIEW& view)
+	{
+		PROFILE_SCOPE("Cull");
+		GW::MATH::GPLANEF planes[6];
+		for (int i = 0; i < 6; ++i) // n.p + w >= 0 inside, GPLANEF wants n.p >= distance
+			planes[i] = { view.planes[i].x, view.planes[i].y, view.planes[i].z, -view.planes[i].w };
+		visibleInstances.clear();
+		level.levelSpatialIndex.QueryFrustum(planes, visibleInstances);
+		instanceVisible.assign(level.levelTransforms.size(), false);
+		for (unsigned k : visibleInstances)
+			instanceVisible[k] = true;
+		stats.instancesCulled = unsigned(level.levelTransforms.size() - visibleInstances.size());
+	}
+
+	// Plans the frame's draws from instanceLods and instanceVisible. Instances
+	// of a model are grouped by LOD so each group is one instanced draw per
+	// mesh; full detail groups of clusterCulledModels get a draw per instance.
+	// texturedMaterials (per levelMaterials entry) picks the pipeline.
+	void Build(const Level_Data& level, const std::vector<bool>& texturedMaterials, const CLUSTER_VIEW& view)
+	{
+		PROFILE_SCOPE("Build draw list");
+		unsigned instancesCulled = stats.instancesCulled;
+		stats = {};
+		stats.instancesCulled = instancesCulled;
+		draws.clear();
+		worlds.clear();
+		clusterIndices.clear();
+		bound = PLANNED_DRAW();
+		boundIndices = false;
+		boundTextures = false;
+		unsigned materialOffset = 0, vertexOffset = 0, clusterOutput = 0;
+		for (size_t j = 0; j < level.levelModels.size(); j++) {
+			const Level_Data::MODEL_INSTANCES& instances = level.levelInstances[j];
+			const Level_Data::LEVEL_MODEL& model = level.levelModels[j];
+			MODEL_PLACEMENT placement = { int(vertexOffset), model.gpuIndexStart };
+			if (modelPlacements.size())
+				placement = modelPlacements[j];
+			for (unsigned lod = 0; lod < model.lodCount; ++lod) {
+				unsigned firstWorld = worlds.size();
+				for (unsigned k = instances.transformStart; k < instances.transformStart + instances.transformCount; ++k)
+					if (instanceLods[k] == lod && instanceVisible[k])
+						worlds.push_back(k);
+				unsigned lodInstances = worlds.size() - firstWorld;
+				if (lodInstances == 0)
+					continue;
+				bool clusterCull = lod == 0 && clusterMode && clusterCulledModels[j];
+				for (unsigned i = model.meshStart; i < model.meshStart + model.meshCount; ++i) {
+					// meshes with fewer levels keep using their coarsest one
+					const H2B::LOD& meshLod = level.levelLods[i];
+					const H2B::BATCH& drawInfo = meshLod.levels[std::min(lod, meshLod.levelCount - 1)];
+					PLANNED_DRAW draw = {};
+					draw.model = j;
+					draw.mesh = i;
+					draw.material = level.levelMeshes[i].materialIndex + materialOffset;
+					draw.firstWorld = firstWorld;
+					draw.instanceCount = lodInstances;
+					draw.firstIndex = drawInfo.indexOffset + placement.firstIndex;
+					draw.indexCount = drawInfo.indexCount;
+					draw.vertexOffset = placement.vertexOffset;
+					draw.indices = model.shortIndices ? DRAW_INDICES_16 : DRAW_INDICES_32;
+					draw.textured = draw.material < texturedMaterials.size() && texturedMaterials[draw.material];
+					stats.fullDetailTriangleCount += level.levelMeshes[i].drawInfo.indexCount / 3 * lodInstances;
+					if (clusterCull == false) {
+						Add(draw);
+						continue;
+					}
+					// one draw per instance, each with its own surviving triangles
+					const H2B::MESHLET_RANGE& range = level.levelMeshletRanges[i];
+					draw.indices = DRAW_INDICES_CLUSTER;
+					draw.instanceCount = 1;
+					for (unsigned n = 0; n < lodInstances; ++n) {
+						draw.firstWorld = firstWorld + n;
+						if (clusterMode == 2) { // an empty draw until the compute pass appends the visible triangles
+							draw.firstIndex = clusterOutput;
+							draw.indexCount = level.levelMeshes[i].drawInfo.indexCount;
+							draw.gpuCulled = true;
+							clusterOutput += draw.indexCount;
+							Add(draw);
+							continue;
+						}
+						CLUSTER_INSTANCE instance = MakeClusterInstance(level.levelTransforms[worlds[firstWorld + n]]);
+						draw.firstIndex = clusterIndices.size();
+						draw.indexCount = CullClusters(level.levelMeshlets.data() + range.meshletOffset, range.meshletCount,
+							level.levelMeshletVertices.data(), level.levelMeshletTriangles.data(),
+							instance, view, clusterIndices, stats.clusters);
+						if (draw.indexCount)
+							Add(draw);
+					}
+				}
+				stats.instanceCount += lodInstances;
+			}
+			vertexOffset += model.vertexCount;
+			materialOffset += model.materialCount;
+		}
+	}
+
+private:
+	std::vector<unsigned> visibleInstances; // frustum query results, reused every frame
+	PLANNED_DRAW bound; // state the draws so far left behind
+	bool boundIndices, boundTextures;
+
+	void Add(PLANNED_DRAW& draw)
+	{
+		draw.bindPipeline = draw.textured != bound.textured;
+		// every texture shares one descriptor set, which stays bound across
+		// the two pipelines because their layouts match
+		draw.bindTextures = draw.textured && boundTextures == false;
+		draw.bindIndices = boundIndices == false || draw.indices != bound.indices;
+		stats.pipelineBinds += draw.bindPipeline;
+		stats.textureBinds += draw.bindTextures;
+		stats.indexBinds += draw.bindIndices;
+		boundTextures = boundTextures || draw.textured;
+		boundIndices = true;
+		bound = draw;
+		++stats.drawCount;
+		if (draw.gpuCulled == false)
+			stats.triangleCount += draw.indexCount / 3 * draw.instanceCount;
+		draws.push_back(draw);
+	}
+};
+#endif
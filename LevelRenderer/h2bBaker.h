@@ -0,0 +1,696 @@
+#ifndef _H2BBAKER_H_
+#define _H2BBAKER_H_
+// Offline processing of parsed .h2b data. Everything here works on H2B::Parser
+// contents only (no Gateware, no GPU) so it can run in the H2BBake tool or at
+// load time when a 1.9d file is missing the v2 tables.
+#include "h2bParser.h"
+#include <cmath>
+#include <cfloat>
+#include <map>
+#include <queue>
+#include <tuple>
+#include <algorithm>
+
+namespace H2B {
+
+	// Axis aligned box and bounding sphere of the vertices referenced by one index range
+	inline BOUNDS ComputeBounds(const std::vector<VERTEX>& vertices,
+								const unsigned* indices, unsigned indexCount)
+	{
+		BOUNDS out = { { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX }, { 0, 0, 0 }, 0 };
+		if (indexCount == 0) {
+			out.min = out.max = out.center = { 0, 0, 0 };
+			out.radius = 0;
+			return out;
+		}
+		for (unsigned i = 0; i < indexCount; ++i) {
+			const VECTOR& p = vertices[indices[i]].pos;
+			out.min.x = std::fmin(out.min.x, p.x); out.max.x = std::fmax(out.max.x, p.x);
+			out.min.y = std::fmin(out.min.y, p.y); out.max.y = std::fmax(out.max.y, p.y);
+			out.min.z = std::fmin(out.min.z, p.z); out.max.z = std::fmax(out.max.z, p.z);
+		}
+		// sphere around the box center, tightened to the farthest actual vertex
+		out.center = { (out.min.x + out.max.x) * 0.5f,
+					   (out.min.y + out.max.y) * 0.5f,
+					   (out.min.z + out.max.z) * 0.5f };
+		float radiusSq = 0;
+		for (unsigned i = 0; i < indexCount; ++i) {
+			const VECTOR& p = vertices[indices[i]].pos;
+			float dx = p.x - out.center.x, dy = p.y - out.center.y, dz = p.z - out.center.z;
+			radiusSq = std::fmax(radiusSq, dx * dx + dy * dy + dz * dz);
+		}
+		out.radius = std::sqrt(radiusSq);
+		return out;
+	}
+	// Combines two bounds (used for whole model bounds)
+	inline BOUNDS MergeBounds(const BOUNDS& a, const BOUNDS& b)
+	{
+		BOUNDS out;
+		out.min = { std::fmin(a.min.x, b.min.x), std::fmin(a.min.y, b.min.y), std::fmin(a.min.z, b.min.z) };
+		out.max = { std::fmax(a.max.x, b.max.x), std::fmax(a.max.y, b.max.y), std::fmax(a.max.z, b.max.z) };
+		out.center = { (out.min.x + out.max.x) * 0.5f,
+					   (out.min.y + out.max.y) * 0.5f,
+					   (out.min.z + out.max.z) * 0.5f };
+		// sphere that encloses both input spheres around the new center
+		float dax = a.center.x - out.center.x, day = a.center.y - out.center.y, daz = a.center.z - out.center.z;
+		float dbx = b.center.x - out.center.x, dby = b.center.y - out.center.y, dbz = b.center.z - out.center.z;
+		out.radius = std::fmax(std::sqrt(dax * dax + day * day + daz * daz) + a.radius,
+							   std::sqrt(dbx * dbx + dby * dby + dbz * dbz) + b.radius);
+		return out;
+	}
+	// Fills parser.bounds with one entry per mesh
+	inline void BakeBounds(Parser& p)
+	{
+		p.bounds.resize(p.meshes.size());
+		for (size_t i = 0; i < p.meshes.size(); ++i) {
+			const BATCH& draw = p.meshes[i].drawInfo;
+			p.bounds[i] = ComputeBounds(p.vertices,
+				p.indices.data() + draw.indexOffset, draw.indexCount);
+		}
+		p.extension.flags |= HAS_BOUNDS;
+	}
+
+	// small vector helpers shared by the bake steps
+	inline VECTOR Sub(const VECTOR& a, const VECTOR& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+	inline VECTOR Cross(const VECTOR& a, const VECTOR& b) {
+		return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+	}
+	inline float Dot(const VECTOR& a, const VECTOR& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+	inline VECTOR Normalize(const VECTOR& v) {
+		float len = std::sqrt(Dot(v, v));
+		return len > 0 ? VECTOR{ v.x / len, v.y / len, v.z / len } : VECTOR{ 0, 0, 0 };
+	}
+
+	// Symmetric 4x4 matrix accumulating squared distances to a set of planes
+	struct QUADRIC {
+		double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+		void AddPlane(double a, double b, double c, double d, double w) {
+			a2 += w * a * a; ab += w * a * b; ac += w * a * c; ad += w * a * d;
+			b2 += w * b * b; bc += w * b * c; bd += w * b * d;
+			c2 += w * c * c; cd += w * c * d; d2 += w * d * d;
+		}
+		void Add(const QUADRIC& q) {
+			a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad; b2 += q.b2;
+			bc += q.bc; bd += q.bd; c2 += q.c2; cd += q.cd; d2 += q.d2;
+		}
+		double Error(const VECTOR& v) const {
+			double x = v.x, y = v.y, z = v.z;
+			return	a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x +
+					b2 * y * y + 2 * bc * y * z + 2 * bd * y +
+					c2 * z * z + 2 * cd * z + d2;
+		}
+	};
+
+	// Quadric error edge collapse over one index range.
+	// Collapses happen on position-welded topology so that faceted/seamed meshes
+	// still simplify, each collapse moves a position onto one of its neighbours
+	// (half-edge collapse) so no new vertices are ever created. Simplify() may be
+	// called repeatedly with decreasing targets to produce a chain of LODs.
+	class Simplifier
+	{
+		struct COLLAPSE {
+			double cost;
+			unsigned from, to, fromVersion, toVersion;
+			bool operator<(const COLLAPSE& o) const { return cost > o.cost; } // min heap
+		};
+		const std::vector<VERTEX>& vertices;
+		std::vector<unsigned> cornerVertex; // original vertex of every triangle corner
+		std::vector<unsigned> cornerPosition; // current welded position of every corner
+		std::vector<bool> triangleAlive;
+		std::vector<VECTOR> positions;
+		std::vector<QUADRIC> quadrics;
+		std::vector<std::vector<unsigned>> positionTriangles;
+		std::vector<std::vector<unsigned>> positionVertices; // seam wedges at each position
+		std::vector<unsigned> version;
+		std::vector<bool> positionAlive;
+		std::priority_queue<COLLAPSE> heap;
+		unsigned triangleCount = 0;
+		double maxCost = 0;
+
+		VECTOR TriangleNormal(unsigned t, unsigned moved, const VECTOR& movedTo) const {
+			VECTOR p[3];
+			for (int c = 0; c < 3; ++c) {
+				unsigned pos = cornerPosition[t * 3 + c];
+				p[c] = pos == moved ? movedTo : positions[pos];
+			}
+			return Cross(Sub(p[1], p[0]), Sub(p[2], p[0]));
+		}
+		void PushEdge(unsigned from, unsigned to) {
+			QUADRIC q = quadrics[from];
+			q.Add(quadrics[to]);
+			heap.push({ std::fmax(q.Error(positions[to]), 0.0), from, to, version[from], version[to] });
+		}
+		void PushNeighbours(unsigned pos) {
+			for (unsigned t : positionTriangles[pos]) {
+				if (!triangleAlive[t])
+					continue;
+				for (int c = 0; c < 3; ++c) {
+					unsigned other = cornerPosition[t * 3 + c];
+					if (other != pos) {
+						PushEdge(pos, other);
+						PushEdge(other, pos);
+					}
+				}
+			}
+		}
+		// rejects collapses that would fold a surviving triangle over
+		bool Flips(unsigned from, unsigned to) const {
+			for (unsigned t : positionTriangles[from]) {
+				if (!triangleAlive[t])
+					continue;
+				bool shared = false;
+				for (int c = 0; c < 3; ++c)
+					shared |= cornerPosition[t * 3 + c] == to;
+				if (shared)
+					continue; // this triangle disappears
+				VECTOR before = Normalize(TriangleNormal(t, ~0u, positions[from]));
+				VECTOR after = Normalize(TriangleNormal(t, from, positions[to]));
+				if (Dot(before, after) < 0.2f)
+					return true;
+			}
+			return false;
+		}
+	public:
+		Simplifier(const std::vector<VERTEX>& _vertices, const unsigned* indices, unsigned indexCount)
+			: vertices(_vertices)
+		{
+			// weld identical positions
+			std::map<std::tuple<float, float, float>, unsigned> weld;
+			triangleCount = indexCount / 3;
+			cornerVertex.assign(indices, indices + triangleCount * 3);
+			cornerPosition.resize(cornerVertex.size());
+			std::map<unsigned, unsigned> vertexPosition;
+			for (size_t i = 0; i < cornerVertex.size(); ++i) {
+				const VECTOR& v = vertices[cornerVertex[i]].pos;
+				auto found = weld.insert({ std::make_tuple(v.x, v.y, v.z), unsigned(positions.size()) });
+				if (found.second) {
+					positions.push_back(v);
+					positionVertices.emplace_back();
+				}
+				cornerPosition[i] = found.first->second;
+				if (vertexPosition.insert({ cornerVertex[i], cornerPosition[i] }).second)
+					positionVertices[cornerPosition[i]].push_back(cornerVertex[i]);
+			}
+			quadrics.resize(positions.size());
+			positionTriangles.resize(positions.size());
+			version.assign(positions.size(), 0);
+			positionAlive.assign(positions.size(), true);
+			triangleAlive.assign(triangleCount, true);
+			// plane quadrics for every face, edge use counts to find open borders
+			std::map<std::pair<unsigned, unsigned>, unsigned> edgeUse;
+			for (unsigned t = 0; t < triangleAlive.size(); ++t) {
+				unsigned* c = &cornerPosition[t * 3];
+				if (c[0] == c[1] || c[1] == c[2] || c[2] == c[0]) {
+					triangleAlive[t] = false; // degenerate in welded space
+					--triangleCount;
+					continue;
+				}
+				VECTOR n = Normalize(TriangleNormal(t, ~0u, positions[0]));
+				double d = -Dot(n, positions[c[0]]);
+				for (int k = 0; k < 3; ++k) {
+					quadrics[c[k]].AddPlane(n.x, n.y, n.z, d, 1.0);
+					positionTriangles[c[k]].push_back(t);
+					unsigned a = c[k], b = c[(k + 1) % 3];
+					++edgeUse[{ std::min(a, b), std::max(a, b) }];
+				}
+			}
+			// open borders get a heavily weighted plane perpendicular to their face
+			for (unsigned t = 0; t < triangleAlive.size(); ++t) {
+				if (!triangleAlive[t])
+					continue;
+				unsigned* c = &cornerPosition[t * 3];
+				VECTOR n = Normalize(TriangleNormal(t, ~0u, positions[0]));
+				for (int k = 0; k < 3; ++k) {
+					unsigned a = c[k], b = c[(k + 1) % 3];
+					if (edgeUse[{ std::min(a, b), std::max(a, b) }] != 1)
+						continue;
+					VECTOR border = Normalize(Cross(Sub(positions[b], positions[a]), n));
+					double d = -Dot(border, positions[a]);
+					quadrics[a].AddPlane(border.x, border.y, border.z, d, 10.0);
+					quadrics[b].AddPlane(border.x, border.y, border.z, d, 10.0);
+				}
+			}
+			for (unsigned p = 0; p < positions.size(); ++p)
+				PushNeighbours(p);
+		}
+		unsigned TriangleCount() const { return triangleCount; }
+		// approximate object space deviation of the current result
+		float Error() const { return float(std::sqrt(maxCost)); }
+
+		void Simplify(unsigned targetTriangles)
+		{
+			while (triangleCount > targetTriangles && !heap.empty()) {
+				COLLAPSE e = heap.top();
+				heap.pop();
+				if (!positionAlive[e.from] || !positionAlive[e.to] ||
+					version[e.from] != e.fromVersion || version[e.to] != e.toVersion)
+					continue; // stale entry
+				if (Flips(e.from, e.to))
+					continue;
+				for (unsigned t : positionTriangles[e.from]) {
+					if (!triangleAlive[t])
+						continue;
+					unsigned* c = &cornerPosition[t * 3];
+					if (c[0] == e.to || c[1] == e.to || c[2] == e.to) {
+						triangleAlive[t] = false;
+						--triangleCount;
+						continue;
+					}
+					for (int k = 0; k < 3; ++k)
+						if (c[k] == e.from)
+							c[k] = e.to;
+					positionTriangles[e.to].push_back(t);
+				}
+				positionTriangles[e.from].clear();
+				positionAlive[e.from] = false;
+				quadrics[e.to].Add(quadrics[e.from]);
+				++version[e.to];
+				maxCost = std::fmax(maxCost, e.cost);
+				PushNeighbours(e.to);
+			}
+		}
+		// Appends the surviving triangles as vertex indices. A corner whose position
+		// moved picks the wedge at its new position with the closest uv and normal.
+		void Emit(std::vector<unsigned>& out) const
+		{
+			for (unsigned t = 0; t < triangleAlive.size(); ++t) {
+				if (!triangleAlive[t])
+					continue;
+				for (int c = 0; c < 3; ++c) {
+					unsigned original = cornerVertex[t * 3 + c];
+					const std::vector<unsigned>& wedges = positionVertices[cornerPosition[t * 3 + c]];
+					unsigned best = wedges[0];
+					float bestDistance = FLT_MAX;
+					for (unsigned w : wedges) {
+						if (w == original) {
+							best = w;
+							break;
+						}
+						const VERTEX& a = vertices[original];
+						const VERTEX& b = vertices[w];
+						VECTOR du = Sub(a.uvw, b.uvw), dn = Sub(a.nrm, b.nrm);
+						float distance = Dot(du, du) + Dot(dn, dn);
+						if (distance < bestDistance) {
+							bestDistance = distance;
+							best = w;
+						}
+					}
+					out.push_back(best);
+				}
+			}
+		}
+	};
+
+	// Builds up to levelCount LODs per mesh, each targeting half the triangles of
+	// the previous one. Level 0 is the mesh itself, generated indices go to lodIndices.
+	inline void BakeLods(Parser& p, unsigned levelCount = H2B_MAX_LODS)
+	{
+		levelCount = std::min(std::max(levelCount, 1u), unsigned(H2B_MAX_LODS));
+		p.lods.assign(p.meshes.size(), LOD());
+		p.lodIndices.clear();
+		std::vector<unsigned> generated;
+		for (size_t i = 0; i < p.meshes.size(); ++i) {
+			const BATCH& draw = p.meshes[i].drawInfo;
+			LOD& lod = p.lods[i];
+			lod.levelCount = 1;
+			lod.levels[0] = draw;
+			lod.error[0] = 0;
+			Simplifier simplifier(p.vertices, p.indices.data() + draw.indexOffset, draw.indexCount);
+			unsigned previous = draw.indexCount / 3;
+			for (unsigned level = 1; level < levelCount; ++level) {
+				simplifier.Simplify(previous / 2);
+				// stop once the simplifier can no longer make meaningful progress
+				if (simplifier.TriangleCount() == 0 || simplifier.TriangleCount() * 10 > previous * 9)
+					break;
+				generated.clear();
+				simplifier.Emit(generated);
+				lod.levels[level].indexCount = generated.size();
+				lod.levels[level].indexOffset = p.indices.size() + p.lodIndices.size();
+				lod.error[level] = simplifier.Error();
+				p.lodIndices.insert(p.lodIndices.end(), generated.begin(), generated.end());
+				previous = simplifier.TriangleCount();
+				lod.levelCount = level + 1;
+			}
+		}
+		p.extension.flags |= HAS_LODS;
+	}
+
+	// Post-transform cache efficiency of an index stream, simulated with a FIFO cache
+	struct VCACHE_STATS {
+		unsigned triangles, vertices, misses; // vertices counts unique references
+		float ACMR() const { return triangles ? float(misses) / triangles : 0; } // misses per triangle
+		float ATVR() const { return vertices ? float(misses) / vertices : 0; } // 1.0 is optimal
+	};
+	inline void AnalyzeVertexCache(const unsigned* indices, unsigned indexCount, unsigned vertexCount,
+									VCACHE_STATS& stats, unsigned cacheSize = 16)
+	{
+		// a vertex is resident while fewer than cacheSize misses happened since it was loaded
+		std::vector<unsigned> loadedAt(vertexCount, 0);
+		std::vector<bool> referenced(vertexCount, false);
+		unsigned time = cacheSize + 1;
+		for (unsigned i = 0; i < indexCount - indexCount % 3; ++i) {
+			unsigned v = indices[i];
+			if (!referenced[v]) {
+				referenced[v] = true;
+				++stats.vertices;
+			}
+			if (time - loadedAt[v] > cacheSize) {
+				loadedAt[v] = time++;
+				++stats.misses;
+			}
+		}
+		stats.triangles += indexCount / 3;
+	}
+	// Cache statistics of everything a model draws at full detail
+	inline VCACHE_STATS AnalyzeVertexCache(const Parser& p, unsigned cacheSize = 16)
+	{
+		VCACHE_STATS stats = {};
+		for (const MESH& mesh : p.meshes)
+			AnalyzeVertexCache(p.indices.data() + mesh.drawInfo.indexOffset, mesh.drawInfo.indexCount,
+				p.vertices.size(), stats, cacheSize);
+		return stats;
+	}
+
+	// Forsyth's linear-speed vertex cache optimization, reorders triangles in place
+	inline void OptimizeVertexCache(unsigned* indices, unsigned indexCount, unsigned vertexCount)
+	{
+		const int cacheSize = 32;
+		unsigned triangleCount = indexCount / 3;
+		if (triangleCount < 2)
+			return;
+		// compact the referenced vertices and build vertex to triangle adjacency
+		std::vector<unsigned> local(vertexCount, ~0u), corners(triangleCount * 3), remaining;
+		for (unsigned i = 0; i < triangleCount * 3; ++i) {
+			unsigned& l = local[indices[i]];
+			if (l == ~0u) {
+				l = remaining.size();
+				remaining.push_back(0);
+			}
+			corners[i] = l;
+			++remaining[l];
+		}
+		std::vector<unsigned> adjacencyStart(remaining.size() + 1, 0), adjacency(triangleCount * 3);
+		for (size_t v = 0; v < remaining.size(); ++v)
+			adjacencyStart[v + 1] = adjacencyStart[v] + remaining[v];
+		std::vector<unsigned> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+		for (unsigned i = 0; i < triangleCount * 3; ++i)
+			adjacency[fill[corners[i]]++] = i / 3;
+
+		std::vector<int> cachePosition(remaining.size(), -1);
+		std::vector<float> vertexScore(remaining.size()), triangleScore(triangleCount);
+		std::vector<bool> emitted(triangleCount, false);
+		auto score = [&](unsigned v) {
+			if (remaining[v] == 0)
+				return -1.0f;
+			float s = 0;
+			int position = cachePosition[v];
+			if (position >= 0) // the last triangle's vertices get a fixed score
+				s = position < 3 ? 0.75f : std::pow(1.0f - (position - 3) / float(cacheSize - 3), 1.5f);
+			return s + 2.0f / std::sqrt(float(remaining[v])); // favour finishing off vertices
+		};
+		for (size_t v = 0; v < remaining.size(); ++v)
+			vertexScore[v] = score(v);
+		int best = 0;
+		for (unsigned t = 0; t < triangleCount; ++t) {
+			triangleScore[t] = vertexScore[corners[t * 3]] + vertexScore[corners[t * 3 + 1]] + vertexScore[corners[t * 3 + 2]];
+			if (triangleScore[t] > triangleScore[best])
+				best = t;
+		}
+		std::vector<unsigned> cache, grown, output;
+		output.reserve(triangleCount * 3);
+		unsigned cursor = 0;
+		for (unsigned count = 0; count < triangleCount; ++count) {
+			if (best < 0) { // nothing in the cache has work left, take the next unemitted triangle
+				while (emitted[cursor])
+					++cursor;
+				best = cursor;
+			}
+			emitted[best] = true;
+			grown.clear();
+			for (int c = 0; c < 3; ++c) {
+				unsigned v = corners[best * 3 + c];
+				output.push_back(indices[best * 3 + c]);
+				grown.push_back(v);
+				// remove the triangle from the vertex's live adjacency
+				unsigned* live = &adjacency[adjacencyStart[v]];
+				for (unsigned k = 0; k < remaining[v]; ++k)
+					if (live[k] == unsigned(best)) {
+						std::swap(live[k], live[remaining[v] - 1]);
+						break;
+					}
+				--remaining[v];
+			}
+			for (unsigned v : cache)
+				if (v != grown[0] && v != grown[1] && v != grown[2])
+					grown.push_back(v);
+			cache.assign(grown.begin(), grown.begin() + std::min<size_t>(grown.size(), cacheSize));
+			for (size_t i = 0; i < grown.size(); ++i) {
+				cachePosition[grown[i]] = i < cacheSize ? int(i) : -1;
+				vertexScore[grown[i]] = score(grown[i]);
+			}
+			// rescore triangles touching anything that moved and pick the best one
+			best = -1;
+			float bestScore = -1;
+			for (unsigned v : grown)
+				for (unsigned k = 0; k < remaining[v]; ++k) {
+					unsigned t = adjacency[adjacencyStart[v] + k];
+					triangleScore[t] = vertexScore[corners[t * 3]] + vertexScore[corners[t * 3 + 1]] + vertexScore[corners[t * 3 + 2]];
+					if (triangleScore[t] > bestScore) {
+						bestScore = triangleScore[t];
+						best = t;
+					}
+				}
+		}
+		std::copy(output.begin(), output.end(), indices);
+	}
+
+	// Overdraw ordering (Sander et al. 2007): cuts the cache optimized stream into
+	// clusters where the simulated cache starts over, then draws the most outward
+	// facing clusters first. Triangles keep their winding, the cache order inside
+	// each cluster is kept, and the result is dropped if ACMR grows past threshold.
+	inline void OptimizeOverdraw(const std::vector<VERTEX>& vertices, unsigned* indices, unsigned indexCount,
+									float threshold = 1.05f)
+	{
+		const unsigned cacheSize = 16;
+		unsigned triangleCount = indexCount / 3;
+		if (triangleCount < 2)
+			return;
+		std::vector<unsigned> starts;
+		std::vector<unsigned> loadedAt(vertices.size(), 0);
+		unsigned time = cacheSize + 1;
+		for (unsigned t = 0; t < triangleCount; ++t) {
+			unsigned misses = 0;
+			for (int c = 0; c < 3; ++c) {
+				unsigned v = indices[t * 3 + c];
+				if (time - loadedAt[v] > cacheSize) {
+					loadedAt[v] = time++;
+					++misses;
+				}
+			}
+			if (t == 0 || misses == 3)
+				starts.push_back(t);
+		}
+		if (starts.size() < 2)
+			return;
+		starts.push_back(triangleCount);
+		// area weighted centroids and normals
+		struct CLUSTER { float sortKey; unsigned start, end; };
+		std::vector<CLUSTER> clusters;
+		std::vector<VECTOR> centroids, normals;
+		VECTOR meshCentroid = { 0, 0, 0 };
+		float meshArea = 0;
+		for (size_t k = 0; k + 1 < starts.size(); ++k) {
+			VECTOR centroid = { 0, 0, 0 }, normal = { 0, 0, 0 };
+			float area = 0;
+			for (unsigned t = starts[k]; t < starts[k + 1]; ++t) {
+				const VECTOR& a = vertices[indices[t * 3]].pos;
+				const VECTOR& b = vertices[indices[t * 3 + 1]].pos;
+				const VECTOR& c = vertices[indices[t * 3 + 2]].pos;
+				VECTOR n = { (b.y - a.y) * (c.z - a.z) - (b.z - a.z) * (c.y - a.y),
+							 (b.z - a.z) * (c.x - a.x) - (b.x - a.x) * (c.z - a.z),
+							 (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x) };
+				float w = std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z) * 0.5f;
+				centroid.x += w * (a.x + b.x + c.x) / 3;
+				centroid.y += w * (a.y + b.y + c.y) / 3;
+				centroid.z += w * (a.z + b.z + c.z) / 3;
+				normal.x += n.x; normal.y += n.y; normal.z += n.z;
+				area += w;
+			}
+			meshCentroid.x += centroid.x; meshCentroid.y += centroid.y; meshCentroid.z += centroid.z;
+			meshArea += area;
+			if (area > 0) {
+				centroid.x /= area; centroid.y /= area; centroid.z /= area;
+			}
+			centroids.push_back(centroid);
+			normals.push_back(normal);
+			clusters.push_back({ 0, starts[k], starts[k + 1] });
+		}
+		if (meshArea > 0) {
+			meshCentroid.x /= meshArea; meshCentroid.y /= meshArea; meshCentroid.z /= meshArea;
+		}
+		for (size_t k = 0; k < clusters.size(); ++k) {
+			const VECTOR& c = centroids[k];
+			const VECTOR& n = normals[k];
+			float length = std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+			clusters[k].sortKey = length > 0 ? ((c.x - meshCentroid.x) * n.x +
+				(c.y - meshCentroid.y) * n.y + (c.z - meshCentroid.z) * n.z) / length : 0;
+		}
+		std::stable_sort(clusters.begin(), clusters.end(),
+			[](const CLUSTER& a, const CLUSTER& b) { return a.sortKey > b.sortKey; });
+		std::vector<unsigned> sorted;
+		sorted.reserve(triangleCount * 3);
+		for (const CLUSTER& cluster : clusters)
+			sorted.insert(sorted.end(), indices + cluster.start * 3, indices + cluster.end * 3);
+		VCACHE_STATS before = {}, after = {};
+		AnalyzeVertexCache(indices, triangleCount * 3, vertices.size(), before);
+		AnalyzeVertexCache(sorted.data(), sorted.size(), vertices.size(), after);
+		if (after.ACMR() <= before.ACMR() * threshold)
+			std::copy(sorted.begin(), sorted.end(), indices);
+	}
+
+	// Renumbers vertices in the order they are first referenced so vertex fetches
+	// walk memory linearly. Every index table is rewritten, unused vertices move last.
+	inline void OptimizeVertexFetch(Parser& p)
+	{
+		std::vector<unsigned> remap(p.vertices.size(), ~0u);
+		unsigned next = 0;
+		auto visit = [&](unsigned& v) {
+			if (remap[v] == ~0u)
+				remap[v] = next++;
+			v = remap[v];
+		};
+		for (unsigned& v : p.indices) visit(v);
+		for (unsigned& v : p.lodIndices) visit(v);
+		for (unsigned& v : p.meshletVertices) visit(v);
+		std::vector<VERTEX> reordered(p.vertices.size());
+		for (size_t v = 0; v < p.vertices.size(); ++v) {
+			if (remap[v] == ~0u)
+				remap[v] = next++;
+			reordered[remap[v]] = p.vertices[v];
+		}
+		p.vertices.swap(reordered);
+	}
+
+	// Cache, overdraw and fetch optimization of every draw range in a model.
+	// Ranges are split wherever any batch, mesh or LOD range begins or ends so
+	// every one of them still draws exactly the same set of triangles.
+	inline void BakeVertexCache(Parser& p)
+	{
+		std::vector<unsigned> all(p.indices);
+		all.insert(all.end(), p.lodIndices.begin(), p.lodIndices.end());
+		std::set<unsigned> cuts = { 0, unsigned(p.indices.size()), unsigned(all.size()) };
+		auto cut = [&](const BATCH& b) {
+			cuts.insert(b.indexOffset);
+			cuts.insert(b.indexOffset + b.indexCount);
+		};
+		for (const BATCH& b : p.batches) cut(b);
+		for (const MESH& m : p.meshes) cut(m.drawInfo);
+		for (const LOD& lod : p.lods)
+			for (unsigned l = 0; l < lod.levelCount; ++l)
+				cut(lod.levels[l]);
+		for (auto a = cuts.begin(), b = std::next(a); b != cuts.end(); ++a, ++b) {
+			if (*b > all.size() || *a % 3 || *b % 3)
+				continue; // malformed range, leave it alone
+			OptimizeVertexCache(all.data() + *a, *b - *a, p.vertices.size());
+			OptimizeOverdraw(p.vertices, all.data() + *a, *b - *a);
+		}
+		std::copy(all.begin(), all.begin() + p.indices.size(), p.indices.begin());
+		std::copy(all.begin() + p.indices.size(), all.end(), p.lodIndices.begin());
+		OptimizeVertexFetch(p);
+		p.extension.flags |= VCACHE_OPTIMIZED;
+	}
+
+	// Splits every mesh's full detail range into meshlets of at most maxVertices
+	// vertices and maxTriangles triangles. Triangles are taken in index order, so
+	// running BakeVertexCache first gives meshlets that are spatially compact.
+	// Each meshlet gets a bounding sphere and a cone around its face normals that
+	// lets a whole cluster be rejected when it faces away from the camera.
+	inline void BakeMeshlets(Parser& p, unsigned maxVertices = 64, unsigned maxTriangles = 124)
+	{
+		maxVertices = std::min(std::max(maxVertices, 3u), 256u); // local indices are bytes
+		maxTriangles = std::max(maxTriangles, 1u);
+		p.meshletRanges.assign(p.meshes.size(), MESHLET_RANGE());
+		p.meshlets.clear();
+		p.meshletVertices.clear();
+		p.meshletTriangles.clear();
+		std::vector<int> local(p.vertices.size(), -1);
+		auto finish = [&](MESHLET& m, float facing) {
+			BOUNDS b = ComputeBounds(p.vertices, p.meshletVertices.data() + m.vertexOffset, m.vertexCount);
+			m.center = b.center;
+			m.radius = b.radius;
+			// outward face normals, the cone axis is their normalized average
+			std::vector<VECTOR> normals;
+			VECTOR axis = { 0, 0, 0 };
+			for (unsigned t = 0; t < m.triangleCount; ++t) {
+				const unsigned char* c = &p.meshletTriangles[(m.triangleOffset + t) * 3];
+				const VECTOR& a = p.vertices[p.meshletVertices[m.vertexOffset + c[0]]].pos;
+				const VECTOR& b = p.vertices[p.meshletVertices[m.vertexOffset + c[1]]].pos;
+				const VECTOR& d = p.vertices[p.meshletVertices[m.vertexOffset + c[2]]].pos;
+				VECTOR n = Normalize(Cross(Sub(b, a), Sub(d, a)));
+				if (n.x == 0 && n.y == 0 && n.z == 0)
+					continue; // degenerate triangles never rasterize
+				n = { n.x * facing, n.y * facing, n.z * facing };
+				normals.push_back(n);
+				axis = { axis.x + n.x, axis.y + n.y, axis.z + n.z };
+			}
+			axis = Normalize(axis);
+			float minDot = normals.empty() ? -1.0f : 1.0f;
+			for (const VECTOR& n : normals)
+				minDot = std::fmin(minDot, Dot(n, axis));
+			m.coneAxis = axis;
+			// the cluster is backfacing when the view direction is inside the cone
+			// of directions that sees every face from behind, disabled past 90 degrees
+			m.coneCutoff = minDot <= 0 ? 1.0f : std::sqrt(1 - minDot * minDot);
+			for (unsigned v = 0; v < m.vertexCount; ++v)
+				local[p.meshletVertices[m.vertexOffset + v]] = -1;
+			p.meshlets.push_back(m);
+		};
+		for (size_t i = 0; i < p.meshes.size(); ++i) {
+			const BATCH& draw = p.meshes[i].drawInfo;
+			const unsigned* indices = p.indices.data() + draw.indexOffset;
+			unsigned triangleCount = draw.indexCount / 3;
+			// which way the winding faces, judged against the authored vertex normals
+			float facing = 0;
+			for (unsigned t = 0; t < triangleCount; ++t) {
+				const VERTEX& a = p.vertices[indices[t * 3]];
+				const VERTEX& b = p.vertices[indices[t * 3 + 1]];
+				const VERTEX& c = p.vertices[indices[t * 3 + 2]];
+				VECTOR n = Cross(Sub(b.pos, a.pos), Sub(c.pos, a.pos));
+				VECTOR vn = { a.nrm.x + b.nrm.x + c.nrm.x, a.nrm.y + b.nrm.y + c.nrm.y, a.nrm.z + b.nrm.z + c.nrm.z };
+				facing += Dot(Normalize(n), vn);
+			}
+			facing = facing < 0 ? -1.0f : 1.0f;
+			p.meshletRanges[i].meshletOffset = p.meshlets.size();
+			MESHLET m = {};
+			m.vertexOffset = p.meshletVertices.size();
+			m.triangleOffset = p.meshletTriangles.size() / 3;
+			for (unsigned t = 0; t < triangleCount; ++t) {
+				const unsigned* tri = indices + t * 3;
+				unsigned added = 0;
+				for (int c = 0; c < 3; ++c)
+					if (local[tri[c]] < 0 && (c < 1 || tri[c] != tri[0]) && (c < 2 || tri[c] != tri[1]))
+						++added;
+				if (m.vertexCount + added > maxVertices || m.triangleCount == maxTriangles) {
+					finish(m, facing);
+					m = {};
+					m.vertexOffset = p.meshletVertices.size();
+					m.triangleOffset = p.meshletTriangles.size() / 3;
+				}
+				for (int c = 0; c < 3; ++c) {
+					int& l = local[tri[c]];
+					if (l < 0) {
+						l = m.vertexCount++;
+						p.meshletVertices.push_back(tri[c]);
+					}
+					p.meshletTriangles.push_back((unsigned char)l);
+				}
+				++m.triangleCount;
+			}
+			if (m.triangleCount)
+				finish(m, facing);
+			p.meshletRanges[i].meshletCount = p.meshlets.size() - p.meshletRanges[i].meshletOffset;
+		}
+		p.extension.flags |= HAS_MESHLETS;
+	}
+}
+#endif
@@ -0,0 +1,158 @@
+#ifndef _H2BPACKED_H_
+#define _H2BPACKED_H_
+// Compact 16 byte alternative to the 36 byte H2B::VERTEX used for GPU upload.
+//  pos: 16 bit unorm per axis relative to the model's bounding box (w unused)
+//  nrm: octahedral encoded unit normal, 16 bit snorm per component
+//  uv:  half floats (w of uvw is dropped, Obj2Header never fills it)
+// Worst case errors for a box of extent E: position E / 131070 per axis,
+// normal about 0.04 degrees, uv 2^-11 relative (0.00049 at uv 1.0).
+#include "h2bParser.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace H2B {
+
+#pragma pack(push,1)
+	struct PACKED_VERTEX {
+		uint16_t pos[4];
+		int16_t nrm[2];
+		uint16_t uv[2];
+	};
+#pragma pack(pop)
+	static_assert(sizeof(PACKED_VERTEX) == 16, "PACKED_VERTEX must stay 16 bytes");
+
+	// IEEE half conversion, rounds to nearest even and keeps inf/nan/denormals
+	inline uint16_t FloatToHalf(float f)
+	{
+		uint32_t x;
+		std::memcpy(&x, &f, 4);
+		uint16_t sign = (x >> 16) & 0x8000;
+		uint32_t exponent = (x >> 23) & 0xFF, mantissa = x & 0x7FFFFF;
+		if (exponent == 0xFF) // inf or nan
+			return sign | 0x7C00 | (mantissa ? 0x200 : 0);
+		int e = int(exponent) - 127 + 15;
+		if (e >= 31) // overflow
+			return sign | 0x7C00;
+		if (e <= 0) { // denormal or zero
+			if (e < -10)
+				return sign;
+			mantissa |= 0x800000;
+			int shift = 14 - e;
+			uint32_t half = mantissa >> shift, rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+			if (rest > halfway || (rest == halfway && (half & 1)))
+				++half;
+			return sign | half;
+		}
+		uint32_t half = (e << 10) | (mantissa >> 13), rest = mantissa & 0x1FFF;
+		if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+			++half; // may carry into the exponent, which is still correct
+		return sign | half;
+	}
+	inline float HalfToFloat(uint16_t h)
+	{
+		uint32_t sign = uint32_t(h & 0x8000) << 16, exponent = (h >> 10) & 0x1F, mantissa = h & 0x3FF, x;
+		if (exponent == 0) {
+			if (mantissa == 0)
+				x = sign;
+			else { // renormalize
+				exponent = 127 - 15 + 1;
+				while ((mantissa & 0x400) == 0) {
+					mantissa <<= 1;
+					--exponent;
+				}
+				x = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+			}
+		}
+		else if (exponent == 31)
+			x = sign | 0x7F800000 | (mantissa << 13);
+		else
+			x = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+		float f;
+		std::memcpy(&f, &x, 4);
+		return f;
+	}
+
+	inline void EncodeOctahedral(const VECTOR& n, int16_t out[2])
+	{
+		float sum = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+		float x = sum > 0 ? n.x / sum : 0, y = sum > 0 ? n.y / sum : 0;
+		if (sum > 0 && n.z < 0) { // fold the lower hemisphere over the diagonals
+			float fx = (1 - std::fabs(y)) * (x >= 0 ? 1 : -1);
+			float fy = (1 - std::fabs(x)) * (y >= 0 ? 1 : -1);
+			x = fx; y = fy;
+		}
+		out[0] = int16_t(std::lround(std::fmax(-1.0f, std::fmin(1.0f, x)) * 32767));
+		out[1] = int16_t(std::lround(std::fmax(-1.0f, std::fmin(1.0f, y)) * 32767));
+	}
+	inline VECTOR DecodeOctahedral(const int16_t in[2])
+	{
+		// mirrors the decode in BasicVertexShader.hlsl
+		VECTOR n = { std::fmax(in[0] / 32767.0f, -1.0f), std::fmax(in[1] / 32767.0f, -1.0f), 0 };
+		n.z = 1 - std::fabs(n.x) - std::fabs(n.y);
+		float t = std::fmax(-n.z, 0.0f);
+		n.x += n.x >= 0 ? -t : t;
+		n.y += n.y >= 0 ? -t : t;
+		float length = std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+		return { n.x / length, n.y / length, n.z / length };
+	}
+
+	// boxMin/boxExtent describe the model's bounding box, positions outside are clamped
+	inline PACKED_VERTEX PackVertex(const VERTEX& v, const VECTOR& boxMin, const VECTOR& boxExtent)
+	{
+		PACKED_VERTEX out;
+		const float* p = &v.pos.x;
+		const float* lo = &boxMin.x;
+		const float* extent = &boxExtent.x;
+		for (int i = 0; i < 3; ++i) {
+			float t = extent[i] > 0 ? (p[i] - lo[i]) / extent[i] : 0;
+			out.pos[i] = uint16_t(std::lround(std::fmax(0.0f, std::fmin(1.0f, t)) * 65535));
+		}
+		out.pos[3] = 0;
+		EncodeOctahedral(v.nrm, out.nrm);
+		out.uv[0] = FloatToHalf(v.uvw.x);
+		out.uv[1] = FloatToHalf(v.uvw.y);
+		return out;
+	}
+	inline VERTEX UnpackVertex(const PACKED_VERTEX& v, const VECTOR& boxMin, const VECTOR& boxExtent)
+	{
+		VERTEX out;
+		out.pos = { boxMin.x + v.pos[0] / 65535.0f * boxExtent.x,
+					boxMin.y + v.pos[1] / 65535.0f * boxExtent.y,
+					boxMin.z + v.pos[2] / 65535.0f * boxExtent.z };
+		out.nrm = DecodeOctahedral(v.nrm);
+		out.uvw = { HalfToFloat(v.uv[0]), HalfToFloat(v.uv[1]), 0 };
+		return out;
+	}
+
+	// Largest round trip errors seen while packing, for load time reporting
+	struct PACKING_ERROR {
+		float position; // model units, largest per axis difference
+		float normalDegrees;
+		float uv;
+	};
+	inline void PackVertices(const VERTEX* vertices, unsigned count, const VECTOR& boxMin,
+								const VECTOR& boxMax, std::vector<PACKED_VERTEX>& out, PACKING_ERROR& error)
+	{
+		VECTOR extent = { boxMax.x - boxMin.x, boxMax.y - boxMin.y, boxMax.z - boxMin.z };
+		for (unsigned i = 0; i < count; ++i) {
+			const VERTEX& v = vertices[i];
+			out.push_back(PackVertex(v, boxMin, extent));
+			VERTEX r = UnpackVertex(out.back(), boxMin, extent);
+			error.position = std::fmax(error.position, std::fmax(std::fabs(r.pos.x - v.pos.x),
+				std::fmax(std::fabs(r.pos.y - v.pos.y), std::fabs(r.pos.z - v.pos.z))));
+			if (v.nrm.x != 0 || v.nrm.y != 0 || v.nrm.z != 0) {
+				// atan2 of the cross and dot products, acos of a cosine this close
+				// to 1 only resolves about 0.02 degrees in float
+				float cx = r.nrm.y * v.nrm.z - r.nrm.z * v.nrm.y;
+				float cy = r.nrm.z * v.nrm.x - r.nrm.x * v.nrm.z;
+				float cz = r.nrm.x * v.nrm.y - r.nrm.y * v.nrm.x;
+				float dot = r.nrm.x * v.nrm.x + r.nrm.y * v.nrm.y + r.nrm.z * v.nrm.z;
+				error.normalDegrees = std::fmax(error.normalDegrees,
+					std::atan2(std::sqrt(cx * cx + cy * cy + cz * cz), dot) * 57.2957795f);
+			}
+			error.uv = std::fmax(error.uv, std::fmax(std::fabs(r.uvw.x - v.uvw.x), std::fabs(r.uvw.y - v.uvw.y)));
+		}
+	}
+}
+#endif
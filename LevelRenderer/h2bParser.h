@@ -3,9 +3,23 @@
 #include <fstream>
 #include <vector>
 #include <set>
+#include <string>
+#include <cstring>
 
 namespace H2B {
 
+	// Version 2 files keep the 1.9d payload untouched and append an extension block.
+	// The major version lives in version[0] ('0' for 1.9d, '2' for v2) which the
+	// legacy check ignores, so older parsers still read the 1.9d portion of a v2 file.
+#define H2B_VERSION_2 '2'
+#define H2B_MAX_LODS 4 // LOD 0 is always the mesh's own drawInfo
+	enum EXTENSION_FLAGS : unsigned {
+		HAS_BOUNDS = 1 << 0, // one BOUNDS per mesh
+		HAS_LODS = 1 << 1, // one LOD per mesh plus lodIndices
+		HAS_MESHLETS = 1 << 2, // meshlet tables plus one MESHLET_RANGE per mesh
+		VCACHE_OPTIMIZED = 1 << 3, // index order was optimized for the post-transform cache
+	};
+
 #pragma pack(push,1)
 	struct VECTOR { 
 		float x, y, z; 
@@ -23,6 +37,31 @@ namespace H2B {
 	struct BATCH {
 		unsigned indexCount, indexOffset;
 	};
+	// v2 extension records
+	struct EXTENSION {
+		char magic[4]; // "H2BX"
+		unsigned flags; // EXTENSION_FLAGS
+		unsigned boundsCount, lodCount, lodIndexCount;
+		unsigned meshletCount, meshletVertexCount, meshletTriangleCount;
+	};
+	struct BOUNDS { // local space, per mesh
+		VECTOR min, max;
+		VECTOR center; float radius;
+	};
+	struct LOD { // offsets address the model index space, lodIndices follow indices
+		unsigned levelCount;
+		BATCH levels[H2B_MAX_LODS];
+		float error[H2B_MAX_LODS]; // object space deviation of each level
+	};
+	struct MESHLET {
+		unsigned vertexOffset, vertexCount; // into meshletVertices
+		unsigned triangleOffset, triangleCount; // into meshletTriangles (3 bytes each)
+		VECTOR center; float radius;
+		VECTOR coneAxis; float coneCutoff; // sin of the cone half angle, sqrt(1 - minDot^2), 1 disables
+	};
+	struct MESHLET_RANGE {
+		unsigned meshletCount, meshletOffset;
+	};
 #pragma pack(pop)
 	struct MATERIAL {
 		ATTRIBUTES attrib;
@@ -57,6 +96,17 @@ namespace H2B {
 		std::vector<MATERIAL> materials;
 		std::vector<BATCH> batches;
 		std::vector<MESH> meshes;
+		// v2 extension data, left empty when reading 1.9d files
+		EXTENSION extension;
+		std::vector<BOUNDS> bounds;
+		std::vector<LOD> lods;
+		std::vector<unsigned> lodIndices;
+		std::vector<MESHLET_RANGE> meshletRanges;
+		std::vector<MESHLET> meshlets;
+		std::vector<unsigned> meshletVertices;
+		std::vector<unsigned char> meshletTriangles;
+
+		bool IsVersion2() const { return version[0] == H2B_VERSION_2; }
 		bool Parse(const char* h2bPath)
 		{
 			Clear();
@@ -78,9 +128,9 @@ namespace H2B {
 			indices.resize(indexCount);
 			file.read(reinterpret_cast<char*>(indices.data()), 4 * indexCount);
 			materials.resize(materialCount);
-			for (int i = 0; i < materialCount; ++i) {
+			for (unsigned i = 0; i < materialCount; ++i) {
 				file.read(reinterpret_cast<char*>(&materials[i].attrib), 80);
-				for (int j = 0; j < 10; ++j) {
+				for (unsigned j = 0; j < 10; ++j) {
 					buffer[0] = '\0';
 					*((&materials[i].name) + j) = nullptr;
 					file.getline(buffer, 260, '\0');
@@ -93,7 +143,7 @@ namespace H2B {
 			batches.resize(materialCount);
 			file.read(reinterpret_cast<char*>(batches.data()), 8 * materialCount);
 			meshes.resize(meshCount);
-			for (int i = 0; i < meshCount; ++i) {
+			for (unsigned i = 0; i < meshCount; ++i) {
 				buffer[0] = '\0';
 				meshes[i].name = nullptr;
 				file.getline(buffer, 260, '\0');
@@ -104,8 +154,75 @@ namespace H2B {
 				file.read(reinterpret_cast<char*>(&meshes[i].drawInfo), 8);
 				file.read(reinterpret_cast<char*>(&meshes[i].materialIndex), 4);
 			}
+			if (IsVersion2())
+				return ParseExtension(file);
 			return true;
 		}
+		// Writes the current contents as a v2 file (the 1.9d payload plus extension)
+		bool Write(const char* h2bPath)
+		{
+			std::ofstream file;
+			file.open(h2bPath,	std::ios_base::out |
+								std::ios_base::binary | std::ios_base::trunc);
+			if (file.is_open() == false)
+				return false;
+			version[0] = H2B_VERSION_2;
+			if (version[1] == '\0') { // nothing was parsed, stamp the base version
+				version[1] = '1'; version[2] = '9'; version[3] = 'd';
+			}
+			vertexCount = vertices.size();
+			indexCount = indices.size();
+			materialCount = materials.size();
+			meshCount = meshes.size();
+			file.write(version, 4);
+			file.write(reinterpret_cast<const char*>(&vertexCount), 4);
+			file.write(reinterpret_cast<const char*>(&indexCount), 4);
+			file.write(reinterpret_cast<const char*>(&materialCount), 4);
+			file.write(reinterpret_cast<const char*>(&meshCount), 4);
+			file.write(reinterpret_cast<const char*>(vertices.data()), 36 * vertexCount);
+			file.write(reinterpret_cast<const char*>(indices.data()), 4 * indexCount);
+			for (unsigned i = 0; i < materialCount; ++i) {
+				file.write(reinterpret_cast<const char*>(&materials[i].attrib), 80);
+				for (unsigned j = 0; j < 10; ++j) {
+					const char* str = *((&materials[i].name) + j);
+					WriteString(file, str);
+				}
+			}
+			batches.resize(materialCount);
+			file.write(reinterpret_cast<const char*>(batches.data()), 8 * materialCount);
+			for (unsigned i = 0; i < meshCount; ++i) {
+				WriteString(file, meshes[i].name);
+				file.write(reinterpret_cast<const char*>(&meshes[i].drawInfo), 8);
+				file.write(reinterpret_cast<const char*>(&meshes[i].materialIndex), 4);
+			}
+			// extension block, counts are refreshed from the tables actually present
+			extension.magic[0] = 'H'; extension.magic[1] = '2';
+			extension.magic[2] = 'B'; extension.magic[3] = 'X';
+			extension.boundsCount = bounds.size();
+			extension.lodCount = lods.size();
+			extension.lodIndexCount = lodIndices.size();
+			extension.meshletCount = meshlets.size();
+			extension.meshletVertexCount = meshletVertices.size();
+			extension.meshletTriangleCount = meshletTriangles.size() / 3;
+			extension.flags &= VCACHE_OPTIMIZED;
+			if (bounds.size() == meshCount && meshCount) extension.flags |= HAS_BOUNDS;
+			if (lods.size() == meshCount && meshCount) extension.flags |= HAS_LODS;
+			if (meshletRanges.size() == meshCount && meshlets.size()) extension.flags |= HAS_MESHLETS;
+			file.write(reinterpret_cast<const char*>(&extension), sizeof(EXTENSION));
+			if (extension.flags & HAS_BOUNDS)
+				file.write(reinterpret_cast<const char*>(bounds.data()), sizeof(BOUNDS) * meshCount);
+			if (extension.flags & HAS_LODS) {
+				file.write(reinterpret_cast<const char*>(lods.data()), sizeof(LOD) * meshCount);
+				file.write(reinterpret_cast<const char*>(lodIndices.data()), 4 * lodIndices.size());
+			}
+			if (extension.flags & HAS_MESHLETS) {
+				file.write(reinterpret_cast<const char*>(meshletRanges.data()), sizeof(MESHLET_RANGE) * meshCount);
+				file.write(reinterpret_cast<const char*>(meshlets.data()), sizeof(MESHLET) * meshlets.size());
+				file.write(reinterpret_cast<const char*>(meshletVertices.data()), 4 * meshletVertices.size());
+				file.write(reinterpret_cast<const char*>(meshletTriangles.data()), meshletTriangles.size());
+			}
+			return file.good();
+		}
 
 		void Clear()
 		{
@@ -116,6 +233,99 @@ namespace H2B {
 			materials.clear();
 			batches.clear();
 			meshes.clear();
+			extension = EXTENSION();
+			bounds.clear();
+			lods.clear();
+			lodIndices.clear();
+			meshletRanges.clear();
+			meshlets.clear();
+			meshletVertices.clear();
+			meshletTriangles.clear();
+		}
+	private:
+		bool ParseExtension(std::ifstream& file)
+		{
+			file.read(reinterpret_cast<char*>(&extension), sizeof(EXTENSION));
+			if (!file || extension.magic[0] != 'H' || extension.magic[1] != '2' ||
+				extension.magic[2] != 'B' || extension.magic[3] != 'X')
+				return false;
+			if (extension.flags & HAS_BOUNDS) {
+				if (extension.boundsCount != meshCount)
+					return false;
+				bounds.resize(meshCount);
+				file.read(reinterpret_cast<char*>(bounds.data()), sizeof(BOUNDS) * meshCount);
+			}
+			if (extension.flags & HAS_LODS) {
+				if (extension.lodCount != meshCount)
+					return false;
+				lods.resize(meshCount);
+				file.read(reinterpret_cast<char*>(lods.data()), sizeof(LOD) * meshCount);
+				lodIndices.resize(extension.lodIndexCount);
+				file.read(reinterpret_cast<char*>(lodIndices.data()), 4 * extension.lodIndexCount);
+				if (!file || ValidLods() == false)
+					return false;
+			}
+			if (extension.flags & HAS_MESHLETS) {
+				meshletRanges.resize(meshCount);
+				file.read(reinterpret_cast<char*>(meshletRanges.data()), sizeof(MESHLET_RANGE) * meshCount);
+				meshlets.resize(extension.meshletCount);
+				file.read(reinterpret_cast<char*>(meshlets.data()), sizeof(MESHLET) * extension.meshletCount);
+				meshletVertices.resize(extension.meshletVertexCount);
+				file.read(reinterpret_cast<char*>(meshletVertices.data()), 4 * extension.meshletVertexCount);
+				meshletTriangles.resize(extension.meshletTriangleCount * 3);
+				file.read(reinterpret_cast<char*>(meshletTriangles.data()), 3 * extension.meshletTriangleCount);
+				if (!file || ValidMeshlets() == false)
+					return false;
+			}
+			return bool(file);
+		}
+		// Every mesh has 1 to H2B_MAX_LODS levels, each inside indices plus
+		// lodIndices, and every LOD index names a vertex, so LOD selection and the
+		// vertex cache passes can index them without checks.
+		bool ValidLods() const
+		{
+			size_t total = indices.size() + lodIndices.size();
+			for (const LOD& lod : lods) {
+				if (lod.levelCount == 0 || lod.levelCount > H2B_MAX_LODS)
+					return false;
+				for (unsigned l = 0; l < lod.levelCount; ++l)
+					if (lod.levels[l].indexOffset > total || lod.levels[l].indexCount > total - lod.levels[l].indexOffset)
+						return false;
+			}
+			for (unsigned i : lodIndices)
+				if (i >= vertexCount)
+					return false;
+			return true;
+		}
+		// Every range and offset stays inside its table, so the culler can index
+		// them without checks. Compares by subtraction, the counts come from the file.
+		bool ValidMeshlets() const
+		{
+			for (const MESHLET_RANGE& range : meshletRanges)
+				if (range.meshletOffset > meshlets.size() || range.meshletCount > meshlets.size() - range.meshletOffset)
+					return false;
+			for (const MESHLET& meshlet : meshlets) {
+				if (meshlet.vertexOffset > meshletVertices.size() ||
+					meshlet.vertexCount > meshletVertices.size() - meshlet.vertexOffset)
+					return false;
+				if (meshlet.triangleOffset > meshletTriangles.size() / 3 ||
+					meshlet.triangleCount > meshletTriangles.size() / 3 - meshlet.triangleOffset)
+					return false;
+				const unsigned char* triangles = meshletTriangles.data() + size_t(meshlet.triangleOffset) * 3;
+				for (unsigned t = 0; t < meshlet.triangleCount * 3; ++t)
+					if (triangles[t] >= meshlet.vertexCount)
+						return false;
+			}
+			for (unsigned v : meshletVertices)
+				if (v >= vertexCount)
+					return false;
+			return true;
+		}
+		static void WriteString(std::ofstream& file, const char* str)
+		{
+			if (str != nullptr)
+				file.write(str, std::strlen(str));
+			file.put('\0');
 		}
 	};
 }
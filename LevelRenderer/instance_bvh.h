@@ -0,0 +1,306 @@
+#ifndef _INSTANCE_BVH_H_
+#define _INSTANCE_BVH_H_
+// Bounding volume hierarchy over world space instance boxes, built with binned
+// SAH splits. Boxes can be moved afterwards and only the path from their leaf
+// to the root is refit, rebuild once refits have loosened the tree too much.
+// Queries reuse the GW::MATH::GCollision tests (requires GATEWARE_ENABLE_MATH).
+#include <cfloat>
+#include <algorithm>
+#include <vector>
+
+class Instance_BVH {
+public:
+	struct NODE {
+		GW::MATH::GAABBCEF bounds;
+		unsigned first, count; // leaf: items[first] onward, inner (count 0): children first, first + 1
+	};
+	std::vector<NODE> nodes; // nodes[0] is the root
+	std::vector<unsigned> items; // item numbers in leaf order
+	std::vector<GW::MATH::GAABBCEF> itemBounds; // indexed by item number
+
+	// Replaces the tree with one over boxes, item numbers are positions in boxes
+	void Build(const std::vector<GW::MATH::GAABBCEF>& boxes) {
+		itemBounds = boxes;
+		nodes.clear();
+		items.resize(boxes.size());
+		for (unsigned i = 0; i < items.size(); ++i)
+			items[i] = i;
+		parents.clear();
+		itemLeaves.assign(boxes.size(), 0);
+		if (boxes.empty())
+			return;
+		nodes.push_back({ {}, 0, unsigned(items.size()) });
+		parents.push_back(~0u);
+		std::vector<std::pair<unsigned, unsigned>> stack = { { 0, 0 } }; // node, depth
+		while (stack.size()) {
+			unsigned n = stack.back().first, depth = stack.back().second;
+			stack.pop_back();
+			unsigned split = Split(n, depth >= SAH_DEPTH);
+			if (split == 0) { // stays a leaf
+				for (unsigned i = nodes[n].first; i < nodes[n].first + nodes[n].count; ++i)
+					itemLeaves[items[i]] = n;
+				continue;
+			}
+			unsigned first = nodes[n].first, count = nodes[n].count, left = nodes.size();
+			nodes.push_back({ {}, first, split });
+			nodes.push_back({ {}, first + split, count - split });
+			parents.push_back(n);
+			parents.push_back(n);
+			nodes[n].first = left;
+			nodes[n].count = 0;
+			stack.push_back({ left, depth + 1 });
+			stack.push_back({ left + 1, depth + 1 });
+		}
+		// children always follow their parent, so refit back to front
+		for (size_t n = nodes.size(); n-- > 0;)
+			Refit(unsigned(n));
+	}
+	// Moves one item and grows or shrinks every node above it to match
+	void Update(unsigned item, const GW::MATH::GAABBCEF& box) {
+		itemBounds[item] = box;
+		for (unsigned n = itemLeaves[item]; n != ~0u; n = parents[n])
+			Refit(n);
+	}
+
+	// The Query functions append the item numbers whose boxes pass the test to out.
+	// Frustum planes point inward, anything below one of them is outside.
+	void QueryFrustum(const GW::MATH::GPLANEF planes[6], std::vector<unsigned>& out) const {
+		if (nodes.empty())
+			return;
+		using GW::MATH::GCollision;
+		struct ENTRY { unsigned node, planeMask; }; // planeMask: planes still straddled
+		ENTRY stack[MAX_DEPTH * 2];
+		unsigned top = 0;
+		stack[top++] = { 0, 0x3F };
+		while (top) {
+			ENTRY e = stack[--top];
+			const NODE& node = nodes[e.node];
+			unsigned mask = e.planeMask;
+			bool outside = false;
+			for (unsigned p = 0; p < 6 && !outside; ++p) {
+				if ((mask & (1 << p)) == 0)
+					continue;
+				GCollision::GCollisionCheck result;
+				GCollision::TestPlaneToAABBF(planes[p], node.bounds, result);
+				if (result == GCollision::GCollisionCheck::BELOW)
+					outside = true;
+				else if (result == GCollision::GCollisionCheck::ABOVE)
+					mask &= ~(1 << p); // children are inside this plane too
+			}
+			if (outside)
+				continue;
+			if (mask == 0) // entirely inside, no more tests needed
+				AppendSubtree(e.node, out);
+			else if (node.count) {
+				for (unsigned i = node.first; i < node.first + node.count; ++i) {
+					bool visible = true;
+					for (unsigned p = 0; p < 6 && visible; ++p) {
+						GCollision::GCollisionCheck result;
+						if (mask & (1 << p)) {
+							GCollision::TestPlaneToAABBF(planes[p], itemBounds[items[i]], result);
+							visible = result != GCollision::GCollisionCheck::BELOW;
+						}
+					}
+					if (visible)
+						out.push_back(items[i]);
+				}
+			}
+			else {
+				stack[top++] = { node.first, mask };
+				stack[top++] = { node.first + 1, mask };
+			}
+		}
+	}
+	void QuerySphere(const GW::MATH::GSPHEREF& sphere, std::vector<unsigned>& out) const {
+		Query(out, [&](const GW::MATH::GAABBCEF& box) {
+			GW::MATH::GCollision::GCollisionCheck result;
+			GW::MATH::GCollision::TestSphereToAABBF(sphere, box, result);
+			return result == GW::MATH::GCollision::GCollisionCheck::COLLISION;
+		});
+	}
+	void QueryAABB(const GW::MATH::GAABBCEF& aabb, std::vector<unsigned>& out) const {
+		Query(out, [&](const GW::MATH::GAABBCEF& box) {
+			GW::MATH::GCollision::GCollisionCheck result;
+			GW::MATH::GCollision::TestAABBToAABBF(aabb, box, result);
+			return result == GW::MATH::GCollision::GCollisionCheck::COLLISION;
+		});
+	}
+	// every box the ray passes through, in no particular order (narrow down for picking)
+	void QueryRay(const GW::MATH::GRAYF& ray, std::vector<unsigned>& out) const {
+		Query(out, [&](const GW::MATH::GAABBCEF& box) {
+			GW::MATH::GAABBMMF minMax;
+			GW::MATH::GCollision::ConvertAABBCEToAABBMMF(box, minMax);
+			GW::MATH::GCollision::GCollisionCheck result;
+			GW::MATH::GCollision::TestRayToAABBF(ray, minMax, result);
+			return result == GW::MATH::GCollision::GCollisionCheck::COLLISION;
+		});
+	}
+
+private:
+	std::vector<unsigned> parents; // same size as nodes, ~0u for the root
+	std::vector<unsigned> itemLeaves; // leaf holding each item
+
+	static const unsigned LEAF_SIZE = 4, BINS = 12;
+	// past SAH_DEPTH splits fall back to medians, which bounds the query stacks
+	static const unsigned SAH_DEPTH = 48, MAX_DEPTH = SAH_DEPTH + 32;
+	struct RANGE { // min/max form is cheaper to grow than center/extent
+		float min[3], max[3];
+		void Reset() {
+			for (int a = 0; a < 3; ++a) {
+				min[a] = FLT_MAX;
+				max[a] = -FLT_MAX;
+			}
+		}
+		void Grow(const float lo[3], const float hi[3]) {
+			for (int a = 0; a < 3; ++a) {
+				min[a] = lo[a] < min[a] ? lo[a] : min[a];
+				max[a] = hi[a] > max[a] ? hi[a] : max[a];
+			}
+		}
+		void Grow(const GW::MATH::GAABBCEF& box) {
+			float lo[3] = { box.center.x - box.extent.x, box.center.y - box.extent.y, box.center.z - box.extent.z };
+			float hi[3] = { box.center.x + box.extent.x, box.center.y + box.extent.y, box.center.z + box.extent.z };
+			Grow(lo, hi);
+		}
+		float Area() const {
+			if (max[0] < min[0])
+				return 0;
+			float x = max[0] - min[0], y = max[1] - min[1], z = max[2] - min[2];
+			return x * y + y * z + z * x;
+		}
+		GW::MATH::GAABBCEF Box() const {
+			GW::MATH::GAABBCEF box;
+			box.center = { (min[0] + max[0]) * 0.5f, (min[1] + max[1]) * 0.5f, (min[2] + max[2]) * 0.5f, 0 };
+			box.extent = { (max[0] - min[0]) * 0.5f, (max[1] - min[1]) * 0.5f, (max[2] - min[2]) * 0.5f, 0 };
+			return box;
+		}
+	};
+
+	void Refit(unsigned n) {
+		NODE& node = nodes[n];
+		RANGE range;
+		range.Reset();
+		if (node.count)
+			for (unsigned i = node.first; i < node.first + node.count; ++i)
+				range.Grow(itemBounds[items[i]]);
+		else {
+			range.Grow(nodes[node.first].bounds);
+			range.Grow(nodes[node.first + 1].bounds);
+		}
+		node.bounds = range.Box();
+	}
+	// Partitions a leaf's items by the cheapest binned SAH plane and returns how
+	// many went left, 0 when keeping the leaf is cheaper
+	unsigned Split(unsigned n, bool median) {
+		unsigned first = nodes[n].first, count = nodes[n].count;
+		if (count <= LEAF_SIZE)
+			return 0;
+		RANGE bounds, centers;
+		bounds.Reset();
+		centers.Reset();
+		for (unsigned i = first; i < first + count; ++i) {
+			const GW::MATH::GAABBCEF& box = itemBounds[items[i]];
+			bounds.Grow(box);
+			centers.Grow(&box.center.x, &box.center.x);
+		}
+		if (median)
+			return Median(first, count, centers);
+		float bestCost = FLT_MAX, bestPlane = 0;
+		int bestAxis = -1;
+		for (int a = 0; a < 3; ++a) {
+			float lo = centers.min[a], extent = centers.max[a] - lo;
+			if (extent <= 0)
+				continue;
+			RANGE bins[BINS];
+			unsigned binCounts[BINS] = {};
+			for (RANGE& bin : bins)
+				bin.Reset();
+			for (unsigned i = first; i < first + count; ++i) {
+				const GW::MATH::GAABBCEF& box = itemBounds[items[i]];
+				unsigned b = std::min(BINS - 1, unsigned(((&box.center.x)[a] - lo) * BINS / extent));
+				bins[b].Grow(box);
+				++binCounts[b];
+			}
+			// sweep from the right, then evaluate every plane from the left
+			float rightArea[BINS];
+			unsigned rightCount[BINS];
+			RANGE right;
+			right.Reset();
+			unsigned total = 0;
+			for (unsigned b = BINS - 1; b > 0; --b) {
+				right.Grow(bins[b].min, bins[b].max);
+				total += binCounts[b];
+				rightArea[b] = right.Area();
+				rightCount[b] = total;
+			}
+			RANGE left;
+			left.Reset();
+			total = 0;
+			for (unsigned b = 0; b < BINS - 1; ++b) {
+				left.Grow(bins[b].min, bins[b].max);
+				total += binCounts[b];
+				float cost = left.Area() * total + rightArea[b + 1] * rightCount[b + 1];
+				if (total && rightCount[b + 1] && cost < bestCost) {
+					bestCost = cost;
+					bestAxis = a;
+					bestPlane = lo + extent * (b + 1) / BINS;
+				}
+			}
+		}
+		// a leaf costs one test per item against the node area
+		if (bestAxis < 0 || bestCost >= bounds.Area() * count)
+			return count > LEAF_SIZE * 8 ? Median(first, count, centers) : 0;
+		unsigned* begin = items.data() + first;
+		unsigned* middle = std::partition(begin, begin + count, [&](unsigned item) {
+			return (&itemBounds[item].center.x)[bestAxis] < bestPlane;
+		});
+		return unsigned(middle - begin);
+	}
+	// fallback for deep trees and boxes sharing centers, keeps leaves small
+	unsigned Median(unsigned first, unsigned count, const RANGE& centers) {
+		int axis = 0;
+		for (int a = 1; a < 3; ++a)
+			if (centers.max[a] - centers.min[a] > centers.max[axis] - centers.min[axis])
+				axis = a;
+		unsigned* begin = items.data() + first;
+		std::nth_element(begin, begin + count / 2, begin + count, [&](unsigned x, unsigned y) {
+			return (&itemBounds[x].center.x)[axis] < (&itemBounds[y].center.x)[axis];
+		});
+		return count / 2;
+	}
+	void AppendSubtree(unsigned n, std::vector<unsigned>& out) const {
+		unsigned stack[MAX_DEPTH * 2], top = 0;
+		stack[top++] = n;
+		while (top) {
+			const NODE& node = nodes[stack[--top]];
+			if (node.count)
+				out.insert(out.end(), items.begin() + node.first, items.begin() + node.first + node.count);
+			else {
+				stack[top++] = node.first;
+				stack[top++] = node.first + 1;
+			}
+		}
+	}
+	template <typename TEST>
+	void Query(std::vector<unsigned>& out, TEST test) const {
+		if (nodes.empty())
+			return;
+		unsigned stack[MAX_DEPTH * 2], top = 0;
+		stack[top++] = 0;
+		while (top) {
+			const NODE& node = nodes[stack[--top]];
+			if (test(node.bounds) == false)
+				continue;
+			if (node.count) {
+				for (unsigned i = node.first; i < node.first + node.count; ++i)
+					if (test(itemBounds[items[i]]))
+						out.push_back(items[i]);
+			}
+			else {
+				stack[top++] = node.first;
+				stack[top++] = node.first + 1;
+			}
+		}
+	}
+};
+#endif
@@ -0,0 +1,256 @@
+#ifndef _LEVEL_HIERARCHY_H_
+#define _LEVEL_HIERARCHY_H_
+// Parent/child placement of level objects. Nodes are stored breadth first in
+// parallel arrays: parents come before their children, every depth is one
+// contiguous run and the children of one node are contiguous too, so a subtree
+// is walked one run of children at a time. Moving a node marks it dirty and
+// Update recomputes world matrices under dirty nodes only, handing independent
+// subtrees to worker threads when there is enough of them to pay for it.
+// Include after batch_matrix.h.
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct HIERARCHY_OBJECT { // one object of the level file, in file order
+	std::string name, modelFile; // modelFile is empty for objects that draw nothing (empties, lights...)
+	unsigned parent; // file order index of the parent, ~0u for roots
+	GW::MATH::GMATRIXF world;
+};
+struct HIERARCHY_STATS {
+	unsigned dirtyRoots; // subtrees recomputed by the last Update
+	unsigned nodesUpdated;
+	unsigned threads; // workers used, 1 when run inline
+};
+
+class Level_Hierarchy {
+public:
+	// per node, breadth first
+	std::vector<unsigned> parents; // ~0u for roots
+	std::vector<unsigned> firstChild, childCount; // firstChild is where children would start even when there are none
+	std::vector<unsigned> subtreeSizes; // node plus all its descendants
+	std::vector<GW::MATH::GMATRIXF> locals; // relative to the parent (row vectors: world = local * parent world)
+	std::vector<GW::MATH::GMATRIXF> worlds;
+	std::vector<unsigned> transforms; // levelTransforms entry the node places, ~0u for none
+	std::vector<std::string> names, modelFiles;
+	std::vector<unsigned> levels; // first node of each depth, then the node count
+	std::vector<unsigned> transformNodes; // node of each levelTransforms entry, ~0u for none
+	unsigned minParallelNodes = 4096; // dirty nodes below this update inline
+
+	void Build(const std::vector<HIERARCHY_OBJECT>& objects) {
+		Clear();
+		unsigned count = objects.size();
+		// children in file order, parents that are missing or not earlier in the file make roots
+		std::vector<std::vector<unsigned>> children(count);
+		std::vector<unsigned> order, fileToNode(count, ~0u);
+		for (unsigned i = 0; i < count; ++i)
+			if (objects[i].parent < i)
+				children[objects[i].parent].push_back(i);
+			else
+				order.push_back(i);
+		// breadth first, one depth at a time
+		unsigned levelStart = 0;
+		while (levelStart < order.size()) {
+			levels.push_back(levelStart);
+			unsigned levelEnd = order.size();
+			for (unsigned n = levelStart; n < levelEnd; ++n)
+				order.insert(order.end(), children[order[n]].begin(), children[order[n]].end());
+			levelStart = levelEnd;
+		}
+		levels.push_back(count);
+		for (unsigned n = 0; n < count; ++n)
+			fileToNode[order[n]] = n;
+		parents.resize(count);
+		firstChild.resize(count);
+		childCount.resize(count);
+		worlds.resize(count);
+		transforms.assign(count, ~0u);
+		names.resize(count);
+		modelFiles.resize(count);
+		unsigned nextChild = levels.size() > 1 ? levels[1] : count;
+		for (unsigned n = 0; n < count; ++n) {
+			const HIERARCHY_OBJECT& object = objects[order[n]];
+			parents[n] = object.parent < order[n] ? fileToNode[object.parent] : ~0u;
+			firstChild[n] = nextChild;
+			childCount[n] = children[order[n]].size();
+			nextChild += childCount[n];
+			worlds[n] = object.world;
+			names[n] = object.name;
+			modelFiles[n] = object.modelFile;
+		}
+		subtreeSizes.assign(count, 1);
+		for (unsigned n = count; n-- > 0;)
+			if (parents[n] != ~0u)
+				subtreeSizes[parents[n]] += subtreeSizes[n];
+		// the file holds world matrices, locals are relative to the parent's
+		std::vector<GW::MATH::GMATRIXF> inverses(count), parentInverses(count, GW::MATH::GIdentityMatrixF);
+		BatchInverseAffine(worlds.data(), inverses.data(), count);
+		for (unsigned n = 0; n < count; ++n)
+			if (parents[n] != ~0u)
+				parentInverses[n] = inverses[parents[n]];
+		locals.resize(count);
+		BatchMultiply(worlds.data(), parentInverses.data(), locals.data(), count);
+		dirtyFlags.assign(count, 0);
+	}
+	void Clear() {
+		parents.clear();
+		firstChild.clear();
+		childCount.clear();
+		subtreeSizes.clear();
+		locals.clear();
+		worlds.clear();
+		transforms.clear();
+		names.clear();
+		modelFiles.clear();
+		levels.clear();
+		transformNodes.clear();
+		dirty.clear();
+		dirtyFlags.clear();
+	}
+	// Fills transformNodes from transforms, call after transforms change
+	void IndexTransforms(size_t transformCount) {
+		transformNodes.assign(transformCount, ~0u);
+		for (unsigned n = 0; n < transforms.size(); ++n)
+			if (transforms[n] < transformCount)
+				transformNodes[transforms[n]] = n;
+	}
+	unsigned Find(const std::string& name) const {
+		auto found = std::find(names.begin(), names.end(), name);
+		return found == names.end() ? ~0u : unsigned(found - names.begin());
+	}
+	// Node and everything under it follow from the next Update
+	void SetLocal(unsigned node, const GW::MATH::GMATRIXF& local) {
+		locals[node] = local;
+		MarkDirty(node);
+	}
+	// Same, placing the node in world space under its current parent
+	void SetWorld(unsigned node, const GW::MATH::GMATRIXF& world) {
+		if (parents[node] == ~0u)
+			locals[node] = world;
+		else {
+			GW::MATH::GMATRIXF parentInverse;
+			BatchInverseAffine(&worlds[parents[node]], &parentInverse, 1);
+			BatchMultiply(&world, parentInverse, &locals[node], 1);
+		}
+		MarkDirty(node);
+	}
+	// Places nodes where a re-export says they are. Every world is written before
+	// the locals of the nodes and their children are derived from them, so patch
+	// order doesn't matter, and nothing is marked dirty: the export already holds
+	// the new world of every moved child, moving them with their parent again
+	// would count the parent's move twice.
+	void SetWorlds(const std::vector<unsigned>& nodes, const std::vector<GW::MATH::GMATRIXF>& nodeWorlds) {
+		std::vector<unsigned> relative = nodes;
+		for (unsigned i = 0; i < nodes.size(); ++i) {
+			worlds[nodes[i]] = nodeWorlds[i];
+			for (unsigned c = firstChild[nodes[i]]; c < firstChild[nodes[i]] + childCount[nodes[i]]; ++c)
+				relative.push_back(c);
+		}
+		std::sort(relative.begin(), relative.end());
+		relative.erase(std::unique(relative.begin(), relative.end()), relative.end());
+		for (unsigned node : relative)
+			if (parents[node] == ~0u)
+				locals[node] = worlds[node];
+			else {
+				GW::MATH::GMATRIXF parentInverse;
+				BatchInverseAffine(&worlds[parents[node]], &parentInverse, 1);
+				BatchMultiply(&worlds[node], parentInverse, &locals[node], 1);
+			}
+	}
+	bool Dirty() const { return dirty.size() != 0; }
+	// Recomputes worlds under dirty nodes and writes the ones placing a level
+	// transform into levelTransforms (indexed by transforms). changed receives
+	// those transform indices, in no particular order.
+	void Update(GW::MATH::GMATRIXF* levelTransforms, std::vector<unsigned>& changed, unsigned threads = 1) {
+		changed.clear();
+		stats = {};
+		if (dirty.empty())
+			return;
+		// a dirty node under another dirty node is covered by the ancestor's pass
+		std::vector<unsigned> roots;
+		unsigned work = 0;
+		for (unsigned node : dirty) {
+			bool covered = false;
+			for (unsigned p = parents[node]; p != ~0u && covered == false; p = parents[p])
+				covered = dirtyFlags[p] != 0;
+			if (covered == false) {
+				roots.push_back(node);
+				work += subtreeSizes[node];
+			}
+		}
+		for (unsigned node : dirty)
+			dirtyFlags[node] = 0;
+		dirty.clear();
+		stats.dirtyRoots = roots.size();
+		stats.nodesUpdated = work;
+		threads = std::min<unsigned>(std::max(threads, 1u), roots.size());
+		if (threads <= 1 || work < minParallelNodes) {
+			stats.threads = 1;
+			for (unsigned root : roots)
+				UpdateSubtree(root, levelTransforms, changed);
+			return;
+		}
+		// largest subtrees first, each to the worker with the least work so far
+		std::sort(roots.begin(), roots.end(), [&](unsigned a, unsigned b) { return subtreeSizes[a] > subtreeSizes[b]; });
+		std::vector<std::vector<unsigned>> groups(threads), groupChanged(threads);
+		std::vector<unsigned> groupWork(threads, 0);
+		for (unsigned root : roots) {
+			unsigned least = unsigned(std::min_element(groupWork.begin(), groupWork.end()) - groupWork.begin());
+			groups[least].push_back(root);
+			groupWork[least] += subtreeSizes[root];
+		}
+		std::vector<std::thread> workers;
+		for (unsigned t = 1; t < threads; ++t)
+			workers.emplace_back([&, t]() {
+				for (unsigned root : groups[t])
+					UpdateSubtree(root, levelTransforms, groupChanged[t]);
+			});
+		for (unsigned root : groups[0])
+			UpdateSubtree(root, levelTransforms, changed);
+		for (std::thread& worker : workers)
+			worker.join();
+		for (unsigned t = 1; t < threads; ++t)
+			changed.insert(changed.end(), groupChanged[t].begin(), groupChanged[t].end());
+		stats.threads = threads;
+	}
+	const HIERARCHY_STATS& GetStats() const { return stats; }
+	unsigned Depth() const { return levels.size() ? unsigned(levels.size() - 1) : 0; }
+
+private:
+	std::vector<unsigned> dirty; // nodes marked since the last Update
+	std::vector<uint8_t> dirtyFlags;
+	HIERARCHY_STATS stats = {};
+
+	void MarkDirty(unsigned node) {
+		if (dirtyFlags[node] == 0) {
+			dirtyFlags[node] = 1;
+			dirty.push_back(node);
+		}
+	}
+	void Place(unsigned node, GW::MATH::GMATRIXF* levelTransforms, std::vector<unsigned>& changed) {
+		if (transforms[node] != ~0u) {
+			levelTransforms[transforms[node]] = worlds[node];
+			changed.push_back(transforms[node]);
+		}
+	}
+	// one run of children at a time, each block multiplied by its parent's world
+	void UpdateSubtree(unsigned root, GW::MATH::GMATRIXF* levelTransforms, std::vector<unsigned>& changed) {
+		if (parents[root] == ~0u)
+			worlds[root] = locals[root];
+		else
+			BatchMultiply(&locals[root], worlds[parents[root]], &worlds[root], 1);
+		Place(root, levelTransforms, changed);
+		unsigned first = root, last = root + 1;
+		while (first < last) {
+			for (unsigned n = first; n < last; ++n) {
+				BatchMultiply(locals.data() + firstChild[n], worlds[n], worlds.data() + firstChild[n], childCount[n]);
+				for (unsigned c = firstChild[n]; c < firstChild[n] + childCount[n]; ++c)
+					Place(c, levelTransforms, changed);
+			}
+			unsigned next = firstChild[first];
+			last = firstChild[last - 1] + childCount[last - 1];
+			first = next;
+		}
+	}
+};
+#endif
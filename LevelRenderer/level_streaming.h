@@ -0,0 +1,413 @@
+#ifndef _LEVEL_STREAMING_H_
+#define _LEVEL_STREAMING_H_
+// Streams a level by world grid cells around the camera. Instances are bucketed
+// by their row4 position on the ground (x/z) plane. Cells inside loadRadius are
+// loaded nearest first on a worker thread, cells past unloadRadius are released.
+// Cells between the two radii stay as they are unless the geometry pool needs
+// room, which keeps cells on a boundary from reloading every frame.
+// The pool is budgetBytes of GPU geometry the streamer sub-allocates: every
+// model a resident or pending cell uses holds one range, its vertices followed
+// by its indices, placed by the first cell that needs it and released with the
+// last. The load callback copies the cell's new models into their ranges.
+// Include after load_data_oriented.h.
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct STREAM_RANGE { // bytes of the geometry pool
+	size_t offset, size; // size 0 when the model isn't placed
+};
+struct STREAM_UPLOAD { // a model a cell's load has to copy into the pool
+	unsigned model;
+	STREAM_RANGE range;
+};
+struct STREAM_CELL {
+	enum STATE { UNLOADED, PENDING, RESIDENT };
+	int x, z; // grid coordinates, a cell spans cellSize world units on each axis
+	std::vector<unsigned> transforms; // levelTransforms placed in this cell
+	std::vector<unsigned> models; // distinct levelModels those transforms use
+	std::vector<STREAM_UPLOAD> uploads; // models this cell placed, set while PENDING
+	STATE state;
+};
+struct STREAM_STATS {
+	unsigned cells, residentCells, pendingLoads;
+	unsigned loadsCompleted, unloads; // totals since Create
+	unsigned budgetDeferrals; // Updates where a load in range had to wait for pool space
+	unsigned modelUploads; // models placed since Create
+	size_t residentBytes, budgetBytes; // pool bytes placed models hold, pool size
+	size_t retiredBytes; // released but possibly still read by frames in flight
+};
+
+// First fit sub-allocator over [0, capacity), sizes round up to alignment and
+// neighbouring free ranges merge
+class Range_Allocator {
+public:
+	void Reset(size_t capacity, size_t alignment) {
+		this->alignment = std::max<size_t>(alignment, 1);
+		freeRanges.clear();
+		capacity -= capacity % this->alignment;
+		if (capacity)
+			freeRanges[0] = capacity;
+	}
+	size_t Align(size_t bytes) const { return (bytes + alignment - 1) / alignment * alignment; }
+	bool Allocate(size_t bytes, size_t& offset) {
+		bytes = Align(bytes);
+		for (auto i = freeRanges.begin(); i != freeRanges.end(); ++i)
+			if (i->second >= bytes) {
+				offset = i->first;
+				if (i->second > bytes)
+					freeRanges[offset + bytes] = i->second - bytes;
+				freeRanges.erase(i);
+				return true;
+			}
+		return false;
+	}
+	void Free(size_t offset, size_t bytes) {
+		bytes = Align(bytes);
+		auto next = freeRanges.lower_bound(offset);
+		if (next != freeRanges.end() && offset + bytes == next->first) {
+			bytes += next->second;
+			next = freeRanges.erase(next);
+		}
+		if (next != freeRanges.begin()) {
+			auto previous = std::prev(next);
+			if (previous->first + previous->second == offset) {
+				previous->second += bytes;
+				return;
+			}
+		}
+		freeRanges[offset] = bytes;
+	}
+	const std::map<size_t, size_t>& GetFreeRanges() const { return freeRanges; }
+
+private:
+	std::map<size_t, size_t> freeRanges; // offset to size
+	size_t alignment = 1;
+};
+
+class Level_Streamer {
+public:
+	// load runs on the worker thread (inline in Update when not threaded) and
+	// copies cell.uploads into the pool, unload runs inside Update. Either may
+	// be empty when only residency is wanted.
+	typedef std::function<void(const STREAM_CELL&)> CELL_CALLBACK;
+
+	// vertexBytes is the size of one uploaded vertex, ranges start on multiples
+	// of it so vertex and index offsets stay whole. Released ranges wait
+	// retireUpdates Updates before reuse, the frames in flight may still read them.
+	void Create(const Level_Data& level, float cellSize, float loadRadius, float unloadRadius,
+				size_t budgetBytes, bool threaded, CELL_CALLBACK load = nullptr, CELL_CALLBACK unload = nullptr,
+				size_t vertexBytes = sizeof(H2B::PACKED_VERTEX), unsigned retireUpdates = 0) {
+		Destroy();
+		this->cellSize = cellSize;
+		this->loadRadius = loadRadius;
+		this->unloadRadius = std::max(loadRadius, unloadRadius);
+		this->load = load;
+		this->unload = unload;
+		this->vertexBytes = vertexBytes;
+		this->retireUpdates = retireUpdates;
+		stats = {};
+		stats.budgetBytes = budgetBytes;
+		pool.Reset(budgetBytes, vertexBytes);
+		retired.clear();
+		updateCount = 0;
+		// the bytes each model occupies once uploaded, vertices then indices
+		modelBytes.clear();
+		for (const Level_Data::LEVEL_MODEL& model : level.levelModels)
+			modelBytes.push_back(pool.Align(size_t(model.vertexCount) * vertexBytes +
+				size_t(model.indexCount) * (model.shortIndices ? 2 : 4)));
+		modelUsers.assign(level.levelModels.size(), 0);
+		modelRanges.assign(level.levelModels.size(), STREAM_RANGE());
+		// bucket every transform by grid cell
+		cellLookup.clear();
+		cells.clear();
+		transformCells.assign(level.levelTransforms.size(), 0);
+		transformModels.assign(level.levelTransforms.size(), 0);
+		for (const Level_Data::MODEL_INSTANCES& instances : level.levelInstances)
+			for (unsigned k = instances.transformStart; k < instances.transformStart + instances.transformCount; ++k) {
+				STREAM_CELL& cell = cells[CellOf(level.levelTransforms[k])];
+				cell.transforms.push_back(k);
+				if (std::find(cell.models.begin(), cell.models.end(), instances.modelIndex) == cell.models.end())
+					cell.models.push_back(instances.modelIndex);
+				transformCells[k] = unsigned(&cell - cells.data());
+				transformModels[k] = instances.modelIndex;
+			}
+		stats.cells = cells.size();
+		if (threaded) {
+			running = true;
+			worker = std::thread([this]() { WorkerLoop(); });
+		}
+	}
+	void Destroy() {
+		if (worker.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				running = false;
+			}
+			wake.notify_all();
+			worker.join();
+		}
+		requests.clear();
+		completed.clear();
+	}
+	~Level_Streamer() { Destroy(); }
+
+	// Call once per frame with the camera's world position
+	void Update(const GW::MATH::GVECTORF& camera) {
+		// ranges no frame in flight can read any more go back to the pool
+		++updateCount;
+		while (retired.size() && retired.front().first + retireUpdates <= updateCount) {
+			pool.Free(retired.front().second.offset, retired.front().second.size);
+			stats.retiredBytes -= retired.front().second.size;
+			retired.pop_front();
+		}
+		FinishLoads();
+		// release what drifted past the unload radius
+		distances.resize(cells.size());
+		for (unsigned c = 0; c < cells.size(); ++c) {
+			distances[c] = Distance(cells[c], camera);
+			if (cells[c].state == STREAM_CELL::RESIDENT && distances[c] > unloadRadius)
+				Unload(c);
+		}
+		// request what came into range, nearest first
+		order.clear();
+		for (unsigned c = 0; c < cells.size(); ++c)
+			if (cells[c].state == STREAM_CELL::UNLOADED && distances[c] <= loadRadius)
+				order.push_back(c);
+		std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+			return distances[a] != distances[b] ? distances[a] < distances[b] : a < b;
+		});
+		for (unsigned c : order) {
+			if (Place(c) == false) {
+				++stats.budgetDeferrals; // farther cells wait too so the nearest loads first
+				break;
+			}
+			cells[c].state = STREAM_CELL::PENDING;
+			++stats.pendingLoads;
+			if (worker.joinable()) {
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					requests.push_back(c);
+				}
+				wake.notify_one();
+			}
+			else { // same hand-off as the worker, resident from the next Update on
+				if (load)
+					load(cells[c]);
+				completed.push_back(c);
+			}
+		}
+	}
+	// Moves already placed transforms (levelTransforms ranges, as ApplyPatches
+	// reports them) to the cells their new positions fall in. Model ranges stay
+	// where they are: a resident cell taking a model nothing has placed places
+	// and loads just that model, or unloads to load whole once it fits. Counts
+	// and order of the level's transforms must not have changed since Create.
+	void MoveTransforms(const Level_Data& level, const std::vector<Level_Data::TRANSFORM_RANGE>& moved) {
+		WaitIdle(); // the worker reads cells, CellOf may grow them
+		FinishLoads();
+		for (const Level_Data::TRANSFORM_RANGE& range : moved)
+			for (unsigned k = range.start; k < range.start + range.count; ++k) {
+				unsigned from = transformCells[k], to = CellOf(level.levelTransforms[k]), m = transformModels[k];
+				if (from == to)
+					continue;
+				// the new cell takes its user of the model before the old one lets go
+				STREAM_CELL& target = cells[to];
+				target.transforms.push_back(k);
+				if (std::find(target.models.begin(), target.models.end(), m) == target.models.end()) {
+					if (target.state == STREAM_CELL::RESIDENT) {
+						if (modelUsers[m])
+							++modelUsers[m];
+						else if (PlaceModel(to, m) == false)
+							Unload(to); // loads again with the model once the pool has room
+					}
+					target.models.push_back(m);
+				}
+				transformCells[k] = to;
+				STREAM_CELL& source = cells[from];
+				source.transforms.erase(std::find(source.transforms.begin(), source.transforms.end(), k));
+				bool used = false;
+				for (unsigned t : source.transforms)
+					used = used || transformModels[t] == m;
+				if (used == false) {
+					source.models.erase(std::find(source.models.begin(), source.models.end(), m));
+					if (source.state == STREAM_CELL::RESIDENT)
+						Release(m);
+				}
+			}
+		stats.cells = cells.size();
+	}
+	// Blocks until every requested load has finished (for tests and level changes)
+	void WaitIdle() {
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [&]() { return requests.empty() && busy == false; });
+	}
+	bool IsResident(unsigned transformIndex) const {
+		return cells.size() && cells[transformCells[transformIndex]].state == STREAM_CELL::RESIDENT;
+	}
+	// Where the model's vertices and indices sit in the pool, size 0 when no
+	// resident or pending cell uses it
+	const STREAM_RANGE& GetModelRange(unsigned model) const { return modelRanges[model]; }
+	const std::vector<STREAM_CELL>& GetCells() const { return cells; }
+	const STREAM_STATS& GetStats() const { return stats; }
+
+private:
+	float cellSize = 1, loadRadius = 0, unloadRadius = 0;
+	size_t vertexBytes = sizeof(H2B::PACKED_VERTEX);
+	unsigned retireUpdates = 0, updateCount = 0;
+	CELL_CALLBACK load, unload;
+	std::vector<STREAM_CELL> cells;
+	std::vector<unsigned> transformCells; // cell of each levelTransforms entry
+	std::vector<unsigned> transformModels; // levelModels entry of each levelTransforms entry
+	std::map<std::pair<int, int>, unsigned> cellLookup; // grid coordinates to cells entry
+	std::vector<size_t> modelBytes;
+	std::vector<unsigned> modelUsers; // resident or pending cells using each model
+	std::vector<STREAM_RANGE> modelRanges;
+	Range_Allocator pool;
+	std::deque<std::pair<unsigned, STREAM_RANGE>> retired; // Update they were released in
+	std::vector<float> distances; // per cell, refreshed every Update
+	std::vector<unsigned> order;
+	STREAM_STATS stats = {};
+	// worker hand-off
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake, idle;
+	std::deque<unsigned> requests, completed;
+	bool running = false, busy = false;
+
+	void WorkerLoop() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			wake.wait(lock, [&]() { return running == false || requests.size(); });
+			if (running == false)
+				break;
+			unsigned c = requests.front();
+			requests.pop_front();
+			busy = true;
+			lock.unlock();
+			if (load)
+				load(cells[c]);
+			lock.lock();
+			busy = false;
+			completed.push_back(c);
+			idle.notify_all();
+		}
+	}
+	// finished loads become resident
+	void FinishLoads() {
+		std::deque<unsigned> done;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			done.swap(completed);
+		}
+		for (unsigned c : done) {
+			cells[c].state = STREAM_CELL::RESIDENT;
+			--stats.pendingLoads;
+			++stats.residentCells;
+			++stats.loadsCompleted;
+		}
+	}
+	// Cell a transform's row4 falls in, added unloaded when it's a new one
+	unsigned CellOf(const GW::MATH::GMATRIXF& world) {
+		std::pair<int, int> key = { int(std::floor(world.row4.x / cellSize)), int(std::floor(world.row4.z / cellSize)) };
+		auto found = cellLookup.find(key);
+		if (found == cellLookup.end()) {
+			found = cellLookup.insert({ key, unsigned(cells.size()) }).first;
+			cells.push_back({ key.first, key.second, {}, {}, {}, STREAM_CELL::UNLOADED });
+		}
+		return found->second;
+	}
+	// Places one model for resident cell c without evicting anything and loads
+	// it right away, for a moved transform bringing its model along
+	bool PlaceModel(unsigned c, unsigned m) {
+		STREAM_RANGE range = { 0, modelBytes[m] };
+		if (pool.Allocate(range.size, range.offset) == false)
+			return false;
+		modelUsers[m] = 1;
+		modelRanges[m] = range;
+		stats.residentBytes += range.size;
+		++stats.modelUploads;
+		STREAM_CELL upload = { cells[c].x, cells[c].z, {}, {}, { { m, range } }, STREAM_CELL::PENDING };
+		if (load)
+			load(upload);
+		return true;
+	}
+	// ground plane distance from the camera to the nearest point of the cell
+	float Distance(const STREAM_CELL& cell, const GW::MATH::GVECTORF& camera) const {
+		float x0 = cell.x * cellSize, z0 = cell.z * cellSize;
+		float dx = std::max(std::max(x0 - camera.x, camera.x - (x0 + cellSize)), 0.0f);
+		float dz = std::max(std::max(z0 - camera.z, camera.z - (z0 + cellSize)), 0.0f);
+		return std::sqrt(dx * dx + dz * dz);
+	}
+	// Drops one user of model, its range leaves the pool with the last
+	void Release(unsigned m) {
+		if (--modelUsers[m])
+			return;
+		stats.residentBytes -= modelRanges[m].size;
+		if (retireUpdates) {
+			retired.push_back({ updateCount, modelRanges[m] });
+			stats.retiredBytes += modelRanges[m].size;
+		}
+		else
+			pool.Free(modelRanges[m].offset, modelRanges[m].size);
+		modelRanges[m] = STREAM_RANGE();
+	}
+	void Unload(unsigned c) {
+		if (unload)
+			unload(cells[c]);
+		cells[c].state = STREAM_CELL::UNLOADED;
+		for (unsigned m : cells[c].models)
+			Release(m);
+		--stats.residentCells;
+		++stats.unloads;
+	}
+	// Takes a user of every model the cell draws and places the unplaced ones
+	// in cell.uploads. A full pool evicts resident cells outside the load
+	// radius, farthest first; cells inside it are never evicted. Returns false,
+	// with nothing taken, when the cell still doesn't fit.
+	bool Place(unsigned c) {
+		STREAM_CELL& cell = cells[c];
+		cell.uploads.clear();
+		for (size_t i = 0; i < cell.models.size(); ++i) {
+			unsigned m = cell.models[i];
+			if (modelUsers[m]++) // the cell's user keeps it from being evicted below
+				continue;
+			STREAM_RANGE range = { 0, modelBytes[m] };
+			while (pool.Allocate(range.size, range.offset) == false) {
+				unsigned farthest = ~0u;
+				for (unsigned r = 0; r < cells.size(); ++r)
+					if (cells[r].state == STREAM_CELL::RESIDENT && distances[r] > loadRadius &&
+						(farthest == ~0u || distances[r] > distances[farthest]))
+						farthest = r;
+				if (farthest == ~0u) {
+					// ranges placed here were never written and go straight back
+					modelUsers[m] = 0;
+					for (const STREAM_UPLOAD& upload : cell.uploads) {
+						pool.Free(upload.range.offset, upload.range.size);
+						stats.residentBytes -= upload.range.size;
+						modelUsers[upload.model] = 0;
+						modelRanges[upload.model] = STREAM_RANGE();
+					}
+					for (size_t j = 0; j < i; ++j)
+						if (modelUsers[cell.models[j]])
+							Release(cell.models[j]);
+					cell.uploads.clear();
+					return false;
+				}
+				Unload(farthest);
+			}
+			modelRanges[m] = range;
+			stats.residentBytes += range.size;
+			cell.uploads.push_back({ m, range });
+		}
+		stats.modelUploads += cell.uploads.size();
+		return true;
+	}
+};
+#endif
@@ -3,7 +3,25 @@
 
 // This reads .h2b files which are optimized binary .obj+.mtl files
 #include "h2bParser.h"
+// Fills in v2 data (bounds etc.) when an older .h2b file does not carry it
+#include "h2bBaker.h"
+// 16 byte vertex encoding used for GPU upload
+#include "h2bPacked.h"
+// Spatial queries over instance world bounds
+#include "instance_bvh.h"
+// 32 byte translation, rotation and scale instance transforms
+#include "compact_transform.h"
+// SIMD kernels over GMATRIXF arrays
+#include "batch_matrix.h"
+// Parent/child placement of level objects
+#include "level_hierarchy.h"
+// Canonical texture paths and MTL map options
+#include "texture_registry.h"
+#include "sampler_cache.h"
+// PROFILE_SCOPE timers, load phases show in the trace
+#include "profiler.h"
 #include <map>
+#include <deque>
 
 class Level_Data {
 
@@ -14,30 +32,81 @@ public:
 	{
 		unsigned vertexCount, indexCount, materialCount, meshCount;
 		unsigned vertexStart, indexStart, materialStart, meshStart, batchStart;
+		H2B::BOUNDS bounds; // local space bounds of all meshes
+		unsigned lodCount; // most LOD levels of any mesh
+		float lodError[H2B_MAX_LODS]; // worst mesh error at each level
+		bool shortIndices; // under 65536 vertices, drawn from levelIndices16
+		unsigned gpuIndexStart; // offset in levelIndices16 or levelIndices32
 	};
 	struct MODEL_INSTANCES // each instance of a model in the level
 	{
 		unsigned modelIndex, transformStart, transformCount, flags; // flags optional
 	};
+	enum INSTANCE_FLAGS {
+		INSTANCE_DYNAMIC = 1 << 0, // moves at runtime, never merged by MergeStaticInstances
+	};
+	struct LEVEL_PATCH // one difference between the resident level and a re-export
+	{
+		enum OP { MOVE, ADD, REMOVE } op;
+		unsigned modelIndex;
+		unsigned transformIndex; // resident transform for MOVE and REMOVE
+		GW::MATH::GMATRIXF transform; // new world matrix (the old one for REMOVE)
+		std::string name; // Blender object name
+	};
+	struct TRANSFORM_RANGE // levelTransforms entries rewritten by ApplyPatches
+	{
+		unsigned start, count;
+	};
 	struct MATERIAL_TEXTURES // swaps string pointers for loaded texture offsets
 	{
 		unsigned int albedoIndex, roughnessIndex, metalIndex, normalIndex;
 	};
 	// All geometry data combined for level to be loaded onto the video card
 	std::vector<H2B::VERTEX> levelVertices;
+	// levelVertices encoded relative to each LEVEL_MODEL's bounds (see h2bPacked.h)
+	std::vector<H2B::PACKED_VERTEX> levelPackedVertices;
 	std::vector<unsigned> levelIndices;
+	// levelIndices split by the width each model needs for upload. Indices stay
+	// local to their model (vertexStart is applied as the draw's vertexOffset).
+	std::vector<uint16_t> levelIndices16;
+	std::vector<unsigned> levelIndices32;
 	// All material data used by the level
 	std::vector<H2B::MATERIAL> levelMaterials;
-	// This could be populated by the Level_Renderer during GPU transfer
+	// Maps of each material as levelTextureFiles indices, ~0u where a material
+	// has none (see BuildTextureTable)
 	std::vector<MATERIAL_TEXTURES> levelTextures; // same size as LevelMaterials
+	std::vector<std::string> levelTextureFiles; // every distinct map file, canonical paths
 	// All transform data used by each model
 	std::vector<GW::MATH::GMATRIXF> levelTransforms;
+	std::vector<std::string> levelInstanceNames; // Blender object names, same size as levelTransforms
 	// All required drawing information combined
 	std::vector<H2B::BATCH> levelBatches;
 	std::vector<H2B::MESH> levelMeshes;
+	std::vector<H2B::BOUNDS> levelBounds; // local space, same size as levelMeshes
+	std::vector<H2B::LOD> levelLods; // same size as levelMeshes, offsets work like drawInfo
+	// Meshlets of every mesh's full detail range (see H2B::BakeMeshlets). Ranges
+	// and meshlet offsets are rebased into these arrays, meshlet vertices stay
+	// local to their model like the indices do.
+	std::vector<H2B::MESHLET_RANGE> levelMeshletRanges; // same size as levelMeshes
+	std::vector<H2B::MESHLET> levelMeshlets;
+	std::vector<unsigned> levelMeshletVertices;
+	std::vector<unsigned char> levelMeshletTriangles; // 3 local vertex numbers per triangle
 	std::vector<LEVEL_MODEL> levelModels;
+	std::vector<std::string> levelModelFiles; // .h2b of each model, empty for merged chunks
 	// what we actually draw once loaded (using GPU instancing)
 	std::vector<MODEL_INSTANCES> levelInstances;
+	// World space box of every transform, same size as levelTransforms
+	std::vector<GW::MATH::GAABBCEF> levelInstanceBounds;
+	// levelTransforms as 32 byte TRS where possible, same size as levelTransforms
+	std::vector<COMPACT_TRANSFORM> levelCompactTransforms;
+	// inverse transpose of each levelTransforms entry, what normals are multiplied by
+	std::vector<GW::MATH::GMATRIXF> levelNormalMatrices;
+	// 1 where levelTransforms can transform normals itself and levelNormalMatrices is not needed
+	std::vector<uint8_t> levelUniformScale;
+	// BVH over levelInstanceBounds, query results are levelTransforms indices
+	Instance_BVH levelSpatialIndex;
+	// Every object of the level file with its parent, mesh nodes place levelTransforms
+	Level_Hierarchy levelHierarchy;
 	
 	// Imports the default level txt format and collects all .h2b data
 	bool LoadLevel(	const char* gameLevelPath, 
@@ -50,11 +119,13 @@ public:
 				// Add model transform to a list of transforms for this model.(instances)
 			// if already encountered, just add its transfrom to the existing model entry.
 		// when finished, traverse model entries to import each model's data to the class.
+		PROFILE_SCOPE("Load level");
 		std::map<std::string, MODEL_ENTRY> uniqueModels; // unique models and their locations
 		log.LogCategorized("EVENT", "LOADING GAME LEVEL [DATA ORIENTED]");
 
+		std::vector<HIERARCHY_OBJECT> objects; // every object with its parent
 		UnloadLevel();// clear previous level data if there is any
-		if (ReadGameLevel(gameLevelPath, uniqueModels, log) == false) {
+		if (ReadGameLevel(gameLevelPath, uniqueModels, log, &objects) == false) {
 			log.LogCategorized("ERROR", "Fatal error reading game level, aborting level load.");
 			return false;
 		}
@@ -62,6 +133,10 @@ public:
 			log.LogCategorized("ERROR", "Fatal error combining H2B mesh data, aborting level load.");
 			return false;
 		}
+		levelHierarchy.Build(objects);
+		LinkHierarchy(log);
+		BuildInstanceData(log);
+		BuildTextureTable(log);
 		// level loaded into CPU ram
 		log.LogCategorized("EVENT", "GAME LEVEL WAS LOADED TO CPU [DATA ORIENTED]");
 		return true;
@@ -70,14 +145,416 @@ public:
 	void UnloadLevel() {
 		level_strings.clear();
 		levelVertices.clear();
+		levelPackedVertices.clear();
 		levelIndices.clear();
+		levelIndices16.clear();
+		levelIndices32.clear();
 		levelMaterials.clear();
 		levelTextures.clear();
+		levelTextureFiles.clear();
 		levelBatches.clear();
 		levelMeshes.clear();
+		levelBounds.clear();
+		levelLods.clear();
+		levelMeshletRanges.clear();
+		levelMeshlets.clear();
+		levelMeshletVertices.clear();
+		levelMeshletTriangles.clear();
 		levelModels.clear();
+		levelModelFiles.clear();
 		levelTransforms.clear();
+		levelInstanceNames.clear();
 		levelInstances.clear();
+		levelInstanceBounds.clear();
+		levelCompactTransforms.clear();
+		levelNormalMatrices.clear();
+		levelUniformScale.clear();
+		levelSpatialIndex.Build(levelInstanceBounds);
+		levelHierarchy.Clear();
+	}
+	// Places one instance somewhere else, only the BVH path above it is refit.
+	// Objects attached to it follow on the next UpdateHierarchy.
+	void MoveInstance(unsigned transformIndex, const GW::MATH::GMATRIXF& world) {
+		levelTransforms[transformIndex] = world;
+		UpdateInstanceData(transformIndex, ModelOfTransform(transformIndex));
+		if (levelHierarchy.transformNodes[transformIndex] != ~0u)
+			levelHierarchy.SetWorld(levelHierarchy.transformNodes[transformIndex], world);
+	}
+	// Recomputes world matrices under hierarchy nodes moved since the last call
+	// (levelHierarchy.SetLocal / SetWorld, MoveInstance) and refreshes the instance
+	// data of every transform that changed. Cost follows the moved subtrees only.
+	void UpdateHierarchy(unsigned threads = std::thread::hardware_concurrency()) {
+		if (levelHierarchy.Dirty() == false)
+			return;
+		levelHierarchy.Update(levelTransforms.data(), hierarchyChanged, threads);
+		for (unsigned k : hierarchyChanged)
+			UpdateInstanceData(k, ModelOfTransform(k));
+	}
+	// Re-reads one model's .h2b over its current data. Only works while the model
+	// keeps the same layout (vertex, index, material, mesh and meshlet counts) so
+	// every offset stays valid, returns false when a full LoadLevel is needed.
+	bool ReloadModel(unsigned modelIndex, const char* h2bPath, GW::SYSTEM::GLog log) {
+		H2B::Parser p;
+		if (p.Parse(h2bPath) == false) {
+			log.LogCategorized("ERROR", (std::string("H2B Reload Failed: ") + h2bPath).c_str());
+			return false;
+		}
+		PrepareModel(p, log);
+		LEVEL_MODEL& model = levelModels[modelIndex];
+		const H2B::MESHLET_RANGE& firstRange = levelMeshletRanges[model.meshStart];
+		unsigned meshletCount = 0, meshletVertexCount = 0, meshletTriangleCount = 0;
+		for (unsigned i = model.meshStart; i < model.meshStart + model.meshCount; ++i)
+			meshletCount += levelMeshletRanges[i].meshletCount;
+		for (unsigned i = firstRange.meshletOffset; i < firstRange.meshletOffset + meshletCount; ++i) {
+			meshletVertexCount += levelMeshlets[i].vertexCount;
+			meshletTriangleCount += levelMeshlets[i].triangleCount;
+		}
+		if (p.vertexCount != model.vertexCount || p.indexCount + p.lodIndices.size() != model.indexCount ||
+			p.materialCount != model.materialCount || p.meshCount != model.meshCount ||
+			p.meshlets.size() != meshletCount || p.meshletVertices.size() != meshletVertexCount ||
+			p.meshletTriangles.size() != meshletTriangleCount * 3) {
+			log.LogCategorized("INFO", (std::string("H2B layout changed, level needs a full reload: ") + h2bPath).c_str());
+			return false;
+		}
+		SummarizeModel(p, model);
+		std::copy(p.vertices.begin(), p.vertices.end(), levelVertices.begin() + model.vertexStart);
+		std::vector<H2B::PACKED_VERTEX> packed;
+		H2B::PACKING_ERROR packingError = {};
+		H2B::PackVertices(p.vertices.data(), p.vertexCount, model.bounds.min, model.bounds.max, packed, packingError);
+		std::copy(packed.begin(), packed.end(), levelPackedVertices.begin() + model.vertexStart);
+		std::vector<unsigned>::iterator indices = levelIndices.begin() + model.indexStart;
+		indices = std::copy(p.indices.begin(), p.indices.end(), indices);
+		std::copy(p.lodIndices.begin(), p.lodIndices.end(), indices);
+		indices = levelIndices.begin() + model.indexStart;
+		if (model.shortIndices)
+			std::copy(indices, indices + model.indexCount, levelIndices16.begin() + model.gpuIndexStart);
+		else
+			std::copy(indices, indices + model.indexCount, levelIndices32.begin() + model.gpuIndexStart);
+		std::copy(p.materials.begin(), p.materials.end(), levelMaterials.begin() + model.materialStart);
+		BuildTextureTable(log);
+		std::copy(p.batches.begin(), p.batches.end(), levelBatches.begin() + model.batchStart);
+		std::copy(p.meshes.begin(), p.meshes.end(), levelMeshes.begin() + model.meshStart);
+		std::copy(p.bounds.begin(), p.bounds.end(), levelBounds.begin() + model.meshStart);
+		std::copy(p.lods.begin(), p.lods.end(), levelLods.begin() + model.meshStart);
+		// meshlet tables keep the model's existing place in the level arrays
+		unsigned meshletStart = firstRange.meshletOffset;
+		unsigned vertexStart = meshletCount ? levelMeshlets[meshletStart].vertexOffset : 0;
+		unsigned triangleStart = meshletCount ? levelMeshlets[meshletStart].triangleOffset : 0;
+		for (unsigned j = 0; j < p.meshCount; ++j) {
+			H2B::MESHLET_RANGE range = p.meshletRanges[j];
+			range.meshletOffset += meshletStart;
+			levelMeshletRanges[model.meshStart + j] = range;
+		}
+		for (unsigned j = 0; j < p.meshlets.size(); ++j) {
+			H2B::MESHLET meshlet = p.meshlets[j];
+			meshlet.vertexOffset += vertexStart;
+			meshlet.triangleOffset += triangleStart;
+			levelMeshlets[meshletStart + j] = meshlet;
+		}
+		std::copy(p.meshletVertices.begin(), p.meshletVertices.end(), levelMeshletVertices.begin() + vertexStart);
+		std::copy(p.meshletTriangles.begin(), p.meshletTriangles.end(), levelMeshletTriangles.begin() + triangleStart * 3);
+		// instance boxes follow the new model bounds
+		for (const MODEL_INSTANCES& instances : levelInstances)
+			if (instances.modelIndex == modelIndex)
+				for (unsigned k = instances.transformStart; k < instances.transformStart + instances.transformCount; ++k) {
+					UpdateInstanceData(k, modelIndex);
+				}
+		log.LogCategorized("INFO", (std::string("H2B Reloaded: ") + h2bPath).c_str());
+		log.Flush();
+		return true;
+	}
+	// Compares a re-exported level file with the resident instances, matching
+	// them by model file plus Blender object name (repeated names pair up in file
+	// order). Returns false when the file places a model that is not loaded or the
+	// level holds merged chunks, both need a full LoadLevel.
+	bool DiffInstances(const char* gameLevelPath, std::vector<LEVEL_PATCH>& patches, GW::SYSTEM::GLog log) {
+		patches.clear();
+		if (std::find(levelModelFiles.begin(), levelModelFiles.end(), "") != levelModelFiles.end()) {
+			log.LogCategorized("INFO", "Level has merged static chunks, it needs a full reload.");
+			return false;
+		}
+		std::map<std::string, MODEL_ENTRY> uniqueModels;
+		if (ReadGameLevel(gameLevelPath, uniqueModels, log) == false)
+			return false;
+		// resident transforms of every model and name, in levelTransforms order
+		std::map<std::pair<unsigned, std::string>, std::deque<unsigned>> resident;
+		for (const MODEL_INSTANCES& instances : levelInstances)
+			for (unsigned k = instances.transformStart; k < instances.transformStart + instances.transformCount; ++k)
+				resident[{ instances.modelIndex, levelInstanceNames[k] }].push_back(k);
+		unsigned moved = 0, added = 0, removed = 0;
+		for (auto i = uniqueModels.begin(); i != uniqueModels.end(); ++i) {
+			auto file = std::find(levelModelFiles.begin(), levelModelFiles.end(), i->second.modelFile);
+			if (file == levelModelFiles.end()) {
+				log.LogCategorized("INFO", (std::string("New model placed, level needs a full reload: ") + i->second.modelFile).c_str());
+				patches.clear();
+				return false;
+			}
+			unsigned modelIndex = unsigned(file - levelModelFiles.begin());
+			for (unsigned n = 0; n < i->second.instances.size(); ++n) {
+				const GW::MATH::GMATRIXF& world = i->second.instances[n];
+				auto found = resident.find({ modelIndex, i->second.names[n] });
+				if (found == resident.end() || found->second.empty()) {
+					patches.push_back({ LEVEL_PATCH::ADD, modelIndex, 0, world, i->second.names[n] });
+					++added;
+					continue;
+				}
+				unsigned k = found->second.front();
+				found->second.pop_front();
+				if (std::memcmp(&levelTransforms[k], &world, sizeof(GW::MATH::GMATRIXF)) != 0) {
+					patches.push_back({ LEVEL_PATCH::MOVE, modelIndex, k, world, i->second.names[n] });
+					++moved;
+				}
+			}
+		}
+		// whatever found no partner is gone from the file
+		for (const auto& unmatched : resident)
+			for (unsigned k : unmatched.second) {
+				patches.push_back({ LEVEL_PATCH::REMOVE, unmatched.first.first, k, levelTransforms[k], unmatched.first.second });
+				++removed;
+			}
+		std::string report = "Level diff: " + std::to_string(moved) + " moved, " + std::to_string(added) +
+			" added, " + std::to_string(removed) + " removed";
+		log.LogCategorized("INFO", report.c_str());
+		return true;
+	}
+	// Applies DiffInstances output. Moves are written in place and refit the BVH,
+	// adds and removes repack the transforms from the first instance set they
+	// touch onward and rebuild it. dirty receives the sorted levelTransforms ranges
+	// that changed. Returns true when instance counts changed, so anything sized
+	// or ordered by levelTransforms must be rebuilt.
+	bool ApplyPatches(const std::vector<LEVEL_PATCH>& patches, std::vector<TRANSFORM_RANGE>& dirty, GW::SYSTEM::GLog log) {
+		dirty.clear();
+		bool resized = false;
+		for (const LEVEL_PATCH& patch : patches)
+			resized = resized || patch.op != LEVEL_PATCH::MOVE;
+		std::vector<unsigned> written, movedNodes;
+		std::vector<GW::MATH::GMATRIXF> movedWorlds;
+		for (const LEVEL_PATCH& patch : patches) {
+			if (patch.op != LEVEL_PATCH::MOVE)
+				continue;
+			levelTransforms[patch.transformIndex] = patch.transform;
+			if (resized == false) // otherwise the rebuild below covers it
+				UpdateInstanceData(patch.transformIndex, patch.modelIndex);
+			if (levelHierarchy.transformNodes[patch.transformIndex] != ~0u) {
+				movedNodes.push_back(levelHierarchy.transformNodes[patch.transformIndex]);
+				movedWorlds.push_back(patch.transform);
+			}
+			written.push_back(patch.transformIndex);
+		}
+		// children moved with their parent come as moves of their own
+		levelHierarchy.SetWorlds(movedNodes, movedWorlds);
+		unsigned shiftedFrom = ~0u; // first transform whose index or data moved by a repack
+		if (resized) {
+			std::vector<bool> removed(levelTransforms.size(), false);
+			std::vector<std::vector<const LEVEL_PATCH*>> added(levelModels.size());
+			for (const LEVEL_PATCH& patch : patches) {
+				if (patch.op == LEVEL_PATCH::REMOVE)
+					removed[patch.transformIndex] = true;
+				else if (patch.op == LEVEL_PATCH::ADD)
+					added[patch.modelIndex].push_back(&patch);
+			}
+			std::vector<GW::MATH::GMATRIXF> transforms;
+			std::vector<std::string> names;
+			transforms.reserve(levelTransforms.size());
+			for (MODEL_INSTANCES& instances : levelInstances) {
+				unsigned start = transforms.size();
+				bool touched = start != instances.transformStart || added[instances.modelIndex].size();
+				for (unsigned k = instances.transformStart; k < instances.transformStart + instances.transformCount; ++k) {
+					touched = touched || removed[k];
+					if (removed[k] == false) {
+						transforms.push_back(levelTransforms[k]);
+						names.push_back(levelInstanceNames[k]);
+					}
+				}
+				for (const LEVEL_PATCH* patch : added[instances.modelIndex]) {
+					transforms.push_back(patch->transform);
+					names.push_back(patch->name);
+				}
+				if (touched && shiftedFrom == ~0u)
+					shiftedFrom = start;
+				instances.transformStart = start;
+				instances.transformCount = transforms.size() - start;
+			}
+			levelTransforms = std::move(transforms);
+			levelInstanceNames = std::move(names);
+			LinkHierarchy(log); // added objects stay outside it, removed ones leave nodes placing nothing
+			BuildInstanceData(log);
+		}
+		// coalesce single moves ahead of the repacked tail
+		std::sort(written.begin(), written.end());
+		for (unsigned k : written) {
+			if (k >= shiftedFrom)
+				break;
+			if (dirty.size() && dirty.back().start + dirty.back().count == k)
+				++dirty.back().count;
+			else
+				dirty.push_back({ k, 1 });
+		}
+		if (shiftedFrom < levelTransforms.size())
+			dirty.push_back({ shiftedFrom, unsigned(levelTransforms.size()) - shiftedFrom });
+		return resized;
+	}
+	// Re-reads the level file and patches the resident instances to match it,
+	// returns false when a full LoadLevel is needed (see DiffInstances)
+	bool ReloadInstances(const char* gameLevelPath, GW::SYSTEM::GLog log) {
+		std::vector<LEVEL_PATCH> patches;
+		std::vector<TRANSFORM_RANGE> dirty;
+		if (DiffInstances(gameLevelPath, patches, log) == false)
+			return false;
+		ApplyPatches(patches, dirty, log);
+		log.Flush();
+		return true;
+	}
+	// Optional bake step run after LoadLevel. Instances of small static models are
+	// pre-transformed into world space and merged per material into chunks of
+	// chunkSize world units, trading instancing for far fewer draw calls. Only
+	// models up to maxModelTriangles whose every instance fits inside a chunk are
+	// merged, and nothing changes unless that lowers the draw count.
+	// Each chunk becomes a new LEVEL_MODEL with a single identity transform.
+	void MergeStaticInstances(float chunkSize, unsigned maxModelTriangles, GW::SYSTEM::GLog log) {
+		log.LogCategorized("MESSAGE", "Begin Merging Static Instances.");
+		unsigned drawsBefore = CountDraws();
+		// find the chunk cell of every instance that could be merged
+		struct CELL {
+			int x, y, z;
+			bool operator<(const CELL& o) const {
+				return x != o.x ? x < o.x : y != o.y ? y < o.y : z < o.z;
+			}
+		};
+		std::vector<bool> merged(levelTransforms.size(), false);
+		std::vector<CELL> cells(levelTransforms.size());
+		unsigned drawsRemoved = 0;
+		for (const MODEL_INSTANCES& instances : levelInstances) {
+			const LEVEL_MODEL& model = levelModels[instances.modelIndex];
+			unsigned triangles = 0;
+			for (unsigned i = model.meshStart; i < model.meshStart + model.meshCount; ++i)
+				triangles += levelMeshes[i].drawInfo.indexCount / 3;
+			if ((instances.flags & INSTANCE_DYNAMIC) || triangles > maxModelTriangles || instances.transformCount == 0)
+				continue;
+			// instancing already draws a model once, merging only pays when all of it goes
+			bool fits = true;
+			for (unsigned k = instances.transformStart; fits && k < instances.transformStart + instances.transformCount; ++k) {
+				const GW::MATH::GMATRIXF& m = levelTransforms[k];
+				float scale = std::sqrt(std::fmax(m.row1.x * m.row1.x + m.row1.y * m.row1.y + m.row1.z * m.row1.z,
+					std::fmax(m.row2.x * m.row2.x + m.row2.y * m.row2.y + m.row2.z * m.row2.z,
+						m.row3.x * m.row3.x + m.row3.y * m.row3.y + m.row3.z * m.row3.z)));
+				fits = model.bounds.radius * scale <= chunkSize * 0.5f;
+				cells[k] = { int(std::floor(m.row4.x / chunkSize)), int(std::floor(m.row4.y / chunkSize)),
+							 int(std::floor(m.row4.z / chunkSize)) };
+			}
+			if (fits == false)
+				continue;
+			for (unsigned k = instances.transformStart; k < instances.transformStart + instances.transformCount; ++k)
+				merged[k] = true;
+			drawsRemoved += model.meshCount;
+		}
+		// build one model per cell with one mesh per distinct material
+		std::map<CELL, MERGE_CHUNK> chunks;
+		unsigned mergedCount = 0, drawsAdded = 0;
+		for (const MODEL_INSTANCES& instances : levelInstances) {
+			for (unsigned k = instances.transformStart; k < instances.transformStart + instances.transformCount; ++k) {
+				if (merged[k] == false)
+					continue;
+				AppendWorldInstance(chunks[cells[k]], levelModels[instances.modelIndex], levelTransforms[k]);
+				++mergedCount;
+			}
+		}
+		for (const auto& cell : chunks)
+			drawsAdded += cell.second.materials.size();
+		if (drawsAdded >= drawsRemoved) {
+			std::string skipped = "Merging " + std::to_string(mergedCount) + " instances would need " +
+				std::to_string(drawsAdded) + " draw calls to replace " + std::to_string(drawsRemoved) +
+				", level left as is (try a larger chunk size).";
+			log.LogCategorized("INFO", skipped.c_str());
+			log.LogCategorized("MESSAGE", "Merging Static Instances Complete.");
+			return;
+		}
+		// drop merged transforms, instance sets stay parallel to levelModels
+		std::vector<GW::MATH::GMATRIXF> kept;
+		std::vector<std::string> keptNames;
+		for (MODEL_INSTANCES& instances : levelInstances) {
+			unsigned start = kept.size();
+			for (unsigned k = instances.transformStart; k < instances.transformStart + instances.transformCount; ++k)
+				if (merged[k] == false) {
+					kept.push_back(levelTransforms[k]);
+					keptNames.push_back(levelInstanceNames[k]);
+				}
+			instances.transformStart = start;
+			instances.transformCount = kept.size() - start;
+		}
+		levelTransforms = std::move(kept);
+		levelInstanceNames = std::move(keptNames);
+		// chunks go through the same path as loaded models (bounds, LODs, meshlets...)
+		H2B::PACKING_ERROR packingError = {};
+		const std::vector<GW::MATH::GMATRIXF> identity = { GW::MATH::GIdentityMatrixF };
+		H2B::Parser p;
+		for (auto& cell : chunks) {
+			MERGE_CHUNK& chunk = cell.second;
+			p.Clear();
+			p.vertices = std::move(chunk.vertices);
+			p.materials = chunk.materials;
+			for (unsigned j = 0; j < chunk.materials.size(); ++j) {
+				H2B::BATCH batch = { unsigned(chunk.indices[j].size()), unsigned(p.indices.size()) };
+				p.indices.insert(p.indices.end(), chunk.indices[j].begin(), chunk.indices[j].end());
+				p.batches.push_back(batch);
+				p.meshes.push_back({ "merged_static_chunk", batch, j });
+			}
+			p.vertexCount = p.vertices.size();
+			p.indexCount = p.indices.size();
+			p.materialCount = p.materials.size();
+			p.meshCount = p.meshes.size();
+			CombineModel(p, identity, packingError, log);
+			levelModelFiles.push_back("");
+			levelInstanceNames.push_back("merged_static_chunk");
+		}
+		std::string report = "Merged " + std::to_string(mergedCount) + " static instances into " +
+			std::to_string(chunks.size()) + " chunks, draw calls " + std::to_string(drawsBefore) +
+			" -> " + std::to_string(CountDraws());
+		log.LogCategorized("INFO", report.c_str());
+		LinkHierarchy(log);
+		BuildInstanceData(log);
+		BuildTextureTable(log);
+		log.LogCategorized("MESSAGE", "Merging Static Instances Complete.");
+	}
+	// Resolves the maps of every material into levelTextures: MTL options are
+	// stripped, paths made canonical and each file listed once in
+	// levelTextureFiles however many materials or map slots use it. Albedo is
+	// map_Kd, roughness map_Ns (Blender exports roughness as the specular
+	// exponent map), metal map_Ks (H2B carries no map_Pm) and normal bump.
+	void BuildTextureTable(GW::SYSTEM::GLog log) {
+		levelTextures.assign(levelMaterials.size(), { ~0u, ~0u, ~0u, ~0u });
+		levelTextureFiles.clear();
+		std::map<std::string, unsigned> files;
+		unsigned maps = 0;
+		for (unsigned i = 0; i < levelMaterials.size(); ++i) {
+			const H2B::MATERIAL& material = levelMaterials[i];
+			const char* sources[4] = { material.map_Kd, material.map_Ns, material.map_Ks, material.bump };
+			unsigned* indices = &levelTextures[i].albedoIndex;
+			for (unsigned m = 0; m < 4; ++m) {
+				if (sources[m] == nullptr || sources[m][0] == '\0')
+					continue;
+				SAMPLER_STATE unused;
+				std::string file = ParseTextureOptions(sources[m], DefaultSamplerState(), 1, unused);
+				if (file.empty())
+					continue;
+				auto known = files.insert({ Texture_Registry::CanonicalPath(file.c_str()), unsigned(files.size()) });
+				if (known.second)
+					levelTextureFiles.push_back(known.first->first);
+				indices[m] = known.first->second;
+				++maps;
+			}
+		}
+		std::string report = "Texture table: " + std::to_string(maps) + " material maps use " +
+			std::to_string(levelTextureFiles.size()) + " files";
+		log.LogCategorized("INFO", report.c_str());
+	}
+	// Draw calls needed when every mesh of every placed model is drawn once (instanced)
+	unsigned CountDraws() const {
+		unsigned draws = 0;
+		for (const MODEL_INSTANCES& instances : levelInstances)
+			if (instances.transformCount)
+				draws += levelModels[instances.modelIndex].meshCount;
+		return draws;
 	}
 	// *NO RENDERING/GPU/DRAW LOGIC IN HERE PLEASE* 
 	// *DATA ORIENTED SHOULD AIM TO SEPERATE DATA FROM THE LOGIC THAT USES IT*
@@ -85,16 +562,153 @@ public:
 	// You can use your chosen API to have one GPU buffer for each type of data.
 	// Then you loop through instances using the API features to draw each mesh only once.
 private:
+	std::vector<unsigned> hierarchyChanged; // UpdateHierarchy scratch
+
+	// levelInstances entry holding transformIndex (instance sets are packed in order)
+	unsigned ModelOfTransform(unsigned transformIndex) const {
+		auto after = std::upper_bound(levelInstances.begin(), levelInstances.end(), transformIndex,
+			[](unsigned k, const MODEL_INSTANCES& instances) { return k < instances.transformStart; });
+		while (after != levelInstances.begin() && (--after)->transformCount == 0)
+			;
+		return after->modelIndex;
+	}
+	// Points hierarchy mesh nodes at the levelTransforms entry with the same model
+	// file and Blender object name (repeated names pair up in order). Instance sets
+	// with attached or parent objects are flagged dynamic so merging leaves them.
+	void LinkHierarchy(GW::SYSTEM::GLog log) {
+		std::map<std::pair<std::string, std::string>, std::deque<unsigned>> lookup;
+		for (const MODEL_INSTANCES& instances : levelInstances)
+			for (unsigned k = instances.transformStart; k < instances.transformStart + instances.transformCount; ++k)
+				lookup[{ levelModelFiles[instances.modelIndex], levelInstanceNames[k] }].push_back(k);
+		unsigned linked = 0;
+		for (unsigned n = 0; n < levelHierarchy.transforms.size(); ++n) {
+			levelHierarchy.transforms[n] = ~0u;
+			if (levelHierarchy.modelFiles[n].empty())
+				continue;
+			auto found = lookup.find({ levelHierarchy.modelFiles[n], levelHierarchy.names[n] });
+			if (found == lookup.end() || found->second.empty())
+				continue;
+			levelHierarchy.transforms[n] = found->second.front();
+			found->second.pop_front();
+			++linked;
+		}
+		levelHierarchy.IndexTransforms(levelTransforms.size());
+		for (unsigned n = 0; n < levelHierarchy.transforms.size(); ++n)
+			if (levelHierarchy.transforms[n] != ~0u && (levelHierarchy.parents[n] != ~0u || levelHierarchy.childCount[n]))
+				levelInstances[ModelOfTransform(levelHierarchy.transforms[n])].flags |= INSTANCE_DYNAMIC;
+		std::string report = "Hierarchy: " + std::to_string(levelHierarchy.parents.size()) + " objects, " +
+			std::to_string(levelHierarchy.levels.size() > 1 ? levelHierarchy.levels[1] : 0) + " roots, depth " +
+			std::to_string(levelHierarchy.Depth()) + ", " + std::to_string(linked) + " placing instances";
+		log.LogCategorized("INFO", report.c_str());
+	}
+	// model bounds as center and extent, placed by BatchTransformAABB
+	static GW::MATH::GAABBCEF LocalBounds(const H2B::BOUNDS& local) {
+		GW::MATH::GAABBCEF box;
+		box.center = { (local.min.x + local.max.x) * 0.5f, (local.min.y + local.max.y) * 0.5f, (local.min.z + local.max.z) * 0.5f, 0 };
+		box.extent = { (local.max.x - local.min.x) * 0.5f, (local.max.y - local.min.y) * 0.5f, (local.max.z - local.min.z) * 0.5f, 0 };
+		return box;
+	}
+	// Everything derived from levelTransforms, rebuilt whenever instances are added or removed
+	void BuildInstanceData(GW::SYSTEM::GLog log) {
+		PROFILE_SCOPE("Build instance data");
+		levelInstanceBounds.resize(levelTransforms.size());
+		levelCompactTransforms.resize(levelTransforms.size());
+		levelNormalMatrices.resize(levelTransforms.size());
+		levelUniformScale.resize(levelTransforms.size());
+		BatchNormalMatrices(levelTransforms.data(), levelNormalMatrices.data(), levelUniformScale.data(), levelTransforms.size());
+		size_t nonUniform = std::count(levelUniformScale.begin(), levelUniformScale.end(), 0);
+		for (const MODEL_INSTANCES& instances : levelInstances)
+			BatchTransformAABB(LocalBounds(levelModels[instances.modelIndex].bounds), levelTransforms.data() + instances.transformStart,
+				levelInstanceBounds.data() + instances.transformStart, instances.transformCount);
+		unsigned fullMatrices = 0;
+		for (unsigned k = 0; k < levelTransforms.size(); ++k)
+			if (EncodeCompactTransform(levelTransforms[k], levelCompactTransforms[k]) == false)
+				++fullMatrices;
+		levelSpatialIndex.Build(levelInstanceBounds);
+		std::string report = "Spatial index: " + std::to_string(levelSpatialIndex.nodes.size()) +
+			" BVH nodes over " + std::to_string(levelInstanceBounds.size()) + " instances";
+		log.LogCategorized("INFO", report.c_str());
+		report = "Compact transforms: " + std::to_string(levelTransforms.size() - fullMatrices) +
+			" TRS, " + std::to_string(fullMatrices) + " kept as full matrices (shear)";
+		log.LogCategorized("INFO", report.c_str());
+		report = "Normal matrices: " + std::to_string(nonUniform) + " of " + std::to_string(levelTransforms.size()) +
+			" instances scale non uniformly and use their inverse transpose";
+		log.LogCategorized("INFO", report.c_str());
+	}
+	// Same for one moved instance, only the BVH path above it is refit
+	void UpdateInstanceData(unsigned transformIndex, unsigned modelIndex) {
+		BatchTransformAABB(LocalBounds(levelModels[modelIndex].bounds), levelTransforms.data() + transformIndex,
+			levelInstanceBounds.data() + transformIndex, 1);
+		levelSpatialIndex.Update(transformIndex, levelInstanceBounds[transformIndex]);
+		EncodeCompactTransform(levelTransforms[transformIndex], levelCompactTransforms[transformIndex]);
+		BatchNormalMatrices(&levelTransforms[transformIndex], &levelNormalMatrices[transformIndex],
+			&levelUniformScale[transformIndex], 1);
+	}
+	// world space geometry gathered for one MergeStaticInstances cell
+	struct MERGE_CHUNK
+	{
+		std::vector<H2B::VERTEX> vertices;
+		std::vector<H2B::MATERIAL> materials; // distinct by attributes and texture maps
+		std::vector<std::vector<unsigned>> indices; // per material
+	};
+	// appends every mesh of model placed by world to the chunk
+	void AppendWorldInstance(MERGE_CHUNK& chunk, const LEVEL_MODEL& model, const GW::MATH::GMATRIXF& world) {
+		const GW::MATH::GMATRIXF& m = world;
+		// normals use the cofactor matrix (inverse transpose up to scale)
+		H2B::VECTOR r1 = { m.row1.x, m.row1.y, m.row1.z };
+		H2B::VECTOR r2 = { m.row2.x, m.row2.y, m.row2.z };
+		H2B::VECTOR r3 = { m.row3.x, m.row3.y, m.row3.z };
+		H2B::VECTOR c1 = H2B::Cross(r2, r3), c2 = H2B::Cross(r3, r1), c3 = H2B::Cross(r1, r2);
+		bool mirrored = H2B::Dot(r1, c1) < 0; // flips winding and normals
+		unsigned base = chunk.vertices.size();
+		for (unsigned v = model.vertexStart; v < model.vertexStart + model.vertexCount; ++v) {
+			H2B::VERTEX out = levelVertices[v];
+			const H2B::VECTOR& p = levelVertices[v].pos;
+			const H2B::VECTOR& n = levelVertices[v].nrm;
+			out.pos = { p.x * m.row1.x + p.y * m.row2.x + p.z * m.row3.x + m.row4.x,
+						p.x * m.row1.y + p.y * m.row2.y + p.z * m.row3.y + m.row4.y,
+						p.x * m.row1.z + p.y * m.row2.z + p.z * m.row3.z + m.row4.z };
+			out.nrm = H2B::Normalize({ n.x * c1.x + n.y * c2.x + n.z * c3.x,
+									   n.x * c1.y + n.y * c2.y + n.z * c3.y,
+									   n.x * c1.z + n.y * c2.z + n.z * c3.z });
+			if (mirrored)
+				out.nrm = { -out.nrm.x, -out.nrm.y, -out.nrm.z };
+			chunk.vertices.push_back(out);
+		}
+		for (unsigned i = model.meshStart; i < model.meshStart + model.meshCount; ++i) {
+			const H2B::MESH& mesh = levelMeshes[i];
+			const H2B::MATERIAL& material = levelMaterials[model.materialStart + mesh.materialIndex];
+			unsigned j = 0;
+			for (; j < chunk.materials.size(); ++j) // map strings are shared through level_strings
+				if (std::memcmp(&chunk.materials[j].attrib, &material.attrib, sizeof(H2B::ATTRIBUTES)) == 0 &&
+					std::memcmp(&chunk.materials[j].map_Kd, &material.map_Kd, sizeof(const char*) * 9) == 0)
+					break;
+			if (j == chunk.materials.size()) {
+				chunk.materials.push_back(material);
+				chunk.indices.emplace_back();
+			}
+			std::vector<unsigned>& indices = chunk.indices[j];
+			const unsigned* source = levelIndices.data() + model.indexStart + mesh.drawInfo.indexOffset;
+			for (unsigned t = 0; t + 2 < mesh.drawInfo.indexCount; t += 3) {
+				indices.push_back(base + source[t]);
+				indices.push_back(base + source[t + (mirrored ? 2 : 1)]);
+				indices.push_back(base + source[t + (mirrored ? 1 : 2)]);
+			}
+		}
+	}
 	// internal defintion for reading the GameLevel layout 
 	struct MODEL_ENTRY
 	{
 		std::string modelFile; // path to .h2b file
 		std::vector<GW::MATH::GMATRIXF> instances; // where to draw
+		std::vector<std::string> names; // Blender object name of each instance
 	};
-	// internal helper for reading the game level
+	// internal helper for reading the game level. Every object's type and name
+	// come on the two lines ahead of its matrix (older exports indent children),
+	// v1.1 files follow the matrix with the file order index of the parent.
 	bool ReadGameLevel(const char* gameLevelPath, 
 						std::map<std::string, MODEL_ENTRY>&outModels,
-						GW::SYSTEM::GLog log) {
+						GW::SYSTEM::GLog log, std::vector<HIERARCHY_OBJECT>* outObjects = nullptr) {
 		log.LogCategorized("MESSAGE", "Begin Reading Game Level Text File.");
 		GW::SYSTEM::GFile file;
 		file.Create();
@@ -104,48 +718,184 @@ private:
 			return false;
 		}
 		char linebuffer[1024];
+		std::string type, name; // the last two lines that were not part of a matrix
 		while (+file.ReadLine(linebuffer, 1024, '\n'))
 		{
 			// having to have this is a bug, need to have Read/ReadLine return failure at EOF
 			if (linebuffer[0] == '\0')
 				break;
-			if (std::strcmp(linebuffer, "MESH") == 0)
-			{
-				file.ReadLine(linebuffer, 1024, '\n');
-				log.LogCategorized("INFO", (std::string("Model Detected: ") + linebuffer).c_str());
-				// create the model file name from this (strip the .001)
-				MODEL_ENTRY add = { linebuffer, };
-				add.modelFile = add.modelFile.substr(0, add.modelFile.find_last_of("."));
-				add.modelFile += ".h2b";
-
-				// now read the transform data as we will need that regardless
-				GW::MATH::GMATRIXF transform;
-				for (int i = 0; i < 4; ++i) {
+			const char* line = linebuffer + std::strspn(linebuffer, " \t");
+			int parent = -1;
+			if (std::sscanf(line, "PARENT %d", &parent) == 1) {
+				if (outObjects && outObjects->size())
+					outObjects->back().parent = parent < 0 ? ~0u : unsigned(parent);
+				continue;
+			}
+			if (std::strncmp(line, "<Matrix 4x4", 11) != 0) {
+				type = name;
+				name = line;
+				continue;
+			}
+			// now read the transform data as we will need that regardless
+			GW::MATH::GMATRIXF transform;
+			for (int i = 0; i < 4; ++i) {
+				if (i > 0)
 					file.ReadLine(linebuffer, 1024, '\n');
-					// read floats
-					std::sscanf(linebuffer + 13, "%f, %f, %f, %f",
-						&transform.data[0 + i * 4], &transform.data[1 + i * 4],
-						&transform.data[2 + i * 4], &transform.data[3 + i * 4]);
-				}
-				std::string loc = "Location: X ";
-				loc += std::to_string(transform.row4.x) + " Y " +
-					std::to_string(transform.row4.y) + " Z " + std::to_string(transform.row4.z);
-				log.LogCategorized("INFO", loc.c_str());
+				// read floats
+				const char* row = std::strchr(linebuffer, '(');
+				std::sscanf(row ? row + 1 : linebuffer, "%f, %f, %f, %f",
+					&transform.data[0 + i * 4], &transform.data[1 + i * 4],
+					&transform.data[2 + i * 4], &transform.data[3 + i * 4]);
+			}
+			bool mesh = type == "MESH";
+			if (outObjects)
+				outObjects->push_back({ name, mesh ? name.substr(0, name.find_last_of(".")) + ".h2b" : "", ~0u, transform });
+			if (mesh == false)
+				continue;
+			log.LogCategorized("INFO", (std::string("Model Detected: ") + name).c_str());
+			// create the model file name from this (strip the .001)
+			MODEL_ENTRY add = {};
+			add.modelFile = name.substr(0, name.find_last_of(".")) + ".h2b";
 
-				// does this model already exist?
-				auto found = outModels.find(add.modelFile);
-				if (found == outModels.end()) // no
-				{
-					add.instances.push_back(transform);
-					outModels[add.modelFile] = add;
-				}
-				else // yes
-					found->second.instances.push_back(transform);
+			std::string loc = "Location: X ";
+			loc += std::to_string(transform.row4.x) + " Y " +
+				std::to_string(transform.row4.y) + " Z " + std::to_string(transform.row4.z);
+			log.LogCategorized("INFO", loc.c_str());
+
+			// does this model already exist?
+			auto found = outModels.find(add.modelFile);
+			if (found == outModels.end()) // no
+			{
+				add.instances.push_back(transform);
+				add.names.push_back(name);
+				outModels[add.modelFile] = add;
+			}
+			else { // yes
+				found->second.instances.push_back(transform);
+				found->second.names.push_back(name);
 			}
 		}
 		log.LogCategorized("MESSAGE", "Game Level File Reading Complete.");
 		return true;
 	}
+	// Fills in any v2 data the file did not carry and moves its strings into the level
+	void PrepareModel(H2B::Parser& p, GW::SYSTEM::GLog log) {
+		// 1.9d files (or v2 files baked without bounds) get them computed here
+		if (p.bounds.size() != p.meshCount) {
+			log.LogCategorized("INFO", "No baked bounds found, computing them at load.");
+			H2B::BakeBounds(p);
+		}
+		if (p.lods.size() != p.meshCount) {
+			log.LogCategorized("INFO", "No baked LODs found, generating them at load (run H2BBake to avoid this).");
+			H2B::BakeLods(p);
+		}
+		// post-transform cache report, optimizing first if the file was not baked
+		H2B::VCACHE_STATS cache = H2B::AnalyzeVertexCache(p);
+		std::string cacheReport = "Vertex cache ACMR " + std::to_string(cache.ACMR()) +
+			" ATVR " + std::to_string(cache.ATVR());
+		if ((p.extension.flags & H2B::VCACHE_OPTIMIZED) == 0) {
+			H2B::BakeVertexCache(p);
+			cache = H2B::AnalyzeVertexCache(p);
+			cacheReport += " optimized at load to ACMR " + std::to_string(cache.ACMR()) +
+				" ATVR " + std::to_string(cache.ATVR());
+		}
+		log.LogCategorized("INFO", cacheReport.c_str());
+		// meshlets are built last as they follow the optimized triangle order
+		if (p.meshletRanges.size() != p.meshCount) {
+			log.LogCategorized("INFO", "No baked meshlets found, building them at load.");
+			H2B::BakeMeshlets(p);
+		}
+		// transfer all string data
+		for (unsigned j = 0; j < p.materialCount; ++j) {
+			for (int k = 0; k < 10; ++k) {
+				if (*((&p.materials[j].name) + k) != nullptr)
+					*((&p.materials[j].name) + k) =
+					level_strings.insert(*((&p.materials[j].name) + k)).first->c_str();
+			}
+		}
+		for (unsigned j = 0; j < p.meshCount; ++j) {
+			if (p.materials[j].name != nullptr)
+				p.materials[j].name =
+				level_strings.insert(p.materials[j].name).first->c_str();
+		}
+	}
+	// Bounds and LOD summary of a prepared model
+	void SummarizeModel(const H2B::Parser& p, LEVEL_MODEL& model) {
+		model.bounds = p.bounds.empty() ? H2B::ComputeBounds(p.vertices, nullptr, 0) : p.bounds[0];
+		for (unsigned j = 1; j < p.meshCount; ++j)
+			model.bounds = H2B::MergeBounds(model.bounds, p.bounds[j]);
+		model.lodCount = 1;
+		for (int l = 0; l < H2B_MAX_LODS; ++l) {
+			model.lodError[l] = 0;
+			for (unsigned j = 0; j < p.meshCount; ++j) {
+				const H2B::LOD& lod = p.lods[j];
+				model.lodCount = std::max(model.lodCount, lod.levelCount);
+				model.lodError[l] = std::max(model.lodError[l], lod.error[std::min<unsigned>(l, lod.levelCount - 1)]);
+			}
+		}
+	}
+	// Appends one parsed model and its instances to the level arrays
+	void CombineModel(H2B::Parser& p, const std::vector<GW::MATH::GMATRIXF>& transforms,
+						H2B::PACKING_ERROR& packingError, GW::SYSTEM::GLog log) {
+		PrepareModel(p, log);
+		// record sizes
+		LEVEL_MODEL model;
+		model.vertexCount = p.vertexCount;
+		model.indexCount = p.indexCount + p.lodIndices.size(); // LOD indices follow the originals
+		model.materialCount = p.materialCount;
+		model.meshCount = p.meshCount;
+		// record offsets
+		model.vertexStart = levelVertices.size();
+		model.indexStart = levelIndices.size();
+		model.materialStart = levelMaterials.size();
+		model.batchStart = levelBatches.size();
+		model.meshStart = levelMeshes.size();
+		SummarizeModel(p, model);
+		// append/move all data
+		levelVertices.insert(levelVertices.end(), p.vertices.begin(), p.vertices.end());
+		H2B::PackVertices(p.vertices.data(), p.vertexCount, model.bounds.min, model.bounds.max,
+			levelPackedVertices, packingError);
+		levelIndices.insert(levelIndices.end(), p.indices.begin(), p.indices.end());
+		levelIndices.insert(levelIndices.end(), p.lodIndices.begin(), p.lodIndices.end());
+		model.shortIndices = p.vertexCount <= 65536;
+		if (model.shortIndices) {
+			model.gpuIndexStart = levelIndices16.size();
+			levelIndices16.insert(levelIndices16.end(), levelIndices.begin() + model.indexStart, levelIndices.end());
+		}
+		else {
+			model.gpuIndexStart = levelIndices32.size();
+			levelIndices32.insert(levelIndices32.end(), levelIndices.begin() + model.indexStart, levelIndices.end());
+		}
+		levelMaterials.insert(levelMaterials.end(), p.materials.begin(), p.materials.end());
+		levelBatches.insert(levelBatches.end(), p.batches.begin(), p.batches.end());
+		levelMeshes.insert(levelMeshes.end(), p.meshes.begin(), p.meshes.end());
+		levelBounds.insert(levelBounds.end(), p.bounds.begin(), p.bounds.end());
+		levelLods.insert(levelLods.end(), p.lods.begin(), p.lods.end());
+		for (H2B::MESHLET_RANGE range : p.meshletRanges) {
+			range.meshletOffset += levelMeshlets.size();
+			levelMeshletRanges.push_back(range);
+		}
+		for (H2B::MESHLET meshlet : p.meshlets) {
+			meshlet.vertexOffset += levelMeshletVertices.size();
+			meshlet.triangleOffset += levelMeshletTriangles.size() / 3;
+			levelMeshlets.push_back(meshlet);
+		}
+		levelMeshletVertices.insert(levelMeshletVertices.end(), p.meshletVertices.begin(), p.meshletVertices.end());
+		levelMeshletTriangles.insert(levelMeshletTriangles.end(), p.meshletTriangles.begin(), p.meshletTriangles.end());
+		// add level model
+		levelModels.push_back(model);
+		// add level model instances
+		MODEL_INSTANCES instances;
+		instances.flags = 0; // shadows? transparency? much we could do with this.
+		instances.modelIndex = levelModels.size() - 1;
+		instances.transformStart = levelTransforms.size();
+		instances.transformCount = transforms.size();
+		levelTransforms.insert(levelTransforms.end(), transforms.begin(), transforms.end());
+		// add instance set
+		levelInstances.push_back(instances);
+		// GLog only queues 20 messages between writes, let it drain per model
+		log.Flush();
+	}
 	// internal helper for collecting all .h2b data into unified arrays
 	bool ReadAndCombineH2Bs(const char* h2bFolderPath, 
 							std::map<std::string, MODEL_ENTRY>& modelSet,
@@ -153,54 +903,17 @@ private:
 		log.LogCategorized("MESSAGE", "Begin Importing .H2B File Data.");
 		// parse each model adding to overall arrays
 		H2B::Parser p; // reads the .h2b format
+		H2B::PACKING_ERROR packingError = {};
 		const std::string modelPath = h2bFolderPath;
 		for (auto i = modelSet.begin(); i != modelSet.end(); ++i)
 		{
+			PROFILE_SCOPE("Load model");
 			if (p.Parse((modelPath + "/" + i->second.modelFile).c_str()))
 			{
 				log.LogCategorized("INFO", (std::string("H2B Imported: ") + i->second.modelFile).c_str());
-				// transfer all string data
-				for (int j = 0; j < p.materialCount; ++j) {
-					for (int k = 0; k < 10; ++k) {
-						if (*((&p.materials[j].name) + k) != nullptr)
-							*((&p.materials[j].name) + k) =
-							level_strings.insert(*((&p.materials[j].name) + k)).first->c_str();
-					}
-				}
-				for (int j = 0; j < p.meshCount; ++j) {
-					if (p.materials[j].name != nullptr)
-						p.materials[j].name =
-						level_strings.insert(p.materials[j].name).first->c_str();
-				}
-				// record sizes
-				LEVEL_MODEL model;
-				model.vertexCount = p.vertexCount;
-				model.indexCount = p.indexCount;
-				model.materialCount = p.materialCount;
-				model.meshCount = p.meshCount;
-				// record offsets
-				model.vertexStart = levelVertices.size();
-				model.indexStart = levelIndices.size();
-				model.materialStart = levelMaterials.size();
-				model.batchStart = levelBatches.size();
-				model.meshStart = levelMeshes.size();
-				// append/move all data
-				levelVertices.insert(levelVertices.end(), p.vertices.begin(), p.vertices.end());
-				levelIndices.insert(levelIndices.end(), p.indices.begin(), p.indices.end());
-				levelMaterials.insert(levelMaterials.end(), p.materials.begin(), p.materials.end());
-				levelBatches.insert(levelBatches.end(), p.batches.begin(), p.batches.end());
-				levelMeshes.insert(levelMeshes.end(), p.meshes.begin(), p.meshes.end());
-				// add level model
-				levelModels.push_back(model);
-				// add level model instances
-				MODEL_INSTANCES instances;
-				instances.flags = 0; // shadows? transparency? much we could do with this.
-				instances.modelIndex = levelModels.size() - 1;
-				instances.transformStart = levelTransforms.size();
-				instances.transformCount = i->second.instances.size();
-				levelTransforms.insert(levelTransforms.end(), i->second.instances.begin(), i->second.instances.end());
-				// add instance set
-				levelInstances.push_back(instances);
+				CombineModel(p, i->second.instances, packingError, log);
+				levelModelFiles.push_back(i->second.modelFile);
+				levelInstanceNames.insert(levelInstanceNames.end(), i->second.names.begin(), i->second.names.end());
 			}
 			else {
 				// notify user that a model file is missing but continue loading
@@ -209,6 +922,22 @@ private:
 				log.LogCategorized("WARNING", "Loading will continue but model(s) are missing.");
 			}
 		}
+		// how much the packed vertex format saves and what it costs in precision
+		std::string packingReport = "Packed vertices: " +
+			std::to_string(levelVertices.size() * sizeof(H2B::VERTEX)) + " bytes -> " +
+			std::to_string(levelPackedVertices.size() * sizeof(H2B::PACKED_VERTEX)) +
+			" bytes, max error position " + std::to_string(packingError.position) +
+			" normal " + std::to_string(packingError.normalDegrees) + " deg uv " + std::to_string(packingError.uv);
+		log.LogCategorized("INFO", packingReport.c_str());
+		std::string indexReport = "Index buffers: " +
+			std::to_string(levelIndices.size() * sizeof(unsigned)) + " bytes as 32 bit -> " +
+			std::to_string(levelIndices16.size() * sizeof(uint16_t) + levelIndices32.size() * sizeof(unsigned)) +
+			" bytes (" + std::to_string(levelIndices16.size()) + " 16 bit, " +
+			std::to_string(levelIndices32.size()) + " 32 bit indices)";
+		log.LogCategorized("INFO", indexReport.c_str());
+		std::string meshletReport = "Meshlets: " + std::to_string(levelMeshlets.size()) + " clusters for " +
+			std::to_string(levelMeshletTriangles.size() / 3) + " full detail triangles";
+		log.LogCategorized("INFO", meshletReport.c_str());
 		log.LogCategorized("MESSAGE", "Importing of .H2B File Data Complete.");
 		return true;
 	}
@@ -13,23 +13,75 @@
 // With what we want & what we don't defined we can include the API
 #include "../Gateware/Gateware.h"
 #include "renderer.h"
+#include "benchmark.h"
 //#include "load_data_oriented.h"
+// 1 bakes small static instances into world space chunks after loading (fewer draws, no instancing)
+#define MERGE_STATIC_INSTANCES 0
+// 1 watches the level, its .h2b models and the shaders, applying edits while running
+#define HOT_RELOAD 1
+// where PROFILING builds write the Chrome trace of the run on exit (chrome://tracing, ui.perfetto.dev)
+#define PROFILE_TRACE_PATH "../ProfileTrace.json"
 // open some namespaces to compact the code a bit
 using namespace GW;
 using namespace CORE;
 using namespace SYSTEM;
 using namespace GRAPHICS;
 // lets pop a window and use Vulkan to clear to a red screen
-int main()
+// --bench path [--frames N] [--step seconds] [--csv path] times the CPU side
+// of a camera path through the level instead of opening a window.
+// --record path writes the camera of every frame to a binary recording,
+// --replay path [--step seconds] flies a recording or .cam in place of input
+// and exits when it ends (see camera_path.h)
+int main(int argc, char** argv)
 {
+	Profiler::Get().NameThread("Main");
 	GW::SYSTEM::GLog log; // handy for logging any messages/warning/errors
 	// begin loading level
 	log.Create("../LevelLoaderLog.txt");
 	log.EnableConsoleLogging(true); // mirror output to the console
 	log.Log("Start Program.");
 
+	const char* levelPath = "../Levels/SmallTest1.txt";
+	const char* modelFolder = "../ModelsOBJ";
 	Level_Data dataOrientedLoader;
-	dataOrientedLoader.LoadLevel("../Levels/SmallTest1.txt", "../ModelsOBJ", log);
+	dataOrientedLoader.LoadLevel(levelPath, modelFolder, log);
+#if MERGE_STATIC_INSTANCES
+	dataOrientedLoader.MergeStaticInstances(50.0f, 4096, log);
+#endif
+	const char* benchPath = nullptr;
+	const char* recordPath = nullptr;
+	const char* replayPath = nullptr;
+	float step = 0; // --step, 0 when not given
+	BENCHMARK_SETTINGS bench;
+	bench.clusterMode = CLUSTER_CULLING;
+	for (int i = 1; i < argc; i += 2) {
+		std::string option = argv[i];
+		if (i + 1 == argc) {
+			log.LogCategorized("ERROR", ("Missing the value of " + option).c_str());
+			return 1;
+		}
+		if (option == "--bench")
+			benchPath = argv[i + 1];
+		else if (option == "--frames")
+			bench.frames = std::strtoul(argv[i + 1], nullptr, 10);
+		else if (option == "--record")
+			recordPath = argv[i + 1];
+		else if (option == "--replay")
+			replayPath = argv[i + 1];
+		else if (option == "--step")
+			step = std::strtof(argv[i + 1], nullptr);
+		else if (option == "--csv")
+			bench.csvPath = argv[i + 1];
+		else
+			log.LogCategorized("WARNING", ("Unknown option " + option).c_str());
+	}
+	if (benchPath) {
+		if (bench.csvPath.empty())
+			bench.csvPath = std::string(benchPath) + ".csv";
+		if (step > 0)
+			bench.step = step;
+		return RunBenchmark(dataOrientedLoader, benchPath, bench, log) ? 0 : 1;
+	}
 
 	GWindow win;
 	GEventResponder msgs;
@@ -61,15 +113,81 @@ int main()
 #endif
 		{
 			Renderer renderer(win, vulkan, dataOrientedLoader);
+			renderer.LogTextureStats(log);
+#if HOT_RELOAD
+			renderer.EnableHotReload(levelPath, modelFolder, log);
+#endif
+			if (recordPath)
+				renderer.RecordCamera(recordPath, log);
+			bool replaying = replayPath && renderer.ReplayCamera(replayPath, step, log);
+			auto statsTime = std::chrono::steady_clock::now();
 			while (+win.ProcessWindowEvents())
 			{
-				if (+vulkan.StartFrame(2, clrAndDepth))
+				Profile_Scope frameScope("Frame");
+#if HOT_RELOAD
+				renderer.CheckForChanges();
+#endif
+				Profile_Scope waitScope("Start frame"); // waits for the swapchain image
+				bool started = +vulkan.StartFrame(2, clrAndDepth);
+				waitScope.End();
+				if (started)
 				{
 					renderer.UpdateCamera();
 					renderer.Render();
+					PROFILE_SCOPE("Submit and present");
 					vulkan.EndFrame(true);
 				}
+				frameScope.End();
+				Profiler::Get().EndFrame();
+				if (replaying && renderer.IsReplayingCamera() == false)
+					break; // so the stats below end with the replay
+				// once a second show what was drawn in the title bar
+				if (std::chrono::steady_clock::now() - statsTime > std::chrono::seconds(1)) {
+					const Renderer::FRAME_STATS& stats = renderer.GetFrameStats();
+					std::string title = "Jordan Teasdale - Assignment 2 - Vulkan | draws " +
+						std::to_string(stats.drawCount) + " | triangles " +
+						std::to_string(stats.triangleCount) + " / " +
+						std::to_string(stats.fullDetailTriangleCount) + " | clusters culled " +
+						std::to_string(stats.clustersCulled) + " / " + std::to_string(stats.clusterCount) +
+						" | instances culled " + std::to_string(stats.instancesCulled);
+#if LEVEL_STREAMING
+					const STREAM_STATS& stream = renderer.GetStreamStats();
+					title += " | cells " + std::to_string(stream.residentCells) + " / " + std::to_string(stream.cells) +
+						" (" + std::to_string(stream.pendingLoads) + " pending, " +
+						std::to_string(stream.residentBytes >> 10) + " KB)";
+#endif
+#if TEXTURE_STREAMING
+					const TEXTURE_STREAM_STATS& mips = renderer.GetTextureStreamStats();
+					title += " | mips " + std::to_string(mips.residentMips) + " resident, " +
+						std::to_string(mips.requestedMips) + " requested, " + std::to_string(mips.evictedMips) +
+						" evicted (" + std::to_string(mips.residentBytes >> 20) + " / " + std::to_string(mips.budgetBytes >> 20) + " MB)";
+#endif
+#if PROFILING
+					PROFILE_STATS frame = Profiler::Get().GetStats("Frame");
+					PROFILE_STATS gpu = Profiler::Get().GetStats("GPU draws");
+					char timing[96];
+					std::snprintf(timing, sizeof(timing), " | frame %.2f avg %.2f p99 ms | GPU draws %.2f ms",
+						frame.avgMilliseconds, frame.p99Milliseconds, gpu.avgMilliseconds);
+					title += timing;
+#endif
+					win.SetWindowName(title.c_str());
+					statsTime = std::chrono::steady_clock::now();
+				}
+			}
+#if PROFILING
+			// the rolling window of the last frames, and everything since loading as a trace
+			for (const PROFILE_STATS& stats : Profiler::Get().GetStats()) {
+				char line[160];
+				std::snprintf(line, sizeof(line), "Profile: %s min %.3f avg %.3f p99 %.3f ms over %u frames",
+					stats.name.c_str(), stats.minMilliseconds, stats.avgMilliseconds, stats.p99Milliseconds, stats.frames);
+				log.LogCategorized("INFO", line);
 			}
+			if (Profiler::Get().GetDroppedEvents())
+				log.LogCategorized("WARNING", ("Profile: " + std::to_string(Profiler::Get().GetDroppedEvents()) +
+					" events dropped (full ring or past the capture limit)").c_str());
+			if (Profiler::Get().WriteChromeTrace(PROFILE_TRACE_PATH))
+				log.LogCategorized("INFO", "Profile: trace written to " PROFILE_TRACE_PATH);
+#endif
 		}
 	}
 	return 0; // that's all folks
@@ -0,0 +1,242 @@
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+// Frame profiler. PROFILE_SCOPE("name") times the rest of the enclosing block
+// on whatever thread runs it. Every thread appends to a ring only it writes,
+// so recording takes no lock; the frame thread drains the rings in EndFrame,
+// keeps a rolling window of per frame totals for each name (min/avg/p99) and,
+// while capturing, the events themselves for WriteChromeTrace, which
+// chrome://tracing and ui.perfetto.dev open. GPU passes arrive through
+// AddGpuEvent already converted to this clock and show as their own track.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifndef PROFILING
+#define PROFILING 1 // 0 compiles PROFILE_SCOPE out and makes Record a no-op
+#endif
+
+struct PROFILE_EVENT {
+	const char* name; // a string literal, events are grouped by its contents
+	uint64_t begin, end; // nanoseconds on Profiler::Now
+	unsigned thread; // Profiler::GPU_TRACK for GPU passes
+};
+struct PROFILE_STATS { // one name over the rolling window
+	std::string name;
+	unsigned frames; // frames in the window that recorded it
+	float lastMilliseconds, minMilliseconds, avgMilliseconds, p99Milliseconds;
+};
+
+class Profiler {
+public:
+	static const unsigned GPU_TRACK = 0; // CPU threads are numbered from 1
+	static const unsigned RING_EVENTS = 4096; // per thread between drains, a power of two
+	unsigned window = 240; // frames the rolling stats cover
+	size_t captureLimit = 1 << 18; // events kept for the trace, later ones only count
+
+	// Process wide, scopes on any thread record into it
+	static Profiler& Get() {
+		static Profiler profiler;
+		return profiler;
+	}
+	static uint64_t Now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void Record(const char* name, uint64_t begin, uint64_t end, unsigned thread = ~0u) {
+#if PROFILING
+		THREAD_RING& ring = LocalRing();
+		uint64_t written = ring.written.load(std::memory_order_relaxed);
+		if (written - ring.read.load(std::memory_order_acquire) >= RING_EVENTS) {
+			ring.dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		ring.events[written & (RING_EVENTS - 1)] = { name, begin, end, thread == ~0u ? ring.thread : thread };
+		ring.written.store(written + 1, std::memory_order_release);
+#endif
+	}
+	void AddGpuEvent(const char* name, uint64_t begin, uint64_t end) {
+		Record(name, begin, end, GPU_TRACK);
+	}
+	// Shown instead of "Thread N" in the trace
+	void NameThread(const char* name) {
+		THREAD_RING& ring = LocalRing();
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		ring.name = name;
+	}
+
+	// Drains every ring and closes the frame: each name that recorded anything
+	// since the last call adds its total to the rolling window. Call once per
+	// frame from one thread.
+	void EndFrame() {
+		Drain();
+		for (auto& total : frameTotals) {
+			HISTORY& history = histories[total.first];
+			if (history.samples.size() < window)
+				history.samples.push_back(total.second);
+			else
+				history.samples[history.next] = total.second;
+			history.next = (history.next + 1) % window;
+			history.last = total.second;
+		}
+		frameTotals.clear();
+		++frames;
+	}
+	std::vector<PROFILE_STATS> GetStats() const {
+		std::vector<PROFILE_STATS> stats;
+		std::vector<float> sorted;
+		for (const auto& history : histories) {
+			sorted = history.second.samples;
+			std::sort(sorted.begin(), sorted.end());
+			float sum = 0;
+			for (float sample : sorted)
+				sum += sample;
+			size_t p99 = (sorted.size() * 99 + 99) / 100; // nearest rank
+			stats.push_back({ history.first, unsigned(sorted.size()), history.second.last,
+				sorted.front(), sum / sorted.size(), sorted[p99 - 1] });
+		}
+		return stats;
+	}
+	// Zeros when name hasn't recorded yet
+	PROFILE_STATS GetStats(const std::string& name) const {
+		for (const PROFILE_STATS& stats : GetStats())
+			if (stats.name == name)
+				return stats;
+		return { name, 0, 0, 0, 0, 0 };
+	}
+	unsigned GetFrameCount() const { return frames; }
+	uint64_t GetDroppedEvents() const {
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		uint64_t dropped = captureDropped;
+		for (const auto& ring : rings)
+			dropped += ring->dropped.load(std::memory_order_relaxed);
+		return dropped;
+	}
+
+	// Captured events start with the first recorded, stopping clears them
+	void SetCapturing(bool capture) {
+		capturing = capture;
+		if (capture == false)
+			captured.clear();
+	}
+	// Writes the captured events as Chrome trace JSON, times relative to the
+	// first of them. Events still in the rings are drained first.
+	bool WriteChromeTrace(const char* path) {
+		Drain();
+		FILE* file = std::fopen(path, "wb");
+		if (file == nullptr)
+			return false;
+		uint64_t origin = ~0ull;
+		for (const PROFILE_EVENT& event : captured)
+			origin = std::min(origin, event.begin);
+		std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		std::fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"GPU\"}}", GPU_TRACK);
+		{
+			std::lock_guard<std::mutex> lock(ringsMutex);
+			for (const auto& ring : rings)
+				std::fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+					ring->thread, Escape(ring->name.size() ? ring->name : "Thread " + std::to_string(ring->thread)).c_str());
+		}
+		for (const PROFILE_EVENT& event : captured)
+			std::fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				Escape(event.name).c_str(), event.thread, (event.begin - origin) / 1000.0, (event.end - event.begin) / 1000.0);
+		std::fprintf(file, "\n]}\n");
+		return std::fclose(file) == 0;
+	}
+
+private:
+	struct THREAD_RING { // single producer (its thread), single consumer (Drain)
+		unsigned thread = 0;
+		std::string name;
+		std::vector<PROFILE_EVENT> events = std::vector<PROFILE_EVENT>(RING_EVENTS);
+		std::atomic<uint64_t> written{ 0 }, read{ 0 };
+		std::atomic<uint64_t> dropped{ 0 }; // ring was full
+	};
+	struct HISTORY {
+		std::vector<float> samples; // milliseconds per frame, a ring of window entries
+		unsigned next = 0;
+		float last = 0;
+	};
+	std::vector<std::unique_ptr<THREAD_RING>> rings; // kept after their thread exits
+	mutable std::mutex ringsMutex; // guards the list, not the events
+	std::map<std::string, double> frameTotals; // this frame so far
+	std::map<std::string, HISTORY> histories;
+	std::vector<PROFILE_EVENT> captured;
+	bool capturing = true;
+	uint64_t captureDropped = 0; // past captureLimit
+	unsigned frames = 0;
+
+	Profiler() = default;
+	Profiler(const Profiler&) = delete;
+	Profiler& operator=(const Profiler&) = delete;
+
+	// Registers the calling thread once, after that only its own ring is touched
+	THREAD_RING& LocalRing() {
+		static thread_local THREAD_RING* local = nullptr;
+		if (local == nullptr) {
+			std::lock_guard<std::mutex> lock(ringsMutex);
+			rings.emplace_back(new THREAD_RING());
+			local = rings.back().get();
+			local->thread = unsigned(rings.size());
+		}
+		return *local;
+	}
+	void Drain() {
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		for (const auto& ring : rings) {
+			uint64_t read = ring->read.load(std::memory_order_relaxed);
+			uint64_t written = ring->written.load(std::memory_order_acquire);
+			for (; read < written; ++read) {
+				const PROFILE_EVENT& event = ring->events[read & (RING_EVENTS - 1)];
+				frameTotals[event.name] += (event.end - event.begin) / 1e6;
+				if (capturing && captured.size() < captureLimit)
+					captured.push_back(event);
+				else if (capturing)
+					++captureDropped;
+			}
+			ring->read.store(written, std::memory_order_release);
+		}
+	}
+	static std::string Escape(const std::string& text) {
+		std::string escaped;
+		for (char c : text) {
+			if (c == '"' || c == '\\')
+				escaped += '\\';
+			if (c >= 0 && c < ' ')
+				continue;
+			escaped += c;
+		}
+		return escaped;
+	}
+};
+
+// Times its own lifetime, or until End
+class Profile_Scope {
+public:
+	explicit Profile_Scope(const char* name) : name(name), begin(Profiler::Now()) {}
+	~Profile_Scope() { End(); }
+	void End() {
+		if (name)
+			Profiler::Get().Record(name, begin, Profiler::Now());
+		name = nullptr;
+	}
+private:
+	const char* name;
+	uint64_t begin;
+};
+
+#if PROFILING
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) Profile_Scope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name)
+#endif
+#endif
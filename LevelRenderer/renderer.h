@@ -1,5 +1,21 @@
+// the layout of SHADER_MODEL_DATA (scene_data.h), so ahead of the includes
+#define MAX_SUBMESH_PER_DRAW 1054 // we can change this if desired
+#define TEXTURE_ARRAYS 0 // 1 layers every material map into 2D arrays by format and size, materials index them
+#define COMPACT_TRANSFORMS 1 // 1 uploads 32 byte COMPACT_TRANSFORM per instance, 0 full 64 byte matrices
 #include "FSLogo.h"
 #include "load_data_oriented.h"
+#include "cluster_culling.h"
+#include "level_streaming.h"
+#include "file_watcher.h"
+#include "texture_registry.h"
+#include "sampler_cache.h"
+#include "texture_pipeline.h"
+#include "texture_streaming.h"
+#include "texture_arrays.h"
+#include "texture_atlas.h"
+#include "frame_planner.h"
+#include "scene_data.h"
+#include "camera_path.h"
 #include "shaderc/shaderc.h" // needed for compiling shaders at runtime
 
 #ifdef _WIN32 // must use MT platform DLL libraries on windows
@@ -35,23 +51,58 @@ const char* pixelShaderSource = fragmentString.c_str();
 std::string textureFragmentString = ShaderAsString("../TexturePixelShader.hlsl");
 const char* texturePixelShaderSource = textureFragmentString.c_str();
 
+// Meshlet Culling Compute Shader
+std::string clusterCullString = ShaderAsString("../ClusterCullCompute.hlsl");
+const char* clusterCullShaderSource = clusterCullString.c_str();
+
 // Creation, Rendering & Cleanup
 class Renderer
 {
-#define MAX_SUBMESH_PER_DRAW 1054 // we can change this if desired
-	struct SHADER_MODEL_DATA {
-		//gloabally shared model data
-		GW::MATH::GVECTORF sunDirection = { -1, -1, 2 }, sunColor; // lighting info
-		GW::MATH::GVECTORF sunAmbient = { 0.25, 0.25, 0.35 }, cameraPos;
-		GW::MATH::GMATRIXF viewMatrix, projectionMatrix; // viewing info
-		// per sub-mesh transform and material data
-		GW::MATH::GMATRIXF matricies[MAX_SUBMESH_PER_DRAW]; // world space transforms
-		H2B::ATTRIBUTES materials[MAX_SUBMESH_PER_DRAW]; // color/texture of surface
-	};
+#define PACKED_VERTICES 1 // 1 uploads 16 byte H2B::PACKED_VERTEX, 0 the original 36 byte H2B::VERTEX
+#define CLUSTER_CULLING 1 // 0 draws whole meshes, 1 culls meshlets on the CPU, 2 in ClusterCullCompute.hlsl
+#define LEVEL_STREAMING 1 // 1 uploads and draws only the models of grid cells streamed in around the camera
+#define TEXTURE_STREAMING 0 // 1 keeps mip tails resident and streams finer levels by their size on screen
+#define MAX_TEXTURE_ARRAYS 32 // array images TexturePixelShader.hlsl can index
+#define TEXTURE_ATLAS_SIZE 256 // TEXTURE_ARRAYS packs maps up to this size into shared atlas pages, 0 layers each by size
+#if TEXTURE_ARRAYS && TEXTURE_STREAMING
+#error TEXTURE_STREAMING resizes per texture images, layers of TEXTURE_ARRAYS can't be streamed
+#endif
+#define MAX_GPU_SCOPES 8 // passes timed with GPU timestamps per frame, PROFILING builds only
+private:
 	struct Push_Constants {
 		unsigned materialIndex;
 		unsigned startWorld;
+		unsigned padding[2];
+		float quantizeMin[4], quantizeScale[4]; // model bounds, decodes packed positions
+	};
+	struct CLUSTER_JOB { // matches ClusterCullCompute.hlsl, one mesh of one instance
+		GW::MATH::GMATRIXF world;
+		unsigned meshletOffset, meshletCount;
+		unsigned outputOffset, coneTest;
+		float scale[4];
+	};
+public:
+	struct FRAME_STATS { // what the last Render call submitted
+		unsigned drawCount, instanceCount;
+		unsigned triangleCount, fullDetailTriangleCount; // drawn vs. without LODs or culling
+		unsigned clusterCount, clustersCulled; // meshlets tested, CPU cluster culling only
+		unsigned instancesCulled; // outside the view frustum (Level_Data::levelSpatialIndex)
+		unsigned pipelineBinds, textureBinds, indexBinds; // state changes between the draws
+	};
+	struct TEXTURE_STATS { // what the last LoadLevelTextures uploaded
+		unsigned textures, failed;
+		unsigned shared; // material references served by a texture already loaded or kept from the last load
+		unsigned resident; // distinct textures the level uses
+		unsigned samplers; // distinct sampler states they are read with
+		unsigned transcoded; // Basis/UASTC files transcoded for this device
+		unsigned arrays, leftOut; // TEXTURE_ARRAYS images, files that didn't fit one
+		unsigned atlased, atlasPages; // files sharing atlas pages, and those pages
+		float atlasEfficiency; // share of the atlas pages' texels the files cover
+		size_t bytes;
+		float milliseconds; // file reads included
+		float readMilliseconds, decodeMilliseconds; // summed over the loader's threads
 	};
+private:
 
 	// proxy handles
 	GW::SYSTEM::GWindow win;
@@ -66,11 +117,14 @@ class Renderer
 	VkBuffer vertexHandle = nullptr;
 	VkDeviceMemory vertexData = nullptr;
 	
-	VkBuffer indexHandle = nullptr;
+	VkBuffer indexHandle = nullptr; // 32 bit indices
 	VkDeviceMemory indexData = nullptr;
+	VkBuffer index16Handle = nullptr; // models with under 65536 vertices
+	VkDeviceMemory index16Data = nullptr;
 	
 	std::vector<VkBuffer> storageHandle;
 	std::vector<VkDeviceMemory> storageData;
+	std::vector<bool> materialsStale; // storage buffer still holds old sceneData.materials
 	VkShaderModule vertexShader = nullptr;
 	VkShaderModule pixelShader = nullptr;
 	VkShaderModule texturePixelShader = nullptr;
@@ -89,10 +143,17 @@ class Renderer
 
 	GW::MATH::GMatrix proxy;
 	GW::MATH::GMATRIXF camera = GW::MATH::GIdentityMatrixF;
+	float fieldOfView = 1.13446f;
 	float aspect;
 	GW::MATH::GMATRIXF perspective;
 	GW::MATH::GMATRIXF world = GW::MATH::GIdentityMatrixF;
 	std::chrono::steady_clock::time_point start;
+	// camera recording and replay (camera_path.h)
+	Camera_Recorder cameraRecorder;
+	std::chrono::steady_clock::time_point recordStart;
+	Camera_Path cameraReplay; // drives the camera instead of input while it has keys
+	std::chrono::steady_clock::time_point replayStart;
+	float replayStep = 0, replayTime = 0; // step 0 follows the clock, otherwise replayTime advances by it each frame
 	GW::MATH::GVECTORF lightDir = { -1, -1, 2 };
 	GW::MATH::GVECTORF lightClr = { 0.9, 0.9, 1.0};
 	
@@ -100,28 +161,125 @@ class Renderer
 	Push_Constants pushConstants;
 
 	struct Texture {
-		ktxVulkanTexture texture;
+		ktxVulkanTexture texture = {};
 		VkDescriptorSet descriptorSet = nullptr;
 		VkImageView textureView = nullptr;
-		VkSampler textureSampler = nullptr;
 	};
-	std::vector<Texture> levelTextures;
+	struct TEXTURE_COPY { // one image of a ktxTexture level through the staging buffer
+		unsigned texture; // image it goes to, a textures slot (or textureArrays entry)
+		const ktx_uint8_t* data;
+		size_t rowBytes, rowPitch, rows; // rows of KTX1 images are padded to 4 bytes
+		VkBufferImageCopy region;
+	};
+	Texture_Registry textureRegistry; // contents are matched after textureLoader reads them
+	Texture_Pipeline textureLoader;
+	unsigned textureDecodeThreads = 0; // 0 keeps one hardware thread free for the render thread
+	std::vector<Texture> textures; // per textureRegistry slot
+	std::vector<unsigned> materialTextures; // slot of each levelMaterials entry, ~0u for none
+	Sampler_Cache samplerCache;
+	std::vector<VkSampler> samplers; // per samplerCache slot
+	std::vector<unsigned> materialSamplers; // slot of each textured material, ~0u for none
+	SAMPLER_STATE textureSamplerState = DefaultSamplerState(); // before map_Kd options apply
+#if TEXTURE_ARRAYS
+	// Every material map (levelData.levelTextureFiles) layered into arrays,
+	// materials reach theirs through sceneData.materialMaps
+	std::vector<Texture> textureArrays; // per TEXTURE_ARRAY, descriptorSet unused
+	std::vector<std::string> arrayFiles; // levelTextureFiles as they were layered
+	std::vector<TEXTURE_LAYER> arrayLayers; // of each file
+	std::vector<GW::MATH::GVECTORF> arrayRects; // of each file in its layer, all of it unless atlased
+	unsigned atlasPageSize = 1024, atlasLevels = 5; // largest pages, most mip levels packed maps keep
+	VkSampler textureArraySampler = nullptr;
+#endif
 
 	unsigned indexOffset = 0;
 	unsigned vertexOffset = 0;
 	unsigned materialOffset = 0;
+
+	// LOD selection, culling and the draw list of each frame
+	Frame_Planner planner;
+	std::vector<bool> texturedMaterials; // per levelMaterials entry, picks the draw's pipeline
+#if LEVEL_STREAMING
+	// Geometry lives in one pool buffer of streamBudgetBytes (vertexHandle, also
+	// bound for indices). The streamer places a model in it while any resident
+	// or pending cell draws it, its worker copies the model in.
+	Level_Streamer streamer;
+	float streamCellSize = 20, streamLoadRadius = 40, streamUnloadRadius = 60;
+	size_t streamBudgetBytes = 64 << 20;
+	void* streamMapped = nullptr; // vertexData, mapped for as long as it exists
+#if PACKED_VERTICES
+	static const size_t streamVertexBytes = sizeof(H2B::PACKED_VERTEX);
+#else
+	static const size_t streamVertexBytes = sizeof(H2B::VERTEX);
+#endif
+#endif
+#if TEXTURE_STREAMING
+	// Streamed slots keep their mip tail, finer levels follow the feedback of
+	// RequestTextureLevels and are evicted least recently used first
+	Texture_Streamer textureStreamer;
+	size_t textureBudgetBytes = 128 << 20;
+	unsigned textureTailSize = 64; // texels across the finest level always resident
+	ktx_transcode_fmt_e textureTranscodeTarget = KTX_TTF_RGBA32; // as textureLoader was created with
+	// per textures slot
+	std::vector<ktxVulkanTexture> streamFull; // the whole mip chain's description, levelCount 0 when not streamed
+	std::vector<unsigned> streamBase; // level of the file that is level 0 of the image
+	std::vector<std::vector<size_t>> streamLevelBytes;
+	std::vector<std::string> streamFiles; // read again by the streamer's worker
+	std::vector<ktxTexture*> streamLoads; // decoded by the worker, uploaded by ApplyTextureStreaming
+	std::vector<std::pair<unsigned, unsigned>> streamChanges; // slot and its new base level, this Update
+#endif
+	FRAME_STATS frameStats = {};
+	TEXTURE_STATS textureStats = {};
+
+	// Hot reload (see EnableHotReload), level and model paths as given to LoadLevel
+	File_Watcher watcher;
+	std::string hotLevelPath, hotModelFolder;
+	GW::SYSTEM::GLog hotLog;
+	std::vector<std::string> changedFiles;
+
+	// Cluster culling, large models draw only their visible meshlets at full detail
+	unsigned clusterCullMinTriangles = 2048; // smaller models are drawn whole, the rest are planner.clusterCulledModels
+	unsigned clusterIndexCapacity = 0; // indices per frame if every cluster survives
+	std::vector<VkBuffer> clusterIndexHandle; // one per swapchain image
+	std::vector<VkDeviceMemory> clusterIndexData;
+#if CLUSTER_CULLING == 2
+	VkBuffer meshletHandle = nullptr, meshletVertexHandle = nullptr, meshletTriangleHandle = nullptr;
+	VkDeviceMemory meshletData = nullptr, meshletVertexData = nullptr, meshletTriangleData = nullptr;
+	unsigned clusterJobCapacity = 0;
+	std::vector<CLUSTER_JOB> clusterJobs; // filled in draw order by Render
+	std::vector<VkDrawIndexedIndirectCommand> clusterArgs; // empty draws the shader grows
+	std::vector<unsigned> clusterJobCount; // jobs last submitted from each swapchain image
+	std::vector<VkBuffer> clusterJobHandle, clusterArgsHandle;
+	std::vector<VkDeviceMemory> clusterJobData, clusterArgsData;
+	VkShaderModule clusterCullShader = nullptr;
+	VkPipeline clusterCullPipeline = nullptr;
+	VkPipelineLayout clusterCullLayout = nullptr;
+	VkDescriptorSetLayout clusterDescriptorLayout = nullptr;
+	VkDescriptorPool clusterDescriptorPool = nullptr;
+	std::vector<VkDescriptorSet> clusterDescriptorSet;
+	VkCommandPool clusterCommandPool = nullptr;
+	std::vector<VkCommandBuffer> clusterCommands;
+	std::vector<VkFence> clusterFences;
+#endif
+
+	// GPU pass timing (BeginGpuScope), MAX_GPU_SCOPES pairs of timestamp
+	// queries per swapchain image, read back when the image comes around again
+	VkQueryPool timestampPool = nullptr; // null when not PROFILING or the queue can't time
+	VkCommandPool timestampCommandPool = nullptr;
+	std::vector<VkCommandBuffer> timestampResets; // per image, recorded once
+	std::vector<std::vector<const char*>> timestampScopes; // per image, the pairs its last frame wrote
+	std::vector<uint64_t> timestampRecorded; // per image, Profiler::Now when its last frame was recorded
+	float timestampPeriod = 0; // nanoseconds per tick
+	uint64_t timestampMask = ~0ull; // valid bits of the graphics queue's timestamps
 	
 public:
 
 	Renderer(GW::SYSTEM::GWindow _win, GW::GRAPHICS::GVulkanSurface _vlk, Level_Data _levelData)
 	{
+		PROFILE_SCOPE("Create renderer");
 		start = std::chrono::steady_clock::now();
 		win = _win;
 		vlk = _vlk;
 		levelData = _levelData;
-		unsigned int width, height;
-		win.GetClientWidth(width);
-		win.GetClientHeight(height);
 
 		inputProxy.Create(win);
 		controllerProxy.Create();
@@ -132,7 +290,7 @@ public:
 		GW::MATH::GVECTORF up = { 0, 1, 0, 0 };
 		proxy.LookAtLHF(eye, center, up, camera);
 		vlk.GetAspectRatio(aspect);
-		proxy.ProjectionVulkanLHF(1.13446f, aspect, 0.1f, 100.0f, perspective);
+		proxy.ProjectionVulkanLHF(fieldOfView, aspect, 0.1f, 100.0f, perspective);
 
 		sceneData.sunColor = lightClr;
 		sceneData.viewMatrix = camera;
@@ -142,33 +300,20 @@ public:
 		for (int i = 0; i < levelData.levelMaterials.size(); ++i) {
 			sceneData.materials[i] = levelData.levelMaterials[i].attrib;
 		}
-		for (int i = 0; i < levelData.levelTransforms.size(); ++i) {
-			sceneData.matricies[i] = levelData.levelTransforms[i];
-		}
+		ResetInstanceState();
 
 		/***************** GEOMETRY INTIALIZATION ******************/
 		// Grab the device & physical device so we can allocate some stuff
 		VkPhysicalDevice physicalDevice = nullptr;
 		vlk.GetDevice((void**)&device);
 		vlk.GetPhysicalDevice((void**)&physicalDevice);
-
-		// Transfer triangle data to the vertex buffer. (staging would be prefered here)
-		unsigned vertexSize = levelData.levelVertices.size() * sizeof(H2B::VERTEX);
-		GvkHelper::create_buffer(physicalDevice, device, vertexSize,
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &vertexHandle, &vertexData);
-		GvkHelper::write_to_buffer(device, vertexData, levelData.levelVertices.data(), vertexSize);
-
-		unsigned indexSize = levelData.levelIndices.size() * sizeof(unsigned);
-		GvkHelper::create_buffer(physicalDevice, device, indexSize,
-			VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &indexHandle, &indexData);
-		GvkHelper::write_to_buffer(device, indexData, levelData.levelIndices.data(), indexSize);
+		CreateGeometryBuffers(physicalDevice);
 
 		UINT32 numBBS = 0;
 		vlk.GetSwapchainImageCount(numBBS);
 		storageHandle.resize(numBBS);
 		storageData.resize(numBBS);
+		materialsStale.assign(numBBS, false); // written whole below
 		descriptorSet.resize(numBBS);
 		for (int i = 0; i < numBBS; ++i) {
 			GvkHelper::create_buffer(physicalDevice, device, sizeof(sceneData),
@@ -176,156 +321,16 @@ public:
 				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &storageHandle[i], &storageData[i]);
 			GvkHelper::write_to_buffer(device, storageData[i], &sceneData, sizeof(sceneData));
 		}
+#if PROFILING
+		CreateGpuTimers(physicalDevice, numBBS);
+#endif
 
 		/***************** SHADER INTIALIZATION ******************/
-		// Intialize runtime shader compiler HLSL -> SPIRV
-		shaderc_compiler_t compiler = shaderc_compiler_initialize();
-		shaderc_compile_options_t options = shaderc_compile_options_initialize();
-		shaderc_compile_options_set_source_language(options, shaderc_source_language_hlsl);
-		shaderc_compile_options_set_invert_y(options, false); // TODO: Part 2i
-#ifndef NDEBUG
-		shaderc_compile_options_set_generate_debug_info(options);
-#endif
-		// Create Vertex Shader
-		shaderc_compilation_result_t result = shaderc_compile_into_spv( // compile
-			compiler, vertexShaderSource, strlen(vertexShaderSource),
-			shaderc_vertex_shader, "main.vert", "main", options);
-		if (shaderc_result_get_compilation_status(result) != shaderc_compilation_status_success) // errors?
-			std::cout << "Vertex Shader Errors: " << shaderc_result_get_error_message(result) << std::endl;
-		GvkHelper::create_shader_module(device, shaderc_result_get_length(result), // load into Vulkan
-			(char*)shaderc_result_get_bytes(result), &vertexShader);
-		shaderc_result_release(result); // done
-		// Create Pixel Shader
-		result = shaderc_compile_into_spv( // compile
-			compiler, pixelShaderSource, strlen(pixelShaderSource),
-			shaderc_fragment_shader, "main.frag", "main", options);
-		if (shaderc_result_get_compilation_status(result) != shaderc_compilation_status_success) // errors?
-			std::cout << "Pixel Shader Errors: " << shaderc_result_get_error_message(result) << std::endl;
-		GvkHelper::create_shader_module(device, shaderc_result_get_length(result), // load into Vulkan
-			(char*)shaderc_result_get_bytes(result), &pixelShader);
-		shaderc_result_release(result); // done
-		// Create Texture Pixel Shader
-		result = shaderc_compile_into_spv( // compile
-			compiler, texturePixelShaderSource, strlen(texturePixelShaderSource),
-			shaderc_fragment_shader, "main.frag", "main", options);
-		if (shaderc_result_get_compilation_status(result) != shaderc_compilation_status_success) // errors?
-			std::cout << "Pixel Shader Errors: " << shaderc_result_get_error_message(result) << std::endl;
-		GvkHelper::create_shader_module(device, shaderc_result_get_length(result), // load into Vulkan
-			(char*)shaderc_result_get_bytes(result), &texturePixelShader);
-		shaderc_result_release(result); // done
-		// Free runtime shader compiler resources
-		shaderc_compile_options_release(options);
-		shaderc_compiler_release(compiler);
+		CompileShader(vertexShaderSource, shaderc_vertex_shader, "main.vert", vertexShader);
+		CompileShader(pixelShaderSource, shaderc_fragment_shader, "main.frag", pixelShader);
+		CompileShader(texturePixelShaderSource, shaderc_fragment_shader, "main.frag", texturePixelShader);
 
 		/***************** PIPELINE INTIALIZATION ******************/
-		// Create Pipeline & Layout (Thanks Tiny!)
-		VkRenderPass renderPass;
-		vlk.GetRenderPass((void**)&renderPass);
-		VkPipelineShaderStageCreateInfo stage_create_info[2] = {};
-		// Create Stage Info for Vertex Shader
-		stage_create_info[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		stage_create_info[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
-		stage_create_info[0].module = vertexShader;
-		stage_create_info[0].pName = "main";
-		// Create Stage Info for Fragment Shader
-		stage_create_info[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		stage_create_info[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-		stage_create_info[1].module = pixelShader;
-		stage_create_info[1].pName = "main";
-		// Assembly State
-		VkPipelineInputAssemblyStateCreateInfo assembly_create_info = {};
-		assembly_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-		assembly_create_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-		assembly_create_info.primitiveRestartEnable = false;
-		// Vertex Input State
-		VkVertexInputBindingDescription vertex_binding_description = {};
-		vertex_binding_description.binding = 0;
-		vertex_binding_description.stride = sizeof(H2B::VERTEX);
-		vertex_binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-		VkVertexInputAttributeDescription vertex_attribute_description[3] = {
-			{ 0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0 }, //uv, normal, etc....
-			{ 1, 0, VK_FORMAT_R32G32B32_SFLOAT, 12 },
-			{ 2, 0, VK_FORMAT_R32G32B32_SFLOAT, 24 }
-		};
-		VkPipelineVertexInputStateCreateInfo input_vertex_info = {};
-		input_vertex_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-		input_vertex_info.vertexBindingDescriptionCount = 1;
-		input_vertex_info.pVertexBindingDescriptions = &vertex_binding_description;
-		input_vertex_info.vertexAttributeDescriptionCount = 3;
-		input_vertex_info.pVertexAttributeDescriptions = vertex_attribute_description;
-		// Viewport State (we still need to set this up even though we will overwrite the values)
-		VkViewport viewport = {
-			0, 0, static_cast<float>(width), static_cast<float>(height), 0, 1
-		};
-		VkRect2D scissor = { {0, 0}, {width, height} };
-		VkPipelineViewportStateCreateInfo viewport_create_info = {};
-		viewport_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-		viewport_create_info.viewportCount = 1;
-		viewport_create_info.pViewports = &viewport;
-		viewport_create_info.scissorCount = 1;
-		viewport_create_info.pScissors = &scissor;
-		// Rasterizer State
-		VkPipelineRasterizationStateCreateInfo rasterization_create_info = {};
-		rasterization_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-		rasterization_create_info.rasterizerDiscardEnable = VK_FALSE;
-		rasterization_create_info.polygonMode = VK_POLYGON_MODE_FILL;
-		rasterization_create_info.lineWidth = 1.0f;
-		rasterization_create_info.cullMode = VK_CULL_MODE_BACK_BIT;
-		rasterization_create_info.frontFace = VK_FRONT_FACE_CLOCKWISE;
-		rasterization_create_info.depthClampEnable = VK_FALSE;
-		rasterization_create_info.depthBiasEnable = VK_FALSE;
-		rasterization_create_info.depthBiasClamp = 0.0f;
-		rasterization_create_info.depthBiasConstantFactor = 0.0f;
-		rasterization_create_info.depthBiasSlopeFactor = 0.0f;
-		// Multisampling State
-		VkPipelineMultisampleStateCreateInfo multisample_create_info = {};
-		multisample_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-		multisample_create_info.sampleShadingEnable = VK_FALSE;
-		multisample_create_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-		multisample_create_info.minSampleShading = 1.0f;
-		multisample_create_info.pSampleMask = VK_NULL_HANDLE;
-		multisample_create_info.alphaToCoverageEnable = VK_FALSE;
-		multisample_create_info.alphaToOneEnable = VK_FALSE;
-		// Depth-Stencil State
-		VkPipelineDepthStencilStateCreateInfo depth_stencil_create_info = {};
-		depth_stencil_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-		depth_stencil_create_info.depthTestEnable = VK_TRUE;
-		depth_stencil_create_info.depthWriteEnable = VK_TRUE;
-		depth_stencil_create_info.depthCompareOp = VK_COMPARE_OP_LESS;
-		depth_stencil_create_info.depthBoundsTestEnable = VK_FALSE;
-		depth_stencil_create_info.minDepthBounds = 0.0f;
-		depth_stencil_create_info.maxDepthBounds = 1.0f;
-		depth_stencil_create_info.stencilTestEnable = VK_FALSE;
-		// Color Blending Attachment & State
-		VkPipelineColorBlendAttachmentState color_blend_attachment_state = {};
-		color_blend_attachment_state.colorWriteMask = 0xF;
-		color_blend_attachment_state.blendEnable = VK_FALSE;
-		color_blend_attachment_state.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_COLOR;
-		color_blend_attachment_state.dstColorBlendFactor = VK_BLEND_FACTOR_DST_COLOR;
-		color_blend_attachment_state.colorBlendOp = VK_BLEND_OP_ADD;
-		color_blend_attachment_state.srcAlphaBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-		color_blend_attachment_state.dstAlphaBlendFactor = VK_BLEND_FACTOR_DST_ALPHA;
-		color_blend_attachment_state.alphaBlendOp = VK_BLEND_OP_ADD;
-		VkPipelineColorBlendStateCreateInfo color_blend_create_info = {};
-		color_blend_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-		color_blend_create_info.logicOpEnable = VK_FALSE;
-		color_blend_create_info.logicOp = VK_LOGIC_OP_COPY;
-		color_blend_create_info.attachmentCount = 1;
-		color_blend_create_info.pAttachments = &color_blend_attachment_state;
-		color_blend_create_info.blendConstants[0] = 0.0f;
-		color_blend_create_info.blendConstants[1] = 0.0f;
-		color_blend_create_info.blendConstants[2] = 0.0f;
-		color_blend_create_info.blendConstants[3] = 0.0f;
-		// Dynamic State 
-		VkDynamicState dynamic_state[2] = {
-			// By setting these we do not need to re-create the pipeline on Resize
-			VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR
-		};
-		VkPipelineDynamicStateCreateInfo dynamic_create_info = {};
-		dynamic_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-		dynamic_create_info.dynamicStateCount = 2;
-		dynamic_create_info.pDynamicStates = dynamic_state;
-
 		VkDescriptorSetLayoutBinding layout_binding = {};
 		layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 		layout_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
@@ -378,12 +383,38 @@ public:
 			vkUpdateDescriptorSets(device, 1, &write_descriptor_set, 0, nullptr);
 		}
 
+		/***************** TEXTURE DESCRIPTOR FOR FRAGMENT/PIXEL SHADER ******************/
+
+		// desribes the order and type of resources bound to the pixel shader
+		VkDescriptorSetLayoutBinding pshader_descriptor_layout_binding = {};
+		pshader_descriptor_layout_binding.binding = 0;
+		pshader_descriptor_layout_binding.descriptorCount = 1;
+		pshader_descriptor_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		pshader_descriptor_layout_binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		pshader_descriptor_layout_binding.pImmutableSamplers = nullptr;
+		// pixel shader will have its own descriptor set layout
+#if TEXTURE_ARRAYS
+		// every array image at binding 0, the one sampler they share at 1
+		VkDescriptorSetLayoutBinding pshader_array_bindings[2] = {
+			{ 0, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, MAX_TEXTURE_ARRAYS, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr },
+			{ 1, VK_DESCRIPTOR_TYPE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr }
+		};
+		layout_create_info.bindingCount = 2;
+		layout_create_info.pBindings = pshader_array_bindings;
+#else
+		layout_create_info.pBindings = &pshader_descriptor_layout_binding;
+#endif
+		vkCreateDescriptorSetLayout(device, &layout_create_info,
+			nullptr, &pixelDescriptorLayout);
+
 	// Descriptor pipeline layout
 		VkPipelineLayoutCreateInfo pipeline_layout_create_info = {};
 		pipeline_layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 		
-		pipeline_layout_create_info.setLayoutCount = 1;
-		pipeline_layout_create_info.pSetLayouts = &descriptorLayout;
+		// textured draws bind their maps as set 1
+		VkDescriptorSetLayout set_layouts[2] = { descriptorLayout, pixelDescriptorLayout };
+		pipeline_layout_create_info.setLayoutCount = 2;
+		pipeline_layout_create_info.pSetLayouts = set_layouts;
 		
 		VkPushConstantRange push_constant_range = {};
 		push_constant_range.offset = 0;
@@ -394,53 +425,26 @@ public:
 		pipeline_layout_create_info.pPushConstantRanges = &push_constant_range;
 		vkCreatePipelineLayout(device, &pipeline_layout_create_info,
 			nullptr, &pipelineLayout);
-		// Pipeline State... (FINALLY) 
-		VkGraphicsPipelineCreateInfo pipeline_create_info = {};
-		pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-		pipeline_create_info.stageCount = 2;
-		pipeline_create_info.pStages = stage_create_info;
-		pipeline_create_info.pInputAssemblyState = &assembly_create_info;
-		pipeline_create_info.pVertexInputState = &input_vertex_info;
-		pipeline_create_info.pViewportState = &viewport_create_info;
-		pipeline_create_info.pRasterizationState = &rasterization_create_info;
-		pipeline_create_info.pMultisampleState = &multisample_create_info;
-		pipeline_create_info.pDepthStencilState = &depth_stencil_create_info;
-		pipeline_create_info.pColorBlendState = &color_blend_create_info;
-		pipeline_create_info.pDynamicState = &dynamic_create_info;
-		pipeline_create_info.layout = pipelineLayout;
-		pipeline_create_info.renderPass = renderPass;
-		pipeline_create_info.subpass = 0;
-		pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
-		vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
-			&pipeline_create_info, nullptr, &pipeline);
-
-		/***************** TEXTURE DESCRIPTOR FOR FRAGMENT/PIXEL SHADER ******************/
-
-		stage_create_info[1].module = texturePixelShader;
-		pipeline_create_info.pStages = stage_create_info;
 
-		// desribes the order and type of resources bound to the pixel shader
-		VkDescriptorSetLayoutBinding pshader_descriptor_layout_binding = {};
-		pshader_descriptor_layout_binding.binding = 0;
-		pshader_descriptor_layout_binding.descriptorCount = 1;
-		pshader_descriptor_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		pshader_descriptor_layout_binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-		pshader_descriptor_layout_binding.pImmutableSamplers = nullptr;
-		// pixel shader will have its own descriptor set layout
-		layout_create_info.pBindings = &pshader_descriptor_layout_binding;
-		vkCreateDescriptorSetLayout(device, &layout_create_info,
-			nullptr, &pixelDescriptorLayout);
 		// Create a descriptor pool!
 		// this is how many unique descriptor sets you want to allocate 
 		// we need one for each uniform buffer and one for each unique texture
 		unsigned int total_descriptorsets = numBBS + 1;
 		VkDescriptorPoolCreateInfo descriptorpool_create_info = {};
 		descriptorpool_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+#if TEXTURE_ARRAYS
+		VkDescriptorPoolSize descriptorpool_size[3] = {
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, numBBS },
+			{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, MAX_TEXTURE_ARRAYS },
+			{ VK_DESCRIPTOR_TYPE_SAMPLER, 1 }
+		};
+#else
 		VkDescriptorPoolSize descriptorpool_size[2] = {
 			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, numBBS },
-			{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 }
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 }
 		};
-		descriptorpool_create_info.poolSizeCount = 2;
+#endif
+		descriptorpool_create_info.poolSizeCount = sizeof(descriptorpool_size) / sizeof(descriptorpool_size[0]);
 		descriptorpool_create_info.pPoolSizes = descriptorpool_size;
 		descriptorpool_create_info.maxSets = total_descriptorsets;
 		descriptorpool_create_info.flags = 0;
@@ -454,19 +458,9 @@ public:
 		descriptorset_allocate_info.descriptorPool = descriptorPool;
 		descriptorset_allocate_info.pNext = nullptr;
 		vkAllocateDescriptorSets(device, &descriptorset_allocate_info, &textureDescriptorSet);
-		// end texturing descriptor specifics
-
-		vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
-			&pipeline_create_info, nullptr, &texturePipeline);
-
-
 
-		for (int i = 0; i < levelData.levelMaterials.size(); ++i) {
-			if (levelData.levelMaterials[i].map_Kd != NULL)
-				levelTextures.push_back(LoadTextures(levelData.levelMaterials[i].map_Kd));
-			else
-				levelTextures.push_back(Texture());
-		}
+		CreateGraphicsPipelines(vertexShader, pixelShader, texturePixelShader, pipeline, texturePipeline);
+		LoadLevelTextures();
 
 		/***************** CLEANUP / SHUTDOWN ******************/
 		// GVulkanSurface will inform us when to release any allocated resources
@@ -477,67 +471,231 @@ public:
 			});
 	}
 
-	Texture LoadTextures(const char* texturePath)
+	// What ktxTexture_VkUploadEx fills in for source, minus the image and memory
+	static ktxVulkanTexture DescribeTexture(ktxTexture* source)
+	{
+		ktxVulkanTexture texture = {};
+		texture.imageFormat = ktxTexture_GetVkFormat(source);
+		texture.width = source->baseWidth;
+		texture.height = source->baseHeight;
+		texture.depth = source->baseDepth;
+		texture.levelCount = source->numLevels;
+		texture.layerCount = source->numLayers * source->numFaces;
+		texture.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		if (source->numDimensions == 1)
+			texture.viewType = source->isArray ? VK_IMAGE_VIEW_TYPE_1D_ARRAY : VK_IMAGE_VIEW_TYPE_1D;
+		else if (source->numDimensions == 3)
+			texture.viewType = VK_IMAGE_VIEW_TYPE_3D;
+		else if (source->isCubemap)
+			texture.viewType = source->isArray ? VK_IMAGE_VIEW_TYPE_CUBE_ARRAY : VK_IMAGE_VIEW_TYPE_CUBE;
+		else
+			texture.viewType = source->isArray ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D;
+		return texture;
+	}
+	// full without its levels finer than baseLevel
+	static ktxVulkanTexture MipChain(const ktxVulkanTexture& full, unsigned baseLevel)
+	{
+		ktxVulkanTexture texture = full;
+		texture.image = nullptr;
+		texture.deviceMemory = nullptr;
+		texture.width = std::max(full.width >> baseLevel, 1u);
+		texture.height = std::max(full.height >> baseLevel, 1u);
+		texture.depth = std::max(full.depth >> baseLevel, 1u);
+		texture.levelCount = full.levelCount - baseLevel;
+		return texture;
+	}
+	// Creates the image and device local memory texture describes
+	bool AllocateTextureImage(ktxVulkanTexture& texture, const VkPhysicalDeviceMemoryProperties& memory)
 	{
-		Texture output;
+		if (texture.imageFormat == VK_FORMAT_UNDEFINED)
+			return false;
+		VkImageType imageType = VK_IMAGE_TYPE_2D;
+		if (texture.viewType == VK_IMAGE_VIEW_TYPE_1D || texture.viewType == VK_IMAGE_VIEW_TYPE_1D_ARRAY)
+			imageType = VK_IMAGE_TYPE_1D;
+		else if (texture.viewType == VK_IMAGE_VIEW_TYPE_3D)
+			imageType = VK_IMAGE_TYPE_3D;
+		bool cube = texture.viewType == VK_IMAGE_VIEW_TYPE_CUBE || texture.viewType == VK_IMAGE_VIEW_TYPE_CUBE_ARRAY;
 
-		// Gateware, access to underlying Vulkan queue and command pool & physical device
-		VkQueue graphicsQueue;
-		VkCommandPool cmdPool;
-		VkPhysicalDevice physicalDevice;
-		vlk.GetGraphicsQueue((void**)&graphicsQueue);
-		vlk.GetCommandPool((void**)&cmdPool);
-		vlk.GetPhysicalDevice((void**)&physicalDevice);
-		// libktx, temporary variables
-		ktxTexture* kTexture;
-		KTX_error_code ktxresult;
-		ktxVulkanDeviceInfo vdi;
-		// used to transfer texture CPU memory to GPU. just need one
-		ktxresult = ktxVulkanDeviceInfo_Construct(&vdi, physicalDevice, device,
-			graphicsQueue, cmdPool, nullptr);
-		if (ktxresult != KTX_error_code::KTX_SUCCESS)
-			return output;
-		// load texture into CPU memory from file
-		ktxresult = ktxTexture_CreateFromNamedFile(texturePath,
-			KTX_TEXTURE_CREATE_NO_FLAGS, &kTexture);
-		if (ktxresult != KTX_error_code::KTX_SUCCESS)
-			return output;
-		// This gets mad if you don't encode/save the .ktx file in a format Vulkan likes
-		ktxresult = ktxTexture_VkUploadEx(kTexture, &vdi, &output.texture,
-			VK_IMAGE_TILING_OPTIMAL,
-			VK_IMAGE_USAGE_SAMPLED_BIT,
-			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-		if (ktxresult != KTX_error_code::KTX_SUCCESS)
-			return output;
-		// after loading all textures you don't need these anymore
-		ktxTexture_Destroy(kTexture);
-		ktxVulkanDeviceInfo_Destruct(&vdi);
+		VkImageCreateInfo imageInfo = {};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.flags = cube ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0;
+		imageInfo.imageType = imageType;
+		imageInfo.format = texture.imageFormat;
+		imageInfo.extent = { texture.width, texture.height, texture.depth };
+		imageInfo.mipLevels = texture.levelCount;
+		imageInfo.arrayLayers = texture.layerCount;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		// streamed textures copy their shared levels from the image they replace
+		imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		if (vkCreateImage(device, &imageInfo, nullptr, &texture.image) != VK_SUCCESS)
+			return false;
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements(device, texture.image, &requirements);
+		VkMemoryAllocateInfo allocateInfo = {};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocateInfo.allocationSize = requirements.size;
+		allocateInfo.memoryTypeIndex = ~0u;
+		for (uint32_t i = 0; i < memory.memoryTypeCount; ++i)
+			if ((requirements.memoryTypeBits & (1u << i)) &&
+				(memory.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+				allocateInfo.memoryTypeIndex = i;
+				break;
+			}
+		if (allocateInfo.memoryTypeIndex == ~0u ||
+			vkAllocateMemory(device, &allocateInfo, nullptr, &texture.deviceMemory) != VK_SUCCESS ||
+			vkBindImageMemory(device, texture.image, texture.deviceMemory, 0) != VK_SUCCESS) {
+			ktxVulkanTexture_Destruct(&texture, device, nullptr);
+			texture = {};
+			return false;
+		}
+		return true;
+	}
+	// Creates the image and memory a texture file is copied into, filling
+	// output.texture the way ktxTexture_VkUploadEx would. Levels finer than
+	// baseLevel are left out (streamed textures start from their mip tail).
+	bool CreateTextureImage(ktxTexture* source, const ktxVulkanDeviceInfo& vdi, Texture& output, unsigned baseLevel = 0)
+	{
+		output.texture = MipChain(DescribeTexture(source), baseLevel);
+		return AllocateTextureImage(output.texture, vdi.deviceMemoryProperties);
+	}
 
-		// create the the image view and sampler
-		VkSamplerCreateInfo samplerInfo = {};
-		// Set the struct values
-		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-		samplerInfo.flags = 0;
-		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER; // REPEAT IS COMMON
-		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
-		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
-		samplerInfo.magFilter = VK_FILTER_LINEAR;
-		samplerInfo.minFilter = VK_FILTER_LINEAR;
-		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-		samplerInfo.mipLodBias = 0;
-		samplerInfo.minLod = 0;
-		samplerInfo.maxLod = output.texture.levelCount;
-		samplerInfo.anisotropyEnable = VK_FALSE;
-		samplerInfo.maxAnisotropy = 1.0;
-		samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
-		samplerInfo.compareEnable = VK_FALSE;
-		samplerInfo.compareOp = VK_COMPARE_OP_LESS;
-		samplerInfo.unnormalizedCoordinates = VK_FALSE;
-		samplerInfo.pNext = nullptr;
-		VkResult vr = vkCreateSampler(device, &samplerInfo, nullptr, &output.textureSampler);
-		if (vr != VkResult::VK_SUCCESS)
-			return output;
+	// Lays out the staging copies of source's levels firstLevel up to endLevel
+	// into texture's image, whose level 0 is source's level baseLevel and whose
+	// layer baseLayer is source's first. Atlas pages place source at x, y.
+	void LayoutTextureCopies(ktxTexture* source, unsigned texture, unsigned baseLevel, unsigned firstLevel,
+		unsigned endLevel, std::vector<TEXTURE_COPY>& copies, VkDeviceSize& stagingSize, unsigned baseLayer = 0,
+		uint32_t x = 0, uint32_t y = 0)
+	{
+		// buffer offsets must be multiples of both 4 and the texel (or block) size
+		VkDeviceSize elementSize = ktxTexture_GetElementSize(source);
+		VkDeviceSize alignment = elementSize % 4 == 0 ? elementSize : elementSize % 2 == 0 ? elementSize * 2 : elementSize * 4;
+		unsigned faces = source->numDimensions == 3 ? 1 : source->numFaces; // 3D levels are copied whole
+		for (unsigned level = firstLevel; level < endLevel; ++level) {
+			uint32_t width = std::max(source->baseWidth >> level, 1u);
+			uint32_t height = std::max(source->baseHeight >> level, 1u);
+			uint32_t depth = std::max(source->baseDepth >> level, 1u);
+			size_t rowPitch = ktxTexture_GetRowPitch(source, level);
+			size_t rows = ktxTexture_GetImageSize(source, level) / rowPitch * depth;
+			for (unsigned layer = 0; layer < source->numLayers; ++layer)
+				for (unsigned face = 0; face < faces; ++face) {
+					ktx_size_t offset = 0;
+					ktxTexture_GetImageOffset(source, level, layer, face, &offset);
+					TEXTURE_COPY copy = {};
+					copy.texture = texture;
+					copy.data = ktxTexture_GetData(source) + offset;
+					copy.rowPitch = rowPitch;
+					copy.rowBytes = source->isCompressed ? rowPitch : width * elementSize;
+					copy.rows = rows;
+					stagingSize = (stagingSize + alignment - 1) / alignment * alignment;
+					copy.region.bufferOffset = stagingSize;
+					copy.region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - baseLevel,
+						baseLayer + layer * source->numFaces + face, 1 };
+					copy.region.imageOffset = { int32_t(x >> (level - baseLevel)), int32_t(y >> (level - baseLevel)), 0 };
+					copy.region.imageExtent = { width, height, depth };
+					stagingSize += copy.rowBytes * copy.rows;
+					copies.push_back(copy);
+				}
+		}
+	}
+	// Creates a host visible buffer of stagingSize bytes and fills it with copies
+	bool StageTextureCopies(VkPhysicalDevice physicalDevice, const std::vector<TEXTURE_COPY>& copies,
+		VkDeviceSize stagingSize, VkBuffer& stagingHandle, VkDeviceMemory& stagingData)
+	{
+		void* staging = nullptr;
+		if (GvkHelper::create_buffer(physicalDevice, device, stagingSize,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingHandle, &stagingData) != VK_SUCCESS ||
+			vkMapMemory(device, stagingData, 0, stagingSize, 0, &staging) != VK_SUCCESS)
+			return false;
+		for (const TEXTURE_COPY& copy : copies) {
+			uint8_t* destination = static_cast<uint8_t*>(staging) + copy.region.bufferOffset;
+			if (copy.rowBytes == copy.rowPitch)
+				memcpy(destination, copy.data, copy.rowBytes * copy.rows);
+			else
+				for (size_t row = 0; row < copy.rows; ++row)
+					memcpy(destination + row * copy.rowBytes, copy.data + row * copy.rowPitch, copy.rowBytes);
+		}
+		vkUnmapMemory(device, stagingData);
+		return true;
+	}
+	// Records the copies into cmd, consecutive copies into one image together
+	void RecordTextureCopies(VkCommandBuffer cmd, VkBuffer stagingHandle, const std::vector<TEXTURE_COPY>& copies,
+		const std::vector<Texture>& images)
+	{
+		std::vector<VkBufferImageCopy> regions;
+		for (size_t c = 0; c < copies.size(); ++c) {
+			regions.push_back(copies[c].region);
+			if (c + 1 == copies.size() || copies[c + 1].texture != copies[c].texture) {
+				vkCmdCopyBufferToImage(cmd, stagingHandle, images[copies[c].texture].texture.image,
+					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regions.size(), regions.data());
+				regions.clear();
+			}
+		}
+	}
+	// Stages the copies, then moves every targets image to transfer, copies and
+	// moves them on to shader reads: one submit on vdi's command buffer behind
+	// one fence wait. The sources copies point into may go once this returns.
+	bool UploadTextureCopies(const ktxVulkanDeviceInfo& vdi, VkPhysicalDevice physicalDevice, VkQueue queue,
+		const std::vector<TEXTURE_COPY>& copies, VkDeviceSize stagingSize, const std::vector<Texture>& images,
+		const std::vector<unsigned>& targets)
+	{
+		VkBuffer stagingHandle = nullptr;
+		VkDeviceMemory stagingData = nullptr;
+		bool staged = StageTextureCopies(physicalDevice, copies, stagingSize, stagingHandle, stagingData);
+		VkFence fence = nullptr;
+		VkFenceCreateInfo fence_create_info = {};
+		fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		staged = staged && vkCreateFence(device, &fence_create_info, nullptr, &fence) == VK_SUCCESS;
+		if (staged) {
+			std::vector<VkImageMemoryBarrier> barriers(targets.size());
+			for (size_t t = 0; t < targets.size(); ++t) {
+				const ktxVulkanTexture& texture = images[targets[t]].texture;
+				barriers[t] = {};
+				barriers[t].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				barriers[t].srcAccessMask = 0;
+				barriers[t].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barriers[t].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+				barriers[t].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				barriers[t].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barriers[t].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barriers[t].image = texture.image;
+				barriers[t].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, texture.levelCount, 0, texture.layerCount };
+			}
+			VkCommandBufferBeginInfo begin_info = {};
+			begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			vkBeginCommandBuffer(vdi.cmdBuffer, &begin_info);
+			vkCmdPipelineBarrier(vdi.cmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				0, 0, nullptr, 0, nullptr, barriers.size(), barriers.data());
+			RecordTextureCopies(vdi.cmdBuffer, stagingHandle, copies, images);
+			for (VkImageMemoryBarrier& barrier : barriers) {
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+				barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			}
+			vkCmdPipelineBarrier(vdi.cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+				0, 0, nullptr, 0, nullptr, barriers.size(), barriers.data());
+			vkEndCommandBuffer(vdi.cmdBuffer);
+			VkSubmitInfo submit_info = {};
+			submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submit_info.commandBufferCount = 1;
+			submit_info.pCommandBuffers = &vdi.cmdBuffer;
+			staged = vkQueueSubmit(queue, 1, &submit_info, fence) == VK_SUCCESS &&
+				vkWaitForFences(device, 1, &fence, VK_TRUE, ~0ull) == VK_SUCCESS;
+		}
+		vkDestroyFence(device, fence, nullptr);
+		vkDestroyBuffer(device, stagingHandle, nullptr);
+		vkFreeMemory(device, stagingData, nullptr);
+		return staged;
+	}
 
+	// Image view over every level and layer of an uploaded texture
+	bool CreateTextureView(Texture& output)
+	{
 		// Create image view.
 		// Textures are not directly accessed by the shaders and are abstracted
 		// by image views containing additional information and sub resource ranges.
@@ -558,9 +716,14 @@ public:
 		viewInfo.subresourceRange.baseMipLevel = 0;
 		viewInfo.subresourceRange.baseArrayLayer = 0;
 		viewInfo.pNext = nullptr;
-		vr = vkCreateImageView(device, &viewInfo, nullptr, &output.textureView);
-		if (vr != VkResult::VK_SUCCESS)
-			return output;
+		VkResult vr = vkCreateImageView(device, &viewInfo, nullptr, &output.textureView);
+		return vr == VkResult::VK_SUCCESS;
+	}
+	// View and descriptor for an uploaded texture
+	bool CreateTextureViews(Texture& output, VkSampler sampler)
+	{
+		if (CreateTextureView(output) == false)
+			return false;
 
 		// update the descriptor set(s) to point to the correct views
 		VkWriteDescriptorSet write_descriptorset = {};
@@ -570,17 +733,17 @@ public:
 		write_descriptorset.dstBinding = 0;
 		write_descriptorset.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 		write_descriptorset.dstSet = textureDescriptorSet;
-		VkDescriptorImageInfo diinfo = { output.textureSampler, output.textureView, output.texture.imageLayout };
+		VkDescriptorImageInfo diinfo = { sampler, output.textureView, output.texture.imageLayout };
 		write_descriptorset.pImageInfo = &diinfo;
 		vkUpdateDescriptorSets(device, 1, &write_descriptorset, 0, nullptr);
 
 		output.descriptorSet = textureDescriptorSet;
-
-		return output;
+		return true;
 	}
 
 	void Render()
 	{
+		PROFILE_SCOPE("Render");
 		// TODO: Part 2a
 		auto end = std::chrono::steady_clock::now();
 		std::chrono::duration<float> timer = end - start;
@@ -594,6 +757,8 @@ public:
 		vlk.GetSwapchainCurrentImage(currentBuffer);
 		VkCommandBuffer commandBuffer;
 		vlk.GetCommandBuffer(currentBuffer, (void**)&commandBuffer);
+		BeginGpuFrame(currentBuffer);
+		unsigned drawScope = BeginGpuScope(commandBuffer, currentBuffer, "GPU draws");
 		// what is the current client area dimensions?
 		unsigned int width, height;
 		win.GetClientWidth(width);
@@ -611,42 +776,114 @@ public:
 		VkDeviceSize offsets[] = { 0 };
 		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexHandle, offsets);
 		// TODO: Part 1h
-		vkCmdBindIndexBuffer(commandBuffer, indexHandle, 0, VK_INDEX_TYPE_UINT32);
 		// TODO: Part 4d
 		UINT32 currentImage = 0;
 		vlk.GetSwapchainCurrentImage(currentImage);
-		GvkHelper::write_to_buffer(device, storageData[currentImage], &sceneData, sizeof(SHADER_MODEL_DATA));
 		// TODO: Part 2i
 		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet[currentImage], 0, nullptr);
 
-		indexOffset = 0;
-		vertexOffset = 0;
-		materialOffset = 0;
-		for (size_t j = 0; j < levelData.levelModels.size(); j++)
-		{
-			pushConstants.startWorld = levelData.levelInstances[j].transformStart;
-			for (int i = levelData.levelModels[j].meshStart; i < levelData.levelModels[j].meshCount + levelData.levelModels[j].meshStart; ++i) {
-				if (levelTextures[levelData.levelMeshes[i].materialIndex + materialOffset].descriptorSet == nullptr) {
-					vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-					vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet[currentImage], 0, nullptr);
-				}
-				else {
-					vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, texturePipeline);
-					vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &textureDescriptorSet, 0, nullptr);
-				}
-				pushConstants.materialIndex = levelData.levelMeshes[i].materialIndex + materialOffset;
-				vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(Push_Constants), &pushConstants);
-				vkCmdDrawIndexed(commandBuffer, levelData.levelMeshes[i].drawInfo.indexCount, levelData.levelInstances[j].transformCount, levelData.levelMeshes[i].drawInfo.indexOffset + indexOffset, vertexOffset, 0);
+		// full detail draws of large models only keep their visible meshlets
+		GW::MATH::GMATRIXF viewProjection, cameraWorld;
+		proxy.MultiplyMatrixF(camera, perspective, viewProjection);
+		proxy.InverseF(camera, cameraWorld);
+		CLUSTER_VIEW clusterView = MakeClusterView(viewProjection, cameraWorld.row4);
+		levelData.UpdateHierarchy(); // attached objects follow parents moved since last frame
+		CullInstances(clusterView);
+		UpdateTexturedMaterials();
+		planner.Build(levelData, texturedMaterials, clusterView);
+#if CLUSTER_CULLING == 2
+		clusterJobs.clear();
+		clusterArgs.clear();
+#endif
+		// the draw list already knows which state changes each draw needs
+		Profile_Scope recordScope("Record draws");
+		const VkBuffer indexBuffers[] = { indexHandle, index16Handle, clusterIndexHandle.size() ? clusterIndexHandle[currentImage] : nullptr };
+		const VkIndexType indexTypes[] = { VK_INDEX_TYPE_UINT32, VK_INDEX_TYPE_UINT16, VK_INDEX_TYPE_UINT32 };
+		unsigned pushedModel = ~0u;
+		for (const PLANNED_DRAW& draw : planner.draws) {
+			if (draw.model != pushedModel) {
+				const H2B::BOUNDS& bounds = levelData.levelModels[draw.model].bounds;
+				pushConstants.quantizeMin[0] = bounds.min.x;
+				pushConstants.quantizeMin[1] = bounds.min.y;
+				pushConstants.quantizeMin[2] = bounds.min.z;
+				pushConstants.quantizeScale[0] = bounds.max.x - bounds.min.x;
+				pushConstants.quantizeScale[1] = bounds.max.y - bounds.min.y;
+				pushConstants.quantizeScale[2] = bounds.max.z - bounds.min.z;
+				pushedModel = draw.model;
 			}
-			indexOffset += levelData.levelModels[j].indexCount;
-			vertexOffset += levelData.levelModels[j].vertexCount;
-			materialOffset += levelData.levelModels[j].materialCount;
-		}
+			if (draw.bindPipeline)
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.textured ? texturePipeline : pipeline);
+			if (draw.bindTextures)
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &textureDescriptorSet, 0, nullptr);
+			if (draw.bindIndices)
+				vkCmdBindIndexBuffer(commandBuffer, indexBuffers[draw.indices], 0, indexTypes[draw.indices]);
+			pushConstants.materialIndex = draw.material;
+			pushConstants.startWorld = draw.firstWorld;
+			vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(Push_Constants), &pushConstants);
+#if CLUSTER_CULLING == 2
+			if (draw.gpuCulled) { // an empty draw until the compute pass appends the visible triangles
+				CLUSTER_INSTANCE instance = MakeClusterInstance(levelData.levelTransforms[planner.worlds[draw.firstWorld]]);
+				const H2B::MESHLET_RANGE& range = levelData.levelMeshletRanges[draw.mesh];
+				VkDrawIndexedIndirectCommand args = { 0, 1, draw.firstIndex, draw.vertexOffset, 0 };
+				CLUSTER_JOB job = { instance.world, range.meshletOffset, range.meshletCount,
+					draw.firstIndex, instance.coneTest ? 1u : 0u, { instance.scale, 0, 0, 0 } };
+				vkCmdDrawIndexedIndirect(commandBuffer, clusterArgsHandle[currentImage],
+					clusterArgs.size() * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+				clusterArgs.push_back(args);
+				clusterJobs.push_back(job);
+				continue;
+			}
+#endif
+			vkCmdDrawIndexed(commandBuffer, draw.indexCount, draw.instanceCount, draw.firstIndex, draw.vertexOffset, 0);
+		}
+		EndGpuScope(commandBuffer, currentBuffer, drawScope);
+		recordScope.End();
+		// only the transforms drawn this frame, materials once per image after they change
+		Profile_Scope uploadScope("Upload scene data");
+		unsigned worldCount = std::min<unsigned>(planner.worlds.size(), MAX_SUBMESH_PER_DRAW);
+		SCENE_RANGE ranges[2];
+		unsigned rangeCount = SceneRanges(worldCount, PackWorlds(levelData, planner.worlds, sceneData), ranges);
+		for (unsigned r = 0; r < rangeCount; ++r)
+			WriteBufferRange(storageData[currentImage], ranges[r].offset,
+				reinterpret_cast<const char*>(&sceneData) + ranges[r].offset, ranges[r].size);
+		if (materialsStale[currentImage]) {
+			WriteBufferRange(storageData[currentImage], offsetof(SHADER_MODEL_DATA, materials),
+				sceneData.materials, sizeof(sceneData.materials));
+#if TEXTURE_ARRAYS
+			WriteBufferRange(storageData[currentImage], offsetof(SHADER_MODEL_DATA, materialMaps),
+				sceneData.materialMaps, sizeof(sceneData.materialMaps) + sizeof(sceneData.mapRects));
+#endif
+			materialsStale[currentImage] = false;
+		}
+		const PLAN_STATS& plan = planner.stats;
+		frameStats = {};
+		frameStats.drawCount = plan.drawCount;
+		frameStats.instanceCount = plan.instanceCount;
+		frameStats.triangleCount = plan.triangleCount;
+		frameStats.fullDetailTriangleCount = plan.fullDetailTriangleCount;
+		frameStats.instancesCulled = plan.instancesCulled;
+		frameStats.pipelineBinds = plan.pipelineBinds;
+		frameStats.textureBinds = plan.textureBinds;
+		frameStats.indexBinds = plan.indexBinds;
+		frameStats.clusterCount = plan.clusters.clusters;
+		frameStats.clustersCulled = plan.clusters.frustumCulled + plan.clusters.backfaceCulled;
+#if CLUSTER_CULLING == 2
+		if (clusterIndexCapacity)
+			DispatchClusterCulling(currentImage, clusterView);
+#else
+		if (planner.clusterIndices.size())
+			GvkHelper::write_to_buffer(device, clusterIndexData[currentImage], planner.clusterIndices.data(),
+				planner.clusterIndices.size() * sizeof(unsigned));
+#endif
+		uploadScope.End();
+		if (timestampRecorded.size())
+			timestampRecorded[currentBuffer] = Profiler::Now();
 
 		start = std::chrono::steady_clock::now();
 	}
 
 	void UpdateCamera() {
+		PROFILE_SCOPE("Update camera");
 		const float cameraSpeed = 0.8;
 		auto end = std::chrono::steady_clock::now();
 		std::chrono::duration<float> timer = end - start;
@@ -700,37 +937,1746 @@ public:
 		float totalYaw = 1.13446f * aspect * mouseX / 800 + RXStick;
 		proxy.RotateXLocalF(tempCam, totalPitch, tempCam);
 		proxy.RotateYGlobalF(tempCam, totalYaw, tempCam);
+		// a replay overrides input, recording keeps whichever camera resulted
+		if (cameraReplay.keys.size()) {
+			if (replayStep == 0)
+				replayTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - replayStart).count();
+			tempCam = cameraReplay.Sample(cameraReplay.keys.front().time + replayTime);
+			if (replayTime >= cameraReplay.Duration())
+				cameraReplay.keys.clear(); // the last key has been shown, input takes over
+			replayTime += replayStep;
+		}
+		if (cameraRecorder.IsOpen())
+			cameraRecorder.Record(std::chrono::duration<float>(std::chrono::steady_clock::now() - recordStart).count(), tempCam);
 		// TODO: Part 4g
+		unsigned int height;
+		win.GetClientHeight(height);
+		planner.SelectLods(levelData, tempCam, height, fieldOfView);
+#if LEVEL_STREAMING
+		streamer.Update(tempCam.row4);
+		UpdateStreamPlacements();
+#endif
+#if TEXTURE_STREAMING
+		RequestTextureLevels();
+		textureStreamer.Update();
+		ApplyTextureStreaming();
+#endif
 		// TODO: Part 4c
 		proxy.InverseF(tempCam, camera);
 		start = std::chrono::steady_clock::now();
 	}
 
+	const FRAME_STATS& GetFrameStats() const { return frameStats; }
+
+	// Appends the camera of every UpdateCamera to path until CleanUp, with
+	// the seconds since now (Camera_Recorder)
+	bool RecordCamera(const char* path, GW::SYSTEM::GLog log)
+	{
+		std::string error;
+		if (cameraRecorder.Open(path, error) == false) {
+			log.LogCategorized("ERROR", ("Camera: " + error).c_str());
+			return false;
+		}
+		recordStart = std::chrono::steady_clock::now();
+		log.LogCategorized("INFO", ("Camera: recording to " + std::string(path)).c_str());
+		return true;
+	}
+	// Drives the camera from path (a recording or a .cam) instead of input,
+	// interpolating between its keys. step 0 plays at the recorded speed,
+	// any other step advances that many seconds per frame so every run sees
+	// the same views whatever the frame rate.
+	bool ReplayCamera(const char* path, float step, GW::SYSTEM::GLog log)
+	{
+		std::string error;
+		if (cameraReplay.Load(path, error) == false) {
+			log.LogCategorized("ERROR", ("Camera: " + error).c_str());
+			return false;
+		}
+		replayStart = std::chrono::steady_clock::now();
+		replayStep = std::max(step, 0.0f);
+		replayTime = 0;
+		char line[160];
+		std::snprintf(line, sizeof(line), "Camera: replaying %u keys (%.2f s) from ", unsigned(cameraReplay.keys.size()),
+			cameraReplay.Duration());
+		log.LogCategorized("INFO", (line + std::string(path)).c_str());
+		return true;
+	}
+	bool IsReplayingCamera() const { return cameraReplay.keys.size() != 0; }
+	const TEXTURE_STATS& GetTextureStats() const { return textureStats; }
+	void LogTextureStats(GW::SYSTEM::GLog log) const
+	{
+		std::string report = "Textures: " + std::to_string(textureStats.textures) + " uploaded (" +
+			std::to_string(textureStats.bytes >> 10) + " KB) in " + std::to_string(textureStats.milliseconds) +
+			" ms, " + std::to_string(textureStats.failed) + " failed";
+		log.LogCategorized(textureStats.failed ? "WARNING" : "INFO", report.c_str());
+		const TEXTURE_REGISTRY_STATS& registry = textureRegistry.GetStats();
+		report = "Textures: " + std::to_string(textureStats.shared) + " duplicate loads avoided (" +
+			std::to_string(registry.pathHits) + " same path, " + std::to_string(registry.contentHits) +
+			" same contents), " + std::to_string(textureStats.resident) + " resident, " +
+			std::to_string(textureStats.samplers) + " samplers";
+		log.LogCategorized("INFO", report.c_str());
+		report = "Textures: read " + std::to_string(textureStats.readMilliseconds) + " ms, decoded " +
+			std::to_string(textureStats.decodeMilliseconds) + " ms across loader threads, " +
+			std::to_string(textureStats.transcoded) + " transcoded";
+		log.LogCategorized("INFO", report.c_str());
+#if TEXTURE_ARRAYS
+		report = "Textures: layered into " + std::to_string(textureStats.arrays) + " arrays, " +
+			std::to_string(textureStats.leftOut) + " files left out (not plain 2D or past " +
+			std::to_string(MAX_TEXTURE_ARRAYS) + " arrays)";
+		log.LogCategorized(textureStats.leftOut ? "WARNING" : "INFO", report.c_str());
+		report = "Textures: " + std::to_string(textureStats.textures) + " in " + std::to_string(textureStats.arrays) +
+			" images, " + std::to_string(textureStats.atlased) + " packed into " + std::to_string(textureStats.atlasPages) +
+			" atlas pages using " + std::to_string(int(textureStats.atlasEfficiency * 100 + 0.5f)) + "% of their texels";
+		log.LogCategorized("INFO", report.c_str());
+#endif
+	}
+
+	// Flags the instances whose world bounds touch the view frustum
+	void CullInstances(const CLUSTER_VIEW& view)
+	{
+		planner.Cull(levelData, view);
+#if LEVEL_STREAMING
+		for (unsigned k = 0; k < planner.instanceVisible.size(); ++k)
+			planner.instanceVisible[k] = planner.instanceVisible[k] && streamer.IsResident(k);
+#endif
+	}
+	// Draws of materials with a texture loaded use texturePipeline
+	void UpdateTexturedMaterials()
+	{
+		texturedMaterials.assign(levelData.levelMaterials.size(), false);
+		for (unsigned m = 0; m < texturedMaterials.size() && m < MAX_SUBMESH_PER_DRAW; ++m) {
+#if TEXTURE_ARRAYS
+			texturedMaterials[m] = sceneData.materialMaps[m][0] != ~0u;
+#else
+			unsigned texture = materialTextures[m];
+			texturedMaterials[m] = texture != ~0u && textures[texture].descriptorSet != nullptr;
+#endif
+		}
+	}
+#if LEVEL_STREAMING
+	const STREAM_STATS& GetStreamStats() const { return streamer.GetStats(); }
+
+	// Draws read each model from the pool range the streamer placed it in
+	void UpdateStreamPlacements()
+	{
+		planner.modelPlacements.resize(levelData.levelModels.size());
+		for (unsigned m = 0; m < levelData.levelModels.size(); ++m) {
+			const Level_Data::LEVEL_MODEL& model = levelData.levelModels[m];
+			const STREAM_RANGE& range = streamer.GetModelRange(m);
+			size_t indexStart = range.offset + size_t(model.vertexCount) * streamVertexBytes;
+			planner.modelPlacements[m] = { int(range.offset / streamVertexBytes),
+				unsigned(indexStart / (model.shortIndices ? sizeof(uint16_t) : sizeof(unsigned))) };
+		}
+	}
+	// Copies a model's vertices and then its indices into its pool range. Runs
+	// on the streamer's worker for the models a cell placed, and inline for one
+	// a moved instance brought into a resident cell.
+	void UploadStreamedModel(unsigned modelIndex, const STREAM_RANGE& range)
+	{
+		const Level_Data::LEVEL_MODEL& model = levelData.levelModels[modelIndex];
+		char* target = static_cast<char*>(streamMapped) + range.offset;
+		size_t vertexBytes = size_t(model.vertexCount) * streamVertexBytes;
+#if PACKED_VERTICES
+		memcpy(target, levelData.levelPackedVertices.data() + model.vertexStart, vertexBytes);
+#else
+		memcpy(target, levelData.levelVertices.data() + model.vertexStart, vertexBytes);
+#endif
+		if (model.shortIndices)
+			memcpy(target + vertexBytes, levelData.levelIndices16.data() + model.gpuIndexStart, model.indexCount * sizeof(uint16_t));
+		else
+			memcpy(target + vertexBytes, levelData.levelIndices32.data() + model.gpuIndexStart, model.indexCount * sizeof(unsigned));
+	}
+#endif
+#if TEXTURE_STREAMING
+	const TEXTURE_STREAM_STATS& GetTextureStreamStats() const { return textureStreamer.GetStats(); }
+#endif
+
+	// Watches the level file, its .h2b models and the HLSL shaders. Paths must
+	// match the ones the level was loaded with.
+	void EnableHotReload(const char* gameLevelPath, const char* h2bFolderPath, GW::SYSTEM::GLog log)
+	{
+		hotLevelPath = gameLevelPath;
+		hotModelFolder = h2bFolderPath;
+		hotLog = log;
+		WatchLevelFiles();
+	}
+	// Call once per frame outside of StartFrame/EndFrame. Shaders rebuild their
+	// pipelines, edited models and instances are rewritten in place through the
+	// existing Level_Data offsets, anything that changes the level layout falls
+	// back to reloading the level into fresh buffers.
+	void CheckForChanges()
+	{
+		PROFILE_SCOPE("Check for changes");
+		changedFiles.clear();
+		watcher.Poll(changedFiles);
+		if (changedFiles.empty())
+			return;
+		bool shaders = false, level = false, fullReload = false;
+		std::vector<unsigned> models;
+		for (const std::string& path : changedFiles) {
+			if (path == hotLevelPath)
+				level = true;
+			else if (path.size() > 5 && path.compare(path.size() - 5, 5, ".hlsl") == 0)
+				shaders = true;
+			else
+				for (unsigned m = 0; m < levelData.levelModelFiles.size(); ++m)
+					if (levelData.levelModelFiles[m].size() && hotModelFolder + "/" + levelData.levelModelFiles[m] == path)
+						models.push_back(m);
+		}
+		vkDeviceWaitIdle(device); // nothing in flight may still read what gets replaced
+		if (shaders)
+			ReloadShaders();
+		for (unsigned m : models)
+			if (fullReload == false && ReloadModelGeometry(m) == false)
+				fullReload = true;
+		if (level && fullReload == false && ReloadLevelInstances() == false)
+			fullReload = true;
+		if (fullReload)
+			ReloadLevel();
+		hotLog.Flush();
+	}
+
 private:
+	// HLSL -> SPIRV -> VkShaderModule, module is only written on success
+	bool CompileShader(const char* source, shaderc_shader_kind kind, const char* name, VkShaderModule& module)
+	{
+		// Intialize runtime shader compiler HLSL -> SPIRV
+		shaderc_compiler_t compiler = shaderc_compiler_initialize();
+		shaderc_compile_options_t options = shaderc_compile_options_initialize();
+		shaderc_compile_options_set_source_language(options, shaderc_source_language_hlsl);
+		shaderc_compile_options_set_invert_y(options, false); // TODO: Part 2i
+		// shaders pick their vertex layout from the same switch as the vertex buffer
+		std::string packedVertices = std::to_string(PACKED_VERTICES);
+		shaderc_compile_options_add_macro_definition(options, "PACKED_VERTICES", 15,
+			packedVertices.c_str(), packedVertices.size());
+		std::string compactTransforms = std::to_string(COMPACT_TRANSFORMS);
+		shaderc_compile_options_add_macro_definition(options, "COMPACT_TRANSFORMS", 18,
+			compactTransforms.c_str(), compactTransforms.size());
+		std::string textureArrays = std::to_string(TEXTURE_ARRAYS);
+		shaderc_compile_options_add_macro_definition(options, "TEXTURE_ARRAYS", 14,
+			textureArrays.c_str(), textureArrays.size());
+#ifndef NDEBUG
+		shaderc_compile_options_set_generate_debug_info(options);
+#endif
+		shaderc_compilation_result_t result = shaderc_compile_into_spv( // compile
+			compiler, source, strlen(source), kind, name, "main", options);
+		bool compiled = shaderc_result_get_compilation_status(result) == shaderc_compilation_status_success;
+		if (compiled) // load into Vulkan
+			GvkHelper::create_shader_module(device, shaderc_result_get_length(result),
+				(char*)shaderc_result_get_bytes(result), &module);
+		else // errors?
+			std::cout << "Shader Errors (" << name << "): " << shaderc_result_get_error_message(result) << std::endl;
+		shaderc_result_release(result); // done
+		// Free runtime shader compiler resources
+		shaderc_compile_options_release(options);
+		shaderc_compiler_release(compiler);
+		return compiled;
+	}
+
+	// Solid and textured pipelines from the given shaders (Thanks Tiny!)
+	bool CreateGraphicsPipelines(VkShaderModule vertex, VkShaderModule pixel, VkShaderModule texturePixel,
+									VkPipeline& outPipeline, VkPipeline& outTexturePipeline)
+	{
+		unsigned int width, height;
+		win.GetClientWidth(width);
+		win.GetClientHeight(height);
+		VkRenderPass renderPass;
+		vlk.GetRenderPass((void**)&renderPass);
+		VkPipelineShaderStageCreateInfo stage_create_info[2] = {};
+		// Create Stage Info for Vertex Shader
+		stage_create_info[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		stage_create_info[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+		stage_create_info[0].module = vertex;
+		stage_create_info[0].pName = "main";
+		// Create Stage Info for Fragment Shader
+		stage_create_info[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		stage_create_info[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		stage_create_info[1].module = pixel;
+		stage_create_info[1].pName = "main";
+		// Assembly State
+		VkPipelineInputAssemblyStateCreateInfo assembly_create_info = {};
+		assembly_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		assembly_create_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		assembly_create_info.primitiveRestartEnable = false;
+		// Vertex Input State
+		VkVertexInputBindingDescription vertex_binding_description = {};
+		vertex_binding_description.binding = 0;
+		vertex_binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+#if PACKED_VERTICES
+		vertex_binding_description.stride = sizeof(H2B::PACKED_VERTEX);
+		VkVertexInputAttributeDescription vertex_attribute_description[3] = {
+			{ 0, 0, VK_FORMAT_R16G16B16A16_UNORM, 0 }, // position within model bounds
+			{ 1, 0, VK_FORMAT_R16G16_SFLOAT, 12 }, // uv
+			{ 2, 0, VK_FORMAT_R16G16_SNORM, 8 } // octahedral normal
+		};
+#else
+		vertex_binding_description.stride = sizeof(H2B::VERTEX);
+		VkVertexInputAttributeDescription vertex_attribute_description[3] = {
+			{ 0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0 }, //uv, normal, etc....
+			{ 1, 0, VK_FORMAT_R32G32B32_SFLOAT, 12 },
+			{ 2, 0, VK_FORMAT_R32G32B32_SFLOAT, 24 }
+		};
+#endif
+		VkPipelineVertexInputStateCreateInfo input_vertex_info = {};
+		input_vertex_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+		input_vertex_info.vertexBindingDescriptionCount = 1;
+		input_vertex_info.pVertexBindingDescriptions = &vertex_binding_description;
+		input_vertex_info.vertexAttributeDescriptionCount = 3;
+		input_vertex_info.pVertexAttributeDescriptions = vertex_attribute_description;
+		// Viewport State (we still need to set this up even though we will overwrite the values)
+		VkViewport viewport = {
+			0, 0, static_cast<float>(width), static_cast<float>(height), 0, 1
+		};
+		VkRect2D scissor = { {0, 0}, {width, height} };
+		VkPipelineViewportStateCreateInfo viewport_create_info = {};
+		viewport_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		viewport_create_info.viewportCount = 1;
+		viewport_create_info.pViewports = &viewport;
+		viewport_create_info.scissorCount = 1;
+		viewport_create_info.pScissors = &scissor;
+		// Rasterizer State
+		VkPipelineRasterizationStateCreateInfo rasterization_create_info = {};
+		rasterization_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		rasterization_create_info.rasterizerDiscardEnable = VK_FALSE;
+		rasterization_create_info.polygonMode = VK_POLYGON_MODE_FILL;
+		rasterization_create_info.lineWidth = 1.0f;
+		rasterization_create_info.cullMode = VK_CULL_MODE_BACK_BIT;
+		rasterization_create_info.frontFace = VK_FRONT_FACE_CLOCKWISE;
+		rasterization_create_info.depthClampEnable = VK_FALSE;
+		rasterization_create_info.depthBiasEnable = VK_FALSE;
+		rasterization_create_info.depthBiasClamp = 0.0f;
+		rasterization_create_info.depthBiasConstantFactor = 0.0f;
+		rasterization_create_info.depthBiasSlopeFactor = 0.0f;
+		// Multisampling State
+		VkPipelineMultisampleStateCreateInfo multisample_create_info = {};
+		multisample_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		multisample_create_info.sampleShadingEnable = VK_FALSE;
+		multisample_create_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+		multisample_create_info.minSampleShading = 1.0f;
+		multisample_create_info.pSampleMask = VK_NULL_HANDLE;
+		multisample_create_info.alphaToCoverageEnable = VK_FALSE;
+		multisample_create_info.alphaToOneEnable = VK_FALSE;
+		// Depth-Stencil State
+		VkPipelineDepthStencilStateCreateInfo depth_stencil_create_info = {};
+		depth_stencil_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+		depth_stencil_create_info.depthTestEnable = VK_TRUE;
+		depth_stencil_create_info.depthWriteEnable = VK_TRUE;
+		depth_stencil_create_info.depthCompareOp = VK_COMPARE_OP_LESS;
+		depth_stencil_create_info.depthBoundsTestEnable = VK_FALSE;
+		depth_stencil_create_info.minDepthBounds = 0.0f;
+		depth_stencil_create_info.maxDepthBounds = 1.0f;
+		depth_stencil_create_info.stencilTestEnable = VK_FALSE;
+		// Color Blending Attachment & State
+		VkPipelineColorBlendAttachmentState color_blend_attachment_state = {};
+		color_blend_attachment_state.colorWriteMask = 0xF;
+		color_blend_attachment_state.blendEnable = VK_FALSE;
+		color_blend_attachment_state.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_COLOR;
+		color_blend_attachment_state.dstColorBlendFactor = VK_BLEND_FACTOR_DST_COLOR;
+		color_blend_attachment_state.colorBlendOp = VK_BLEND_OP_ADD;
+		color_blend_attachment_state.srcAlphaBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+		color_blend_attachment_state.dstAlphaBlendFactor = VK_BLEND_FACTOR_DST_ALPHA;
+		color_blend_attachment_state.alphaBlendOp = VK_BLEND_OP_ADD;
+		VkPipelineColorBlendStateCreateInfo color_blend_create_info = {};
+		color_blend_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		color_blend_create_info.logicOpEnable = VK_FALSE;
+		color_blend_create_info.logicOp = VK_LOGIC_OP_COPY;
+		color_blend_create_info.attachmentCount = 1;
+		color_blend_create_info.pAttachments = &color_blend_attachment_state;
+		color_blend_create_info.blendConstants[0] = 0.0f;
+		color_blend_create_info.blendConstants[1] = 0.0f;
+		color_blend_create_info.blendConstants[2] = 0.0f;
+		color_blend_create_info.blendConstants[3] = 0.0f;
+		// Dynamic State 
+		VkDynamicState dynamic_state[2] = {
+			// By setting these we do not need to re-create the pipeline on Resize
+			VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR
+		};
+		VkPipelineDynamicStateCreateInfo dynamic_create_info = {};
+		dynamic_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		dynamic_create_info.dynamicStateCount = 2;
+		dynamic_create_info.pDynamicStates = dynamic_state;
+		// Pipeline State... (FINALLY) 
+		VkGraphicsPipelineCreateInfo pipeline_create_info = {};
+		pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipeline_create_info.stageCount = 2;
+		pipeline_create_info.pStages = stage_create_info;
+		pipeline_create_info.pInputAssemblyState = &assembly_create_info;
+		pipeline_create_info.pVertexInputState = &input_vertex_info;
+		pipeline_create_info.pViewportState = &viewport_create_info;
+		pipeline_create_info.pRasterizationState = &rasterization_create_info;
+		pipeline_create_info.pMultisampleState = &multisample_create_info;
+		pipeline_create_info.pDepthStencilState = &depth_stencil_create_info;
+		pipeline_create_info.pColorBlendState = &color_blend_create_info;
+		pipeline_create_info.pDynamicState = &dynamic_create_info;
+		pipeline_create_info.layout = pipelineLayout;
+		pipeline_create_info.renderPass = renderPass;
+		pipeline_create_info.subpass = 0;
+		pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
+		VkResult solid = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
+			&pipeline_create_info, nullptr, &outPipeline);
+		stage_create_info[1].module = texturePixel;
+		VkResult textured = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
+			&pipeline_create_info, nullptr, &outTexturePipeline);
+		return solid == VK_SUCCESS && textured == VK_SUCCESS;
+	}
+
+	// models big enough to be worth culling per meshlet, and the worst case
+	// amount of indices they can emit in one frame
+	void SelectClusterModels()
+	{
+		planner.SelectClusterModels(levelData, CLUSTER_CULLING ? clusterCullMinTriangles : ~0u);
+		clusterIndexCapacity = 0;
+#if CLUSTER_CULLING == 2
+		clusterJobCapacity = 0;
+#endif
+		for (const Level_Data::MODEL_INSTANCES& instances : levelData.levelInstances) {
+			if (planner.clusterCulledModels[instances.modelIndex] == false)
+				continue;
+			const Level_Data::LEVEL_MODEL& model = levelData.levelModels[instances.modelIndex];
+			for (unsigned i = model.meshStart; i < model.meshStart + model.meshCount; ++i)
+				clusterIndexCapacity += levelData.levelMeshes[i].drawInfo.indexCount * instances.transformCount;
+#if CLUSTER_CULLING == 2
+			clusterJobCapacity += model.meshCount * instances.transformCount;
+#endif
+		}
+	}
+
+	// Vertex and index buffers of the whole level, plus what cluster culling needs
+	void CreateGeometryBuffers(VkPhysicalDevice physicalDevice)
+	{
+		PROFILE_SCOPE("Upload geometry");
+#if LEVEL_STREAMING
+		// an empty pool, models are copied in as the cells using them stream in
+		GvkHelper::create_buffer(physicalDevice, device, streamBudgetBytes,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &vertexHandle, &vertexData);
+		vkMapMemory(device, vertexData, 0, VK_WHOLE_SIZE, 0, &streamMapped);
+		indexHandle = index16Handle = vertexHandle;
+#else
+		// Transfer triangle data to the vertex buffer. (staging would be prefered here)
+#if PACKED_VERTICES
+		unsigned vertexSize = levelData.levelPackedVertices.size() * sizeof(H2B::PACKED_VERTEX);
+		const void* vertexSource = levelData.levelPackedVertices.data();
+#else
+		unsigned vertexSize = levelData.levelVertices.size() * sizeof(H2B::VERTEX);
+		const void* vertexSource = levelData.levelVertices.data();
+#endif
+		GvkHelper::create_buffer(physicalDevice, device, vertexSize,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &vertexHandle, &vertexData);
+		GvkHelper::write_to_buffer(device, vertexData, vertexSource, vertexSize);
+
+		// each model draws from the buffer matching its index width
+		unsigned indexSize = levelData.levelIndices32.size() * sizeof(unsigned);
+		if (indexSize) {
+			GvkHelper::create_buffer(physicalDevice, device, indexSize,
+				VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &indexHandle, &indexData);
+			GvkHelper::write_to_buffer(device, indexData, levelData.levelIndices32.data(), indexSize);
+		}
+		unsigned index16Size = levelData.levelIndices16.size() * sizeof(uint16_t);
+		if (index16Size) {
+			GvkHelper::create_buffer(physicalDevice, device, index16Size,
+				VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &index16Handle, &index16Data);
+			GvkHelper::write_to_buffer(device, index16Data, levelData.levelIndices16.data(), index16Size);
+		}
+#endif
+
+		UINT32 numBBS = 0;
+		vlk.GetSwapchainImageCount(numBBS);
+		SelectClusterModels();
+		if (clusterIndexCapacity) {
+			clusterIndexHandle.resize(numBBS);
+			clusterIndexData.resize(numBBS);
+			for (int i = 0; i < numBBS; ++i)
+				GvkHelper::create_buffer(physicalDevice, device, clusterIndexCapacity * sizeof(unsigned),
+					VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					&clusterIndexHandle[i], &clusterIndexData[i]);
+			planner.clusterIndices.reserve(clusterIndexCapacity);
+		}
+#if CLUSTER_CULLING == 2
+		if (clusterIndexCapacity)
+			CreateClusterCulling(physicalDevice, numBBS);
+#endif
+	}
+	void DestroyGeometryBuffers()
+	{
+#if LEVEL_STREAMING
+		if (streamMapped)
+			vkUnmapMemory(device, vertexData);
+		streamMapped = nullptr;
+#else
+		vkDestroyBuffer(device, indexHandle, nullptr);
+		vkFreeMemory(device, indexData, nullptr);
+		vkDestroyBuffer(device, index16Handle, nullptr);
+		vkFreeMemory(device, index16Data, nullptr);
+#endif
+		for (size_t i = 0; i < clusterIndexHandle.size(); ++i) {
+			vkDestroyBuffer(device, clusterIndexHandle[i], nullptr);
+			vkFreeMemory(device, clusterIndexData[i], nullptr);
+		}
+		clusterIndexHandle.clear();
+		clusterIndexData.clear();
+#if CLUSTER_CULLING == 2
+		if (clusterIndexCapacity)
+			DestroyClusterCulling();
+#endif
+		vkDestroyBuffer(device, vertexHandle, nullptr);
+		vkFreeMemory(device, vertexData, nullptr);
+		indexHandle = index16Handle = vertexHandle = nullptr;
+		indexData = index16Data = vertexData = nullptr;
+	}
+
+	// Per instance state sized to levelTransforms
+	void ResetInstanceState()
+	{
+		planner.clusterMode = CLUSTER_CULLING;
+		planner.Reset(levelData);
+#if LEVEL_STREAMING
+		CreateStreamer();
+#endif
+	}
+#if LEVEL_STREAMING
+	// Streams levelData from an empty pool. Frames in flight may still draw
+	// from the old ranges, so they finish first.
+	void CreateStreamer()
+	{
+		if (device)
+			vkDeviceWaitIdle(device);
+		UINT32 frames = 0;
+		vlk.GetSwapchainImageCount(frames);
+		streamer.Create(levelData, streamCellSize, streamLoadRadius, streamUnloadRadius, streamBudgetBytes, true,
+			[this](const STREAM_CELL& cell) {
+				for (const STREAM_UPLOAD& upload : cell.uploads)
+					UploadStreamedModel(upload.model, upload.range);
+			}, nullptr, streamVertexBytes, frames);
+		UpdateStreamPlacements();
+	}
+#endif
+
+	// Uploads the textures levelData's materials use
+	void LoadLevelTextures()
+	{
+		PROFILE_SCOPE("Load textures");
+#if TEXTURE_ARRAYS
+		LoadTextureArrays();
+#else
+		LoadTextureSlots();
+#endif
+	}
+	// Creates textureLoader on first use
+	void StartTextureLoader(const VkPhysicalDeviceFeatures& features)
+	{
+		if (textureLoader.Running())
+			return;
+		unsigned threads = textureDecodeThreads ? textureDecodeThreads :
+			std::max(std::thread::hardware_concurrency(), 2u) - 1;
+		// Basis/UASTC files become the best block format the device samples
+		ktx_transcode_fmt_e target = features.textureCompressionBC ? KTX_TTF_BC7_RGBA :
+			features.textureCompressionETC2 ? KTX_TTF_ETC2_RGBA : KTX_TTF_RGBA32;
+		textureLoader.Create(threads, target);
+#if TEXTURE_STREAMING
+		textureTranscodeTarget = target;
+#endif
+	}
+
+	// Every material's texture at once: one ktxVulkanDeviceInfo and its command
+	// buffer for the whole level, all files copied through a single staging
+	// buffer and submitted together behind one fence wait. Files are loaded once
+	// however many materials use them (see Texture_Registry), samplers once per
+	// distinct state (see Sampler_Cache).
+	void LoadTextureSlots()
+	{
+		auto begin = std::chrono::steady_clock::now();
+#if TEXTURE_STREAMING
+		StopTextureStreaming(); // its worker reads the per slot arrays resized below
+#endif
+		textureStats = {};
+		textureRegistry.ResetStats();
+		samplerCache.ResetStats();
+		// Gateware, access to underlying Vulkan queue and command pool & physical device
+		VkQueue graphicsQueue;
+		VkCommandPool cmdPool;
+		VkPhysicalDevice physicalDevice;
+		vlk.GetGraphicsQueue((void**)&graphicsQueue);
+		vlk.GetCommandPool((void**)&cmdPool);
+		vlk.GetPhysicalDevice((void**)&physicalDevice);
+		VkPhysicalDeviceFeatures features;
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceFeatures(physicalDevice, &features);
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		float maxAnisotropy = features.samplerAnisotropy ? properties.limits.maxSamplerAnisotropy : 1.0f;
+		// acquire before releasing the previous level's references so textures
+		// and samplers both levels use stay resident
+		std::vector<unsigned> previous = materialTextures, previousSamplers = materialSamplers;
+		std::vector<unsigned> loads; // first material asking for each new slot
+		std::vector<std::string> files; // of each load
+		textureRegistry.hashContents = false; // textureLoader hashes on its I/O thread
+		materialTextures.assign(levelData.levelMaterials.size(), ~0u);
+		materialSamplers.assign(levelData.levelMaterials.size(), ~0u);
+		for (unsigned i = 0; i < materialTextures.size(); ++i) {
+			if (levelData.levelMaterials[i].map_Kd == NULL)
+				continue;
+			SAMPLER_STATE state;
+			std::string path = ParseTextureOptions(levelData.levelMaterials[i].map_Kd,
+				textureSamplerState, maxAnisotropy, state);
+			bool isNew = false;
+			materialSamplers[i] = samplerCache.Acquire(state, isNew);
+			samplers.resize(samplerCache.SlotCount(), nullptr);
+			if (isNew) {
+				VkSamplerCreateInfo samplerInfo = SamplerCreateInfo(state);
+				if (vkCreateSampler(device, &samplerInfo, nullptr, &samplers[materialSamplers[i]]) != VK_SUCCESS) {
+					samplerCache.Release(materialSamplers[i]);
+					materialSamplers[i] = ~0u;
+					++textureStats.failed;
+					continue;
+				}
+			}
+			std::vector<uint8_t> unread;
+			materialTextures[i] = textureRegistry.Acquire(path.c_str(), isNew, unread);
+			if (isNew) {
+				loads.push_back(i);
+				files.push_back(path);
+			}
+			else
+				++textureStats.shared;
+		}
+		textures.resize(textureRegistry.SlotCount());
+		ReleaseTextures(previous, previousSamplers);
+#if TEXTURE_STREAMING
+		streamFull.resize(textures.size(), ktxVulkanTexture());
+		streamBase.resize(textures.size(), 0);
+		streamLevelBytes.resize(textures.size());
+		streamFiles.resize(textures.size());
+		streamLoads.resize(textures.size(), nullptr);
+#endif
+		// files are read and decoded on the loader's threads while this one
+		// creates images for the ones already finished
+		StartTextureLoader(features);
+		TEXTURE_PIPELINE_STATS loaderStart = textureLoader.GetStats();
+		for (unsigned l = 0; l < loads.size(); ++l)
+			textureLoader.Submit(l, files[l]);
+		ktxVulkanDeviceInfo vdi;
+		if (ktxVulkanDeviceInfo_Construct(&vdi, physicalDevice, device,
+			graphicsQueue, cmdPool, nullptr) != KTX_error_code::KTX_SUCCESS) {
+			for (std::vector<TEXTURE_LOAD> done; textureLoader.Collect(done, true); done.clear())
+				for (TEXTURE_LOAD& load : done)
+					if (load.texture)
+						ktxTexture_Destroy(load.texture);
+			textureStats.failed = loads.size();
+			DropFailedTextures();
+			return;
+		}
+		// make images for the decoded files as they arrive and lay out the copies
+		std::vector<TEXTURE_COPY> copies;
+		std::vector<ktxTexture*> sources;
+		std::vector<unsigned> uploads; // loads waiting on the staging copy
+		std::vector<TEXTURE_LOAD> duplicates;
+		VkDeviceSize stagingSize = 0;
+		for (std::vector<TEXTURE_LOAD> done; textureLoader.Collect(done, true); done.clear()) for (TEXTURE_LOAD& load : done) {
+			unsigned l = load.id;
+			if (load.duplicateOf != ~0u) { // merged once the original has its final slot
+				duplicates.push_back(std::move(load));
+				continue;
+			}
+			// same bytes as a texture kept from an earlier load
+			unsigned i = textureRegistry.MatchContents(materialTextures[loads[l]], load.fileBytes, load.fileHash);
+			if (i != materialTextures[loads[l]]) {
+				textureStats.shared += RedirectMaterials(materialTextures[loads[l]], i);
+				if (load.texture)
+					ktxTexture_Destroy(load.texture);
+				continue;
+			}
+			ktxTexture* source = load.texture;
+			if (source == nullptr) {
+				++textureStats.failed;
+				continue;
+			}
+#if TEXTURE_STREAMING
+			streamFull[i] = ktxVulkanTexture(); // textures libktx mipmaps itself are loaded whole
+			streamBase[i] = 0;
+#endif
+			if (source->generateMipmaps) {
+				// libktx blits the missing mips itself, these keep their own submit
+				if (ktxTexture_VkUploadEx(source, &vdi, &textures[i].texture,
+					VK_IMAGE_TILING_OPTIMAL,
+					VK_IMAGE_USAGE_SAMPLED_BIT,
+					VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) == KTX_error_code::KTX_SUCCESS &&
+					CreateTextureViews(textures[i], samplers[materialSamplers[loads[l]]])) {
+					++textureStats.textures;
+					textureStats.bytes += ktxTexture_GetDataSize(source);
+				}
+				else
+					++textureStats.failed;
+				ktxTexture_Destroy(source);
+				continue;
+			}
+			unsigned baseLevel = 0;
+#if TEXTURE_STREAMING
+			// only the mip tail at first, finer levels stream in by their size on screen
+			streamFull[i] = DescribeTexture(source);
+			streamFiles[i] = files[l];
+			streamLevelBytes[i].clear();
+			for (unsigned level = 0; level < source->numLevels; ++level)
+				streamLevelBytes[i].push_back(ktxTexture_GetImageSize(source, level) * std::max(source->baseDepth >> level, 1u) *
+					source->numLayers * source->numFaces);
+			baseLevel = streamBase[i] = Texture_Streamer::TailLevel(source->baseWidth, source->baseHeight,
+				source->numLevels, textureTailSize);
+#endif
+			if (CreateTextureImage(source, vdi, textures[i], baseLevel) == false) {
+				ktxTexture_Destroy(source);
+				++textureStats.failed;
+				continue;
+			}
+			sources.push_back(source);
+			uploads.push_back(l);
+			LayoutTextureCopies(source, i, baseLevel, baseLevel, source->numLevels, copies, stagingSize);
+		}
+		for (TEXTURE_LOAD& load : duplicates) {
+			unsigned from = materialTextures[loads[load.id]], into = materialTextures[loads[load.duplicateOf]];
+			textureRegistry.Merge(from, into);
+			textureStats.shared += RedirectMaterials(from, into);
+		}
+		TEXTURE_PIPELINE_STATS loader = textureLoader.GetStats();
+		textureStats.transcoded = loader.transcoded - loaderStart.transcoded;
+		textureStats.readMilliseconds = loader.readMilliseconds - loaderStart.readMilliseconds;
+		textureStats.decodeMilliseconds = loader.decodeMilliseconds - loaderStart.decodeMilliseconds;
+		if (uploads.size()) {
+			std::vector<unsigned> targets;
+			for (unsigned l : uploads)
+				targets.push_back(materialTextures[loads[l]]);
+			bool staged = UploadTextureCopies(vdi, physicalDevice, graphicsQueue, copies, stagingSize, textures, targets);
+			for (ktxTexture* source : sources)
+				ktxTexture_Destroy(source);
+			for (unsigned l : uploads) {
+				Texture& texture = textures[materialTextures[loads[l]]];
+				if (staged && CreateTextureViews(texture, samplers[materialSamplers[loads[l]]]))
+					++textureStats.textures;
+				else {
+					DestroyTexture(texture);
+					++textureStats.failed;
+				}
+			}
+			if (staged)
+				textureStats.bytes += stagingSize;
+		}
+		ktxVulkanDeviceInfo_Destruct(&vdi);
+		DropFailedTextures();
+#if TEXTURE_STREAMING
+		StartTextureStreaming();
+#endif
+		for (unsigned i = 0; i < textures.size(); ++i)
+			textureStats.resident += textureRegistry.References(i) != 0;
+		textureStats.samplers = samplerCache.Resident();
+		textureStats.milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - begin).count();
+	}
+
+#if TEXTURE_ARRAYS
+	// Every map of every material at once (levelData.levelTextureFiles). Files
+	// decode on textureLoader, those with the same format, size and mip count
+	// become layers of one 2D array image (see GroupTextureArrays), and all of
+	// them go through one staging buffer and submit. Materials index their maps
+	// by array and layer in sceneData.materialMaps, so the one descriptor set
+	// holding every array serves every textured draw. The arrays share a single
+	// sampler, map options (-clamp, -aniso) don't apply to them.
+	void LoadTextureArrays()
+	{
+		auto begin = std::chrono::steady_clock::now();
+		textureStats = {};
+		DestroyTextureArrays();
+		VkQueue graphicsQueue;
+		VkCommandPool cmdPool;
+		VkPhysicalDevice physicalDevice;
+		vlk.GetGraphicsQueue((void**)&graphicsQueue);
+		vlk.GetCommandPool((void**)&cmdPool);
+		vlk.GetPhysicalDevice((void**)&physicalDevice);
+		VkPhysicalDeviceFeatures features;
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceFeatures(physicalDevice, &features);
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		StartTextureLoader(features);
+		const std::vector<std::string>& files = levelData.levelTextureFiles;
+		TEXTURE_PIPELINE_STATS loaderStart = textureLoader.GetStats();
+		for (unsigned f = 0; f < files.size(); ++f)
+			textureLoader.Submit(f, files[f]);
+		// decoded files by table index, files with the bytes of another share its layer
+		std::vector<ktxTexture*> sources(files.size(), nullptr);
+		std::vector<unsigned> sameAs(files.size(), ~0u);
+		for (std::vector<TEXTURE_LOAD> done; textureLoader.Collect(done, true); done.clear())
+			for (TEXTURE_LOAD& load : done) {
+				if (load.duplicateOf != ~0u) {
+					sameAs[load.id] = load.duplicateOf;
+					++textureStats.shared;
+				}
+				else if (load.texture)
+					sources[load.id] = load.texture;
+				else
+					++textureStats.failed;
+			}
+		TEXTURE_PIPELINE_STATS loader = textureLoader.GetStats();
+		textureStats.transcoded = loader.transcoded - loaderStart.transcoded;
+		textureStats.readMilliseconds = loader.readMilliseconds - loaderStart.readMilliseconds;
+		textureStats.decodeMilliseconds = loader.decodeMilliseconds - loaderStart.decodeMilliseconds;
+		// only plain 2D textures whose file holds every level can be layered
+		std::vector<TEXTURE_ARRAY_KEY> keys(files.size(), TEXTURE_ARRAY_KEY());
+		for (unsigned f = 0; f < files.size(); ++f) {
+			ktxTexture* source = sources[f];
+			if (source && source->numDimensions == 2 && source->isArray == false &&
+				source->isCubemap == false && source->generateMipmaps == false)
+				keys[f] = { uint32_t(ktxTexture_GetVkFormat(source)), source->baseWidth, source->baseHeight, source->numLevels };
+		}
+		// small maps of any size share atlas pages, the rest get layers of their own size
+		std::vector<ATLAS_TEXTURE> small(files.size(), ATLAS_TEXTURE());
+		for (unsigned f = 0; f < files.size(); ++f)
+			if (keys[f].format)
+				small[f] = { keys[f].format, keys[f].width, keys[f].height, keys[f].levels,
+					AtlasBlockSize(VkFormat(keys[f].format), sources[f]->isCompressed) };
+		std::vector<TEXTURE_ATLAS> atlases;
+		std::vector<ATLAS_RECT> rects;
+#if TEXTURE_ATLAS_SIZE
+		TEXTURE_ATLAS_STATS atlasStats = PackTextureAtlases(small, TEXTURE_ATLAS_SIZE, atlasPageSize, atlasLevels,
+			properties.limits.maxImageArrayLayers, MAX_TEXTURE_ARRAYS, atlases, rects);
+		textureStats.atlasPages = atlasStats.pages;
+		textureStats.atlasEfficiency = atlasStats.Efficiency();
+		for (unsigned f = 0; f < files.size(); ++f)
+			if (rects[f].atlas != ~0u)
+				keys[f].format = 0;
+#endif
+		std::vector<TEXTURE_ARRAY> arrays;
+		GroupTextureArrays(keys, properties.limits.maxImageArrayLayers, MAX_TEXTURE_ARRAYS - atlases.size(),
+			arrays, arrayLayers);
+		// atlases follow the arrays, a page per layer
+		unsigned firstAtlas = arrays.size();
+		arrayRects.assign(files.size(), { 0, 0, 1, 1 });
+		for (const TEXTURE_ATLAS& atlas : atlases) {
+			float size = float(atlas.key.width);
+			for (unsigned f : atlas.textures) {
+				arrayLayers[f] = { unsigned(arrays.size()), rects[f].page };
+				arrayRects[f] = { rects[f].x / size, rects[f].y / size, rects[f].width / size, rects[f].height / size };
+			}
+			arrays.push_back({ atlas.key, atlas.textures });
+			textureStats.atlased += atlas.textures.size();
+		}
+		for (unsigned f = 0; f < files.size(); ++f)
+			textureStats.leftOut += sources[f] && arrayLayers[f].array == ~0u;
+		// one image per array, every layer through the same staging buffer
+		ktxVulkanDeviceInfo vdi;
+		bool constructed = ktxVulkanDeviceInfo_Construct(&vdi, physicalDevice, device,
+			graphicsQueue, cmdPool, nullptr) == KTX_error_code::KTX_SUCCESS;
+		std::vector<TEXTURE_COPY> copies;
+		std::vector<unsigned> targets; // arrays with an image
+		VkDeviceSize stagingSize = 0;
+		textureArrays.resize(arrays.size());
+		for (unsigned a = 0; constructed && a < arrays.size(); ++a) {
+			const TEXTURE_ARRAY_KEY& key = arrays[a].key;
+			ktxVulkanTexture& image = textureArrays[a].texture;
+			image.imageFormat = VkFormat(key.format);
+			image.width = key.width;
+			image.height = key.height;
+			image.depth = 1;
+			image.levelCount = key.levels;
+			image.layerCount = a < firstAtlas ? arrays[a].textures.size() : atlases[a - firstAtlas].pages;
+			image.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			image.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+			if (AllocateTextureImage(image, vdi.deviceMemoryProperties) == false)
+				continue;
+			targets.push_back(a);
+			for (unsigned l = 0; l < arrays[a].textures.size(); ++l) {
+				unsigned f = arrays[a].textures[l];
+				if (a < firstAtlas)
+					LayoutTextureCopies(sources[f], a, 0, 0, key.levels, copies, stagingSize, l);
+				else // packed maps keep only the levels the page has
+					LayoutTextureCopies(sources[f], a, 0, 0, key.levels, copies, stagingSize, rects[f].page, rects[f].x, rects[f].y);
+			}
+		}
+		bool staged = targets.size() &&
+			UploadTextureCopies(vdi, physicalDevice, graphicsQueue, copies, stagingSize, textureArrays, targets);
+		for (ktxTexture* source : sources)
+			if (source)
+				ktxTexture_Destroy(source);
+		if (constructed)
+			ktxVulkanDeviceInfo_Destruct(&vdi);
+		// arrays that didn't make it take their layers with them
+		for (unsigned a = 0; a < textureArrays.size(); ++a) {
+			Texture& texture = textureArrays[a];
+			if (staged && texture.texture.image && CreateTextureView(texture)) {
+				textureStats.textures += arrays[a].textures.size();
+				++textureStats.arrays;
+				continue;
+			}
+			DestroyTexture(texture);
+			textureStats.failed += arrays[a].textures.size();
+			for (unsigned f : arrays[a].textures)
+				arrayLayers[f] = { ~0u, ~0u };
+		}
+		for (unsigned f = 0; f < files.size(); ++f)
+			if (sameAs[f] != ~0u) { // always a file that was decoded
+				arrayLayers[f] = arrayLayers[sameAs[f]];
+				arrayRects[f] = arrayRects[sameAs[f]];
+			}
+		if (textureStats.arrays)
+			WriteArrayDescriptors();
+		arrayFiles = files;
+		WriteMaterialMaps();
+		if (staged)
+			textureStats.bytes += stagingSize;
+		textureStats.resident = textureStats.textures;
+		textureStats.samplers = textureArraySampler != nullptr;
+		textureStats.milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - begin).count();
+	}
+	// Texels across a block of format for atlas packing, 0 for blocks that aren't 4x4
+	static uint32_t AtlasBlockSize(VkFormat format, bool compressed)
+	{
+		if (compressed == false)
+			return 1;
+		// BC, ETC2/EAC and 4x4 ASTC are contiguous in VkFormat
+		return format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_ASTC_4x4_SRGB_BLOCK ? 4 : 0;
+	}
+	// Points textureDescriptorSet at every array and their sampler. Unused
+	// elements repeat an uploaded array, materials never index them.
+	void WriteArrayDescriptors()
+	{
+		VkSamplerCreateInfo samplerInfo = SamplerCreateInfo(textureSamplerState);
+		if (vkCreateSampler(device, &samplerInfo, nullptr, &textureArraySampler) != VK_SUCCESS) {
+			textureArraySampler = nullptr;
+			return;
+		}
+		VkImageView fallback = nullptr;
+		for (const Texture& texture : textureArrays)
+			if (fallback == nullptr)
+				fallback = texture.textureView;
+		std::vector<VkDescriptorImageInfo> views(MAX_TEXTURE_ARRAYS,
+			{ nullptr, fallback, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL });
+		for (unsigned a = 0; a < textureArrays.size(); ++a)
+			if (textureArrays[a].textureView)
+				views[a].imageView = textureArrays[a].textureView;
+		VkDescriptorImageInfo samplerView = { textureArraySampler, nullptr, VK_IMAGE_LAYOUT_UNDEFINED };
+		VkWriteDescriptorSet writes[2] = {};
+		for (VkWriteDescriptorSet& write : writes) {
+			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			write.dstSet = textureDescriptorSet;
+			write.descriptorCount = 1;
+		}
+		writes[0].dstBinding = 0;
+		writes[0].descriptorCount = MAX_TEXTURE_ARRAYS;
+		writes[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		writes[0].pImageInfo = views.data();
+		writes[1].dstBinding = 1;
+		writes[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+		writes[1].pImageInfo = &samplerView;
+		vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+	}
+	// sceneData.materialMaps from levelData.levelTextures, ~0u for maps with no
+	// layer (no file, failed or left out). Uploaded with the materials.
+	void WriteMaterialMaps()
+	{
+		for (unsigned m = 0; m < MAX_SUBMESH_PER_DRAW; ++m)
+			for (unsigned k = 0; k < 4; ++k) {
+				unsigned file = m < levelData.levelTextures.size() ? (&levelData.levelTextures[m].albedoIndex)[k] : ~0u;
+				bool layered = file < arrayLayers.size() && textureArraySampler != nullptr;
+				sceneData.materialMaps[m][k] = layered ? PackTextureLayer(arrayLayers[file]) : ~0u;
+				sceneData.mapRects[m][k] = layered ? arrayRects[file] : GW::MATH::GVECTORF{ 0, 0, 1, 1 };
+			}
+		materialsStale.assign(materialsStale.size(), true);
+	}
+	void DestroyTextureArrays()
+	{
+		for (Texture& texture : textureArrays)
+			DestroyTexture(texture);
+		textureArrays.clear();
+		arrayFiles.clear();
+		arrayLayers.clear();
+		arrayRects.clear();
+		vkDestroySampler(device, textureArraySampler, nullptr);
+		textureArraySampler = nullptr;
+	}
+#endif
+
+	// Materials whose texture failed to load draw untextured and let go of it,
+	// so the next load tries the file again
+	void DropFailedTextures()
+	{
+		for (unsigned i = 0; i < materialTextures.size(); ++i)
+			if (materialTextures[i] != ~0u && textures[materialTextures[i]].descriptorSet == nullptr) {
+				std::vector<unsigned> texture(1, materialTextures[i]), sampler(1, materialSamplers[i]);
+				ReleaseTextures(texture, sampler);
+				materialTextures[i] = materialSamplers[i] = ~0u;
+			}
+	}
+
+	// Points materials using texture slot from at slot into, returns how many
+	unsigned RedirectMaterials(unsigned from, unsigned into)
+	{
+		unsigned count = 0;
+		for (unsigned& texture : materialTextures)
+			if (texture == from) {
+				texture = into;
+				++count;
+			}
+		return count;
+	}
+
+	void ReleaseTextures(const std::vector<unsigned>& textureSlots, const std::vector<unsigned>& samplerSlots)
+	{
+		for (unsigned texture : textureSlots)
+			if (texture != ~0u && textureRegistry.Release(texture))
+				DestroyTexture(textures[texture]);
+		for (unsigned sampler : samplerSlots)
+			if (sampler != ~0u && samplerCache.Release(sampler)) {
+				vkDestroySampler(device, samplers[sampler], nullptr);
+				samplers[sampler] = nullptr;
+			}
+	}
+
+	void DestroyTexture(Texture& texture)
+	{
+		vkDestroyImageView(device, texture.textureView, nullptr);
+		if (texture.texture.image != nullptr)
+			ktxVulkanTexture_Destruct(&texture.texture, device, nullptr);
+		texture = Texture();
+	}
+
+#if TEXTURE_STREAMING
+	// Streams every slot with a mip chain description, kept slots go on from the levels they hold
+	void StartTextureStreaming()
+	{
+		textureStreamer.Create(textureBudgetBytes, textureTailSize, true,
+			[this](unsigned slot, unsigned level) { return LoadStreamedLevels(slot, level); },
+			[this](unsigned slot, unsigned level) { streamChanges.push_back({ slot, level }); });
+		for (unsigned i = 0; i < textures.size(); ++i)
+			if (textures[i].descriptorSet != nullptr && streamFull[i].levelCount)
+				textureStreamer.Add(i, streamFull[i].width, streamFull[i].height, streamLevelBytes[i], streamBase[i]);
+	}
+	void StopTextureStreaming()
+	{
+		textureStreamer.Destroy();
+		for (ktxTexture*& source : streamLoads)
+			if (source) {
+				ktxTexture_Destroy(source);
+				source = nullptr;
+			}
+		streamChanges.clear();
+	}
+	// On the streamer's worker: decodes the file again, ApplyTextureStreaming
+	// copies the levels the image is missing. Each slot has one load at a time.
+	bool LoadStreamedLevels(unsigned slot, unsigned level)
+	{
+		TEXTURE_LOAD load;
+		load.path = streamFiles[slot];
+		if (Texture_Pipeline::ReadFile(load.path, load.contents) == false ||
+			DecodeKtxTexture(load, textureTranscodeTarget) == false)
+			return false;
+		if (load.texture->numLevels != streamFull[slot].levelCount) { // edited since it was loaded
+			ktxTexture_Destroy(load.texture);
+			return false;
+		}
+		streamLoads[slot] = load.texture;
+		return true;
+	}
+	// Feedback for the streamer: the finest level each texture needs on the
+	// instances left visible by the last frame's culling. Without UV density
+	// data a texture is assumed to span its model's bounds once.
+	void RequestTextureLevels()
+	{
+		unsigned materials = 0;
+		for (size_t j = 0; j < levelData.levelModels.size(); j++) {
+			const Level_Data::MODEL_INSTANCES& instances = levelData.levelInstances[j];
+			float pixels = 0;
+			for (unsigned k = instances.transformStart; k < instances.transformStart + instances.transformCount; ++k)
+				if (planner.instanceVisible[k])
+					pixels = std::max(pixels, planner.instancePixels[k]);
+			if (pixels > 0)
+				for (int i = levelData.levelModels[j].meshStart; i < levelData.levelModels[j].meshCount + levelData.levelModels[j].meshStart; ++i) {
+					unsigned slot = materialTextures[levelData.levelMeshes[i].materialIndex + materials];
+					if (slot != ~0u && streamFull[slot].levelCount)
+						textureStreamer.Request(slot, Texture_Streamer::DesiredLevel(
+							std::max(streamFull[slot].width, streamFull[slot].height), pixels));
+				}
+			materials += levelData.levelModels[j].materialCount;
+		}
+	}
+	// Rebuilds the images whose resident levels changed in this Update: levels
+	// both images hold are copied on the GPU, newly streamed ones through one
+	// staging buffer, all in one submit. The first barrier waits for every
+	// frame already submitted, so the old images can go once the fence signals.
+	void ApplyTextureStreaming()
+	{
+		if (streamChanges.empty())
+			return;
+		VkQueue graphicsQueue;
+		VkCommandPool cmdPool;
+		VkPhysicalDevice physicalDevice;
+		vlk.GetGraphicsQueue((void**)&graphicsQueue);
+		vlk.GetCommandPool((void**)&cmdPool);
+		vlk.GetPhysicalDevice((void**)&physicalDevice);
+		ktxVulkanDeviceInfo vdi;
+		bool constructed = ktxVulkanDeviceInfo_Construct(&vdi, physicalDevice, device,
+			graphicsQueue, cmdPool, nullptr) == KTX_error_code::KTX_SUCCESS;
+		bool applied = constructed;
+		std::vector<Texture> previous; // per change, the image being replaced
+		std::vector<TEXTURE_COPY> copies;
+		std::vector<VkImageCopy> shared; // per change, levels both images hold
+		VkDeviceSize stagingSize = 0;
+		for (const std::pair<unsigned, unsigned>& change : streamChanges) {
+			unsigned slot = change.first, level = change.second;
+			Texture next;
+			next.texture = MipChain(streamFull[slot], level);
+			if (applied == false || (level < streamBase[slot] && streamLoads[slot] == nullptr) ||
+				AllocateTextureImage(next.texture, vdi.deviceMemoryProperties) == false) {
+				previous.push_back(Texture()); // keeps the levels it has until its next change
+				shared.push_back(VkImageCopy());
+				continue;
+			}
+			previous.push_back(textures[slot]);
+			textures[slot].texture = next.texture;
+			textures[slot].textureView = nullptr;
+			unsigned oldBase = streamBase[slot];
+			if (level < oldBase && streamLoads[slot])
+				LayoutTextureCopies(streamLoads[slot], slot, level, level, oldBase, copies, stagingSize);
+			VkImageCopy copy = {};
+			unsigned first = std::max(level, oldBase); // finest level both hold
+			copy.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, first - oldBase, 0, streamFull[slot].layerCount };
+			copy.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, first - level, 0, streamFull[slot].layerCount };
+			shared.push_back(copy);
+			streamBase[slot] = level;
+		}
+		VkBuffer stagingHandle = nullptr;
+		VkDeviceMemory stagingData = nullptr;
+		VkFence fence = nullptr;
+		VkFenceCreateInfo fence_create_info = {};
+		fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		applied = applied && (copies.empty() || StageTextureCopies(physicalDevice, copies, stagingSize, stagingHandle, stagingData)) &&
+			vkCreateFence(device, &fence_create_info, nullptr, &fence) == VK_SUCCESS;
+		if (applied) {
+			// old images to transfer sources, new ones to transfer destinations
+			std::vector<VkImageMemoryBarrier> barriers;
+			for (size_t c = 0; c < streamChanges.size(); ++c) {
+				if (previous[c].texture.image == nullptr)
+					continue;
+				VkImageMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+				barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+				barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+				barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.image = previous[c].texture.image;
+				barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, previous[c].texture.levelCount, 0, previous[c].texture.layerCount };
+				barriers.push_back(barrier);
+				const ktxVulkanTexture& next = textures[streamChanges[c].first].texture;
+				barrier.srcAccessMask = 0;
+				barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+				barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				barrier.image = next.image;
+				barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, next.levelCount, 0, next.layerCount };
+				barriers.push_back(barrier);
+			}
+			VkCommandBufferBeginInfo begin_info = {};
+			begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			vkBeginCommandBuffer(vdi.cmdBuffer, &begin_info);
+			vkCmdPipelineBarrier(vdi.cmdBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				0, 0, nullptr, 0, nullptr, barriers.size(), barriers.data());
+			if (copies.size())
+				RecordTextureCopies(vdi.cmdBuffer, stagingHandle, copies, textures);
+			for (size_t c = 0; c < streamChanges.size(); ++c) {
+				if (previous[c].texture.image == nullptr)
+					continue;
+				// one region per level, every layer at once
+				const ktxVulkanTexture& next = textures[streamChanges[c].first].texture;
+				std::vector<VkImageCopy> regions;
+				for (VkImageCopy region = shared[c]; region.dstSubresource.mipLevel < next.levelCount;
+					++region.srcSubresource.mipLevel, ++region.dstSubresource.mipLevel) {
+					region.extent = { std::max(next.width >> region.dstSubresource.mipLevel, 1u),
+						std::max(next.height >> region.dstSubresource.mipLevel, 1u),
+						std::max(next.depth >> region.dstSubresource.mipLevel, 1u) };
+					regions.push_back(region);
+				}
+				vkCmdCopyImage(vdi.cmdBuffer, previous[c].texture.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+					next.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regions.size(), regions.data());
+			}
+			// only the new images go on to be sampled
+			size_t b = 0;
+			for (size_t c = 0; c < streamChanges.size(); ++c)
+				if (previous[c].texture.image != nullptr) {
+					barriers[b] = barriers[2 * b + 1];
+					barriers[b].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+					barriers[b].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+					barriers[b].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+					barriers[b].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+					++b;
+				}
+			vkCmdPipelineBarrier(vdi.cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+				0, 0, nullptr, 0, nullptr, b, barriers.data());
+			vkEndCommandBuffer(vdi.cmdBuffer);
+			VkSubmitInfo submit_info = {};
+			submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submit_info.commandBufferCount = 1;
+			submit_info.pCommandBuffers = &vdi.cmdBuffer;
+			applied = vkQueueSubmit(graphicsQueue, 1, &submit_info, fence) == VK_SUCCESS &&
+				vkWaitForFences(device, 1, &fence, VK_TRUE, ~0ull) == VK_SUCCESS;
+		}
+		vkDestroyFence(device, fence, nullptr);
+		vkDestroyBuffer(device, stagingHandle, nullptr);
+		vkFreeMemory(device, stagingData, nullptr);
+		for (size_t c = 0; c < streamChanges.size(); ++c) {
+			unsigned slot = streamChanges[c].first;
+			if (previous[c].texture.image == nullptr)
+				continue;
+			if (applied == false) { // back to the image that was there
+				DestroyTexture(textures[slot]);
+				textures[slot] = previous[c];
+				streamBase[slot] = streamFull[slot].levelCount - previous[c].texture.levelCount;
+				continue;
+			}
+			DestroyTexture(previous[c]);
+			unsigned material = 0;
+			while (material < materialTextures.size() && materialTextures[material] != slot)
+				++material;
+			if (material == materialTextures.size() ||
+				CreateTextureViews(textures[slot], samplers[materialSamplers[material]]) == false)
+				textures[slot].descriptorSet = nullptr; // draws untextured until its next change
+		}
+		for (const std::pair<unsigned, unsigned>& change : streamChanges)
+			if (streamLoads[change.first]) {
+				ktxTexture_Destroy(streamLoads[change.first]);
+				streamLoads[change.first] = nullptr;
+			}
+		if (constructed)
+			ktxVulkanDeviceInfo_Destruct(&vdi);
+		streamChanges.clear();
+	}
+#endif
+
+	void DestroyLevelTextures()
+	{
+#if TEXTURE_STREAMING
+		StopTextureStreaming();
+#endif
+		for (Texture& texture : textures)
+			DestroyTexture(texture);
+#if TEXTURE_ARRAYS
+		DestroyTextureArrays();
+#endif
+		textureLoader.Destroy();
+		textures.clear();
+		materialTextures.clear();
+		textureRegistry.Clear();
+		for (VkSampler sampler : samplers)
+			vkDestroySampler(device, sampler, nullptr);
+		samplers.clear();
+		materialSamplers.clear();
+		samplerCache.Clear();
+	}
+
+	void WatchLevelFiles()
+	{
+		watcher.Clear();
+		watcher.Add(hotLevelPath);
+		for (const std::string& file : levelData.levelModelFiles)
+			if (file.size())
+				watcher.Add(hotModelFolder + "/" + file);
+		for (const char* shader : { "../BasicVertexShader.hlsl", "../BasicPixelShader.hlsl", "../TexturePixelShader.hlsl" })
+			watcher.Add(shader);
+	}
+	// Recompiles the graphics shaders, a shader that fails to compile keeps the old pipelines
+	void ReloadShaders()
+	{
+		vertexString = ShaderAsString("../BasicVertexShader.hlsl");
+		vertexShaderSource = vertexString.c_str();
+		fragmentString = ShaderAsString("../BasicPixelShader.hlsl");
+		pixelShaderSource = fragmentString.c_str();
+		textureFragmentString = ShaderAsString("../TexturePixelShader.hlsl");
+		texturePixelShaderSource = textureFragmentString.c_str();
+		VkShaderModule vertex = nullptr, pixel = nullptr, texturePixel = nullptr;
+		VkPipeline solid = nullptr, textured = nullptr;
+		bool compiled = CompileShader(vertexShaderSource, shaderc_vertex_shader, "main.vert", vertex) &&
+			CompileShader(pixelShaderSource, shaderc_fragment_shader, "main.frag", pixel) &&
+			CompileShader(texturePixelShaderSource, shaderc_fragment_shader, "main.frag", texturePixel);
+		if (compiled && CreateGraphicsPipelines(vertex, pixel, texturePixel, solid, textured)) {
+			std::swap(vertex, vertexShader);
+			std::swap(pixel, pixelShader);
+			std::swap(texturePixel, texturePixelShader);
+			std::swap(solid, pipeline);
+			std::swap(textured, texturePipeline);
+			hotLog.LogCategorized("INFO", "Shaders reloaded.");
+		}
+		else
+			hotLog.LogCategorized("ERROR", "Shader reload failed, keeping the previous pipelines.");
+		// whichever set lost, old or new
+		vkDestroyShaderModule(device, vertex, nullptr);
+		vkDestroyShaderModule(device, pixel, nullptr);
+		vkDestroyShaderModule(device, texturePixel, nullptr);
+		vkDestroyPipeline(device, solid, nullptr);
+		vkDestroyPipeline(device, textured, nullptr);
+	}
+	// Uploads one edited model over its old vertex and index ranges
+	bool ReloadModelGeometry(unsigned modelIndex)
+	{
+		std::string path = hotModelFolder + "/" + levelData.levelModelFiles[modelIndex];
+#if LEVEL_STREAMING
+		streamer.WaitIdle(); // its worker may be copying the model
+#endif
+		if (levelData.ReloadModel(modelIndex, path.c_str(), hotLog) == false)
+			return false;
+		const Level_Data::LEVEL_MODEL& model = levelData.levelModels[modelIndex];
+#if LEVEL_STREAMING
+		const STREAM_RANGE& range = streamer.GetModelRange(modelIndex);
+		if (range.size) // placed models are rewritten, the rest are copied in when they stream in
+			UploadStreamedModel(modelIndex, range);
+#else
+#if PACKED_VERTICES
+		WriteBufferRange(vertexData, model.vertexStart * sizeof(H2B::PACKED_VERTEX),
+			&levelData.levelPackedVertices[model.vertexStart], model.vertexCount * sizeof(H2B::PACKED_VERTEX));
+#else
+		WriteBufferRange(vertexData, model.vertexStart * sizeof(H2B::VERTEX),
+			&levelData.levelVertices[model.vertexStart], model.vertexCount * sizeof(H2B::VERTEX));
+#endif
+		if (model.shortIndices)
+			WriteBufferRange(index16Data, model.gpuIndexStart * sizeof(uint16_t),
+				&levelData.levelIndices16[model.gpuIndexStart], model.indexCount * sizeof(uint16_t));
+		else
+			WriteBufferRange(indexData, model.gpuIndexStart * sizeof(unsigned),
+				&levelData.levelIndices32[model.gpuIndexStart], model.indexCount * sizeof(unsigned));
+#endif
+		for (unsigned i = model.materialStart; i < model.materialStart + model.materialCount; ++i)
+			sceneData.materials[i] = levelData.levelMaterials[i].attrib;
+		materialsStale.assign(materialsStale.size(), true);
+#if TEXTURE_ARRAYS
+		if (levelData.levelTextureFiles != arrayFiles)
+			LoadLevelTextures(); // the edit changed which files the level uses
+		else
+			WriteMaterialMaps();
+#endif
+#if CLUSTER_CULLING == 2
+		if (clusterIndexCapacity) { // meshlet tables are small, rewrite them whole
+			WriteBufferRange(meshletData, 0, levelData.levelMeshlets.data(),
+				levelData.levelMeshlets.size() * sizeof(H2B::MESHLET));
+			WriteBufferRange(meshletVertexData, 0, levelData.levelMeshletVertices.data(),
+				levelData.levelMeshletVertices.size() * sizeof(unsigned));
+			WriteBufferRange(meshletTriangleData, 0, levelData.levelMeshletTriangles.data(),
+				levelData.levelMeshletTriangles.size());
+		}
+#endif
+		return true;
+	}
+	// Patches only the instances that differ from the level file. Render writes
+	// the transforms it draws every frame, so patched ones need no upload of their own.
+	bool ReloadLevelInstances()
+	{
+		std::vector<Level_Data::LEVEL_PATCH> patches;
+		std::vector<Level_Data::TRANSFORM_RANGE> dirty;
+		if (levelData.DiffInstances(hotLevelPath.c_str(), patches, hotLog) == false)
+			return false;
+		if (levelData.ApplyPatches(patches, dirty, hotLog) == false) {
+#if LEVEL_STREAMING
+			// moved instances may belong to other cells, the rest of the pool stays
+			streamer.MoveTransforms(levelData, dirty);
+			UpdateStreamPlacements();
+#endif
+			return true;
+		}
+		// cluster buffers were sized for the old instance counts
+		unsigned indexCapacity = clusterIndexCapacity;
+#if CLUSTER_CULLING == 2
+		unsigned jobCapacity = clusterJobCapacity;
+#endif
+		SelectClusterModels();
+		bool fits = clusterIndexCapacity <= indexCapacity;
+		clusterIndexCapacity = indexCapacity;
+#if CLUSTER_CULLING == 2
+		fits = fits && clusterJobCapacity <= jobCapacity;
+		clusterJobCapacity = jobCapacity;
+#endif
+		if (fits == false)
+			return false;
+		ResetInstanceState();
+		return true;
+	}
+	// Layout changed, reload the level into new geometry buffers. The files are
+	// read into a separate Level_Data first, one that fails to load (say, saved
+	// halfway) keeps the current level running.
+	void ReloadLevel()
+	{
+		hotLog.LogCategorized("EVENT", "Hot reload needs a full level load.");
+		Level_Data loaded;
+		if (loaded.LoadLevel(hotLevelPath.c_str(), hotModelFolder.c_str(), hotLog) == false) {
+			hotLog.LogCategorized("ERROR", "Level reload failed, keeping the current level.");
+			return;
+		}
+#if LEVEL_STREAMING
+		streamer.Destroy(); // its worker reads levelData
+#endif
+		std::swap(levelData, loaded);
+		VkPhysicalDevice physicalDevice = nullptr;
+		vlk.GetPhysicalDevice((void**)&physicalDevice);
+		DestroyGeometryBuffers();
+		CreateGeometryBuffers(physicalDevice);
+		for (int i = 0; i < levelData.levelMaterials.size(); ++i)
+			sceneData.materials[i] = levelData.levelMaterials[i].attrib;
+		materialsStale.assign(materialsStale.size(), true);
+		ResetInstanceState();
+		LoadLevelTextures();
+		LogTextureStats(hotLog);
+		WatchLevelFiles(); // the level may use other models now
+	}
+
+	// Overwrites part of a host visible buffer
+	void WriteBufferRange(VkDeviceMemory memory, VkDeviceSize offset, const void* data, VkDeviceSize bytes)
+	{
+		if (bytes == 0)
+			return;
+		void* mapped = nullptr;
+		vkMapMemory(device, memory, offset, bytes, 0, &mapped);
+		memcpy(mapped, data, bytes);
+		vkUnmapMemory(device, memory);
+	}
+
+#if CLUSTER_CULLING == 2
+	// Buffers, pipeline and command buffers of the compute culling path
+	void CreateClusterCulling(VkPhysicalDevice physicalDevice, unsigned numBBS)
+	{
+		CompileShader(clusterCullShaderSource, shaderc_compute_shader, "main.comp", clusterCullShader);
+		auto createStorage = [&](const void* data, unsigned size, VkBuffer* handle, VkDeviceMemory* memory) {
+			GvkHelper::create_buffer(physicalDevice, device, std::max(size, 4u),
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, handle, memory);
+			if (size)
+				GvkHelper::write_to_buffer(device, *memory, data, size);
+		};
+		createStorage(levelData.levelMeshlets.data(), levelData.levelMeshlets.size() * sizeof(H2B::MESHLET),
+			&meshletHandle, &meshletData);
+		createStorage(levelData.levelMeshletVertices.data(), levelData.levelMeshletVertices.size() * sizeof(unsigned),
+			&meshletVertexHandle, &meshletVertexData);
+		// ByteAddressBuffer loads whole words, pad the triangle bytes to a multiple of 4
+		std::vector<unsigned char> triangles(levelData.levelMeshletTriangles);
+		triangles.resize((triangles.size() + 3) & ~size_t(3));
+		createStorage(triangles.data(), triangles.size(), &meshletTriangleHandle, &meshletTriangleData);
+		clusterJobHandle.resize(numBBS);
+		clusterJobData.resize(numBBS);
+		clusterArgsHandle.resize(numBBS);
+		clusterArgsData.resize(numBBS);
+		clusterJobCount.assign(numBBS, 0);
+		for (int i = 0; i < numBBS; ++i) {
+			GvkHelper::create_buffer(physicalDevice, device, clusterJobCapacity * sizeof(CLUSTER_JOB),
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &clusterJobHandle[i], &clusterJobData[i]);
+			GvkHelper::create_buffer(physicalDevice, device, clusterJobCapacity * sizeof(VkDrawIndexedIndirectCommand),
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &clusterArgsHandle[i], &clusterArgsData[i]);
+		}
+
+		// six storage buffers, see the bindings in ClusterCullCompute.hlsl
+		VkDescriptorSetLayoutBinding layout_bindings[6] = {};
+		for (unsigned b = 0; b < 6; ++b) {
+			layout_bindings[b].binding = b;
+			layout_bindings[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			layout_bindings[b].descriptorCount = 1;
+			layout_bindings[b].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+		VkDescriptorSetLayoutCreateInfo layout_create_info = {};
+		layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layout_create_info.bindingCount = 6;
+		layout_create_info.pBindings = layout_bindings;
+		vkCreateDescriptorSetLayout(device, &layout_create_info, nullptr, &clusterDescriptorLayout);
+		VkDescriptorPoolSize pool_size = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 6 * numBBS };
+		VkDescriptorPoolCreateInfo pool_create_info = {};
+		pool_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		pool_create_info.maxSets = numBBS;
+		pool_create_info.poolSizeCount = 1;
+		pool_create_info.pPoolSizes = &pool_size;
+		vkCreateDescriptorPool(device, &pool_create_info, nullptr, &clusterDescriptorPool);
+		clusterDescriptorSet.resize(numBBS);
+		for (int i = 0; i < numBBS; ++i) {
+			VkDescriptorSetAllocateInfo set_allocate_info = {};
+			set_allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+			set_allocate_info.descriptorPool = clusterDescriptorPool;
+			set_allocate_info.descriptorSetCount = 1;
+			set_allocate_info.pSetLayouts = &clusterDescriptorLayout;
+			vkAllocateDescriptorSets(device, &set_allocate_info, &clusterDescriptorSet[i]);
+			VkBuffer buffers[6] = { meshletHandle, meshletVertexHandle, meshletTriangleHandle,
+				clusterJobHandle[i], clusterIndexHandle[i], clusterArgsHandle[i] };
+			VkDescriptorBufferInfo buffer_infos[6];
+			VkWriteDescriptorSet writes[6] = {};
+			for (unsigned b = 0; b < 6; ++b) {
+				buffer_infos[b] = { buffers[b], 0, VK_WHOLE_SIZE };
+				writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writes[b].dstSet = clusterDescriptorSet[i];
+				writes[b].dstBinding = b;
+				writes[b].descriptorCount = 1;
+				writes[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				writes[b].pBufferInfo = &buffer_infos[b];
+			}
+			vkUpdateDescriptorSets(device, 6, writes, 0, nullptr);
+		}
+
+		VkPushConstantRange push_constant_range = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CLUSTER_VIEW) };
+		VkPipelineLayoutCreateInfo pipeline_layout_create_info = {};
+		pipeline_layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipeline_layout_create_info.setLayoutCount = 1;
+		pipeline_layout_create_info.pSetLayouts = &clusterDescriptorLayout;
+		pipeline_layout_create_info.pushConstantRangeCount = 1;
+		pipeline_layout_create_info.pPushConstantRanges = &push_constant_range;
+		vkCreatePipelineLayout(device, &pipeline_layout_create_info, nullptr, &clusterCullLayout);
+		VkComputePipelineCreateInfo compute_create_info = {};
+		compute_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		compute_create_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		compute_create_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		compute_create_info.stage.module = clusterCullShader;
+		compute_create_info.stage.pName = "main";
+		compute_create_info.layout = clusterCullLayout;
+		vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &compute_create_info, nullptr, &clusterCullPipeline);
+
+		// Gateware begins the render pass inside StartFrame, so the dispatch gets
+		// its own command buffers, submitted to the graphics queue ahead of the frame
+		unsigned int graphicsFamily = 0, presentFamily = 0;
+		vlk.GetQueueFamilyIndices(graphicsFamily, presentFamily);
+		VkCommandPoolCreateInfo command_pool_create_info = {};
+		command_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		command_pool_create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		command_pool_create_info.queueFamilyIndex = graphicsFamily;
+		vkCreateCommandPool(device, &command_pool_create_info, nullptr, &clusterCommandPool);
+		clusterCommands.resize(numBBS);
+		VkCommandBufferAllocateInfo command_allocate_info = {};
+		command_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		command_allocate_info.commandPool = clusterCommandPool;
+		command_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		command_allocate_info.commandBufferCount = numBBS;
+		vkAllocateCommandBuffers(device, &command_allocate_info, clusterCommands.data());
+		clusterFences.resize(numBBS);
+		VkFenceCreateInfo fence_create_info = {};
+		fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fence_create_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		for (int i = 0; i < numBBS; ++i)
+			vkCreateFence(device, &fence_create_info, nullptr, &clusterFences[i]);
+	}
+
+	// Runs this frame's cluster jobs before the frame's own command buffer. The
+	// barrier at the end covers every later command on the queue, which includes
+	// the indirect draws EndFrame submits afterwards.
+	void DispatchClusterCulling(unsigned currentImage, const CLUSTER_VIEW& view)
+	{
+		PROFILE_SCOPE("Dispatch cluster culling");
+		vkWaitForFences(device, 1, &clusterFences[currentImage], VK_TRUE, ~0ull);
+		// draws last submitted from this image are done, count what survived in them
+		if (clusterJobCount[currentImage]) {
+			void* mapped = nullptr;
+			vkMapMemory(device, clusterArgsData[currentImage], 0, VK_WHOLE_SIZE, 0, &mapped);
+			const VkDrawIndexedIndirectCommand* args = static_cast<const VkDrawIndexedIndirectCommand*>(mapped);
+			for (unsigned i = 0; i < clusterJobCount[currentImage]; ++i)
+				frameStats.triangleCount += args[i].indexCount / 3;
+			vkUnmapMemory(device, clusterArgsData[currentImage]);
+		}
+		clusterJobCount[currentImage] = clusterJobs.size();
+		if (clusterJobs.empty())
+			return;
+		GvkHelper::write_to_buffer(device, clusterJobData[currentImage], clusterJobs.data(),
+			clusterJobs.size() * sizeof(CLUSTER_JOB));
+		GvkHelper::write_to_buffer(device, clusterArgsData[currentImage], clusterArgs.data(),
+			clusterArgs.size() * sizeof(VkDrawIndexedIndirectCommand));
+
+		VkCommandBuffer commands = clusterCommands[currentImage];
+		vkResetFences(device, 1, &clusterFences[currentImage]);
+		vkResetCommandBuffer(commands, 0);
+		VkCommandBufferBeginInfo begin_info = {};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(commands, &begin_info);
+		vkCmdBindPipeline(commands, VK_PIPELINE_BIND_POINT_COMPUTE, clusterCullPipeline);
+		vkCmdBindDescriptorSets(commands, VK_PIPELINE_BIND_POINT_COMPUTE, clusterCullLayout, 0, 1,
+			&clusterDescriptorSet[currentImage], 0, nullptr);
+		vkCmdPushConstants(commands, clusterCullLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CLUSTER_VIEW), &view);
+		unsigned cullScope = BeginGpuScope(commands, currentImage, "GPU cluster culling");
+		vkCmdDispatch(commands, clusterJobs.size(), 1, 1);
+		EndGpuScope(commands, currentImage, cullScope);
+		VkMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(commands, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+		vkEndCommandBuffer(commands);
+		VkQueue graphicsQueue;
+		vlk.GetGraphicsQueue((void**)&graphicsQueue);
+		VkSubmitInfo submit_info = {};
+		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit_info.commandBufferCount = 1;
+		submit_info.pCommandBuffers = &commands;
+		vkQueueSubmit(graphicsQueue, 1, &submit_info, clusterFences[currentImage]);
+	}
+
+	void DestroyClusterCulling()
+	{
+		VkBuffer clusterBuffers[] = { meshletHandle, meshletVertexHandle, meshletTriangleHandle };
+		VkDeviceMemory clusterMemory[] = { meshletData, meshletVertexData, meshletTriangleData };
+		for (int i = 0; i < 3; ++i) {
+			vkDestroyBuffer(device, clusterBuffers[i], nullptr);
+			vkFreeMemory(device, clusterMemory[i], nullptr);
+		}
+		for (size_t i = 0; i < clusterJobHandle.size(); ++i) {
+			vkDestroyBuffer(device, clusterJobHandle[i], nullptr);
+			vkFreeMemory(device, clusterJobData[i], nullptr);
+			vkDestroyBuffer(device, clusterArgsHandle[i], nullptr);
+			vkFreeMemory(device, clusterArgsData[i], nullptr);
+		}
+		for (VkFence fence : clusterFences)
+			vkDestroyFence(device, fence, nullptr);
+		vkDestroyCommandPool(device, clusterCommandPool, nullptr);
+		vkDestroyPipeline(device, clusterCullPipeline, nullptr);
+		vkDestroyPipelineLayout(device, clusterCullLayout, nullptr);
+		vkDestroyDescriptorPool(device, clusterDescriptorPool, nullptr);
+		vkDestroyDescriptorSetLayout(device, clusterDescriptorLayout, nullptr);
+		vkDestroyShaderModule(device, clusterCullShader, nullptr);
+		clusterJobHandle.clear();
+		clusterJobData.clear();
+		clusterArgsHandle.clear();
+		clusterArgsData.clear();
+		clusterFences.clear();
+		clusterCommands.clear();
+		clusterDescriptorSet.clear();
+	}
+#endif
+
+	// Timestamp queries for BeginGpuScope, when the graphics queue supports them
+	void CreateGpuTimers(VkPhysicalDevice physicalDevice, unsigned numBBS)
+	{
+		unsigned int graphicsFamily = 0, presentFamily = 0;
+		vlk.GetQueueFamilyIndices(graphicsFamily, presentFamily);
+		uint32_t familyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+		std::vector<VkQueueFamilyProperties> families(familyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+		if (graphicsFamily >= familyCount || families[graphicsFamily].timestampValidBits == 0)
+			return; // CPU scopes only
+		unsigned validBits = families[graphicsFamily].timestampValidBits;
+		timestampMask = validBits < 64 ? (1ull << validBits) - 1 : ~0ull;
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		timestampPeriod = properties.limits.timestampPeriod;
+		VkQueryPoolCreateInfo query_pool_create_info = {};
+		query_pool_create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		query_pool_create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		query_pool_create_info.queryCount = numBBS * MAX_GPU_SCOPES * 2;
+		if (vkCreateQueryPool(device, &query_pool_create_info, nullptr, &timestampPool) != VK_SUCCESS) {
+			timestampPool = nullptr;
+			return;
+		}
+		// queries can only be reset outside a render pass and Gateware's command
+		// buffer is inside one from StartFrame, so each image's reset is submitted
+		// on its own ahead of the frame
+		VkCommandPoolCreateInfo command_pool_create_info = {};
+		command_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		command_pool_create_info.queueFamilyIndex = graphicsFamily;
+		vkCreateCommandPool(device, &command_pool_create_info, nullptr, &timestampCommandPool);
+		timestampResets.resize(numBBS);
+		VkCommandBufferAllocateInfo command_allocate_info = {};
+		command_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		command_allocate_info.commandPool = timestampCommandPool;
+		command_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		command_allocate_info.commandBufferCount = numBBS;
+		vkAllocateCommandBuffers(device, &command_allocate_info, timestampResets.data());
+		VkCommandBufferBeginInfo begin_info = {};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		for (unsigned i = 0; i < numBBS; ++i) {
+			vkBeginCommandBuffer(timestampResets[i], &begin_info);
+			vkCmdResetQueryPool(timestampResets[i], timestampPool, i * MAX_GPU_SCOPES * 2, MAX_GPU_SCOPES * 2);
+			vkEndCommandBuffer(timestampResets[i]);
+		}
+		timestampScopes.assign(numBBS, std::vector<const char*>());
+		timestampRecorded.assign(numBBS, 0);
+	}
+	// Hands the Profiler what image's last frame measured, then resets its
+	// queries. That frame is done, StartFrame waited for it before handing the
+	// image back, and its fence also covers the reset submitted ahead of it.
+	void BeginGpuFrame(unsigned image)
+	{
+		if (timestampPool == nullptr)
+			return;
+		std::vector<const char*>& scopes = timestampScopes[image];
+		uint64_t ticks[MAX_GPU_SCOPES * 2];
+		if (scopes.size() && vkGetQueryPoolResults(device, timestampPool, image * MAX_GPU_SCOPES * 2,
+			scopes.size() * 2, sizeof(ticks), ticks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+			// GPU ticks share no epoch with the CPU clock, so the frame's first
+			// timestamp is placed where the CPU finished recording it
+			uint64_t first = ~0ull;
+			for (unsigned q = 0; q < scopes.size() * 2; ++q)
+				first = std::min(first, ticks[q] & timestampMask);
+			for (unsigned q = 0; q < scopes.size(); ++q) {
+				uint64_t begin = timestampRecorded[image] + uint64_t(((ticks[q * 2] & timestampMask) - first) * double(timestampPeriod));
+				uint64_t end = timestampRecorded[image] + uint64_t(((ticks[q * 2 + 1] & timestampMask) - first) * double(timestampPeriod));
+				Profiler::Get().AddGpuEvent(scopes[q], begin, std::max(begin, end));
+			}
+		}
+		scopes.clear();
+		VkQueue graphicsQueue;
+		vlk.GetGraphicsQueue((void**)&graphicsQueue);
+		VkSubmitInfo submit_info = {};
+		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit_info.commandBufferCount = 1;
+		submit_info.pCommandBuffers = &timestampResets[image];
+		vkQueueSubmit(graphicsQueue, 1, &submit_info, VK_NULL_HANDLE);
+	}
+	// Times the commands recorded into commands until EndGpuScope, returns ~0u
+	// (which EndGpuScope ignores) when not timing or past MAX_GPU_SCOPES
+	unsigned BeginGpuScope(VkCommandBuffer commands, unsigned image, const char* name)
+	{
+		if (timestampPool == nullptr || timestampScopes[image].size() == MAX_GPU_SCOPES)
+			return ~0u;
+		unsigned scope = timestampScopes[image].size();
+		timestampScopes[image].push_back(name);
+		vkCmdWriteTimestamp(commands, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, (image * MAX_GPU_SCOPES + scope) * 2);
+		return scope;
+	}
+	void EndGpuScope(VkCommandBuffer commands, unsigned image, unsigned scope)
+	{
+		if (scope != ~0u)
+			vkCmdWriteTimestamp(commands, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool,
+				(image * MAX_GPU_SCOPES + scope) * 2 + 1);
+	}
+	void DestroyGpuTimers()
+	{
+		vkDestroyCommandPool(device, timestampCommandPool, nullptr);
+		vkDestroyQueryPool(device, timestampPool, nullptr);
+		timestampCommandPool = nullptr;
+		timestampPool = nullptr;
+		timestampResets.clear();
+		timestampScopes.clear();
+		timestampRecorded.clear();
+	}
+
 	void CleanUp()
 	{
 		// wait till everything has completed
 		vkDeviceWaitIdle(device);
+		DestroyGpuTimers();
+		cameraRecorder.Close();
+#if LEVEL_STREAMING
+		streamer.Destroy();
+#endif
 		// Release allocated buffers, shaders & pipeline
 		// TODO: Part 1g
-		vkDestroyBuffer(device, indexHandle, nullptr);
-		vkFreeMemory(device, indexData, nullptr);
+		DestroyGeometryBuffers();
+		DestroyLevelTextures();
 		// TODO: Part 2d
 		for (int i = 0; i < 2; ++i) {
 			vkDestroyBuffer(device, storageHandle[i], nullptr);
 			vkFreeMemory(device, storageData[i], nullptr);
 		}
 		
-
-		vkDestroyBuffer(device, vertexHandle, nullptr);
-		vkFreeMemory(device, vertexData, nullptr);
 		vkDestroyShaderModule(device, vertexShader, nullptr);
 		vkDestroyShaderModule(device, pixelShader, nullptr);
+		vkDestroyShaderModule(device, texturePixelShader, nullptr);
 		// TODO: Part 2e
 		vkDestroyDescriptorSetLayout(device, descriptorLayout, nullptr);
 		// TODO: part 2f
 		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 		vkDestroyPipeline(device, pipeline, nullptr);
+		vkDestroyPipeline(device, texturePipeline, nullptr);
 	}
 };
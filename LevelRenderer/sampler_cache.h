@@ -0,0 +1,219 @@
+#ifndef _SAMPLER_CACHE_H_
+#define _SAMPLER_CACHE_H_
+// Samplers shared by every texture that samples the same way. SAMPLER_STATE
+// mirrors VkSamplerCreateInfo minus sType/pNext in plain 32 bit fields, so
+// states hash and compare without a device. Like Texture_Registry the cache
+// only maps states to reference counted slots, the owner keeps the VkSampler
+// of each slot: create it when Acquire says the slot is new, destroy it when
+// Release says the last reference is gone.
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct SAMPLER_STATE { // VkSamplerCreateInfo field order, enums as their values
+	uint32_t flags;
+	uint32_t magFilter, minFilter, mipmapMode; // 1 = LINEAR
+	uint32_t addressModeU, addressModeV, addressModeW; // 0 = REPEAT, 2 = CLAMP_TO_EDGE, 3 = CLAMP_TO_BORDER
+	float mipLodBias;
+	uint32_t anisotropyEnable;
+	float maxAnisotropy;
+	uint32_t compareEnable, compareOp;
+	float minLod, maxLod;
+	uint32_t borderColor, unnormalizedCoordinates;
+
+	bool operator==(const SAMPLER_STATE& other) const { return std::memcmp(this, &other, sizeof(SAMPLER_STATE)) == 0; }
+	bool operator!=(const SAMPLER_STATE& other) const { return !(*this == other); }
+};
+struct SAMPLER_STATE_HASH { // 64 bit FNV-1a over the fields, no padding to skip
+	size_t operator()(const SAMPLER_STATE& state) const {
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&state);
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < sizeof(SAMPLER_STATE); ++i)
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		return size_t(hash);
+	}
+};
+struct SAMPLER_CACHE_STATS { // since the last ResetStats
+	unsigned requests, creates;
+};
+
+// What textures used before materials could ask for more: trilinear, clamped
+// to an opaque white border, no anisotropy, every mip level
+inline SAMPLER_STATE DefaultSamplerState() {
+	SAMPLER_STATE state = {};
+	state.magFilter = state.minFilter = state.mipmapMode = 1;
+	state.addressModeU = state.addressModeV = state.addressModeW = 3;
+	state.maxAnisotropy = 1;
+	state.compareOp = 1; // LESS, unused with compareEnable off
+	state.maxLod = 1000.0f; // VK_LOD_CLAMP_NONE, the view limits it to the texture's levels
+	state.borderColor = 3; // FLOAT_OPAQUE_WHITE
+	return state;
+}
+
+// Splits an MTL map statement ("-clamp on -aniso 8 rock.ktx") into its file
+// and the sampler state it asks for, starting from base. Understood options:
+//   -clamp on|off  clamp to the edge or repeat (MTL)
+//   -aniso N       anisotropic filtering up to N, capped by maxAnisotropy
+// Other MTL options are skipped along with their arguments. maxAnisotropy is
+// what the device allows, 0 or 1 when it can't filter anisotropically.
+inline std::string ParseTextureOptions(const char* map, const SAMPLER_STATE& base, float maxAnisotropy, SAMPLER_STATE& state) {
+	state = base;
+	auto next = [&map]() { // the next word, map left after it
+		while (*map == ' ' || *map == '\t')
+			++map;
+		const char* start = map;
+		while (*map != '\0' && *map != ' ' && *map != '\t')
+			++map;
+		return std::string(start, map);
+	};
+	auto number = [](const char* text) {
+		char* end = nullptr;
+		std::strtod(text, &end);
+		return end != text && *end == '\0';
+	};
+	while (true) {
+		while (*map == ' ' || *map == '\t')
+			++map;
+		if (*map != '-')
+			break; // the file name is the rest, it may hold spaces
+		std::string option = next();
+		if (option == "-clamp") {
+			uint32_t mode = next() == "on" ? 2 : 0; // CLAMP_TO_EDGE or REPEAT
+			state.addressModeU = state.addressModeV = state.addressModeW = mode;
+		}
+		else if (option == "-aniso") {
+			float level = float(std::atof(next().c_str()));
+			level = level < maxAnisotropy ? level : maxAnisotropy;
+			state.anisotropyEnable = level > 1;
+			state.maxAnisotropy = level > 1 ? level : 1;
+		}
+		else if (option == "-mm")
+			next(), next();
+		else if (option == "-o" || option == "-s" || option == "-t") { // u [v [w]]
+			next();
+			for (int i = 0; i < 2; ++i) {
+				const char* before = map;
+				if (number(next().c_str()) == false) {
+					map = before;
+					break;
+				}
+			}
+		}
+		else if (option == "-blendu" || option == "-blendv" || option == "-bm" || option == "-boost" ||
+			option == "-cc" || option == "-imfchan" || option == "-texres" || option == "-type")
+			next();
+	}
+	std::string file = map;
+	while (file.size() && (file.back() == ' ' || file.back() == '\t' || file.back() == '\r'))
+		file.pop_back();
+	return file;
+}
+
+class Sampler_Cache {
+public:
+	// Slot for state with one more reference, isNew when the caller must create its sampler
+	unsigned Acquire(const SAMPLER_STATE& state, bool& isNew) {
+		++stats.requests;
+		auto found = lookup.find(state);
+		isNew = found == lookup.end();
+		if (isNew == false) {
+			++slots[found->second].references;
+			return found->second;
+		}
+		unsigned index;
+		if (freeSlots.size()) {
+			index = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else {
+			index = slots.size();
+			slots.emplace_back();
+		}
+		slots[index].state = state;
+		slots[index].references = 1;
+		lookup[state] = index;
+		++stats.creates;
+		return index;
+	}
+	// True when that was the last reference and the slot's sampler should be destroyed
+	bool Release(unsigned index) {
+		if (index >= slots.size() || slots[index].references == 0)
+			return false;
+		if (--slots[index].references)
+			return false;
+		lookup.erase(slots[index].state);
+		freeSlots.push_back(index);
+		return true;
+	}
+	unsigned References(unsigned index) const { return index < slots.size() ? slots[index].references : 0; }
+	const SAMPLER_STATE& State(unsigned index) const { return slots[index].state; }
+	size_t SlotCount() const { return slots.size(); }
+	size_t Resident() const { return lookup.size(); }
+	const SAMPLER_CACHE_STATS& GetStats() const { return stats; }
+	void ResetStats() { stats = {}; }
+	void Clear() {
+		slots.clear();
+		freeSlots.clear();
+		lookup.clear();
+		stats = {};
+	}
+
+private:
+	struct SAMPLER_SLOT {
+		SAMPLER_STATE state;
+		unsigned references;
+	};
+	std::vector<SAMPLER_SLOT> slots;
+	std::vector<unsigned> freeSlots;
+	std::unordered_map<SAMPLER_STATE, unsigned, SAMPLER_STATE_HASH> lookup;
+	SAMPLER_CACHE_STATS stats = {};
+};
+
+#ifdef VK_VERSION_1_0
+inline SAMPLER_STATE SamplerState(const VkSamplerCreateInfo& info) {
+	SAMPLER_STATE state;
+	state.flags = info.flags;
+	state.magFilter = info.magFilter;
+	state.minFilter = info.minFilter;
+	state.mipmapMode = info.mipmapMode;
+	state.addressModeU = info.addressModeU;
+	state.addressModeV = info.addressModeV;
+	state.addressModeW = info.addressModeW;
+	state.mipLodBias = info.mipLodBias;
+	state.anisotropyEnable = info.anisotropyEnable;
+	state.maxAnisotropy = info.maxAnisotropy;
+	state.compareEnable = info.compareEnable;
+	state.compareOp = info.compareOp;
+	state.minLod = info.minLod;
+	state.maxLod = info.maxLod;
+	state.borderColor = info.borderColor;
+	state.unnormalizedCoordinates = info.unnormalizedCoordinates;
+	return state;
+}
+inline VkSamplerCreateInfo SamplerCreateInfo(const SAMPLER_STATE& state) {
+	VkSamplerCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	info.pNext = nullptr;
+	info.flags = state.flags;
+	info.magFilter = VkFilter(state.magFilter);
+	info.minFilter = VkFilter(state.minFilter);
+	info.mipmapMode = VkSamplerMipmapMode(state.mipmapMode);
+	info.addressModeU = VkSamplerAddressMode(state.addressModeU);
+	info.addressModeV = VkSamplerAddressMode(state.addressModeV);
+	info.addressModeW = VkSamplerAddressMode(state.addressModeW);
+	info.mipLodBias = state.mipLodBias;
+	info.anisotropyEnable = state.anisotropyEnable;
+	info.maxAnisotropy = state.maxAnisotropy;
+	info.compareEnable = state.compareEnable;
+	info.compareOp = VkCompareOp(state.compareOp);
+	info.minLod = state.minLod;
+	info.maxLod = state.maxLod;
+	info.borderColor = VkBorderColor(state.borderColor);
+	info.unnormalizedCoordinates = state.unnormalizedCoordinates;
+	return info;
+}
+#endif
+#endif
@@ -0,0 +1,95 @@
+#ifndef _SCENE_DATA_H_
+#define _SCENE_DATA_H_
+// The storage buffer every draw reads (SHADER_MODEL_DATA, mirrored in
+// BasicVertexShader.hlsl) and how a frame fills it, kept out of renderer.h so
+// the headless benchmark packs the same bytes without Vulkan. renderer.h sets
+// the layout flags below before including this. Include after
+// load_data_oriented.h.
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#ifndef MAX_SUBMESH_PER_DRAW
+#define MAX_SUBMESH_PER_DRAW 1054 // world slots and materials one frame uploads
+#endif
+#ifndef COMPACT_TRANSFORMS
+#define COMPACT_TRANSFORMS 1 // 1 uploads 32 byte COMPACT_TRANSFORM per instance, 0 full 64 byte matrices
+#endif
+#ifndef TEXTURE_ARRAYS
+#define TEXTURE_ARRAYS 0 // 1 adds the per material array layers and rects
+#endif
+
+struct SHADER_MODEL_DATA {
+	//gloabally shared model data
+	GW::MATH::GVECTORF sunDirection = { -1, -1, 2, 0 }, sunColor; // lighting info
+	GW::MATH::GVECTORF sunAmbient = { 0.25, 0.25, 0.35, 0 }, cameraPos;
+	GW::MATH::GMATRIXF viewMatrix, projectionMatrix; // viewing info
+	// per sub-mesh transform and material data
+#if COMPACT_TRANSFORMS // same size as matricies so materials do not move
+	COMPACT_TRANSFORM transforms[MAX_SUBMESH_PER_DRAW]; // world space transforms
+	GW::MATH::GMATRIXF fullMatricies[MAX_SUBMESH_PER_DRAW / 2]; // transforms with shear, each followed by its normal matrix
+#else
+	GW::MATH::GMATRIXF matricies[MAX_SUBMESH_PER_DRAW]; // world space transforms, normal matrices from the end down
+#endif
+	H2B::ATTRIBUTES materials[MAX_SUBMESH_PER_DRAW]; // color/texture of surface
+#if TEXTURE_ARRAYS
+	unsigned materialMaps[MAX_SUBMESH_PER_DRAW][4]; // albedo, roughness, metal, normal (see PackTextureLayer)
+	GW::MATH::GVECTORF mapRects[MAX_SUBMESH_PER_DRAW][4]; // uv offset (xy) and scale (zw) of each map in its layer
+#endif
+};
+struct SCENE_RANGE { // bytes of SHADER_MODEL_DATA a frame rewrites
+	size_t offset, size;
+};
+
+// Fills the world slots of data with the levelTransforms indices in worlds
+// (up to MAX_SUBMESH_PER_DRAW), returns the extra matrices that took. Non
+// uniformly scaled instances also need their normal matrix: compact ones
+// rebuild it from their scale in the shader, full matrices upload it.
+inline unsigned PackWorlds(const Level_Data& level, const std::vector<unsigned>& worlds, SHADER_MODEL_DATA& data)
+{
+	unsigned extra = 0; // fullMatricies used, or normal matrices at the end of matricies
+	size_t worldCount = std::min<size_t>(worlds.size(), MAX_SUBMESH_PER_DRAW);
+	for (unsigned slot = 0; slot < worldCount; ++slot) {
+		unsigned transformIndex = worlds[slot];
+#if COMPACT_TRANSFORMS
+		COMPACT_TRANSFORM& transform = data.transforms[slot];
+		transform = level.levelCompactTransforms[transformIndex];
+		if (transform.rotationHi & COMPACT_FULL_MATRIX) {
+			if (extra + 2 > MAX_SUBMESH_PER_DRAW / 2) { // out of room, closest TRS is better than nothing
+				transform.rotationHi &= ~COMPACT_FULL_MATRIX;
+				continue;
+			}
+			transform.rotationLo = extra;
+			data.fullMatricies[extra++] = level.levelTransforms[transformIndex];
+			data.fullMatricies[extra++] = level.levelNormalMatrices[transformIndex];
+		}
+#else
+		// the w column is unused by the shader, row1.w holds where the normal matrix went (0 for none)
+		GW::MATH::GMATRIXF& world = data.matricies[slot];
+		world = level.levelTransforms[transformIndex];
+		world.row1.w = 0;
+		// normal matrices fill down from the end, never into a world slot this frame still writes
+		if (level.levelUniformScale[transformIndex] == 0 && worldCount + extra + 1 <= MAX_SUBMESH_PER_DRAW) {
+			unsigned normalSlot = MAX_SUBMESH_PER_DRAW - ++extra;
+			data.matricies[normalSlot] = level.levelNormalMatrices[transformIndex];
+			world.row1.w = float(normalSlot);
+		}
+#endif
+	}
+	return extra;
+}
+// What a frame of worldCount slots and PackWorlds' extra matrices uploads:
+// the globals and world slots, then the extra matrices. Returns the ranges.
+inline unsigned SceneRanges(unsigned worldCount, unsigned extra, SCENE_RANGE ranges[2])
+{
+#if COMPACT_TRANSFORMS
+	ranges[0] = { 0, offsetof(SHADER_MODEL_DATA, transforms) + worldCount * sizeof(COMPACT_TRANSFORM) };
+	ranges[1] = { offsetof(SHADER_MODEL_DATA, fullMatricies), extra * sizeof(GW::MATH::GMATRIXF) };
+#else
+	ranges[0] = { 0, offsetof(SHADER_MODEL_DATA, matricies) + worldCount * sizeof(GW::MATH::GMATRIXF) };
+	ranges[1] = { offsetof(SHADER_MODEL_DATA, matricies) + (MAX_SUBMESH_PER_DRAW - extra) * sizeof(GW::MATH::GMATRIXF),
+		extra * sizeof(GW::MATH::GMATRIXF) };
+#endif
+	return extra ? 2 : 1;
+}
+#endif
@@ -0,0 +1,240 @@
+// Bakes meshlets for the sample models with H2B::BakeMeshlets under several
+// limits and checks the tables: the meshlets of each mesh rebuild its index
+// range in order, stay within the vertex and triangle limits, and their spheres
+// hold every vertex. Then culls them with CullClusters from random views of
+// plain, scaled, stretched and mirrored instances and brute forces every
+// triangle of the clusters it dropped: none may be front facing and inside the
+// frustum. CLUSTER_CULL_STATS must add up to what was appended.
+// Usage: ClusterCullingTest <folder with the .h2b models>
+#define GATEWARE_ENABLE_CORE
+#define GATEWARE_ENABLE_SYSTEM
+#define GATEWARE_ENABLE_MATH
+#include "../../Gateware/Gateware.h"
+#include "../h2bBaker.h"
+#include "../cluster_culling.h"
+#include "test_check.h"
+#include <random>
+#include <string>
+
+using namespace GW::MATH;
+
+static const char* models[] = { "Mountain_Group_1.h2b", "Mountain_Group_2.h2b", "Archery_FirstAge_Level1.h2b", "kriegsmesser.h2b" };
+
+struct LIMITS {
+	unsigned maxVertices, maxTriangles;
+};
+
+// Which way a mesh's winding faces, judged against its vertex normals the way
+// BakeMeshlets does: 1 when counter clockwise faces out, -1 when clockwise does
+static float Facing(const H2B::Parser& p, const H2B::MESH& mesh)
+{
+	float facing = 0;
+	for (unsigned i = 0; i + 2 < mesh.drawInfo.indexCount; i += 3) {
+		const H2B::VERTEX& a = p.vertices[p.indices[mesh.drawInfo.indexOffset + i]];
+		const H2B::VERTEX& b = p.vertices[p.indices[mesh.drawInfo.indexOffset + i + 1]];
+		const H2B::VERTEX& c = p.vertices[p.indices[mesh.drawInfo.indexOffset + i + 2]];
+		H2B::VECTOR n = H2B::Cross(H2B::Sub(b.pos, a.pos), H2B::Sub(c.pos, a.pos));
+		H2B::VECTOR vn = { a.nrm.x + b.nrm.x + c.nrm.x, a.nrm.y + b.nrm.y + c.nrm.y, a.nrm.z + b.nrm.z + c.nrm.z };
+		facing += H2B::Dot(H2B::Normalize(n), vn);
+	}
+	return facing < 0 ? -1.0f : 1.0f;
+}
+
+static void CheckMeshlets(const H2B::Parser& p, const LIMITS& limits)
+{
+	CHECK(p.meshletRanges.size() == p.meshes.size() && (p.extension.flags & H2B::HAS_MESHLETS));
+	unsigned nextMeshlet = 0, nextVertex = 0, nextTriangle = 0;
+	for (size_t i = 0; i < p.meshes.size(); ++i) {
+		const H2B::MESHLET_RANGE& range = p.meshletRanges[i];
+		CHECK(range.meshletOffset == nextMeshlet);
+		nextMeshlet += range.meshletCount;
+		std::vector<unsigned> rebuilt;
+		for (unsigned k = range.meshletOffset; k < range.meshletOffset + range.meshletCount && k < p.meshlets.size(); ++k) {
+			const H2B::MESHLET& m = p.meshlets[k];
+			// packed back to back, within the limits, every local index in range
+			CHECK(m.vertexOffset == nextVertex && m.triangleOffset == nextTriangle);
+			CHECK(m.vertexCount >= 1 && m.vertexCount <= limits.maxVertices && m.vertexCount <= 256);
+			CHECK(m.triangleCount >= 1 && m.triangleCount <= limits.maxTriangles);
+			nextVertex += m.vertexCount;
+			nextTriangle += m.triangleCount;
+			for (unsigned t = 0; t < m.triangleCount * 3; ++t) {
+				unsigned char l = p.meshletTriangles[(m.triangleOffset * 3) + t];
+				CHECK(l < m.vertexCount);
+				rebuilt.push_back(p.meshletVertices[m.vertexOffset + l]);
+			}
+			// the sphere holds every vertex, the cone is a unit axis or disabled
+			for (unsigned v = 0; v < m.vertexCount; ++v) {
+				const H2B::VECTOR& pos = p.vertices[p.meshletVertices[m.vertexOffset + v]].pos;
+				float dx = pos.x - m.center.x, dy = pos.y - m.center.y, dz = pos.z - m.center.z;
+				CHECK(std::sqrt(dx * dx + dy * dy + dz * dz) <= m.radius * 1.0001f + 1e-5f);
+			}
+			CHECK(m.coneCutoff >= 0 && m.coneCutoff <= 1);
+			CHECK(m.coneCutoff == 1 || std::fabs(H2B::Dot(m.coneAxis, m.coneAxis) - 1) < 1e-4f);
+		}
+		const unsigned* indices = p.indices.data() + p.meshes[i].drawInfo.indexOffset;
+		CHECK(rebuilt == std::vector<unsigned>(indices, indices + p.meshes[i].drawInfo.indexCount));
+	}
+	CHECK(nextMeshlet == p.meshlets.size());
+	CHECK(nextVertex == p.meshletVertices.size() && nextTriangle * 3 == p.meshletTriangles.size());
+}
+
+static H2B::VECTOR Transform(const H2B::VECTOR& v, const GMATRIXF& m)
+{
+	return { v.x * m.row1.x + v.y * m.row2.x + v.z * m.row3.x + m.row4.x,
+			 v.x * m.row1.y + v.y * m.row2.y + v.z * m.row3.y + m.row4.y,
+			 v.x * m.row1.z + v.y * m.row2.z + v.z * m.row3.z + m.row4.z };
+}
+
+// Scale per axis, then a turn about y, then a move
+static GMATRIXF World(float sx, float sy, float sz, float angle, const H2B::VECTOR& position)
+{
+	GMATRIXF m = GIdentityMatrixF;
+	m.row1 = { sx * std::cos(angle), 0, -sx * std::sin(angle), 0 };
+	m.row2 = { 0, sy, 0, 0 };
+	m.row3 = { sz * std::sin(angle), 0, sz * std::cos(angle), 0 };
+	m.row4 = { position.x, position.y, position.z, 1 };
+	return m;
+}
+
+struct CULL_TOTALS {
+	unsigned views, frustumCulled, backfaceCulled, missed;
+};
+
+// Culls every mesh from one view and checks what was dropped triangle by triangle
+static void CullAndCheck(const H2B::Parser& p, const std::vector<float>& facings, const GMATRIXF& world,
+	const CLUSTER_VIEW& view, CULL_TOTALS& totals)
+{
+	CLUSTER_INSTANCE instance = MakeClusterInstance(world);
+	float mirror = world.row1.x * (world.row2.y * world.row3.z - world.row2.z * world.row3.y) -
+		world.row1.y * (world.row2.x * world.row3.z - world.row2.z * world.row3.x) +
+		world.row1.z * (world.row2.x * world.row3.y - world.row2.y * world.row3.x) < 0 ? -1.0f : 1.0f;
+	float tolerance = 1e-4f * instance.scale;
+	for (size_t i = 0; i < p.meshes.size(); ++i) {
+		const H2B::MESHLET_RANGE& range = p.meshletRanges[i];
+		CLUSTER_CULL_STATS stats = {};
+		std::vector<unsigned> out = { 7 }; // appends after what is there
+		unsigned added = CullClusters(p.meshlets.data() + range.meshletOffset, range.meshletCount,
+			p.meshletVertices.data(), p.meshletTriangles.data(), instance, view, out, stats);
+		// the same clusters one at a time tell which were dropped and why
+		std::vector<unsigned> expected = { 7 };
+		unsigned triangles = 0;
+		for (unsigned k = range.meshletOffset; k < range.meshletOffset + range.meshletCount; ++k) {
+			const H2B::MESHLET& m = p.meshlets[k];
+			CLUSTER_CULL_STATS one = {};
+			bool visible = ClusterVisible(m, instance, view, one);
+			triangles += m.triangleCount;
+			totals.frustumCulled += one.frustumCulled;
+			totals.backfaceCulled += one.backfaceCulled;
+			for (unsigned t = 0; t < m.triangleCount; ++t) {
+				const unsigned char* local = &p.meshletTriangles[(m.triangleOffset + t) * 3];
+				unsigned tri[3] = { p.meshletVertices[m.vertexOffset + local[0]], p.meshletVertices[m.vertexOffset + local[1]],
+									p.meshletVertices[m.vertexOffset + local[2]] };
+				if (visible) {
+					expected.insert(expected.end(), tri, tri + 3);
+					continue;
+				}
+				H2B::VECTOR v[3];
+				for (int c = 0; c < 3; ++c)
+					v[c] = Transform(p.vertices[tri[c]].pos, world);
+				// inside unless all three corners are behind one plane, or within a hair of it
+				bool inside = true;
+				for (const GVECTORF& plane : view.planes) {
+					bool behind = true;
+					for (int c = 0; c < 3; ++c)
+						behind = behind && plane.x * v[c].x + plane.y * v[c].y + plane.z * v[c].z + plane.w < tolerance;
+					inside = inside && behind == false;
+				}
+				// front facing when the outward normal clearly points at the eye
+				H2B::VECTOR n = H2B::Normalize(H2B::Cross(H2B::Sub(v[1], v[0]), H2B::Sub(v[2], v[0])));
+				H2B::VECTOR toEye = { view.eye.x - v[0].x, view.eye.y - v[0].y, view.eye.z - v[0].z };
+				float facing = H2B::Dot(n, toEye) * facings[i] * mirror;
+				bool front = facing > 1e-3f * std::sqrt(H2B::Dot(toEye, toEye));
+				if (inside && front)
+					++totals.missed;
+			}
+		}
+		CHECK(out == expected);
+		CHECK(added == out.size() - 1 && stats.visibleTriangles * 3 == added);
+		CHECK(stats.clusters == range.meshletCount && stats.triangles == triangles);
+		CHECK(stats.frustumCulled + stats.backfaceCulled <= stats.clusters);
+		CHECK(stats.visibleTriangles <= stats.triangles);
+	}
+	++totals.views;
+}
+
+static void CullModel(const H2B::Parser& p, std::mt19937& rng)
+{
+	std::vector<float> facings;
+	for (const H2B::MESH& mesh : p.meshes)
+		facings.push_back(Facing(p, mesh));
+	H2B::BOUNDS bounds = H2B::ComputeBounds(p.vertices, p.indices.data(), unsigned(p.indices.size()));
+	std::uniform_real_distribution<float> unit(-1, 1), distance(0.3f, 3.0f);
+	struct INSTANCE_CASE {
+		float sx, sy, sz;
+		bool cones; // whether MakeClusterInstance may use the normal cones
+	} cases[] = { { 1, 1, 1, true }, { 2.5f, 2.5f, 2.5f, true }, { 1, 3, 1, false }, { -1.5f, 1.5f, 1.5f, false } };
+	for (const INSTANCE_CASE& c : cases) {
+		GMATRIXF world = World(c.sx, c.sy, c.sz, unit(rng) * 3.14159f, { unit(rng) * 50, unit(rng) * 5, unit(rng) * 50 });
+		CHECK(MakeClusterInstance(world).coneTest == c.cones);
+		float scale = std::fmax(std::fabs(c.sx), std::fmax(c.sy, c.sz));
+		float radius = bounds.radius * scale;
+		H2B::VECTOR center = Transform(bounds.center, world);
+		CULL_TOTALS totals = {};
+		for (int v = 0; v < 40; ++v) {
+			// eyes all around the model, some inside its sphere, looking near its middle
+			H2B::VECTOR direction = H2B::Normalize({ unit(rng), unit(rng) * 0.6f, unit(rng) });
+			float d = radius * distance(rng);
+			GVECTORF eye = { center.x + direction.x * d, center.y + direction.y * d, center.z + direction.z * d, 1 };
+			GVECTORF at = { center.x + unit(rng) * radius * 0.5f, center.y + unit(rng) * radius * 0.5f,
+							center.z + unit(rng) * radius * 0.5f, 1 };
+			GVECTORF up = { 0, 1, 0, 0 };
+			GMATRIXF viewMatrix, projection, viewProjection;
+			GMatrix::LookAtLHF(eye, at, up, viewMatrix);
+			GMatrix::ProjectionVulkanLHF(1.13f, 1.33f, 0.1f, radius * 10, projection);
+			GMatrix::MultiplyMatrixF(viewMatrix, projection, viewProjection);
+			CullAndCheck(p, facings, world, MakeClusterView(viewProjection, eye), totals);
+		}
+		CHECK(totals.missed == 0);
+		if (totals.missed)
+			std::printf("  %u visible front facing triangles culled at scale %g %g %g\n", totals.missed, c.sx, c.sy, c.sz);
+		// the views do cull, cones only where they hold
+		CHECK(totals.frustumCulled > 0);
+		CHECK(c.cones ? totals.backfaceCulled > 0 : totals.backfaceCulled == 0);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		std::printf("usage: ClusterCullingTest <model folder>\n");
+		return 1;
+	}
+	std::mt19937 rng(31);
+	LIMITS limits[] = { { 64, 124 }, { 3, 1 }, { 16, 8 }, { 256, 512 } };
+	for (const char* model : models) {
+		H2B::Parser source;
+		CHECK(source.Parse((std::string(argv[1]) + "/" + model).c_str()));
+		if (source.meshes.empty())
+			continue;
+		// file order, the cache optimized order H2BBake writes, and that with the
+		// winding reversed against the same normals, which BakeMeshlets must notice
+		for (int variant = 0; variant < 3; ++variant) {
+			H2B::Parser p = source;
+			if (variant)
+				H2B::BakeVertexCache(p);
+			if (variant == 2)
+				for (size_t i = 0; i + 2 < p.indices.size(); i += 3)
+					std::swap(p.indices[i + 1], p.indices[i + 2]);
+			for (const LIMITS& limit : limits) {
+				H2B::BakeMeshlets(p, limit.maxVertices, limit.maxTriangles);
+				CheckMeshlets(p, limit);
+			}
+			// the defaults are what the renderer loads
+			if (variant) {
+				H2B::BakeMeshlets(p);
+				CullModel(p, rng);
+			}
+		}
+	}
+	return TestResult();
+}
@@ -0,0 +1,118 @@
+// EncodeCompactTransform/DecodeCompactTransform: TRS matrices (mirrored
+// included) round trip within tolerance, and the ones that need a full matrix
+// (shear, projective column, collapsed axis) are flagged but still decode to
+// the closest TRS, which PackWorlds falls back to once fullMatricies is full.
+#define GATEWARE_ENABLE_CORE
+#define GATEWARE_ENABLE_SYSTEM
+#define GATEWARE_ENABLE_MATH
+#include "../../Gateware/Gateware.h"
+#include "../compact_transform.h"
+#include "test_check.h"
+#include <random>
+
+static GW::MATH::GMATRIXF Trs(float yaw, float pitch, float roll, float sx, float sy, float sz)
+{
+	GW::MATH::GMATRIXF m = GW::MATH::GIdentityMatrixF;
+	GW::MATH::GMatrix::RotateYGlobalF(m, yaw, m);
+	GW::MATH::GMatrix::RotateXGlobalF(m, pitch, m);
+	GW::MATH::GMatrix::RotateZGlobalF(m, roll, m);
+	GW::MATH::GVECTORF s = { sx, sy, sz, 0 };
+	GW::MATH::GMatrix::ScaleLocalF(m, s, m);
+	m.row4 = { 3, -7, 11, 1 };
+	return m;
+}
+
+static float RowError(const GW::MATH::GVECTORF& a, const GW::MATH::GVECTORF& b)
+{
+	float dx = a.x - b.x, dy = a.y - b.y, dz = a.z - b.z;
+	return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+// rows of a decoded flagged transform are unit axes times scale, orthogonal, right handed after the mirror
+static bool ProperTrs(const COMPACT_TRANSFORM& t)
+{
+	GW::MATH::GMATRIXF m = DecodeCompactTransform(t);
+	const GW::MATH::GVECTORF* rows[3] = { &m.row1, &m.row2, &m.row3 };
+	float axes[3][3];
+	for (int i = 0; i < 3; ++i) {
+		if (std::isfinite(t.scale[i]) == false)
+			return false;
+		// scale 0 rows carry no direction, rebuild it from the quaternion alone
+		COMPACT_TRANSFORM unit = t;
+		unit.scale[0] = unit.scale[1] = unit.scale[2] = 1;
+		GW::MATH::GMATRIXF r = DecodeCompactTransform(unit);
+		const GW::MATH::GVECTORF* u[3] = { &r.row1, &r.row2, &r.row3 };
+		axes[i][0] = u[i]->x; axes[i][1] = u[i]->y; axes[i][2] = u[i]->z;
+		if (RowError(*rows[i], { u[i]->x * t.scale[i], u[i]->y * t.scale[i], u[i]->z * t.scale[i], 0 }) > 1e-4f * (1 + std::fabs(t.scale[i])))
+			return false;
+	}
+	for (int i = 0; i < 3; ++i) {
+		float length = 0, dot = 0;
+		for (int j = 0; j < 3; ++j) {
+			length += axes[i][j] * axes[i][j];
+			dot += axes[i][j] * axes[(i + 1) % 3][j];
+		}
+		if (std::fabs(length - 1) > 1e-4f || std::fabs(dot) > 1e-4f)
+			return false;
+	}
+	return true;
+}
+
+int main()
+{
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<float> angle(-3.14159f, 3.14159f), scale(0.1f, 8);
+	float worst = 0;
+	for (int i = 0; i < 20000; ++i) {
+		float sx = scale(rng) * (i % 4 == 0 ? -1 : 1);
+		GW::MATH::GMATRIXF m = Trs(angle(rng), angle(rng), angle(rng), sx, scale(rng), scale(rng));
+		COMPACT_TRANSFORM t;
+		CHECK(EncodeCompactTransform(m, t));
+		CHECK((t.rotationHi & COMPACT_FULL_MATRIX) == 0);
+		GW::MATH::GMATRIXF back = DecodeCompactTransform(t);
+		const GW::MATH::GVECTORF* rows[4] = { &m.row1, &m.row2, &m.row3, &m.row4 };
+		const GW::MATH::GVECTORF* decoded[4] = { &back.row1, &back.row2, &back.row3, &back.row4 };
+		for (int r = 0; r < 3; ++r) {
+			float length = std::sqrt(rows[r]->x * rows[r]->x + rows[r]->y * rows[r]->y + rows[r]->z * rows[r]->z);
+			worst = std::fmax(worst, RowError(*rows[r], *decoded[r]) / length);
+		}
+		CHECK(RowError(*rows[3], *decoded[3]) == 0);
+	}
+	CHECK(worst <= 1e-4f);
+
+	// shear: flagged, the closest TRS keeps the scales and roughly the axes
+	GW::MATH::GMATRIXF sheared = Trs(0.3f, -1.1f, 2.0f, 2, 3, 4);
+	sheared.row2.x += 0.3f;
+	COMPACT_TRANSFORM t;
+	CHECK(EncodeCompactTransform(sheared, t) == false);
+	CHECK(t.rotationHi & COMPACT_FULL_MATRIX);
+	t.rotationHi &= ~COMPACT_FULL_MATRIX; // what PackWorlds does when out of room
+	CHECK(ProperTrs(t));
+	GW::MATH::GMATRIXF fallback = DecodeCompactTransform(t);
+	CHECK(RowError(fallback.row1, sheared.row1) < 0.2f && RowError(fallback.row2, sheared.row2) < 0.4f &&
+		RowError(fallback.row3, sheared.row3) < 0.4f && RowError(fallback.row4, sheared.row4) == 0);
+
+	// projective column: flagged, the affine part is exact
+	GW::MATH::GMATRIXF projective = Trs(1.0f, 0.5f, -0.25f, 1, 2, -1);
+	projective.row3.w = 0.5f;
+	CHECK(EncodeCompactTransform(projective, t) == false);
+	t.rotationHi &= ~COMPACT_FULL_MATRIX;
+	fallback = DecodeCompactTransform(t);
+	CHECK(ProperTrs(t) && RowError(fallback.row1, projective.row1) < 1e-3f && RowError(fallback.row2, projective.row2) < 1e-3f &&
+		RowError(fallback.row3, projective.row3) < 1e-3f);
+
+	// collapsed axes: flagged (normals divide by scale) yet a valid rotation
+	for (int zeros = 1; zeros <= 3; ++zeros) {
+		GW::MATH::GMATRIXF flat = Trs(-0.7f, 0.2f, 1.3f, 5, 6, 7);
+		GW::MATH::GVECTORF* rows[3] = { &flat.row1, &flat.row2, &flat.row3 };
+		for (int r = 0; r < zeros; ++r)
+			*rows[(r + 1) % 3] = { 0, 0, 0, 0 };
+		CHECK(EncodeCompactTransform(flat, t) == false);
+		t.rotationHi &= ~COMPACT_FULL_MATRIX;
+		fallback = DecodeCompactTransform(t);
+		CHECK(ProperTrs(t) && RowError(fallback.row1, flat.row1) < 1e-3f && RowError(fallback.row2, flat.row2) < 1e-3f &&
+			RowError(fallback.row3, flat.row3) < 1e-3f);
+	}
+	std::printf("worst TRS round trip error %g of the axis length\n", worst);
+	return TestResult();
+}
@@ -0,0 +1,229 @@
+// Hot reload of instance edits: writes a level file, loads it, applies
+// synthetic edits (moves, adds, removes, a shuffled export) through
+// DiffInstances and ApplyPatches, and compares the result with a fresh load
+// of the edited file once the hierarchy has updated. Parents moved like Blender
+// exports them, with the new world of every child, must not move the children
+// twice. Also checks the dirty ranges and the BVH after every round.
+// Usage: LevelPatchTest <folder with the .h2b models>
+#define GATEWARE_ENABLE_CORE
+#define GATEWARE_ENABLE_SYSTEM
+#define GATEWARE_ENABLE_MATH
+#include "../../Gateware/Gateware.h"
+#include "../load_data_oriented.h"
+#include "test_check.h"
+#include <array>
+#include <fstream>
+#include <map>
+#include <random>
+#include <tuple>
+
+// one MESH entry of the exporter's format, m in row major order. Children
+// keep an offset from their parent, their world is recomputed when it moves.
+struct LEVEL_OBJECT {
+	std::string name;
+	float m[16];
+	std::string parent; // empty for roots
+	float offset[3];
+};
+static const char* models[] = { "Mountain_Group_1_Cube", "Mountain_Group_2_Cube", "Archery_FirstAge_Level1_Cube", "Mountain_Group_1" };
+
+static void WriteLevel(const char* path, const std::vector<LEVEL_OBJECT>& objects)
+{
+	std::ofstream file(path);
+	file << "# Game Level Exporter v1.0\n";
+	char line[256];
+	std::map<std::string, unsigned> written; // file order index of each name
+	unsigned index = 0;
+	for (const LEVEL_OBJECT& object : objects) {
+		file << "MESH\n" << object.name << "\n";
+		for (int r = 0; r < 4; ++r) {
+			std::snprintf(line, sizeof(line), "%s(%.4f, %.4f, %.4f, %.4f)%s\n", r == 0 ? "<Matrix 4x4 " : "            ",
+				object.m[r * 4], object.m[r * 4 + 1], object.m[r * 4 + 2], object.m[r * 4 + 3], r == 3 ? ">" : "");
+			file << line;
+		}
+		auto parent = written.find(object.parent);
+		file << "PARENT " << (parent == written.end() ? -1 : int(parent->second)) << "\n";
+		written.emplace(object.name, index++);
+	}
+}
+
+// the file keeps 4 decimals, edits do too so a fresh load reads the same floats
+static float Round4(float x)
+{
+	return std::round(x * 10000) / 10000;
+}
+
+// Every instance as model file, object name and matrix, in a canonical order
+typedef std::vector<std::tuple<std::string, std::string, std::array<float, 16>>> INSTANCE_KEYS;
+static INSTANCE_KEYS Keys(const Level_Data& level)
+{
+	INSTANCE_KEYS keys;
+	for (const Level_Data::MODEL_INSTANCES& instances : level.levelInstances)
+		for (unsigned k = instances.transformStart; k < instances.transformStart + instances.transformCount; ++k) {
+			std::array<float, 16> m;
+			std::memcpy(m.data(), &level.levelTransforms[k], sizeof(m));
+			keys.emplace_back(level.levelModelFiles[instances.modelIndex], level.levelInstanceNames[k], m);
+		}
+	std::sort(keys.begin(), keys.end());
+	return keys;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		std::printf("usage: LevelPatchTest <model folder>\n");
+		return 1;
+	}
+	const char* modelFolder = argv[1];
+	GW::SYSTEM::GLog log;
+	log.Create("LevelPatchTest.log");
+	log.EnableConsoleLogging(false);
+
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> position(-200, 200), unit(0, 1);
+	unsigned serial = 0;
+	auto makeObject = [&](const char* model) {
+		LEVEL_OBJECT object = {};
+		object.name = std::string(model) + "." + std::to_string(serial++);
+		float scale = Round4(0.5f + unit(rng));
+		object.m[0] = object.m[5] = object.m[10] = scale;
+		object.m[12] = Round4(position(rng));
+		object.m[14] = Round4(position(rng));
+		object.m[15] = 1;
+		return object;
+	};
+	// children and grandchildren follow their parent's scale and position
+	auto place = [](LEVEL_OBJECT& child, const LEVEL_OBJECT& parent) {
+		child.m[0] = child.m[5] = child.m[10] = parent.m[0];
+		for (int k = 0; k < 3; ++k)
+			child.m[12 + k] = Round4(child.offset[k] * parent.m[0] + parent.m[12 + k]);
+	};
+	auto find = [](std::vector<LEVEL_OBJECT>& objects, const std::string& name) {
+		auto found = std::find_if(objects.begin(), objects.end(), [&](const LEVEL_OBJECT& o) { return o.name == name; });
+		return found == objects.end() ? nullptr : &*found;
+	};
+	std::vector<LEVEL_OBJECT> objects;
+	for (int i = 0; i < 2000; ++i)
+		objects.push_back(makeObject(models[rng() % 4]));
+	LEVEL_OBJECT twin = objects[5]; // a repeated name pairs up in file order
+	twin.m[12] += 1;
+	objects.push_back(twin);
+	std::vector<std::string> families; // parents, each with two children and a grandchild
+	for (int f = 0; f < 20; ++f) {
+		LEVEL_OBJECT parent = makeObject(models[rng() % 4]);
+		families.push_back(parent.name);
+		objects.push_back(parent);
+		for (int c = 0; c < 2; ++c) {
+			LEVEL_OBJECT child = makeObject(models[rng() % 4]);
+			child.parent = parent.name;
+			child.offset[0] = Round4(position(rng) / 20);
+			child.offset[1] = Round4(unit(rng) * 4);
+			place(child, parent);
+			objects.push_back(child);
+			LEVEL_OBJECT grandchild = makeObject(models[rng() % 4]);
+			grandchild.parent = child.name;
+			grandchild.offset[2] = Round4(position(rng) / 40);
+			place(grandchild, child);
+			objects.push_back(grandchild);
+		}
+	}
+	WriteLevel("LevelPatchTest.txt", objects);
+	Level_Data level;
+	CHECK(level.LoadLevel("LevelPatchTest.txt", modelFolder, log));
+	CHECK(level.levelTransforms.size() == objects.size());
+	CHECK(level.levelHierarchy.Depth() == 3);
+
+	for (int round = 0; round < 6; ++round) {
+		// round 0 only moves, round 1 changes nothing, the rest mix everything
+		unsigned moves = round == 1 ? 0 : 1 + rng() % 20;
+		unsigned removes = round < 2 ? 0 : rng() % 15, adds = round < 2 ? 0 : rng() % 15;
+		std::vector<LEVEL_OBJECT> edited = objects;
+		for (unsigned i = 0; i < moves; ++i) {
+			LEVEL_OBJECT& object = edited[rng() % edited.size()];
+			object.m[12] = Round4(object.m[12] + 1 + unit(rng));
+		}
+		// moved parents carry the objects under them, as the exporter writes them
+		unsigned familyMoves = round == 1 ? 0 : 1 + rng() % 4;
+		for (unsigned i = 0; i < familyMoves; ++i) {
+			LEVEL_OBJECT* parent = find(edited, families[rng() % families.size()]);
+			if (parent == nullptr)
+				continue;
+			parent->m[12] = Round4(parent->m[12] + 1 + unit(rng));
+			parent->m[14] = Round4(parent->m[14] - 1 - unit(rng));
+			for (LEVEL_OBJECT& child : edited)
+				if (child.parent == parent->name) {
+					place(child, *parent);
+					for (LEVEL_OBJECT& grandchild : edited)
+						if (grandchild.parent == child.name)
+							place(grandchild, child);
+				}
+		}
+		for (unsigned i = 0; i < removes; ++i)
+			edited.erase(edited.begin() + rng() % edited.size());
+		for (unsigned i = 0; i < adds; ++i)
+			edited.insert(edited.begin() + rng() % edited.size(), makeObject(models[rng() % 4]));
+		if (round == 5) // export order must not matter
+			std::shuffle(edited.begin(), edited.end(), rng);
+		WriteLevel("LevelPatchTest.txt", edited);
+
+		std::vector<GW::MATH::GMATRIXF> before = level.levelTransforms;
+		std::vector<Level_Data::LEVEL_PATCH> patches;
+		std::vector<Level_Data::TRANSFORM_RANGE> dirty;
+		CHECK(level.DiffInstances("LevelPatchTest.txt", patches, log));
+		unsigned added = 0, removed = 0, moved = 0;
+		for (const Level_Data::LEVEL_PATCH& patch : patches) {
+			added += patch.op == Level_Data::LEVEL_PATCH::ADD;
+			removed += patch.op == Level_Data::LEVEL_PATCH::REMOVE;
+			moved += patch.op == Level_Data::LEVEL_PATCH::MOVE;
+		}
+		// an object can move twice, and a shuffle may swap which twin pairs with which
+		CHECK(added == adds && removed == removes && moved <= moves + familyMoves * 5 + (round == 5 ? 2 : 0));
+		CHECK(round != 1 || patches.empty());
+		bool resized = level.ApplyPatches(patches, dirty, log);
+		CHECK(resized == (adds || removes));
+		level.UpdateHierarchy(1); // what the next frame runs
+
+		// the patched level matches a fresh load of the edited file
+		Level_Data fresh;
+		CHECK(fresh.LoadLevel("LevelPatchTest.txt", modelFolder, log));
+		CHECK(Keys(level) == Keys(fresh));
+		CHECK(level.levelInstanceBounds.size() == level.levelTransforms.size());
+
+		// dirty ranges are sorted, disjoint and cover every changed transform
+		std::vector<bool> covered(level.levelTransforms.size(), false);
+		unsigned end = 0;
+		for (const Level_Data::TRANSFORM_RANGE& range : dirty) {
+			CHECK(range.count && range.start >= end && range.start + range.count <= level.levelTransforms.size());
+			end = range.start + range.count;
+			for (unsigned k = range.start; k < end && k < covered.size(); ++k)
+				covered[k] = true;
+		}
+		for (size_t k = 0; k < level.levelTransforms.size(); ++k)
+			if (covered[k] == false)
+				CHECK(k < before.size() && std::memcmp(&before[k], &level.levelTransforms[k], sizeof(GW::MATH::GMATRIXF)) == 0);
+		CHECK(round != 1 || dirty.empty());
+
+		// the refit or rebuilt BVH finds what testing every box finds
+		std::vector<unsigned> hits;
+		GW::MATH::GAABBCEF query;
+		query.center = { 0, 0, 0, 0 };
+		query.extent = { 60, 60, 60, 0 };
+		level.levelSpatialIndex.QueryAABB(query, hits);
+		size_t expected = 0;
+		for (const GW::MATH::GAABBCEF& box : level.levelInstanceBounds) {
+			GW::MATH::GCollision::GCollisionCheck result;
+			GW::MATH::GCollision::TestAABBToAABBF(query, box, result);
+			expected += result == GW::MATH::GCollision::GCollisionCheck::COLLISION;
+		}
+		CHECK(hits.size() == expected);
+		objects = edited;
+	}
+
+	// a model the level doesn't hold yet needs a full load
+	objects.push_back(makeObject("Mountain_Group_2"));
+	WriteLevel("LevelPatchTest.txt", objects);
+	std::vector<Level_Data::LEVEL_PATCH> patches;
+	CHECK(level.DiffInstances("LevelPatchTest.txt", patches, log) == false);
+	CHECK(patches.empty());
+	return TestResult();
+}
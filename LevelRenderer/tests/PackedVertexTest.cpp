@@ -0,0 +1,146 @@
+// Round trips synthetic vertices through H2B::PackVertices and checks the
+// decoded data against the error bounds h2bPacked.h documents, and that the
+// PACKING_ERROR it reports matches what actually comes back.
+#include "../h2bPacked.h"
+#include "test_check.h"
+#include <random>
+#include <vector>
+
+using namespace H2B;
+
+static float Length(const VECTOR& v)
+{
+	return std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+}
+
+// Angle between a and b in degrees, in double so it resolves hundredths of a degree
+static double Degrees(const VECTOR& a, const VECTOR& b)
+{
+	double cx = double(a.y) * b.z - double(a.z) * b.y;
+	double cy = double(a.z) * b.x - double(a.x) * b.z;
+	double cz = double(a.x) * b.y - double(a.y) * b.x;
+	double dot = double(a.x) * b.x + double(a.y) * b.y + double(a.z) * b.z;
+	return std::atan2(std::sqrt(cx * cx + cy * cy + cz * cz), dot) * 57.29577951308232;
+}
+
+// Every finite half survives HalfToFloat then FloatToHalf unchanged
+static void TestHalfRoundTrip()
+{
+	unsigned mismatches = 0;
+	for (uint32_t h = 0; h < 0x10000; ++h) {
+		float f = HalfToFloat(uint16_t(h));
+		if (std::isnan(f) == false && FloatToHalf(f) != h)
+			++mismatches;
+	}
+	CHECK(mismatches == 0);
+	CHECK(FloatToHalf(1.0f) == 0x3C00);
+	CHECK(FloatToHalf(-2.0f) == 0xC000);
+	CHECK(FloatToHalf(65520.0f) == 0x7C00); // rounds past the largest half
+	CHECK(HalfToFloat(0x0001) == std::ldexp(1.0f, -24)); // smallest denormal
+}
+
+// Octahedral encoding stays within the documented 0.04 degrees on every octant
+static void TestOctahedral()
+{
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> unit(-1, 1);
+	double worst = 0;
+	for (int i = 0; i < 200000; ++i) {
+		VECTOR n = { unit(rng), unit(rng), unit(rng) };
+		float length = Length(n);
+		if (length < 1e-3f)
+			continue;
+		n = { n.x / length, n.y / length, n.z / length };
+		int16_t encoded[2];
+		EncodeOctahedral(n, encoded);
+		VECTOR r = DecodeOctahedral(encoded);
+		CHECK(std::fabs(Length(r) - 1) < 1e-5f);
+		worst = std::fmax(worst, Degrees(r, n));
+	}
+	CHECK(worst <= 0.04);
+	const VECTOR axes[] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+	for (const VECTOR& a : axes) {
+		int16_t encoded[2];
+		EncodeOctahedral(a, encoded);
+		VECTOR r = DecodeOctahedral(encoded);
+		CHECK(r.x * a.x + r.y * a.y + r.z * a.z > 0.99999f);
+	}
+}
+
+// PackVertices on a random model: every vertex within the bounds, and the
+// reported PACKING_ERROR equal to the largest error recomputed here
+static void TestPackVertices(const VECTOR& boxMin, const VECTOR& boxMax, unsigned seed)
+{
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> unit(0, 1), uv(-4, 4);
+	std::vector<VERTEX> vertices(5000);
+	for (VERTEX& v : vertices) {
+		v.pos = { boxMin.x + unit(rng) * (boxMax.x - boxMin.x), boxMin.y + unit(rng) * (boxMax.y - boxMin.y),
+				  boxMin.z + unit(rng) * (boxMax.z - boxMin.z) };
+		v.nrm = { unit(rng) * 2 - 1, unit(rng) * 2 - 1, unit(rng) * 2 - 1 };
+		float length = Length(v.nrm);
+		v.nrm = { v.nrm.x / length, v.nrm.y / length, v.nrm.z / length };
+		v.uvw = { uv(rng), uv(rng), 0 };
+	}
+	vertices[0].pos = boxMin; // the box corners hit the ends of the unorm range
+	vertices[1].pos = boxMax;
+	vertices[2].nrm = { 0, 0, 0 }; // degenerate normals are skipped, not NaN
+
+	std::vector<PACKED_VERTEX> packed;
+	PACKING_ERROR error = {};
+	PackVertices(vertices.data(), unsigned(vertices.size()), boxMin, boxMax, packed, error);
+	CHECK(packed.size() == vertices.size());
+	CHECK(packed[0].pos[0] == 0 && packed[0].pos[1] == 0 && packed[0].pos[2] == 0);
+	CHECK(packed[1].pos[0] == 65535 && packed[1].pos[1] == 65535 && packed[1].pos[2] == 65535);
+
+	VECTOR extent = { boxMax.x - boxMin.x, boxMax.y - boxMin.y, boxMax.z - boxMin.z };
+	PACKING_ERROR measured = {};
+	for (size_t i = 0; i < vertices.size(); ++i) {
+		const VERTEX& v = vertices[i];
+		VERTEX r = UnpackVertex(packed[i], boxMin, extent);
+		const float* p = &v.pos.x;
+		const float* q = &r.pos.x;
+		const float* e = &extent.x;
+		for (int a = 0; a < 3; ++a) {
+			float difference = std::fabs(q[a] - p[a]);
+			// half a quantization step, plus float rounding of the decode
+			CHECK(difference <= e[a] / 131070 * 1.001f + std::fabs(p[a]) * 1e-6f);
+			measured.position = std::fmax(measured.position, difference);
+		}
+		if (Length(v.nrm) > 0)
+			measured.normalDegrees = std::fmax(measured.normalDegrees, float(Degrees(r.nrm, v.nrm)));
+		float du = std::fabs(r.uvw.x - v.uvw.x), dv = std::fabs(r.uvw.y - v.uvw.y);
+		CHECK(du <= std::fabs(v.uvw.x) * std::ldexp(1.0f, -11) && dv <= std::fabs(v.uvw.y) * std::ldexp(1.0f, -11));
+		CHECK(r.uvw.z == 0);
+		measured.uv = std::fmax(measured.uv, std::fmax(du, dv));
+	}
+	CHECK(std::isnan(error.normalDegrees) == false);
+	CHECK(error.position == measured.position);
+	CHECK(std::fabs(error.normalDegrees - measured.normalDegrees) < 1e-3f);
+	CHECK(error.normalDegrees <= 0.04f);
+	CHECK(error.uv == measured.uv);
+	CHECK(error.uv <= 4 * std::ldexp(1.0f, -11));
+}
+
+// A flat model packs its zero extent axis to the box minimum
+static void TestFlatBox()
+{
+	VERTEX v = {};
+	v.pos = { 1, 5, 3 };
+	v.nrm = { 0, 1, 0 };
+	std::vector<PACKED_VERTEX> packed;
+	PACKING_ERROR error = {};
+	PackVertices(&v, 1, VECTOR{ 0, 5, 0 }, VECTOR{ 2, 5, 4 }, packed, error);
+	CHECK(packed.size() == 1 && packed[0].pos[1] == 0);
+	CHECK(error.position <= 2.0f / 131070);
+}
+
+int main()
+{
+	TestHalfRoundTrip();
+	TestOctahedral();
+	TestPackVertices(VECTOR{ -1, -1, -1 }, VECTOR{ 1, 1, 1 }, 1);
+	TestPackVertices(VECTOR{ -250, 0, 40 }, VECTOR{ 250, 12, 41 }, 2);
+	TestFlatBox();
+	return TestResult();
+}
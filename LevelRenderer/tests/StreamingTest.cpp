@@ -0,0 +1,293 @@
+// Drives Level_Streamer along a scripted camera path over a synthetic level
+// and checks after every Update that the geometry pool stays consistent:
+// placed ranges are aligned, disjoint and inside the budget, resident models
+// still hold what their load copied in, released ranges wait out the frames
+// in flight, and cells follow the load and unload radii. Partway along some
+// instances move to other cells, as a hot reload does. The same path run
+// inline and threaded must make the same decisions.
+#define GATEWARE_ENABLE_CORE
+#define GATEWARE_ENABLE_SYSTEM
+#define GATEWARE_ENABLE_MATH
+#include "../../Gateware/Gateware.h"
+#include "../load_data_oriented.h"
+#include "../level_streaming.h"
+#include "test_check.h"
+#include <cstring>
+
+static const float cellSize = 20, loadRadius = 40, unloadRadius = 60;
+static const size_t vertexBytes = sizeof(H2B::PACKED_VERTEX);
+
+// 12 x 12 cells of 3 instances each, drawn from 48 models of mixed sizes
+static void MakeLevel(Level_Data& level)
+{
+	for (unsigned m = 0; m < 48; ++m) {
+		Level_Data::LEVEL_MODEL model = {};
+		model.vertexCount = 100 + m * 397 % 3000;
+		model.indexCount = model.vertexCount * 3 + m;
+		model.shortIndices = m % 3 != 0;
+		level.levelModels.push_back(model);
+	}
+	std::vector<std::vector<GW::MATH::GMATRIXF>> placed(level.levelModels.size());
+	for (int z = -6; z < 6; ++z)
+		for (int x = -6; x < 6; ++x)
+			for (int i = 0; i < 3; ++i) {
+				GW::MATH::GMATRIXF world = GW::MATH::GIdentityMatrixF;
+				world.row4 = { (x + 0.25f + i * 0.25f) * cellSize, 0, (z + 0.5f) * cellSize, 1 };
+				placed[unsigned(x * 7 + z * 13 + i * 5 + 1000) % placed.size()].push_back(world);
+			}
+	for (unsigned m = 0; m < placed.size(); ++m) {
+		Level_Data::MODEL_INSTANCES instances = { m, unsigned(level.levelTransforms.size()), unsigned(placed[m].size()), 0 };
+		level.levelInstances.push_back(instances);
+		level.levelTransforms.insert(level.levelTransforms.end(), placed[m].begin(), placed[m].end());
+	}
+}
+
+// Out across the level, a loop around it and a stretch jittering on a cell edge
+static GW::MATH::GVECTORF CameraAt(unsigned step)
+{
+	if (step < 200)
+		return { -130.0f + step * 1.3f, 2, -20.0f + step * 0.4f, 1 };
+	if (step < 500) {
+		float angle = (step - 200) / 300.0f * 6.2831853f;
+		return { 90 * std::cos(angle), 2, 70 * std::sin(2 * angle), 1 };
+	}
+	return { 40.0f + (step % 2 ? 0.5f : -0.5f), 2, 10, 1 };
+}
+
+static float CellDistance(const STREAM_CELL& cell, const GW::MATH::GVECTORF& camera)
+{
+	float x0 = cell.x * cellSize, z0 = cell.z * cellSize;
+	float dx = std::max(std::max(x0 - camera.x, camera.x - (x0 + cellSize)), 0.0f);
+	float dz = std::max(std::max(z0 - camera.z, camera.z - (z0 + cellSize)), 0.0f);
+	return std::sqrt(dx * dx + dz * dz);
+}
+
+// Every decision of one run, compared across runs
+struct RUN_TRACE {
+	std::vector<unsigned> states;
+	std::vector<size_t> offsets;
+	STREAM_STATS stats;
+};
+
+static RUN_TRACE Run(Level_Data level, size_t budget, bool threaded, unsigned retireUpdates)
+{
+	RUN_TRACE trace;
+	// stands in for the mapped pool buffer, each load stamps its models in
+	std::vector<unsigned> pool(budget / sizeof(unsigned), ~0u);
+	Level_Streamer streamer;
+	streamer.Create(level, cellSize, loadRadius, unloadRadius, budget, threaded,
+		[&](const STREAM_CELL& cell) {
+			for (const STREAM_UPLOAD& upload : cell.uploads) {
+				if (upload.range.offset + upload.range.size > budget)
+					continue; // flagged below
+				unsigned* words = pool.data() + upload.range.offset / sizeof(unsigned);
+				std::fill(words, words + upload.range.size / sizeof(unsigned), upload.model);
+			}
+		}, nullptr, vertexBytes, retireUpdates);
+	std::vector<STREAM_RANGE> previous(level.levelModels.size(), STREAM_RANGE());
+	std::vector<std::pair<unsigned, STREAM_RANGE>> released; // step and range
+	for (unsigned step = 0; step < 700; ++step) {
+		if (threaded)
+			streamer.WaitIdle(); // the same hand-off as inline, so the same decisions
+		GW::MATH::GVECTORF camera = CameraAt(step);
+		if (step == 350 || step == 420) { // instances moved by a hot reload
+			STREAM_STATS before = streamer.GetStats();
+			std::vector<Level_Data::TRANSFORM_RANGE> moved;
+			// some one cell over, some from far away to around the camera, where
+			// cells are resident and may not have their models placed
+			for (unsigned k = step % 7; k < level.levelTransforms.size(); k += 11) {
+				if (k % 2) {
+					level.levelTransforms[k].row4.x += cellSize;
+					level.levelTransforms[k].row4.z -= cellSize * (k % 3);
+				}
+				else
+					level.levelTransforms[k].row4 = { camera.x + (k % 5) * 3.0f, 0, camera.z - (k % 3) * 3.0f, 1 };
+				moved.push_back({ k, 1 });
+			}
+			streamer.MoveTransforms(level, moved);
+			const STREAM_STATS& after = streamer.GetStats();
+			// only cells that couldn't place a moved model unload, pending loads
+			// finish and nothing is requested again
+			CHECK(after.unloads - before.unloads <= moved.size() && after.pendingLoads == 0);
+			CHECK(after.loadsCompleted == before.loadsCompleted + before.pendingLoads);
+			CHECK(after.residentBytes <= after.budgetBytes);
+			for (const Level_Data::TRANSFORM_RANGE& range : moved) {
+				const GW::MATH::GMATRIXF& world = level.levelTransforms[range.start];
+				unsigned found = 0;
+				for (const STREAM_CELL& cell : streamer.GetCells())
+					if (std::count(cell.transforms.begin(), cell.transforms.end(), range.start)) {
+						++found;
+						CHECK(cell.x == int(std::floor(world.row4.x / cellSize)) && cell.z == int(std::floor(world.row4.z / cellSize)));
+					}
+				CHECK(found == 1);
+			}
+		}
+		unsigned deferrals = streamer.GetStats().budgetDeferrals;
+		streamer.Update(camera);
+		const STREAM_STATS& stats = streamer.GetStats();
+		bool deferred = stats.budgetDeferrals != deferrals;
+		CHECK(stats.residentBytes <= stats.budgetBytes);
+
+		// placed ranges: aligned, inside the pool, disjoint, sized for the model
+		std::vector<std::pair<size_t, size_t>> ranges;
+		size_t placedBytes = 0;
+		for (unsigned m = 0; m < level.levelModels.size(); ++m) {
+			const STREAM_RANGE& range = streamer.GetModelRange(m);
+			const Level_Data::LEVEL_MODEL& model = level.levelModels[m];
+			if (previous[m].size && (range.size == 0 || range.offset != previous[m].offset))
+				released.push_back({ step, previous[m] });
+			if (range.size && (previous[m].size == 0 || range.offset != previous[m].offset))
+				for (const std::pair<unsigned, STREAM_RANGE>& r : released)
+					if (range.offset < r.second.offset + r.second.size && r.second.offset < range.offset + range.size)
+						CHECK(step - r.first >= retireUpdates); // reused while frames may still read it
+			previous[m] = range;
+			if (range.size == 0)
+				continue;
+			CHECK(range.offset % vertexBytes == 0);
+			CHECK(range.offset + range.size <= budget);
+			CHECK(range.size >= model.vertexCount * vertexBytes + model.indexCount * (model.shortIndices ? 2 : 4));
+			ranges.push_back({ range.offset, range.offset + range.size });
+			placedBytes += range.size;
+		}
+		std::sort(ranges.begin(), ranges.end());
+		for (size_t i = 1; i < ranges.size(); ++i)
+			CHECK(ranges[i - 1].second <= ranges[i].first);
+		CHECK(placedBytes == stats.residentBytes);
+
+		// cells: everything in loadRadius requested unless the pool was full,
+		// every model of a pending or resident cell placed, resident ones still
+		// holding what their load wrote, nothing resident past unloadRadius
+		std::vector<bool> used(level.levelModels.size(), false);
+		for (const STREAM_CELL& cell : streamer.GetCells()) {
+			trace.states.push_back(cell.state);
+			// a cell lists exactly the models its transforms use
+			std::vector<unsigned> models;
+			for (const Level_Data::MODEL_INSTANCES& instances : level.levelInstances)
+				for (unsigned k : cell.transforms)
+					if (k >= instances.transformStart && k < instances.transformStart + instances.transformCount &&
+						std::count(models.begin(), models.end(), instances.modelIndex) == 0)
+						models.push_back(instances.modelIndex);
+			std::vector<unsigned> listed = cell.models;
+			std::sort(models.begin(), models.end());
+			std::sort(listed.begin(), listed.end());
+			CHECK(models == listed);
+			if (cell.state == STREAM_CELL::UNLOADED) {
+				CHECK(deferred || CellDistance(cell, camera) > loadRadius);
+				continue;
+			}
+			for (unsigned m : cell.models) {
+				CHECK(streamer.GetModelRange(m).size != 0);
+				used[m] = true;
+			}
+			if (cell.state != STREAM_CELL::RESIDENT)
+				continue;
+			CHECK(CellDistance(cell, camera) <= unloadRadius);
+			for (unsigned m : cell.models) {
+				const STREAM_RANGE& range = streamer.GetModelRange(m);
+				const unsigned* words = pool.data() + range.offset / sizeof(unsigned);
+				CHECK(std::count(words, words + range.size / sizeof(unsigned), m) == std::ptrdiff_t(range.size / sizeof(unsigned)));
+			}
+		}
+		for (unsigned m = 0; m < level.levelModels.size(); ++m) {
+			CHECK(used[m] == (streamer.GetModelRange(m).size != 0)); // placed while a loaded cell uses it
+			trace.offsets.push_back(streamer.GetModelRange(m).offset);
+		}
+	}
+	if (threaded)
+		streamer.WaitIdle();
+	trace.stats = streamer.GetStats();
+	return trace;
+}
+
+static bool SameTrace(const RUN_TRACE& a, const RUN_TRACE& b)
+{
+	return a.states == b.states && a.offsets == b.offsets && a.stats.loadsCompleted == b.stats.loadsCompleted &&
+		a.stats.unloads == b.stats.unloads && a.stats.budgetDeferrals == b.stats.budgetDeferrals &&
+		a.stats.modelUploads == b.stats.modelUploads;
+}
+
+static void TestRangeAllocator()
+{
+	Range_Allocator pool;
+	pool.Reset(1000, 16); // rounds down to 992
+	size_t a = 0, b = 0, c = 0, d = 0, e = 0;
+	CHECK(pool.Allocate(100, a) && a == 0); // takes 112
+	CHECK(pool.Allocate(16, b) && b == 112);
+	CHECK(pool.Allocate(500, c) && c == 128); // takes 512
+	CHECK(pool.Allocate(400, d) == false); // 352 left
+	pool.Free(b, 16);
+	CHECK(pool.Allocate(32, d) && d == 640); // first fit skips the 16 byte hole
+	CHECK(pool.Allocate(16, e) && e == 112); // and fills it later
+	pool.Free(a, 100);
+	pool.Free(c, 500);
+	pool.Free(e, 16); // joins both neighbours
+	CHECK(pool.GetFreeRanges().size() == 2 && pool.GetFreeRanges().begin()->second == 640);
+	CHECK(pool.Allocate(640, a) && a == 0);
+	pool.Free(d, 32);
+	CHECK(pool.GetFreeRanges().size() == 1 && pool.GetFreeRanges().begin()->first == 640);
+	pool.Free(a, 640);
+	CHECK(pool.GetFreeRanges().size() == 1 && pool.GetFreeRanges().begin()->second == 992);
+}
+
+// A moved instance whose model doesn't fit next to what its new, resident
+// cell holds unloads that cell until it fits whole again
+static void TestMoveIntoFullPool()
+{
+	Level_Data level;
+	for (unsigned m = 0; m < 2; ++m) {
+		Level_Data::LEVEL_MODEL model = {};
+		model.vertexCount = 1000;
+		model.indexCount = 3000;
+		level.levelModels.push_back(model);
+		Level_Data::MODEL_INSTANCES instances = { m, m, 1, 0 };
+		level.levelInstances.push_back(instances);
+		GW::MATH::GMATRIXF world = GW::MATH::GIdentityMatrixF;
+		world.row4 = { m * 10 * cellSize + 1, 0, 1, 1 };
+		level.levelTransforms.push_back(world);
+	}
+	size_t modelBytes = 1000 * vertexBytes + 3000 * 4;
+	Level_Streamer streamer;
+	unsigned loads = 0;
+	streamer.Create(level, cellSize, loadRadius, unloadRadius, modelBytes + modelBytes / 2, false,
+		[&](const STREAM_CELL&) { ++loads; }, nullptr, vertexBytes, 0);
+	GW::MATH::GVECTORF camera = { 1, 2, 1, 1 };
+	streamer.Update(camera);
+	streamer.Update(camera);
+	CHECK(streamer.IsResident(0) && streamer.IsResident(1) == false && loads == 1);
+	level.levelTransforms[1].row4 = { 5, 0, 5, 1 };
+	streamer.MoveTransforms(level, { { 1, 1 } });
+	CHECK(streamer.IsResident(0) == false && streamer.GetStats().residentBytes == 0);
+	streamer.Update(camera); // both models don't fit
+	CHECK(streamer.IsResident(0) == false && streamer.GetStats().budgetDeferrals == 1);
+	level.levelTransforms[1].row4 = { 10 * cellSize + 1, 0, 1, 1 };
+	streamer.MoveTransforms(level, { { 1, 1 } });
+	streamer.Update(camera);
+	streamer.Update(camera);
+	CHECK(streamer.IsResident(0) && streamer.IsResident(1) == false && loads == 2);
+	CHECK(streamer.GetModelRange(0).size && streamer.GetModelRange(1).size == 0);
+}
+
+int main()
+{
+	TestRangeAllocator();
+	TestMoveIntoFullPool();
+	Level_Data level;
+	MakeLevel(level);
+
+	// room for the whole level: every cell in range loads and stays loaded
+	RUN_TRACE roomy = Run(level, 64 << 20, false, 0);
+	CHECK(roomy.stats.budgetDeferrals == 0);
+	CHECK(roomy.stats.loadsCompleted > 0 && roomy.stats.unloads > 0);
+	// a pool just short of what the load radius covers: eviction, deferral and reuse
+	RUN_TRACE tight = Run(level, 2048 << 10, false, 3);
+	CHECK(tight.stats.budgetDeferrals > 0);
+	CHECK(tight.stats.modelUploads > roomy.stats.modelUploads && tight.stats.unloads > roomy.stats.unloads);
+
+	CHECK(SameTrace(roomy, Run(level, 64 << 20, false, 0)));
+	CHECK(SameTrace(tight, Run(level, 2048 << 10, false, 3)));
+	CHECK(SameTrace(tight, Run(level, 2048 << 10, true, 3)));
+	std::printf("roomy: %u loads, %u unloads, %u model uploads\n", roomy.stats.loadsCompleted, roomy.stats.unloads, roomy.stats.modelUploads);
+	std::printf("tight: %u loads, %u unloads, %u model uploads, %u deferrals\n", tight.stats.loadsCompleted,
+		tight.stats.unloads, tight.stats.modelUploads, tight.stats.budgetDeferrals);
+	return TestResult();
+}
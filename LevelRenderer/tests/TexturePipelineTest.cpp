@@ -0,0 +1,202 @@
+// Texture_Pipeline without a GPU or libktx: a decode callback stands in for
+// DecodeKtxTexture and builds the mip chain of a raw RGBA file into a
+// ktxTexture of its own. Checks every submitted load comes back once with
+// what a single threaded decode makes of it, that duplicates, unreadable and
+// undecodable files are reported, and that the stats add up. Prints the wall
+// time with one decoder and with every hardware thread.
+#include "../texture_pipeline.h"
+#include "test_check.h"
+#include <cstring>
+#include <random>
+
+static const uint32_t rawMagic = 0x58545354; // "TSTX", then width and height, then RGBA8 texels
+
+static void KTX_APIENTRY DestroyRaw(ktxTexture* texture)
+{
+	delete[] texture->pData;
+	delete texture;
+}
+static ktxTexture_vtbl rawVtbl = {}; // only Destroy is called, set in main
+
+// The decode stage: a box filtered mip chain, like a transcode it is CPU bound
+static bool DecodeRaw(TEXTURE_LOAD& load)
+{
+	uint32_t header[3];
+	if (load.contents.size() < sizeof(header)) {
+		load.error = "truncated";
+		return false;
+	}
+	std::memcpy(header, load.contents.data(), sizeof(header));
+	uint32_t width = header[1], height = header[2];
+	if (header[0] != rawMagic || width == 0 || height == 0 || load.contents.size() != sizeof(header) + size_t(width) * height * 4) {
+		load.error = "not a raw texture";
+		return false;
+	}
+	unsigned levels = 1;
+	size_t bytes = size_t(width) * height * 4;
+	for (uint32_t w = width, h = height; w > 1 || h > 1; ++levels) {
+		w = std::max(w / 2, 1u);
+		h = std::max(h / 2, 1u);
+		bytes += size_t(w) * h * 4;
+	}
+	ktxTexture* texture = new ktxTexture{}; // ktxTexture() is a cast macro
+	texture->vtbl = &rawVtbl;
+	texture->baseWidth = width;
+	texture->baseHeight = height;
+	texture->baseDepth = 1;
+	texture->numDimensions = 2;
+	texture->numLevels = levels;
+	texture->numLayers = texture->numFaces = 1;
+	texture->dataSize = bytes;
+	texture->pData = new ktx_uint8_t[bytes];
+	std::memcpy(texture->pData, load.contents.data() + sizeof(header), size_t(width) * height * 4);
+	const uint8_t* source = texture->pData;
+	uint8_t* level = texture->pData + size_t(width) * height * 4;
+	for (uint32_t w = width, h = height; w > 1 || h > 1;) {
+		uint32_t nw = std::max(w / 2, 1u), nh = std::max(h / 2, 1u);
+		for (uint32_t y = 0; y < nh; ++y)
+			for (uint32_t x = 0; x < nw; ++x)
+				for (int c = 0; c < 4; ++c) {
+					uint32_t x1 = std::min(x * 2 + 1, w - 1), y1 = std::min(y * 2 + 1, h - 1);
+					unsigned sum = source[(y * 2 * w + x * 2) * 4 + c] + source[(y * 2 * w + x1) * 4 + c] +
+						source[(y1 * w + x * 2) * 4 + c] + source[(y1 * w + x1) * 4 + c];
+					level[(y * nw + x) * 4 + c] = uint8_t((sum + 2) / 4);
+				}
+		source = level;
+		level += size_t(nw) * nh * 4;
+		w = nw;
+		h = nh;
+	}
+	load.texture = texture;
+	return true;
+}
+
+static std::vector<uint8_t> MakeRaw(uint32_t width, uint32_t height, uint32_t seed)
+{
+	std::vector<uint8_t> contents(12 + size_t(width) * height * 4);
+	uint32_t header[3] = { rawMagic, width, height };
+	std::memcpy(contents.data(), header, sizeof(header));
+	std::mt19937 rng(seed);
+	for (size_t i = 12; i < contents.size(); ++i)
+		contents[i] = uint8_t(rng());
+	return contents;
+}
+
+struct BATCH_FILE {
+	std::string path;
+	std::vector<uint8_t> contents; // what the file holds
+	bool preloaded; // submitted with its contents, skipping the read
+	unsigned duplicateOf; // ~0u unless an earlier file has the same bytes
+	bool readable, decodable;
+	uint64_t decodedHash; // of a single threaded DecodeRaw
+};
+
+// Submits the whole batch, checks what comes back and prints where the time
+// went. Returns the wall time in ms.
+static float RunBatch(const std::vector<BATCH_FILE>& files, unsigned workers)
+{
+	Texture_Pipeline pipeline;
+	pipeline.Create(workers, DecodeRaw);
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned f = 0; f < files.size(); ++f)
+		pipeline.Submit(f, files[f].path, files[f].preloaded ? files[f].contents : std::vector<uint8_t>());
+	std::vector<unsigned> seen(files.size(), 0);
+	size_t bytesRead = 0;
+	for (std::vector<TEXTURE_LOAD> done; pipeline.Collect(done, true); done.clear())
+		for (TEXTURE_LOAD& load : done) {
+			CHECK(load.id < files.size());
+			if (load.id >= files.size())
+				continue;
+			const BATCH_FILE& file = files[load.id];
+			++seen[load.id];
+			CHECK(load.contents.empty()); // released once decoded
+			bytesRead += load.fileBytes;
+			if (file.readable == false)
+				CHECK(load.texture == nullptr && load.error == "could not read " + file.path);
+			else if (file.duplicateOf != ~0u)
+				CHECK(load.texture == nullptr && load.duplicateOf == file.duplicateOf && load.error.empty());
+			else if (file.decodable == false)
+				CHECK(load.texture == nullptr && load.error == "not a raw texture");
+			else {
+				CHECK(load.texture && load.error.empty() && load.duplicateOf == ~0u);
+				CHECK(load.fileBytes == file.contents.size());
+				CHECK(load.fileHash == Texture_Registry::Hash(file.contents.data(), file.contents.size()));
+				if (load.texture)
+					CHECK(Texture_Registry::Hash(load.texture->pData, load.texture->dataSize) == file.decodedHash);
+			}
+			if (load.texture)
+				ktxTexture_Destroy(load.texture);
+		}
+	float milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	CHECK(std::count(seen.begin(), seen.end(), 1u) == std::ptrdiff_t(files.size()));
+	CHECK(pipeline.Pending() == 0);
+
+	TEXTURE_PIPELINE_STATS stats = pipeline.GetStats();
+	unsigned decoded = 0, duplicates = 0, failed = 0;
+	for (const BATCH_FILE& file : files) {
+		bool duplicate = file.readable && file.duplicateOf != ~0u;
+		decoded += file.readable && file.decodable && duplicate == false;
+		duplicates += duplicate;
+		failed += file.readable == false || (file.decodable == false && duplicate == false);
+	}
+	CHECK(stats.submitted == files.size() && stats.decoded == decoded && stats.duplicates == duplicates);
+	CHECK(stats.failed == failed && stats.transcoded == 0 && stats.bytesRead == bytesRead);
+	std::printf("%u decoder%s: %.1f ms wall, read and hash %.1f ms, decode %.1f ms summed over threads\n", workers,
+		workers == 1 ? "" : "s", milliseconds, stats.readMilliseconds, stats.decodeMilliseconds);
+	return milliseconds;
+}
+
+int main()
+{
+	rawVtbl.Destroy = DestroyRaw;
+	// 48 textures of mixed sizes, some read by the caller, a few repeated
+	// under other names, one missing and two that don't decode
+	std::vector<BATCH_FILE> files;
+	for (unsigned f = 0; f < 48; ++f) {
+		uint32_t size = 128u << (f % 3);
+		BATCH_FILE file = { "TexturePipelineTest" + std::to_string(f) + ".raw", MakeRaw(size, size / (1 + f % 2), f),
+			f % 5 == 0, ~0u, true, true, 0 };
+		files.push_back(file);
+	}
+	for (unsigned f = 0; f < 4; ++f) {
+		BATCH_FILE copy = files[f * 7];
+		copy.path = "TexturePipelineTestCopy" + std::to_string(f) + ".raw";
+		copy.preloaded = f == 3;
+		copy.duplicateOf = f * 7;
+		files.push_back(copy);
+	}
+	BATCH_FILE missing = { "TexturePipelineTestMissing.raw", {}, false, ~0u, false, false, 0 };
+	files.push_back(missing);
+	BATCH_FILE bad = { "TexturePipelineTestBad.raw", MakeRaw(64, 64, 99), false, ~0u, true, false, 0 };
+	bad.contents[0] ^= 0xFF;
+	files.push_back(bad);
+	bad.path = "TexturePipelineTestTruncated.raw";
+	bad.contents.resize(bad.contents.size() / 2);
+	bad.contents[0] ^= 0xFF; // a valid header, too few texels
+	files.push_back(bad);
+	std::remove(missing.path.c_str());
+
+	for (BATCH_FILE& file : files) {
+		if (file.readable == false)
+			continue;
+		FILE* out = std::fopen(file.path.c_str(), "wb");
+		CHECK(out && std::fwrite(file.contents.data(), 1, file.contents.size(), out) == file.contents.size());
+		if (out)
+			std::fclose(out);
+		if (file.decodable == false || file.duplicateOf != ~0u)
+			continue;
+		TEXTURE_LOAD load;
+		load.contents = file.contents;
+		CHECK(DecodeRaw(load));
+		file.decodedHash = Texture_Registry::Hash(load.texture->pData, load.texture->dataSize);
+		ktxTexture_Destroy(load.texture);
+	}
+
+	unsigned threads = std::max(std::thread::hardware_concurrency(), 2u);
+	float one = RunBatch(files, 1);
+	float all = RunBatch(files, threads);
+	std::printf("%.1fx with %u decoders\n", one / all, threads);
+	for (const BATCH_FILE& file : files)
+		std::remove(file.path.c_str());
+	return TestResult();
+}
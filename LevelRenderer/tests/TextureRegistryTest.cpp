@@ -0,0 +1,191 @@
+// The dedupe behind texture and sampler sharing, without a device:
+// SAMPLER_STATE equality and hashing, ParseTextureOptions on MTL map
+// statements, Sampler_Cache reference counting and slot reuse, and
+// Texture_Registry matching files by canonical path and by contents, hashed
+// by itself or handed in through MatchContents, along with Merge.
+#include "../sampler_cache.h"
+#include "../texture_registry.h"
+#include "test_check.h"
+#include <unordered_set>
+
+static void TestSamplerState()
+{
+	SAMPLER_STATE base = DefaultSamplerState(), copy = base;
+	CHECK(base == copy && !(base != copy));
+	CHECK(SAMPLER_STATE_HASH()(base) == SAMPLER_STATE_HASH()(copy));
+	// every field takes part in equality and the hash
+	std::unordered_set<size_t> hashes = { SAMPLER_STATE_HASH()(base) };
+	for (size_t field = 0; field < sizeof(SAMPLER_STATE) / 4; ++field) {
+		SAMPLER_STATE changed = base;
+		uint32_t word;
+		std::memcpy(&word, reinterpret_cast<const char*>(&changed) + field * 4, 4);
+		word ^= 0x40000000; // a different value for integers and floats alike
+		std::memcpy(reinterpret_cast<char*>(&changed) + field * 4, &word, 4);
+		CHECK(changed != base);
+		hashes.insert(SAMPLER_STATE_HASH()(changed));
+	}
+	CHECK(hashes.size() == sizeof(SAMPLER_STATE) / 4 + 1);
+	CHECK(base.magFilter == 1 && base.addressModeU == 3 && base.anisotropyEnable == 0 && base.maxAnisotropy == 1);
+}
+
+static void TestParseTextureOptions()
+{
+	SAMPLER_STATE base = DefaultSamplerState(), state;
+	CHECK(ParseTextureOptions("rock.ktx", base, 16, state) == "rock.ktx" && state == base);
+	CHECK(ParseTextureOptions("  rock.ktx \r", base, 16, state) == "rock.ktx");
+	CHECK(ParseTextureOptions("-clamp on rock.ktx", base, 16, state) == "rock.ktx");
+	CHECK(state.addressModeU == 2 && state.addressModeV == 2 && state.addressModeW == 2);
+	ParseTextureOptions("-clamp off rock.ktx", base, 16, state);
+	CHECK(state.addressModeU == 0 && state.addressModeV == 0 && state.addressModeW == 0);
+	// anisotropy is capped by the device and off at 1 or below
+	ParseTextureOptions("-aniso 8 rock.ktx", base, 16, state);
+	CHECK(state.anisotropyEnable == 1 && state.maxAnisotropy == 8);
+	ParseTextureOptions("-aniso 8 rock.ktx", base, 4, state);
+	CHECK(state.anisotropyEnable == 1 && state.maxAnisotropy == 4);
+	ParseTextureOptions("-aniso 8 rock.ktx", base, 1, state);
+	CHECK(state.anisotropyEnable == 0 && state.maxAnisotropy == 1);
+	ParseTextureOptions("-aniso 1 rock.ktx", base, 16, state);
+	CHECK(state == base);
+	// other options are skipped with their arguments, the file may hold spaces
+	CHECK(ParseTextureOptions("-mm 0 1 -o 0.5 0.5 -s 2 -bm 0.3 -clamp on -aniso 4 my rock.ktx", base, 16, state) == "my rock.ktx");
+	CHECK(state.addressModeU == 2 && state.maxAnisotropy == 4);
+	CHECK(ParseTextureOptions("-o 1 rock.ktx", base, 16, state) == "rock.ktx"); // u alone
+	CHECK(ParseTextureOptions("-t 1 2 3 rock.ktx", base, 16, state) == "rock.ktx");
+	CHECK(ParseTextureOptions("-blendu on -blendv off -boost 2 -cc on -imfchan r -texres 512 -type sphere rock.ktx",
+		base, 16, state) == "rock.ktx" && state == base);
+	CHECK(ParseTextureOptions("-unknown rock.ktx", base, 16, state) == "rock.ktx");
+	// base carries over what the map doesn't set
+	SAMPLER_STATE clamped = base;
+	clamped.addressModeU = clamped.addressModeV = clamped.addressModeW = 2;
+	ParseTextureOptions("-aniso 2 rock.ktx", clamped, 16, state);
+	CHECK(state.addressModeU == 2 && state.maxAnisotropy == 2);
+}
+
+static void TestSamplerCache()
+{
+	Sampler_Cache cache;
+	SAMPLER_STATE a = DefaultSamplerState(), b = a, c = a;
+	b.anisotropyEnable = 1;
+	b.maxAnisotropy = 8;
+	c.addressModeU = c.addressModeV = c.addressModeW = 0;
+	bool isNew = false;
+	unsigned sa = cache.Acquire(a, isNew);
+	CHECK(isNew && sa == 0);
+	CHECK(cache.Acquire(a, isNew) == sa && isNew == false && cache.References(sa) == 2);
+	unsigned sb = cache.Acquire(b, isNew);
+	CHECK(isNew && sb == 1 && cache.State(sb) == b && cache.Resident() == 2);
+	CHECK(cache.GetStats().requests == 3 && cache.GetStats().creates == 2);
+	// the last release frees the slot, the next new state reuses it
+	CHECK(cache.Release(sa) == false && cache.References(sa) == 1);
+	CHECK(cache.Release(sa) && cache.References(sa) == 0 && cache.Resident() == 1);
+	CHECK(cache.Release(sa) == false && cache.Release(99) == false);
+	unsigned sc = cache.Acquire(c, isNew);
+	CHECK(isNew && sc == sa && cache.State(sc) == c && cache.SlotCount() == 2);
+	// a released state is new again
+	unsigned again = cache.Acquire(a, isNew);
+	CHECK(isNew && again == 2 && cache.SlotCount() == 3);
+	cache.ResetStats();
+	CHECK(cache.GetStats().requests == 0 && cache.Resident() == 3);
+	cache.Clear();
+	CHECK(cache.SlotCount() == 0 && cache.Resident() == 0);
+}
+
+static bool WriteFile(const char* path, const char* text)
+{
+	FILE* file = std::fopen(path, "wb");
+	if (file == nullptr)
+		return false;
+	bool written = std::fwrite(text, 1, std::strlen(text), file) == std::strlen(text);
+	std::fclose(file);
+	return written;
+}
+
+static const char* fileA = "TextureRegistryTestA.ktx";
+static const char* fileB = "TextureRegistryTestB.ktx"; // the bytes of A under another name
+static const char* fileC = "TextureRegistryTestC.ktx";
+static const char* fileMissing = "TextureRegistryTestMissing.ktx";
+
+// Acquire hashing the files itself
+static void TestRegistryHashing()
+{
+	Texture_Registry registry;
+	std::vector<uint8_t> contents;
+	bool isNew = false;
+	unsigned a = registry.Acquire(fileA, isNew, contents);
+	CHECK(isNew && contents.size() == 5 && std::memcmp(contents.data(), "first", 5) == 0);
+	CHECK(registry.Path(a) == Texture_Registry::CanonicalPath(fileA) && registry.Path(a)[0] == '/');
+	// another route to the same file, then the same bytes under another name
+	CHECK(registry.Acquire("././TextureRegistryTestA.ktx", isNew, contents) == a && isNew == false && contents.empty());
+	CHECK(registry.Acquire(fileB, isNew, contents) == a && isNew == false && contents.empty());
+	unsigned c = registry.Acquire(fileC, isNew, contents);
+	CHECK(isNew && c != a && registry.References(a) == 3 && registry.References(c) == 1);
+	// unreadable files get a slot of their own, matched by path only
+	unsigned missing = registry.Acquire(fileMissing, isNew, contents);
+	CHECK(isNew && contents.empty() && registry.Acquire(fileMissing, isNew, contents) == missing && isNew == false);
+	const TEXTURE_REGISTRY_STATS& stats = registry.GetStats();
+	CHECK(stats.requests == 6 && stats.loads == 3 && stats.pathHits == 2 && stats.contentHits == 1);
+
+	// the last release forgets every path and the contents, the slot is reused
+	CHECK(registry.Release(a) == false && registry.Release(a) == false);
+	CHECK(registry.Release(a) && registry.References(a) == 0);
+	CHECK(registry.Release(a) == false && registry.Release(99) == false);
+	unsigned b = registry.Acquire(fileB, isNew, contents);
+	CHECK(isNew && b == a && contents.size() == 5 && registry.SlotCount() == 3);
+	registry.Clear();
+	CHECK(registry.SlotCount() == 0 && registry.GetStats().requests == 0);
+}
+
+// Files hashed elsewhere come back through MatchContents
+static void TestRegistryMatchContents()
+{
+	Texture_Registry registry;
+	registry.hashContents = false;
+	std::vector<uint8_t> contents;
+	bool isNew = false;
+	unsigned a = registry.Acquire(fileA, isNew, contents);
+	CHECK(isNew && contents.empty()); // nothing read
+	unsigned b = registry.Acquire(fileB, isNew, contents);
+	unsigned c = registry.Acquire(fileC, isNew, contents);
+	CHECK(isNew && a != b && b != c);
+	uint64_t hashA = Texture_Registry::Hash(reinterpret_cast<const uint8_t*>("first"), 5);
+	uint64_t hashC = Texture_Registry::Hash(reinterpret_cast<const uint8_t*>("second"), 6);
+	CHECK(registry.MatchContents(a, 5, hashA) == a);
+	CHECK(registry.MatchContents(a, 5, hashA) == a); // matching itself keeps it
+	CHECK(registry.MatchContents(b, 5, hashA) == a && registry.References(a) == 2 && registry.References(b) == 0);
+	CHECK(registry.GetStats().contentHits == 1);
+	// b's path now leads to a, its slot goes to the next new file
+	CHECK(registry.Acquire(fileB, isNew, contents) == a && isNew == false && registry.References(a) == 3);
+	CHECK(registry.Acquire(fileMissing, isNew, contents) == b && isNew);
+	// a new key replaces the old one, which no longer matches
+	CHECK(registry.MatchContents(c, 6, hashA + 1) == c);
+	CHECK(registry.MatchContents(c, 6, hashC) == c);
+	CHECK(registry.MatchContents(b, 6, hashA + 1) == b && registry.References(b) == 1);
+
+	// Merge moves every path and reference
+	registry.Merge(c, a);
+	registry.Merge(a, a);
+	CHECK(registry.References(a) == 4 && registry.References(c) == 0 && registry.Path(a) == Texture_Registry::CanonicalPath(fileA));
+	CHECK(registry.Acquire(fileC, isNew, contents) == a && isNew == false);
+	// c's contents left with it, so a new slot with them stays apart from a
+	unsigned d = registry.Acquire("TextureRegistryTestD.ktx", isNew, contents);
+	CHECK(isNew && d == c && registry.MatchContents(d, 6, hashC) == d);
+	for (int i = 0; i < 4; ++i)
+		CHECK(registry.Release(a) == false);
+	CHECK(registry.Release(a));
+	CHECK(registry.Acquire(fileC, isNew, contents) == a && isNew); // every path went with it
+}
+
+int main()
+{
+	TestSamplerState();
+	TestParseTextureOptions();
+	TestSamplerCache();
+	CHECK(WriteFile(fileA, "first") && WriteFile(fileB, "first") && WriteFile(fileC, "second"));
+	std::remove(fileMissing);
+	TestRegistryHashing();
+	TestRegistryMatchContents();
+	std::remove(fileA);
+	std::remove(fileB);
+	std::remove(fileC);
+	return TestResult();
+}
@@ -0,0 +1,296 @@
+// Texture_Streamer's residency policy without a GPU: tail sizing, upgrades
+// towards the requested level, LRU eviction that leaves mip tails, pending
+// loads and textures asked for this frame alone, and failed loads. A long run
+// of random feedback checks after every Update that the budget holds, the
+// stats match the per texture state and the caller's images follow the
+// resident callback. The same run inline and threaded must make the same
+// decisions.
+#include "../texture_streaming.h"
+#include "test_check.h"
+#include <random>
+
+// RGBA8 mip chain of a width x height texture
+static std::vector<size_t> LevelBytes(unsigned width, unsigned height)
+{
+	std::vector<size_t> bytes;
+	for (unsigned l = 0; (width >> l) || (height >> l); ++l)
+		bytes.push_back(size_t(std::max(width >> l, 1u)) * std::max(height >> l, 1u) * 4);
+	return bytes;
+}
+static size_t Sum(const std::vector<size_t>& bytes, unsigned from)
+{
+	size_t sum = 0;
+	for (unsigned l = from; l < bytes.size(); ++l)
+		sum += bytes[l];
+	return sum;
+}
+
+// stats against the per texture state, pending levels count as resident bytes
+static void CheckAccounting(const Texture_Streamer& streamer)
+{
+	size_t bytes = 0;
+	unsigned textures = 0, mips = 0, pending = 0;
+	for (const STREAM_TEXTURE& t : streamer.GetTextures()) {
+		if (t.levels == 0)
+			continue;
+		++textures;
+		CHECK(t.pendingLevel <= t.residentLevel && t.residentLevel <= t.tailLevel && t.tailLevel < t.levels);
+		bytes += Sum(t.levelBytes, t.pendingLevel);
+		mips += t.levels - t.residentLevel;
+		pending += t.pendingLevel != t.residentLevel;
+	}
+	const TEXTURE_STREAM_STATS& stats = streamer.GetStats();
+	CHECK(stats.textures == textures && stats.residentBytes == bytes);
+	CHECK(stats.residentMips == mips && stats.pendingLoads == pending);
+}
+
+static void TestSizing()
+{
+	CHECK(Texture_Streamer::TailLevel(1024, 1024, 11, 64) == 4);
+	CHECK(Texture_Streamer::TailLevel(1024, 256, 11, 64) == 4); // the larger side decides
+	CHECK(Texture_Streamer::TailLevel(64, 64, 7, 64) == 0); // small enough to be all tail
+	CHECK(Texture_Streamer::TailLevel(4096, 4096, 3, 64) == 2); // short chains keep their coarsest
+	CHECK(Texture_Streamer::DesiredLevel(1024, 256) == 2);
+	CHECK(Texture_Streamer::DesiredLevel(1024, 4096) == 0);
+	CHECK(Texture_Streamer::DesiredLevel(1024, 0) == 0);
+
+	Texture_Streamer streamer;
+	streamer.Create(1 << 20, 64, false);
+	std::vector<size_t> bytes = LevelBytes(256, 128);
+	streamer.Add(3, 256, 128, bytes);
+	streamer.Add(5, 512, 512, {}); // not streamed
+	streamer.Add(7, 256, 128, bytes, 1); // the caller already holds level 1
+	CHECK(streamer.GetTextures().size() == 8 && streamer.GetTextures()[0].levels == 0);
+	CHECK(streamer.ResidentLevel(3) == 2 && streamer.GetTextures()[3].tailLevel == 2 && streamer.ResidentLevel(7) == 1);
+	CHECK(streamer.GetStats().residentBytes == Sum(bytes, 2) + Sum(bytes, 1));
+	CheckAccounting(streamer);
+	streamer.Add(7, 64, 32, LevelBytes(64, 32)); // replaced, its old levels leave the budget
+	CHECK(streamer.ResidentLevel(7) == 0 && streamer.GetStats().textures == 2);
+	CheckAccounting(streamer);
+}
+
+// Requests load the finest level that fits and become resident on the next Update
+static void TestUpgrades()
+{
+	std::vector<size_t> bytes = LevelBytes(256, 256); // tail at level 2
+	std::vector<std::pair<unsigned, unsigned>> loads, resident;
+	Texture_Streamer streamer;
+	streamer.Create(Sum(bytes, 1), 64, false,
+		[&](unsigned texture, unsigned level) { loads.push_back({ texture, level }); return true; },
+		[&](unsigned texture, unsigned level) { resident.push_back({ texture, level }); });
+	streamer.Add(0, 256, 256, bytes);
+	streamer.Request(0, 0.7f); // rounds down to level 0, which doesn't fit
+	streamer.Update();
+	CHECK(loads.size() == 1 && loads[0].second == 1 && resident.empty());
+	CHECK(streamer.ResidentLevel(0) == 2 && streamer.GetTextures()[0].pendingLevel == 1);
+	CheckAccounting(streamer);
+	streamer.Update();
+	CHECK(streamer.ResidentLevel(0) == 1 && resident.size() == 1 && resident[0].second == 1);
+	CHECK(streamer.GetStats().requestedMips == 1 && streamer.GetStats().residentBytes == Sum(bytes, 1));
+	streamer.Request(0, 0); // still no room and nothing else to evict
+	streamer.Request(0, 5); // coarser asks change nothing
+	streamer.Update();
+	CHECK(loads.size() == 1 && streamer.GetStats().budgetDeferrals == 1);
+	CheckAccounting(streamer);
+
+	// the texture short the most levels goes first
+	Texture_Streamer neediest;
+	neediest.Create(2 * Sum(bytes, 2) + bytes[0] + bytes[1], 64, false);
+	neediest.Add(0, 256, 256, bytes);
+	neediest.Add(1, 256, 256, bytes);
+	neediest.Request(0, 1);
+	neediest.Request(1, 0);
+	neediest.Update();
+	CHECK(neediest.GetTextures()[1].pendingLevel == 0 && neediest.GetTextures()[0].pendingLevel == 2);
+	CHECK(neediest.GetStats().budgetDeferrals == 1);
+	CheckAccounting(neediest);
+}
+
+// The least recently used texture holding more than it asked for loses its
+// finest level first, never below its tail
+static void TestEviction()
+{
+	std::vector<size_t> bytes = LevelBytes(256, 256);
+	std::vector<std::pair<unsigned, unsigned>> resident;
+	Texture_Streamer streamer;
+	streamer.Create(4 * Sum(bytes, 2) + 3 * bytes[1], 64, false, nullptr,
+		[&](unsigned texture, unsigned level) { resident.push_back({ texture, level }); });
+	for (unsigned i = 0; i < 4; ++i)
+		streamer.Add(i, 256, 256, bytes);
+	for (unsigned i = 0; i < 3; ++i) { // one a frame, 0 is the oldest
+		streamer.Request(i, 1);
+		streamer.Update();
+	}
+	streamer.Update();
+	CHECK(streamer.ResidentLevel(0) == 1 && streamer.ResidentLevel(1) == 1 && streamer.ResidentLevel(2) == 1);
+	CHECK(streamer.GetStats().residentBytes == streamer.GetStats().budgetBytes);
+	// 0 and 2 weren't asked for, 0 was used longest ago
+	resident.clear();
+	streamer.Request(1, 1);
+	streamer.Request(3, 1);
+	streamer.Update();
+	CHECK(streamer.ResidentLevel(0) == 2 && streamer.ResidentLevel(1) == 1 && streamer.ResidentLevel(2) == 1);
+	CHECK(streamer.GetTextures()[3].pendingLevel == 1);
+	CHECK(resident.size() == 1 && resident[0].first == 0 && resident[0].second == 2);
+	CHECK(streamer.GetStats().evictedMips == 1);
+	CheckAccounting(streamer);
+	// with 1, 2 and 3 asked for, 0 waits and no tail is touched
+	for (unsigned i = 1; i < 4; ++i)
+		streamer.Request(i, 1);
+	streamer.Request(0, 0);
+	streamer.Update();
+	CHECK(streamer.ResidentLevel(0) == 2 && streamer.ResidentLevel(3) == 1);
+	CHECK(streamer.GetStats().budgetDeferrals == 1 && streamer.GetStats().evictedMips == 1);
+	CheckAccounting(streamer);
+
+	// tails count even past the budget and are never evicted for a request
+	Texture_Streamer tight;
+	tight.Create(Sum(bytes, 2), 64, false);
+	tight.Add(0, 256, 256, bytes);
+	tight.Add(1, 256, 256, bytes);
+	tight.Request(1, 0);
+	tight.Update();
+	CHECK(tight.ResidentLevel(0) == 2 && tight.ResidentLevel(1) == 2 && tight.GetStats().evictedMips == 0);
+	CHECK(tight.GetStats().budgetDeferrals == 1 && tight.GetStats().residentBytes == 2 * Sum(bytes, 2));
+	CheckAccounting(tight);
+}
+
+// A texture whose load is still running holds its bytes and keeps the levels
+// it has, even when nothing asks for them
+static void TestPendingLoads()
+{
+	std::vector<size_t> bytes = LevelBytes(256, 256);
+	std::mutex gateMutex;
+	std::condition_variable gate;
+	bool open = false;
+	Texture_Streamer streamer;
+	streamer.Create(2 * Sum(bytes, 2) + bytes[0] + bytes[1], 64, true, [&](unsigned texture, unsigned level) {
+		std::unique_lock<std::mutex> lock(gateMutex);
+		gate.wait(lock, [&]() { return open || texture != 0 || level != 0; });
+		return true;
+	});
+	streamer.Add(0, 256, 256, bytes);
+	streamer.Add(1, 256, 256, bytes);
+	streamer.Request(0, 1);
+	streamer.Update();
+	streamer.WaitIdle();
+	streamer.Update();
+	CHECK(streamer.ResidentLevel(0) == 1);
+	streamer.Request(0, 0); // held at the gate
+	streamer.Update();
+	streamer.Request(1, 1); // would fit if 0 gave up level 1
+	streamer.Update();
+	CHECK(streamer.GetTextures()[0].pendingLevel == 0 && streamer.ResidentLevel(0) == 1);
+	CHECK(streamer.GetTextures()[1].pendingLevel == 2 && streamer.GetStats().budgetDeferrals == 1);
+	CHECK(streamer.GetStats().evictedMips == 0);
+	CheckAccounting(streamer);
+	{
+		std::lock_guard<std::mutex> lock(gateMutex);
+		open = true;
+	}
+	gate.notify_all();
+	streamer.WaitIdle();
+	streamer.Request(1, 1); // resident now, so 0 makes room
+	streamer.Update();
+	CHECK(streamer.ResidentLevel(0) == 1 && streamer.GetTextures()[1].pendingLevel == 1);
+	CHECK(streamer.GetStats().evictedMips == 1);
+	streamer.WaitIdle();
+	streamer.Update();
+	CHECK(streamer.ResidentLevel(1) == 1);
+	CheckAccounting(streamer);
+}
+
+// A failed load gives its bytes back and leaves the chain as it was
+static void TestFailedLoads()
+{
+	std::vector<size_t> bytes = LevelBytes(512, 512); // tail at level 3
+	unsigned resident = 0;
+	Texture_Streamer streamer;
+	streamer.Create(Sum(bytes, 0), 64, false, [](unsigned, unsigned level) { return level != 0; },
+		[&](unsigned, unsigned) { ++resident; });
+	streamer.Add(0, 512, 512, bytes);
+	streamer.Request(0, 0);
+	streamer.Update();
+	CHECK(streamer.GetStats().residentBytes == Sum(bytes, 0));
+	streamer.Update();
+	CHECK(streamer.ResidentLevel(0) == 3 && resident == 0);
+	CHECK(streamer.GetStats().failedMips == 3 && streamer.GetStats().residentBytes == Sum(bytes, 3));
+	CheckAccounting(streamer);
+	streamer.Request(0, 1); // asked again, the levels that load do
+	streamer.Update();
+	streamer.Update();
+	CHECK(streamer.ResidentLevel(0) == 1 && resident == 1);
+	CheckAccounting(streamer);
+}
+
+// Every decision of one run, compared across runs
+struct RUN_TRACE {
+	std::vector<unsigned> levels;
+	TEXTURE_STREAM_STATS stats;
+};
+
+// 600 frames of random feedback over 200 textures, a few loads failing
+static RUN_TRACE Run(bool threaded)
+{
+	RUN_TRACE trace;
+	std::mt19937 rng(21);
+	std::vector<unsigned> widths, heights;
+	size_t tails = 0;
+	for (unsigned i = 0; i < 200; ++i) {
+		widths.push_back(32u << rng() % 7);
+		heights.push_back(32u << rng() % 7);
+		std::vector<size_t> bytes = LevelBytes(widths[i], heights[i]);
+		tails += Sum(bytes, Texture_Streamer::TailLevel(widths[i], heights[i], unsigned(bytes.size()), 64));
+	}
+	std::vector<unsigned> images(200); // the caller's view of every chain
+	Texture_Streamer streamer;
+	streamer.Create(tails + (24 << 20), 64, threaded,
+		[](unsigned texture, unsigned level) { return (texture * 7 + level) % 23 != 0; },
+		[&](unsigned texture, unsigned level) {
+			CHECK(level == streamer.ResidentLevel(texture));
+			images[texture] = level;
+		});
+	for (unsigned i = 0; i < 200; ++i) {
+		streamer.Add(i, widths[i], heights[i], LevelBytes(widths[i], heights[i]));
+		images[i] = streamer.ResidentLevel(i);
+	}
+	for (unsigned frame = 0; frame < 600; ++frame) {
+		// a moving hot set and some noise, each seen at a random distance
+		for (unsigned r = 0; r < 40; ++r) {
+			unsigned texture = r < 30 ? (frame / 20 * 13 + r) % 200 : rng() % 200;
+			streamer.Request(texture, Texture_Streamer::DesiredLevel(widths[texture], float(16 + rng() % 2048)));
+		}
+		if (threaded)
+			streamer.WaitIdle(); // the same hand-off as inline, so the same decisions
+		streamer.Update();
+		CHECK(streamer.GetStats().residentBytes <= streamer.GetStats().budgetBytes);
+		CheckAccounting(streamer);
+		for (unsigned i = 0; i < 200; ++i) {
+			CHECK(images[i] == streamer.ResidentLevel(i));
+			trace.levels.push_back(streamer.GetTextures()[i].pendingLevel);
+		}
+	}
+	if (threaded)
+		streamer.WaitIdle();
+	trace.stats = streamer.GetStats();
+	return trace;
+}
+
+int main()
+{
+	TestSizing();
+	TestUpgrades();
+	TestEviction();
+	TestPendingLoads();
+	TestFailedLoads();
+
+	RUN_TRACE inline_ = Run(false), threaded = Run(true);
+	CHECK(inline_.stats.requestedMips > 0 && inline_.stats.evictedMips > 0);
+	CHECK(inline_.stats.failedMips > 0 && inline_.stats.budgetDeferrals > 0);
+	CHECK(inline_.levels == threaded.levels);
+	CHECK(inline_.stats.requestedMips == threaded.stats.requestedMips && inline_.stats.evictedMips == threaded.stats.evictedMips);
+	CHECK(inline_.stats.failedMips == threaded.stats.failedMips && inline_.stats.budgetDeferrals == threaded.stats.budgetDeferrals);
+	std::printf("%u mips requested, %u evicted, %u failed, %u deferrals\n", inline_.stats.requestedMips,
+		inline_.stats.evictedMips, inline_.stats.failedMips, inline_.stats.budgetDeferrals);
+	return TestResult();
+}
@@ -0,0 +1,28 @@
+#ifndef _TEST_CHECK_H_
+#define _TEST_CHECK_H_
+// Minimal assertions for the CPU only tests. A failed CHECK prints the
+// expression and keeps going, main returns TestResult() so ctest sees it.
+#include <cstdio>
+
+inline unsigned& TestFailures()
+{
+	static unsigned failures = 0;
+	return failures;
+}
+#define CHECK(expression) \
+	do { \
+		if (!(expression)) { \
+			std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expression); \
+			++TestFailures(); \
+		} \
+	} while (0)
+
+inline int TestResult()
+{
+	if (TestFailures())
+		std::printf("%u checks failed\n", TestFailures());
+	else
+		std::printf("all checks passed\n");
+	return TestFailures() ? 1 : 0;
+}
+#endif
@@ -0,0 +1,73 @@
+#ifndef _TEXTURE_ARRAYS_H_
+#define _TEXTURE_ARRAYS_H_
+// Groups textures that can share one 2D array image, one layer each: same
+// format, size and mip count. Groups larger than the device allows per image
+// are split, and when there are more groups than descriptors the smallest
+// ones are left out. Only the grouping happens here, the renderer creates one
+// image per TEXTURE_ARRAY and copies each texture into its layer.
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <tuple>
+#include <vector>
+
+struct TEXTURE_ARRAY_KEY {
+	uint32_t format; // VkFormat, 0 (UNDEFINED) for textures that can't be layered
+	uint32_t width, height, levels;
+
+	bool operator<(const TEXTURE_ARRAY_KEY& other) const {
+		return std::tie(format, width, height, levels) < std::tie(other.format, other.width, other.height, other.levels);
+	}
+};
+struct TEXTURE_ARRAY {
+	TEXTURE_ARRAY_KEY key;
+	std::vector<unsigned> textures; // in layer order
+};
+struct TEXTURE_LAYER {
+	unsigned array, layer; // array is ~0u for textures left out
+};
+struct TEXTURE_ARRAY_STATS {
+	unsigned textures, arrays, leftOut, largestArray;
+};
+
+// Fills arrays and layers (one per key) and returns what it did. Keys with
+// format 0 or no levels are left out. Arrays come out largest first, so
+// maxArrays keeps the ones that save the most descriptors.
+inline TEXTURE_ARRAY_STATS GroupTextureArrays(const std::vector<TEXTURE_ARRAY_KEY>& keys, unsigned maxLayers,
+	unsigned maxArrays, std::vector<TEXTURE_ARRAY>& arrays, std::vector<TEXTURE_LAYER>& layers) {
+	TEXTURE_ARRAY_STATS stats = {};
+	arrays.clear();
+	layers.assign(keys.size(), { ~0u, ~0u });
+	std::map<TEXTURE_ARRAY_KEY, std::vector<unsigned>> groups;
+	for (unsigned t = 0; t < keys.size(); ++t)
+		if (keys[t].format && keys[t].levels)
+			groups[keys[t]].push_back(t);
+	maxLayers = std::min(std::max(maxLayers, 1u), 0xFFFFu); // PackTextureLayer keeps 16 bits
+	for (const auto& group : groups)
+		for (size_t first = 0; first < group.second.size(); first += maxLayers) {
+			size_t last = std::min(first + maxLayers, group.second.size());
+			arrays.push_back({ group.first, std::vector<unsigned>(group.second.begin() + first, group.second.begin() + last) });
+		}
+	// map order breaks ties, the result doesn't depend on submission order
+	std::stable_sort(arrays.begin(), arrays.end(), [](const TEXTURE_ARRAY& a, const TEXTURE_ARRAY& b) {
+		return a.textures.size() > b.textures.size();
+	});
+	if (arrays.size() > maxArrays)
+		arrays.resize(maxArrays);
+	for (unsigned a = 0; a < arrays.size(); ++a) {
+		for (unsigned l = 0; l < arrays[a].textures.size(); ++l)
+			layers[arrays[a].textures[l]] = { a, l };
+		stats.textures += arrays[a].textures.size();
+		stats.largestArray = std::max<unsigned>(stats.largestArray, arrays[a].textures.size());
+	}
+	stats.arrays = arrays.size();
+	stats.leftOut = keys.size() - stats.textures;
+	return stats;
+}
+
+// A layer as the shaders read it: array in the high 16 bits, layer in the low
+// 16, ~0u for none
+inline uint32_t PackTextureLayer(const TEXTURE_LAYER& layer) {
+	return layer.array == ~0u ? ~0u : layer.array << 16 | layer.layer;
+}
+#endif
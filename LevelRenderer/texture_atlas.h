@@ -0,0 +1,137 @@
+#ifndef _TEXTURE_ATLAS_H_
+#define _TEXTURE_ATLAS_H_
+// Packs small textures of one format into the pages of a shared 2D array, so
+// maps of many different sizes cost one image instead of one each. Textures
+// keep the mip levels they can share with the page: every level kept must be
+// whole blocks (4x4 for block compressed formats), so a 64x64 BC texture keeps
+// 5 levels and a 100x100 RGBA one 3. Rects are placed on the grid of their
+// coarsest level, which keeps each level of each texture in its own blocks.
+// Sampling stays inside a rect by clamping half a texel in at the level read
+// (TexturePixelShader.hlsl), so no gutter has to be filled with edge texels.
+// Only the layout happens here, the renderer copies the levels into place.
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+#include "texture_arrays.h"
+
+struct ATLAS_TEXTURE {
+	uint32_t format; // VkFormat, 0 for textures that can't be packed
+	uint32_t width, height, levels;
+	uint32_t blockSize; // texels across a block, 1 for uncompressed formats
+};
+struct ATLAS_RECT {
+	unsigned atlas, page; // atlas is ~0u for textures left unpacked
+	uint32_t x, y, width, height; // in texels of the page's level 0
+};
+struct TEXTURE_ATLAS {
+	TEXTURE_ARRAY_KEY key; // format, page size and the levels every rect shares
+	unsigned pages;
+	std::vector<unsigned> textures;
+};
+struct TEXTURE_ATLAS_STATS {
+	unsigned textures, atlases, pages;
+	uint64_t usedTexels, pageTexels; // level 0 of the packed textures and of every page
+	float Efficiency() const { return pageTexels ? float(usedTexels) / float(pageTexels) : 0.0f; }
+};
+
+// Levels a width x height texture with levels mips keeps in an atlas: each one
+// whole blocks, at most maxLevels. 0 when not even level 0 is.
+inline uint32_t AtlasLevels(uint32_t width, uint32_t height, uint32_t levels, uint32_t blockSize, uint32_t maxLevels) {
+	if (blockSize == 0 || width % blockSize || height % blockSize)
+		return 0;
+	uint32_t kept = 1;
+	while (kept < std::min(levels, maxLevels) && width % (blockSize << kept) == 0 && height % (blockSize << kept) == 0)
+		++kept;
+	return kept;
+}
+
+// Shelf packs members (sorted tallest first) into size square pages, every
+// corner on the align grid. Returns the pages used.
+inline unsigned Shelve(const std::vector<ATLAS_TEXTURE>& textures, const std::vector<unsigned>& members,
+	uint32_t size, uint32_t align, std::vector<ATLAS_RECT>& placed) {
+	placed.assign(members.size(), ATLAS_RECT());
+	unsigned page = 0;
+	uint32_t x = 0, y = 0, shelf = 0; // shelf is the height of the current row
+	for (unsigned m = 0; m < members.size(); ++m) {
+		uint32_t width = (textures[members[m]].width + align - 1) / align * align;
+		uint32_t height = (textures[members[m]].height + align - 1) / align * align;
+		if (x + width > size) { // next shelf
+			x = 0;
+			y += shelf;
+			shelf = 0;
+		}
+		if (y + height > size) { // next page
+			++page;
+			x = y = shelf = 0;
+		}
+		placed[m] = { 0, page, x, y, textures[members[m]].width, textures[members[m]].height };
+		x += width;
+		shelf = std::max(shelf, height);
+	}
+	return members.size() ? page + 1 : 0;
+}
+
+// Packs every texture with neither side over maxSize into atlases of one
+// format and level count, in shelves sorted by height. Pages are pageSize
+// square, or the smallest power of two that holds a whole atlas on one page.
+// rects gets one entry per texture. Atlases past maxAtlases or pages past
+// maxPages leave their textures unpacked, they can still have layers of
+// their own (see GroupTextureArrays).
+inline TEXTURE_ATLAS_STATS PackTextureAtlases(const std::vector<ATLAS_TEXTURE>& textures, uint32_t maxSize,
+	uint32_t pageSize, uint32_t maxLevels, unsigned maxPages, unsigned maxAtlases,
+	std::vector<TEXTURE_ATLAS>& atlases, std::vector<ATLAS_RECT>& rects) {
+	TEXTURE_ATLAS_STATS stats = {};
+	atlases.clear();
+	rects.assign(textures.size(), { ~0u, ~0u, 0, 0, 0, 0 });
+	std::map<std::pair<uint32_t, uint32_t>, std::vector<unsigned>> groups; // format and levels kept
+	for (unsigned t = 0; t < textures.size(); ++t) {
+		const ATLAS_TEXTURE& texture = textures[t];
+		uint32_t levels = AtlasLevels(texture.width, texture.height, texture.levels, texture.blockSize, maxLevels);
+		if (texture.format && levels && texture.width <= maxSize && texture.height <= maxSize && maxSize <= pageSize)
+			groups[{ texture.format, levels }].push_back(t);
+	}
+	std::vector<ATLAS_RECT> placed;
+	for (auto& group : groups) {
+		if (atlases.size() == maxAtlases)
+			break;
+		std::vector<unsigned>& members = group.second;
+		if (members.size() < 2)
+			continue; // nothing to share a page with
+		std::stable_sort(members.begin(), members.end(), [&](unsigned a, unsigned b) {
+			return textures[a].height != textures[b].height ? textures[a].height > textures[b].height :
+				textures[a].width > textures[b].width;
+		});
+		uint32_t align = textures[members[0]].blockSize << (group.first.second - 1);
+		// one page as small as it can be, else as many full pages as needed
+		uint32_t size = 1, largest = 0;
+		for (unsigned t : members)
+			largest = std::max(largest, std::max(textures[t].width, textures[t].height));
+		while (size < largest)
+			size <<= 1;
+		unsigned pages = 0;
+		for (; size <= pageSize; size <<= 1) {
+			pages = Shelve(textures, members, size, align, placed);
+			if (pages == 1)
+				break;
+		}
+		if (size > pageSize)
+			pages = Shelve(textures, members, size = pageSize, align, placed);
+		if (pages > maxPages)
+			continue;
+		unsigned a = atlases.size();
+		atlases.push_back({ { group.first.first, size, size, group.first.second }, pages, members });
+		for (unsigned m = 0; m < members.size(); ++m) {
+			rects[members[m]] = placed[m];
+			rects[members[m]].atlas = a;
+			stats.usedTexels += uint64_t(placed[m].width) * placed[m].height;
+		}
+		stats.textures += members.size();
+		stats.pages += pages;
+		stats.pageTexels += uint64_t(size) * size * pages;
+	}
+	stats.atlases = atlases.size();
+	return stats;
+}
+#endif
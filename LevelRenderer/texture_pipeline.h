@@ -0,0 +1,256 @@
+#ifndef _TEXTURE_PIPELINE_H_
+#define _TEXTURE_PIPELINE_H_
+// Loads texture files in three stages: an I/O thread reads each file, a pool
+// of workers decodes it (KTX2 zstd/zlib supercompression is inflated and
+// Basis/UASTC payloads are transcoded for the GPU), and the thread that owns
+// the device collects finished loads to upload them. The decode step is a
+// callback so the pipeline runs, and can be timed, without a GPU.
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <ktx.h>
+#include "texture_registry.h"
+#include "profiler.h"
+
+struct TEXTURE_LOAD {
+	unsigned id = ~0u; // the caller's tag, as given to Submit
+	std::string path;
+	std::vector<uint8_t> contents; // the file, released once decoded
+	size_t fileBytes = 0;
+	uint64_t fileHash = 0; // Texture_Registry::Hash of the file, when hashed
+	unsigned duplicateOf = ~0u; // id of an earlier load with identical contents, nothing was decoded
+	ktxTexture* texture = nullptr; // owned by the caller once collected
+	bool transcoded = false;
+	std::string error;
+	float readMilliseconds = 0, decodeMilliseconds = 0;
+};
+struct TEXTURE_PIPELINE_STATS { // since Create
+	unsigned submitted, decoded, transcoded, duplicates, failed;
+	size_t bytesRead;
+	float readMilliseconds, decodeMilliseconds; // summed over loads, not wall time
+};
+
+// Creates load.texture from load.contents with every image loaded, which
+// inflates supercompressed KTX2 files, then transcodes Basis/UASTC payloads
+// to target (KTX_TTF_BC7_RGBA, KTX_TTF_ETC2_RGBA or KTX_TTF_RGBA32).
+inline bool DecodeKtxTexture(TEXTURE_LOAD& load, ktx_transcode_fmt_e target) {
+	KTX_error_code result = ktxTexture_CreateFromMemory(load.contents.data(), load.contents.size(),
+		KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT, &load.texture);
+	if (result != KTX_SUCCESS) {
+		load.error = ktxErrorString(result);
+		load.texture = nullptr;
+		return false;
+	}
+	if (load.texture->classId == ktxTexture2_c && ktxTexture2_NeedsTranscoding((ktxTexture2*)load.texture)) {
+		result = ktxTexture2_TranscodeBasis((ktxTexture2*)load.texture, target, 0);
+		if (result != KTX_SUCCESS) {
+			load.error = std::string("transcode: ") + ktxErrorString(result);
+			ktxTexture_Destroy(load.texture);
+			load.texture = nullptr;
+			return false;
+		}
+		load.transcoded = true;
+	}
+	return true;
+}
+
+class Texture_Pipeline {
+public:
+	// Runs on a worker, fills load.texture (or load.error) from load.contents
+	typedef std::function<bool(TEXTURE_LOAD&)> DECODE_CALLBACK;
+	bool hashContents = true; // loads with the same bytes as an earlier one skip decoding
+
+	// decode defaults to DecodeKtxTexture with target
+	void Create(unsigned workers, ktx_transcode_fmt_e target = KTX_TTF_RGBA32, DECODE_CALLBACK decode = nullptr) {
+		if (decode == nullptr)
+			decode = [target](TEXTURE_LOAD& load) { return DecodeKtxTexture(load, target); };
+		Create(workers, decode);
+	}
+	// Only decode touches libktx, so this builds without linking it (tests/TexturePipelineTest.cpp)
+	void Create(unsigned workers, DECODE_CALLBACK decode) {
+		Destroy();
+		this->decode = decode;
+		stats = {};
+		running = true;
+		reader = std::thread([this]() { ReadLoop(); });
+		for (unsigned w = 0; w < std::max(workers, 1u); ++w)
+			decoders.emplace_back([this]() { DecodeLoop(); });
+	}
+	void Destroy() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		wakeReader.notify_all();
+		wakeDecoders.notify_all();
+		if (reader.joinable())
+			reader.join();
+		for (std::thread& decoder : decoders)
+			decoder.join();
+		decoders.clear();
+		for (std::deque<TEXTURE_LOAD>* queue : { &reads, &decodes, &completed })
+			for (TEXTURE_LOAD& load : *queue)
+				if (load.texture)
+					ktxTexture_Destroy(load.texture);
+		reads.clear();
+		decodes.clear();
+		completed.clear();
+		contentOwners.clear();
+		pending = 0;
+	}
+	~Texture_Pipeline() { Destroy(); }
+	bool Running() const { return reader.joinable(); }
+
+	// Queues a file, contents may hold it already (skipping the read stage)
+	void Submit(unsigned id, const std::string& path, std::vector<uint8_t> contents = std::vector<uint8_t>()) {
+		TEXTURE_LOAD load;
+		load.id = id;
+		load.path = path;
+		load.contents = std::move(contents);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			++pending;
+			++stats.submitted;
+			reads.push_back(std::move(load));
+		}
+		wakeReader.notify_one();
+	}
+	// Moves finished loads into done in the order they finished. With wait it
+	// blocks until at least one is ready, unless nothing is pending. False when
+	// nothing was collected and nothing is left.
+	bool Collect(std::vector<TEXTURE_LOAD>& done, bool wait) {
+		std::unique_lock<std::mutex> lock(mutex);
+		if (wait)
+			finished.wait(lock, [&]() { return completed.size() || pending == 0; });
+		if (completed.empty())
+			return pending != 0;
+		pending -= completed.size();
+		for (TEXTURE_LOAD& load : completed)
+			done.push_back(std::move(load));
+		completed.clear();
+		if (pending == 0) // later batches may hold other files under the same ids
+			contentOwners.clear();
+		return true;
+	}
+	unsigned Pending() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return pending;
+	}
+	TEXTURE_PIPELINE_STATS GetStats() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return stats;
+	}
+	static bool ReadFile(const std::string& path, std::vector<uint8_t>& contents) {
+		FILE* file = fopen(path.c_str(), "rb");
+		if (file == nullptr)
+			return false;
+		bool read = fseek(file, 0, SEEK_END) == 0;
+		long size = read ? ftell(file) : -1;
+		read = size > 0 && fseek(file, 0, SEEK_SET) == 0;
+		if (read) {
+			contents.resize(size);
+			read = fread(contents.data(), 1, size, file) == size_t(size);
+		}
+		fclose(file);
+		return read;
+	}
+
+private:
+	DECODE_CALLBACK decode;
+	std::thread reader;
+	std::vector<std::thread> decoders;
+	std::mutex mutex;
+	std::condition_variable wakeReader, wakeDecoders, finished;
+	std::deque<TEXTURE_LOAD> reads, decodes, completed;
+	std::map<std::pair<size_t, uint64_t>, unsigned> contentOwners; // first load id with each file
+	unsigned pending = 0; // submitted but not collected
+	bool running = false;
+	TEXTURE_PIPELINE_STATS stats = {};
+
+	static float Milliseconds(std::chrono::steady_clock::time_point since) {
+		return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - since).count();
+	}
+	void Complete(TEXTURE_LOAD& load) { // with the lock held
+		if (load.texture == nullptr && load.duplicateOf == ~0u)
+			++stats.failed;
+		completed.push_back(std::move(load));
+		finished.notify_all();
+	}
+	void ReadLoop() {
+		Profiler::Get().NameThread("Texture reader");
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			wakeReader.wait(lock, [&]() { return running == false || reads.size(); });
+			if (running == false)
+				break;
+			TEXTURE_LOAD load = std::move(reads.front());
+			reads.pop_front();
+			lock.unlock();
+			auto start = std::chrono::steady_clock::now();
+			Profile_Scope scope("Read texture");
+			bool read = load.contents.size() || ReadFile(load.path, load.contents);
+			load.fileBytes = load.contents.size();
+			if (read && hashContents)
+				load.fileHash = Texture_Registry::Hash(load.contents.data(), load.contents.size());
+			scope.End();
+			load.readMilliseconds = Milliseconds(start);
+			lock.lock();
+			stats.bytesRead += load.fileBytes;
+			stats.readMilliseconds += load.readMilliseconds;
+			if (read == false) {
+				load.error = "could not read " + load.path;
+				Complete(load);
+				continue;
+			}
+			if (hashContents) {
+				auto owner = contentOwners.insert({ { load.fileBytes, load.fileHash }, load.id });
+				if (owner.second == false) {
+					load.duplicateOf = owner.first->second;
+					load.contents.clear();
+					++stats.duplicates;
+					Complete(load);
+					continue;
+				}
+			}
+			decodes.push_back(std::move(load));
+			wakeDecoders.notify_one();
+		}
+	}
+	void DecodeLoop() {
+		Profiler::Get().NameThread("Texture decoder");
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			wakeDecoders.wait(lock, [&]() { return running == false || decodes.size(); });
+			if (running == false)
+				break;
+			TEXTURE_LOAD load = std::move(decodes.front());
+			decodes.pop_front();
+			lock.unlock();
+			auto start = std::chrono::steady_clock::now();
+			Profile_Scope scope("Decode texture");
+			if (decode(load) == false && load.texture) {
+				ktxTexture_Destroy(load.texture);
+				load.texture = nullptr;
+			}
+			std::vector<uint8_t>().swap(load.contents);
+			scope.End();
+			load.decodeMilliseconds = Milliseconds(start);
+			lock.lock();
+			stats.decodeMilliseconds += load.decodeMilliseconds;
+			stats.decoded += load.texture != nullptr;
+			stats.transcoded += load.transcoded;
+			Complete(load);
+		}
+	}
+};
+#endif
@@ -0,0 +1,201 @@
+#ifndef _TEXTURE_REGISTRY_H_
+#define _TEXTURE_REGISTRY_H_
+// Texture files shared between materials. Paths are made canonical so the same
+// file reached through different relative paths meets in one slot, and with
+// hashContents on, identical files under different names do too. The registry
+// only hands out slots and counts references, the owner keeps whatever GPU
+// handles belong to each slot: Acquire tells it when a slot is new and must be
+// loaded, Release when the last reference is gone and it can be destroyed.
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#ifndef _WIN32
+	#include <climits>
+#endif
+
+struct TEXTURE_REGISTRY_STATS { // since the last ResetStats
+	unsigned requests; // Acquire calls
+	unsigned loads; // new slots the caller had to fill
+	unsigned pathHits, contentHits; // loads avoided by path and by identical contents
+};
+
+class Texture_Registry {
+public:
+	bool hashContents = true; // also match files with the same bytes under another name
+
+	// Slot of the texture at path, with one more reference. isNew is set when
+	// the slot has no texture yet, contents then holds the file when it was
+	// read for hashing so the caller can load from memory instead.
+	unsigned Acquire(const char* path, bool& isNew, std::vector<uint8_t>& contents) {
+		++stats.requests;
+		isNew = false;
+		contents.clear();
+		std::string canonical = CanonicalPath(path);
+		auto known = byPath.find(canonical);
+		if (known != byPath.end()) {
+			++slots[known->second].references;
+			++stats.pathHits;
+			return known->second;
+		}
+		CONTENT_KEY key = { 0, 0 };
+		bool hashed = hashContents && ReadFile(canonical, contents);
+		if (hashed) {
+			key = { contents.size(), Hash(contents.data(), contents.size()) };
+			auto same = byContent.find(key);
+			if (same != byContent.end()) {
+				TEXTURE_SLOT& slot = slots[same->second];
+				++slot.references;
+				slot.paths.push_back(canonical);
+				byPath[canonical] = same->second;
+				contents.clear();
+				++stats.contentHits;
+				return same->second;
+			}
+		}
+		unsigned index;
+		if (freeSlots.size()) {
+			index = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else {
+			index = slots.size();
+			slots.emplace_back();
+		}
+		TEXTURE_SLOT& slot = slots[index];
+		slot.paths.assign(1, canonical);
+		slot.key = key;
+		slot.hashed = hashed;
+		slot.references = 1;
+		byPath[canonical] = index;
+		if (hashed)
+			byContent[key] = index;
+		isNew = true;
+		++stats.loads;
+		return index;
+	}
+	// Drops one reference, true when that was the last and the slot's handles
+	// should be destroyed. The slot may be handed out again afterwards.
+	bool Release(unsigned index) {
+		if (index >= slots.size() || slots[index].references == 0)
+			return false;
+		TEXTURE_SLOT& slot = slots[index];
+		if (--slot.references)
+			return false;
+		for (const std::string& path : slot.paths)
+			byPath.erase(path);
+		if (slot.hashed)
+			byContent.erase(slot.key);
+		slot = TEXTURE_SLOT();
+		freeSlots.push_back(index);
+		return true;
+	}
+	// For files hashed elsewhere (hashContents off, e.g. by Texture_Pipeline):
+	// when another slot already holds the same bytes, index is merged into it
+	// and that slot is returned, otherwise index remembers the key and is kept.
+	unsigned MatchContents(unsigned index, size_t bytes, uint64_t hash) {
+		CONTENT_KEY key = { bytes, hash };
+		auto same = byContent.find(key);
+		if (same != byContent.end() && same->second != index) {
+			Merge(index, same->second);
+			++stats.contentHits;
+			return same->second;
+		}
+		TEXTURE_SLOT& slot = slots[index];
+		if (slot.hashed)
+			byContent.erase(slot.key);
+		slot.key = key;
+		slot.hashed = true;
+		byContent[key] = index;
+		return index;
+	}
+	// Moves every path and reference of from onto into and frees from
+	void Merge(unsigned from, unsigned into) {
+		if (from == into)
+			return;
+		TEXTURE_SLOT& source = slots[from];
+		TEXTURE_SLOT& target = slots[into];
+		for (const std::string& path : source.paths) {
+			byPath[path] = into;
+			target.paths.push_back(path);
+		}
+		target.references += source.references;
+		if (source.hashed && byContent[source.key] == from)
+			byContent.erase(source.key);
+		source = TEXTURE_SLOT();
+		freeSlots.push_back(from);
+	}
+	unsigned References(unsigned index) const { return index < slots.size() ? slots[index].references : 0; }
+	// First path the slot was acquired under
+	const std::string& Path(unsigned index) const { return slots[index].paths.front(); }
+	// Slots handed out so far, free ones included, for sizing per slot arrays
+	size_t SlotCount() const { return slots.size(); }
+	const TEXTURE_REGISTRY_STATS& GetStats() const { return stats; }
+	void ResetStats() { stats = {}; }
+	void Clear() {
+		slots.clear();
+		freeSlots.clear();
+		byPath.clear();
+		byContent.clear();
+		stats = {};
+	}
+
+	// Absolute path with forward slashes, the input unchanged if it can't be resolved
+	static std::string CanonicalPath(const char* path) {
+		std::string output = path;
+#ifdef _WIN32
+		char resolved[_MAX_PATH];
+		if (_fullpath(resolved, path, _MAX_PATH))
+			output = resolved;
+		for (char& c : output) // NTFS is case insensitive
+			c = c == '\\' ? '/' : char(tolower((unsigned char)c));
+#else
+		char resolved[PATH_MAX];
+		if (realpath(path, resolved))
+			output = resolved;
+#endif
+		return output;
+	}
+	// 64 bit FNV-1a
+	static uint64_t Hash(const uint8_t* data, size_t bytes) {
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < bytes; ++i)
+			hash = (hash ^ data[i]) * 1099511628211ull;
+		return hash;
+	}
+
+private:
+	typedef std::pair<size_t, uint64_t> CONTENT_KEY; // file size and hash
+	struct TEXTURE_SLOT {
+		std::vector<std::string> paths; // every canonical path that led here
+		CONTENT_KEY key = { 0, 0 };
+		bool hashed = false;
+		unsigned references = 0;
+	};
+	std::vector<TEXTURE_SLOT> slots;
+	std::vector<unsigned> freeSlots;
+	std::map<std::string, unsigned> byPath;
+	std::map<CONTENT_KEY, unsigned> byContent;
+	TEXTURE_REGISTRY_STATS stats = {};
+
+	static bool ReadFile(const std::string& path, std::vector<uint8_t>& contents) {
+		FILE* file = fopen(path.c_str(), "rb");
+		if (file == nullptr)
+			return false;
+		bool read = fseek(file, 0, SEEK_END) == 0;
+		long size = read ? ftell(file) : -1;
+		read = size > 0 && fseek(file, 0, SEEK_SET) == 0;
+		if (read) {
+			contents.resize(size);
+			read = fread(contents.data(), 1, size, file) == size_t(size);
+		}
+		fclose(file);
+		if (read == false)
+			contents.clear();
+		return read;
+	}
+};
+#endif
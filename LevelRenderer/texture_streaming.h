@@ -0,0 +1,273 @@
+#ifndef _TEXTURE_STREAMING_H_
+#define _TEXTURE_STREAMING_H_
+// Streams texture mip levels by how large they appear on screen. Each texture
+// starts with only its mip tail (levels no larger than tailSize) resident.
+// Every frame the caller reports the finest level each visible texture needs,
+// Update then loads the missing levels on a worker thread and, when the budget
+// runs out, evicts the finest levels of the least recently used textures that
+// hold more than they were asked for. Levels are always resident as a chain:
+// a texture holds residentLevel and everything coarser. Only residency is
+// tracked here, the caller owns the images and is told when they must change.
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+struct STREAM_TEXTURE {
+	unsigned levels; // 0 for textures that are not streamed
+	unsigned tailLevel; // finest level of the mip tail, resident from Add on
+	unsigned residentLevel; // finest level in memory, every coarser one is too
+	unsigned pendingLevel; // finest level being loaded, residentLevel when none is
+	unsigned wantedLevel; // finest level asked for since the last Update, tailLevel when none was
+	unsigned lastUsed; // Update count when feedback last asked for it
+	std::vector<size_t> levelBytes;
+};
+struct TEXTURE_STREAM_STATS {
+	unsigned textures, pendingLoads;
+	unsigned residentMips; // levels in memory now, mip tails included
+	unsigned requestedMips, evictedMips, failedMips; // totals since Create
+	unsigned budgetDeferrals; // Updates where a wanted load had to wait for budget
+	size_t residentBytes, budgetBytes; // of resident and pending levels
+};
+
+class Texture_Streamer {
+public:
+	// load runs on the worker thread (inline in Update when not threaded) and
+	// fetches levels level up to the texture's residentLevel, false if it failed.
+	// resident runs inside Update once per texture whose resident chain changed,
+	// after loads complete or levels are evicted: the caller's image must now
+	// hold level and every coarser level. Either may be empty for simulations.
+	typedef std::function<bool(unsigned texture, unsigned level)> LOAD_CALLBACK;
+	typedef std::function<void(unsigned texture, unsigned level)> RESIDENT_CALLBACK;
+
+	void Create(size_t budgetBytes, unsigned tailSize, bool threaded,
+				LOAD_CALLBACK load = nullptr, RESIDENT_CALLBACK resident = nullptr) {
+		Destroy();
+		this->tailSize = std::max(tailSize, 1u);
+		this->load = load;
+		this->resident = resident;
+		textures.clear();
+		frame = 0;
+		stats = {};
+		stats.budgetBytes = budgetBytes;
+		if (threaded) {
+			running = true;
+			worker = std::thread([this]() { WorkerLoop(); });
+		}
+	}
+	void Destroy() {
+		if (worker.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				running = false;
+			}
+			wake.notify_all();
+			worker.join();
+		}
+		requests.clear();
+		completed.clear();
+	}
+	~Texture_Streamer() { Destroy(); }
+
+	// Streams texture (the caller's index) with levelBytes[l] per level. Only the
+	// mip tail is resident unless residentLevel keeps finer levels the caller
+	// already holds. The tail always counts against the budget, even past it.
+	void Add(unsigned texture, unsigned width, unsigned height, const std::vector<size_t>& levelBytes,
+			 unsigned residentLevel = ~0u) {
+		if (texture >= textures.size())
+			textures.resize(texture + 1, STREAM_TEXTURE());
+		STREAM_TEXTURE& added = textures[texture];
+		Remove(texture);
+		added.levels = unsigned(levelBytes.size());
+		if (added.levels == 0)
+			return;
+		added.levelBytes = levelBytes;
+		added.tailLevel = TailLevel(width, height, added.levels, tailSize);
+		added.residentLevel = std::min(residentLevel, added.tailLevel);
+		added.pendingLevel = added.residentLevel;
+		added.wantedLevel = added.tailLevel;
+		added.lastUsed = frame;
+		for (unsigned l = added.residentLevel; l < added.levels; ++l)
+			stats.residentBytes += added.levelBytes[l];
+		stats.residentMips += added.levels - added.residentLevel;
+		++stats.textures;
+	}
+	// Feedback for this frame: texture is seen needing level (fractional levels
+	// round down to the finer one). See DesiredLevel.
+	void Request(unsigned texture, float level) {
+		if (texture >= textures.size() || textures[texture].levels == 0)
+			return;
+		STREAM_TEXTURE& wanted = textures[texture];
+		unsigned l = level > 0 ? unsigned(level) : 0;
+		wanted.wantedLevel = std::min(wanted.wantedLevel, std::min(l, wanted.levels - 1));
+		wanted.lastUsed = frame;
+	}
+	// Call once per frame after the feedback
+	void Update() {
+		// finished loads become resident
+		std::deque<std::pair<unsigned, bool>> done;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			done.swap(completed);
+		}
+		changed.clear();
+		for (const std::pair<unsigned, bool>& result : done) {
+			STREAM_TEXTURE& t = textures[result.first];
+			--stats.pendingLoads;
+			if (result.second) {
+				stats.residentMips += t.residentLevel - t.pendingLevel;
+				t.residentLevel = t.pendingLevel;
+				changed.push_back(result.first);
+			}
+			else {
+				stats.residentBytes -= Bytes(t, t.pendingLevel, t.residentLevel);
+				stats.failedMips += t.residentLevel - t.pendingLevel;
+				t.pendingLevel = t.residentLevel;
+			}
+		}
+		// request what is missing, textures short the most levels first
+		order.clear();
+		for (unsigned i = 0; i < textures.size(); ++i)
+			if (textures[i].levels && textures[i].pendingLevel == textures[i].residentLevel &&
+				textures[i].wantedLevel < textures[i].residentLevel)
+				order.push_back(i);
+		std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+			unsigned shortA = textures[a].residentLevel - textures[a].wantedLevel;
+			unsigned shortB = textures[b].residentLevel - textures[b].wantedLevel;
+			return shortA != shortB ? shortA > shortB : a < b;
+		});
+		for (unsigned i : order) {
+			STREAM_TEXTURE& t = textures[i];
+			// the finest level that fits, a step towards wantedLevel is still sharper
+			unsigned level = t.wantedLevel;
+			while (level < t.residentLevel && MakeRoom(Bytes(t, level, t.residentLevel), i) == false)
+				++level;
+			if (level == t.residentLevel) {
+				++stats.budgetDeferrals; // coarser requests wait too so the neediest load first
+				break;
+			}
+			t.pendingLevel = level;
+			stats.residentBytes += Bytes(t, level, t.residentLevel);
+			stats.requestedMips += t.residentLevel - level;
+			++stats.pendingLoads;
+			if (worker.joinable()) {
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					requests.push_back({ i, level });
+				}
+				wake.notify_one();
+			}
+			else // same hand-off as the worker, resident from the next Update on
+				completed.push_back({ i, load ? load(i, level) : true });
+		}
+		// feedback starts over, one callback per texture with its final chain
+		for (STREAM_TEXTURE& t : textures)
+			t.wantedLevel = t.tailLevel;
+		std::sort(changed.begin(), changed.end());
+		changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+		if (resident)
+			for (unsigned i : changed)
+				resident(i, textures[i].residentLevel);
+		++frame;
+	}
+	// Blocks until every requested load has finished (for tests and level changes)
+	void WaitIdle() {
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [&]() { return requests.empty() && busy == false; });
+	}
+	unsigned ResidentLevel(unsigned texture) const { return textures[texture].residentLevel; }
+	const std::vector<STREAM_TEXTURE>& GetTextures() const { return textures; }
+	const TEXTURE_STREAM_STATS& GetStats() const { return stats; }
+
+	// First level no larger than tailSize on either side, the coarsest when none is
+	static unsigned TailLevel(unsigned width, unsigned height, unsigned levels, unsigned tailSize) {
+		unsigned level = 0;
+		while (level + 1 < levels && std::max(width >> level, height >> level) > tailSize)
+			++level;
+		return level;
+	}
+	// Finest level worth sampling for a texture size texels across that covers
+	// pixels on screen: one texel per pixel
+	static float DesiredLevel(unsigned size, float pixels) {
+		return pixels > 0 && size > pixels ? std::log2(size / pixels) : 0.0f;
+	}
+
+private:
+	unsigned tailSize = 64;
+	LOAD_CALLBACK load;
+	RESIDENT_CALLBACK resident;
+	std::vector<STREAM_TEXTURE> textures;
+	std::vector<unsigned> order, changed; // reused every Update
+	unsigned frame = 0;
+	TEXTURE_STREAM_STATS stats = {};
+	// worker hand-off
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake, idle;
+	std::deque<std::pair<unsigned, unsigned>> requests; // texture and level
+	std::deque<std::pair<unsigned, bool>> completed; // texture and whether it loaded
+	bool running = false, busy = false;
+
+	void WorkerLoop() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			wake.wait(lock, [&]() { return running == false || requests.size(); });
+			if (running == false)
+				break;
+			std::pair<unsigned, unsigned> request = requests.front();
+			requests.pop_front();
+			busy = true;
+			lock.unlock();
+			bool loaded = load ? load(request.first, request.second) : true;
+			lock.lock();
+			busy = false;
+			completed.push_back({ request.first, loaded });
+			idle.notify_all();
+		}
+	}
+	static size_t Bytes(const STREAM_TEXTURE& t, unsigned from, unsigned to) {
+		size_t bytes = 0;
+		for (unsigned l = from; l < to; ++l)
+			bytes += t.levelBytes[l];
+		return bytes;
+	}
+	void Remove(unsigned texture) {
+		STREAM_TEXTURE& t = textures[texture];
+		if (t.levels) {
+			stats.residentBytes -= Bytes(t, t.residentLevel, t.levels);
+			stats.residentMips -= t.levels - t.residentLevel;
+			--stats.textures;
+		}
+		t = STREAM_TEXTURE();
+	}
+	// Evicts the finest level of the least recently used texture holding more
+	// than it was asked for this frame, until bytes fit. Pending textures, the
+	// requester and mip tails are never evicted.
+	bool MakeRoom(size_t bytes, unsigned requester) {
+		while (stats.residentBytes + bytes > stats.budgetBytes) {
+			unsigned oldest = ~0u;
+			for (unsigned i = 0; i < textures.size(); ++i) {
+				const STREAM_TEXTURE& t = textures[i];
+				if (i != requester && t.levels && t.pendingLevel == t.residentLevel &&
+					t.residentLevel < t.tailLevel && t.residentLevel < t.wantedLevel &&
+					(oldest == ~0u || t.lastUsed < textures[oldest].lastUsed))
+					oldest = i;
+			}
+			if (oldest == ~0u)
+				return false;
+			STREAM_TEXTURE& t = textures[oldest];
+			stats.residentBytes -= t.levelBytes[t.residentLevel];
+			t.pendingLevel = ++t.residentLevel;
+			--stats.residentMips;
+			++stats.evictedMips;
+			changed.push_back(oldest);
+		}
+		return true;
+	}
+};
+#endif